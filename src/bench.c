@@ -0,0 +1,320 @@
+// synthetic end-to-end benchmark: transformer run with random weights, no model files required.
+// measure prefill and decode speed for several context depths and threads counts.
+// usage: llama_st --bench <preset | model_id model_path> [-w w_type] [-t threads] [-d depths] [-n tokens] [-o report.json]
+//  preset:     built in model shape (see presets list)
+//  model_id:   model identifier (as defined in run config), shape read in model_path/config.json
+//  -w w_type:  memory weights format (fp32/fp16/bf16/sf16/f12/f8/q8/q4/f12s/f8s), default is model torch format
+//  -t threads: comma separated list of threads counts, ex: 4,8,16 (default: max auto detected)
+//  -d depths:  comma separated list of context depths used for decode, ex: 0,512,2048 (default)
+//  -n tokens:  count of tokens used for prefill and for each decode measure (default 32)
+//  -o file:    json report file name (default bench.json)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "l_util.h"
+#include "mem_alloc.h"
+#include "model.h"
+#include "matmul.h"
+#include "omp_numa.h"
+#include "load_transformer.h"
+
+#define BENCH_MAX_LIST 16              // max threads/depths list size
+
+// built in model shapes
+static const struct bench_preset_t
+{
+  const char *name;
+  enum e_model_id model_id;
+  int dim, hidden_dim, n_layers, n_heads, n_kv_heads, vocab_size;
+  float rope_theta;
+  enum e_w_type torch_type;
+  int num_experts, top_k;
+} presets[] =
+{
+  //  name            model_id            dim   hidden lay head kv   vocab   rope_theta   torch_type   experts
+  { "tinyllama",    model_id_tinyllama, 2048,  5632, 22, 32,  4,  32000,    10000.0f, w_type_bf16, 0, 0 },
+  { "llama2-7b",    model_id_llama2,    4096, 11008, 32, 32, 32,  32000,    10000.0f, w_type_f16,  0, 0 },
+  { "llama3-8b",    model_id_llama3,    4096, 14336, 32, 32,  8, 128256,   500000.0f, w_type_bf16, 0, 0 },
+  { "mistral-7b",   model_id_mistral,   4096, 14336, 32, 32,  8,  32768,  1000000.0f, w_type_bf16, 0, 0 },
+  { "mixtral-8x7b", model_id_mixtral,   4096, 14336, 32, 32,  8,  32000,  1000000.0f, w_type_bf16, 8, 2 },
+  { "qwen2.5-7b",   model_id_qwen2,     3584, 18944, 28, 28,  4, 152064,  1000000.0f, w_type_bf16, 0, 0 },
+};
+
+#define N_PRESETS (sizeof(presets) / sizeof(presets[0]))
+
+static const char *simd_names[simd_n] = { "fpu", "sse", "avx", "avx2", "avx512" };
+
+// decode measure result
+struct bench_res_t
+{
+  int depth;                           // context depth (tokens in kv cache)
+  double ms_tok;                       // ms per token
+};
+
+// bench parameters
+static struct
+{
+  const char *name;                    // preset or model id name
+  enum e_w_type w_type;                // memory format, w_type_COUNT if model format
+  int thrd[BENCH_MAX_LIST];            // threads counts list
+  int n_thrd;
+  int depth[BENCH_MAX_LIST];           // decode context depths list
+  int n_depth;
+  int n_tok;                           // tokens per measure
+  const char *out_name;                // json report
+} bp = { 0 };
+
+static void usage_exit(void)
+{
+  int i;
+  msg_info("Usage: llama_st --bench <preset | model_id model_path> [-w w_type] [-t threads] [-d depths] [-n tokens] [-o report.json]\n");
+  msg_info("presets:");
+  for (i=0; i<(int)N_PRESETS; i++)
+    msg_info(" %s", presets[i].name);
+  msg_info("\nExample: llama_st --bench llama3-8b -w f12 -t 4,8 -d 0,1024\n");
+  msg_error("invalid bench arguments");
+}
+
+// read comma separated list of int >= 0
+static int get_int_list(int *l, const char *s)
+{
+  int n = 0;
+  while (*s)
+  {
+    char *e;
+    if (n == BENCH_MAX_LIST)
+      msg_error("bench: list %s too long", s);
+    l[n] = (int)strtol(s, &e, 10);
+    if ((e == s) || (l[n] < 0) || (*e && (*e != ',')))
+      usage_exit();
+    n++;
+    s = *e ? e + 1 : e;
+  }
+  return n;
+}
+
+// get memory weights format from name
+static enum e_w_type get_w_type(const char *str)
+{
+  enum e_w_type t;
+  for (t=0; t<w_type_COUNT; t++)
+    if (!strcmp(str, w_type_name[t]))
+      return t;
+  msg_error("bench: undefined weights type: %s", str);
+  return w_type_COUNT;
+}
+
+// define run and transformer config from arguments
+static void init_bench_conf(int argc, char *argv[])
+{
+  struct run_conf_t *conf = &model.config;
+  struct transformer_config_t *p = &model.transformer.config;
+  int i, a;
+
+  if (argc < 1)
+    usage_exit();
+
+  // run config defaults (as in run config .json files)
+  bp.name = argv[0];
+  bp.w_type = w_type_COUNT;
+  bp.n_tok = 32;
+  bp.out_name = "bench.json";
+  bp.n_thrd = 1;                       // thrd[0] = 0: max auto detected
+  bp.n_depth = get_int_list(bp.depth, "0,512,2048");
+
+  conf->numa_nodes = -1;
+  conf->simd_mode = -1;
+  conf->mm_pf_dist = -1;
+  for (i=0; i<lw_class_count; i++)
+    conf->w_policy.cls_type[i] = w_type_COUNT;
+  conf->w_policy.ly_type = w_type_COUNT;
+  conf->wcls_shadow = w_type_COUNT;
+  conf->wcls_rescore = 256;
+  model.sampler.conf.temperature = 0.0f;         // greedy, classifier compute argmax only
+
+  // model shape
+  for (i=0; i<(int)N_PRESETS; i++)
+    if (!strcmp(bp.name, presets[i].name))
+      break;
+  if (i < (int)N_PRESETS)
+  {
+    const struct bench_preset_t *pr = &presets[i];
+    conf->e_model_id = pr->model_id;
+    p->dim = pr->dim;
+    p->hidden_dim = pr->hidden_dim;
+    p->n_layers = pr->n_layers;
+    p->n_heads = pr->n_heads;
+    p->n_kv_heads = pr->n_kv_heads;
+    p->seq_len = 1 << 20;              // adjusted to bench needs
+    p->rms_norm_eps = 1e-5f;
+    p->rope_theta = pr->rope_theta;
+    p->vocab_size = pr->vocab_size;
+    p->torch_type = pr->torch_type;
+    p->moe.num_experts = pr->num_experts;
+    p->moe.top_k = pr->top_k;
+    p->head_size = p->dim / p->n_heads;
+    p->kv_dim = (p->dim * p->n_kv_heads) / p->n_heads;
+    p->kv_mul = p->n_heads / p->n_kv_heads;
+    p->sqrt_head_size = sqrtf((float)p->head_size);
+    a = 1;
+  }
+  else
+  {
+    for (i=0; i<model_id_count; i++)
+      if (!strcmp(bp.name, model_id_names[i]))
+        break;
+    if ((i == model_id_count) || (argc < 2))
+      usage_exit();
+    conf->e_model_id = (enum e_model_id)i;
+    conf->load.model_path = argv[1];
+    load_checkpoint_config();
+    a = 2;
+  }
+
+  // options
+  for (; a<argc; a+=2)
+  {
+    const char *o = argv[a];
+    if ((a + 1 == argc) || (o[0] != '-') || !o[1] || o[2])
+      usage_exit();
+    switch (o[1])
+    {
+      case 'w': bp.w_type = get_w_type(argv[a+1]); break;
+      case 't': bp.n_thrd = get_int_list(bp.thrd, argv[a+1]); break;
+      case 'd': bp.n_depth = get_int_list(bp.depth, argv[a+1]); break;
+      case 'n': bp.n_tok = atoi(argv[a+1]); break;
+      case 'o': bp.out_name = argv[a+1]; break;
+      default: usage_exit();
+    }
+  }
+  if ((bp.n_thrd < 1) || (bp.n_depth < 1) || (bp.n_tok < 1))
+    usage_exit();
+
+  // memory format, random weights are generated in torch format then converted like at load
+  switch (bp.w_type)
+  {
+    case w_type_f32:
+    case w_type_f16:
+    case w_type_bf16: p->torch_type = bp.w_type; break;
+    case w_type_sf16: p->torch_type = w_type_f16; conf->cvt_sf16 = true; break;
+    case w_type_f12s: conf->cvt_row_scale = true; conf->cvt_f12 = true; break;
+    case w_type_f12:  conf->cvt_f12 = true; break;
+    case w_type_f8s:  conf->cvt_row_scale = true; conf->cvt_f8 = true; break;
+    case w_type_f8:   conf->cvt_f8 = true; break;
+    case w_type_q8:   conf->cvt_q8 = true; break;
+    case w_type_q4:   conf->cvt_q4 = true; break;
+    default: break;
+  }
+  if ((p->torch_type == w_type_f32) && (bp.w_type > w_type_sf16) && (bp.w_type < w_type_COUNT))
+    p->torch_type = w_type_bf16;       // conversions are done from f16/bf16 only
+
+  // kv cache sized for deepest measure (avoid large allocations with 128k context models)
+  {
+    int d_max = 0;
+    for (i=0; i<bp.n_depth; i++)
+      if (bp.depth[i] > d_max)
+        d_max = bp.depth[i];
+    if (d_max < bp.n_tok)
+      d_max = bp.n_tok;                // decode start after prefill
+    d_max += bp.n_tok;
+    if (d_max + 1 > p->seq_len)
+      msg_error("bench: context depth %d exceed model max sequence length %d", d_max, p->seq_len);
+    p->seq_len = (d_max + SIMD_LV) & ~(SIMD_LV-1);  // state alloc sizes must be multiple of SIMD_LV
+  }
+}
+
+// forward n tokens, return ms per token
+static double run_tokens(int n, bool def_logits)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  double t0 = omp_get_wtime();
+  int i;
+  for (i=0; i<n; i++)
+    forward(rand_n() % p->vocab_size, def_logits, def_logits || (i == (n-1)));
+  return ((omp_get_wtime() - t0) * 1000.0) / n;
+}
+
+void bench(int argc, char *argv[])
+{
+  struct transformer_t *t = &model.transformer;
+  struct transformer_config_t p_def;
+  struct run_conf_t conf_def;
+  FILE *fp;
+  int i, j;
+
+  init_bench_conf(argc, argv);
+  p_def = t->config;
+  conf_def = model.config;
+
+  matmul_init(model.config.simd_mode);
+
+  fp = fopen(bp.out_name, "w");
+  if (!fp)
+    msg_error("can't create file %s", bp.out_name);
+  fprintf(fp, "{\n  \"model\": \"%s\",\n  \"simd\": \"%s\",\n  \"runs\": [\n", bp.name, simd_names[matmul_procs.simd_set]);
+
+  for (i=0; i<bp.n_thrd; i++)
+  {
+    struct bench_res_t res[BENCH_MAX_LIST];
+    double ms_prefill, gb_tok, gb_pf;
+    int n_res = 0;
+
+    // restore config and build with random weights
+    t->config = p_def;
+    model.config = conf_def;
+    model.config.num_procs = bp.thrd[i];
+    memset(&t->weights, 0, sizeof(t->weights));
+    memset(&t->state, 0, sizeof(t->state));
+    rand_seed(1234);
+    msg_info("bench: init random weights..\n");
+    build_transformer_bench();
+    build_classifier(NULL);
+    gb_tok = t->config.sz_read_tok / (1024.0*1024.0*1024.0);
+    gb_pf = t->config.sz_read_pf / (1024.0*1024.0*1024.0);   // no logits for prefill tokens
+
+    // prefill, logits only for last token
+    run_tokens(1, false);                          // warmup
+    t->state.cache.n_tokens = 0;
+    ms_prefill = run_tokens(bp.n_tok, false);
+
+    // decode at context depths, kv cache datas beyond prefill are zero (speed is not data dependent)
+    for (j=0; j<bp.n_depth; j++)
+    {
+      int d = bp.depth[j];
+      if (d < bp.n_tok)
+        d = bp.n_tok;                            // after prefill
+      t->state.cache.n_tokens = d;
+      res[n_res].depth = d;
+      res[n_res].ms_tok = run_tokens(bp.n_tok, true);
+      n_res++;
+    }
+
+    // display and report
+    msg_info("bench %s %s, %d threads, read per token %.3f Gb (prefill %.3f Gb):\n", bp.name, w_type_name[t->config.lw_type],
+             numa_map.n_threads, gb_tok, gb_pf);
+    msg_info("  prefill          %8.2f tok/s %8.2f ms/tok %6.2f GB/s\n",
+             1000.0 / ms_prefill, ms_prefill, gb_pf * 1000.0 / ms_prefill);
+    for (j=0; j<n_res; j++)
+      msg_info("  decode depth %-5d %7.2f tok/s %8.2f ms/tok %6.2f GB/s\n", res[j].depth,
+               1000.0 / res[j].ms_tok, res[j].ms_tok, gb_tok * 1000.0 / res[j].ms_tok);
+
+    fprintf(fp, "    { \"threads\": %d, \"w_type\": \"%s\", \"read_tok_gb\": %.4f, \"read_prefill_gb\": %.4f,\n",
+            numa_map.n_threads, w_type_name[t->config.lw_type], gb_tok, gb_pf);
+    fprintf(fp, "      \"prefill\": { \"tokens\": %d, \"tok_s\": %.3f, \"ms_tok\": %.4f, \"gbs\": %.3f },\n      \"decode\": [",
+            bp.n_tok, 1000.0 / ms_prefill, ms_prefill, gb_pf * 1000.0 / ms_prefill);
+    for (j=0; j<n_res; j++)
+      fprintf(fp, "%s\n        { \"depth\": %d, \"tok_s\": %.3f, \"ms_tok\": %.4f, \"gbs\": %.3f }", j ? "," : "", res[j].depth,
+              1000.0 / res[j].ms_tok, res[j].ms_tok, gb_tok * 1000.0 / res[j].ms_tok);
+    fprintf(fp, " ] }%s\n", (i < (bp.n_thrd - 1)) ? "," : "");
+
+    free_transformer();
+  }
+
+  fprintf(fp, "  ]\n}\n");
+  fclose(fp);
+  msg_info("bench report saved in %s\n", bp.out_name);
+  matmul_exit();
+}
@@ -584,6 +584,7 @@ static enum e_cmd user_menu(bool usr_inp, bool en_regen, bool en_forget)
   text_color(col_sys);
   msg_info("------------------------------------\n");
   msg_info("MENU: ctx size %d/%d (nd:%d)\n", t->state.cache.n_tokens, t->config.seq_len, t->state.cache.n_tokens_del);
+  transformer_disp_stats();
   if (en_regen)  // cannot be done if no previous reply
   msg_info(" 1   - forget and regenerate last llm reply.\n");
   if (en_forget)
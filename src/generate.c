@@ -25,7 +25,10 @@ void generate(void)
   for (i=0; i<mt_list->n_list; i++)
   {
     int token = mt_list->mt[i].tok_id;
-    forward(token, false, i == (mt_list->n_list-1));
+    bool eval = conf->gen_eval_nll && (i < (mt_list->n_list-1));
+    forward(token, false, eval || (i == (mt_list->n_list-1)));
+    if (eval)                  // teacher forced, log likelihood of next prompt token
+      transformer_eval_nll(mt_list->mt[i+1].tok_id);
     tokenizer_decode_print_ex(token, -1.0f);
   }
 
@@ -60,4 +63,5 @@ void generate(void)
   t1 = time_in_ms();
   n_gen = model.transformer.state.cache.n_tokens;
   msg_info("\ntotal time: %.2fs for %d tokens, tok/s: %.2f\n", (t1-t0) / 1000.0, n_gen, n_gen*1000.0 / (t1-t0));
+  transformer_disp_stats();
 }
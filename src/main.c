@@ -1,3 +1,4 @@
+#include <string.h>
 #include "l_util.h"
 #include "model.h"
 
@@ -12,9 +13,17 @@ int main(int argc, char *argv[])
     return -1;
 
 #if 1
+  // synthetic benchmark mode, no model files required
+  if ((argc >= 3) && !strcmp(argv[1], "--bench"))
+  {
+    bench(argc - 2, argv + 2);
+    return 0;
+  }
+
   if (argc != 2)
   {
     msg_info("Usage: llama_st <run_config.json>\n");
+    msg_info("       llama_st --bench <preset | model_id model_path> [options] (see bench.c)\n");
     msg_info("Example: llama_st run_json/run_llama2.json\n");
     return -1;
   }
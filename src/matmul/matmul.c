@@ -6,22 +6,78 @@
 #include "w_types.h"
 #include "matmul.h"
 #include "matmul_priv.h"
+#include "vec_simd.h"
 #ifdef VS_2008
 #define __cpuidex(a,b,c) __cpuid(a,b)    // avx2 will not detect
 #endif
 
 struct matmul_procs_t matmul_procs = { 0 };
 
-static const char *simd_typ_names[simd_n] = { "FPU", "SSE", "AVX", "AVX2" };
+static const char *simd_typ_names[simd_n] = { "FPU", "SSE", "AVX", "AVX2", "AVX512" };
 
 // types names and sizeof
-const char *w_type_name[w_type_COUNT]  = { "fp32", "fp16", "bf16", "sf16", "f12", "f8" };
-// const int w_type_sizeof[w_type_COUNT] = {   4,      2,      2,       2,   1.5,   1  };
+const char *w_type_name[w_type_COUNT]  = { "fp32", "fp16", "bf16", "sf16", "f12", "f8", "q8", "q4", "f12s", "f8s" };
+// const int w_type_sizeof[w_type_COUNT] = {   4,      2,      2,       2,   1.5,   1, 1.0625, 0.625, 1.5+, 1+ };
 
 // -------------------------------------------
 // types convert
 
-void cvt_w_data(void *d, enum e_w_type d_type, const void *s, enum e_w_type s_type, size_t ne)
+// convert f16/bf16 to f12s/f8s. each row is scaled by a power of 2 to use max converted range,
+// then converted to f12/f8 and followed by row scale.
+static void cvt_w_data_row_scaled(void *d, enum e_w_type d_type, const void *s, enum e_w_type s_type, size_t ne, int wx)
+{
+  enum e_w_type r_type = (d_type == w_type_f8s) ? w_type_f8 : w_type_f12;
+  float cvt_max = (d_type == w_type_f8s) ? f8_cvt_max : f12_cvt_max;
+  size_t sz_d = (d_type == w_type_f8s) ? wx : wx + (wx >> 1);   // row datas size
+  VAR_ALLOC(r_f32, float, wx);
+  VAR_ALLOC(r_bf16, bf16_t, wx);
+  unsigned char *r_d = (unsigned char *)d;
+  size_t y, wy = ne / wx;
+  int i;
+
+  for (y=0; y<wy; y++, r_d+=sz_d + W_ROW_SCALE_SZ)
+  {
+    float a_max = 0, scale = 1.0f, inv_s;
+    if (s_type == w_type_f16)
+      matmul_procs.cvt_f16_to_f32(r_f32, (const f16_t *)s + y*wx, wx);
+    else
+      matmul_procs.cvt_bf16_to_f32(r_f32, (const bf16_t *)s + y*wx, wx);
+
+    for (i=0; i<wx; i++)
+    {
+      float a = fabsf(r_f32[i]);
+      if (a > a_max)
+        a_max = a;
+    }
+    if (a_max != a_max)
+      msg_error("conversion to %s: NAN value", w_type_name[d_type]);
+
+    // get power of 2 scale, a_max / scale in ]cvt_max/2, cvt_max]
+    if (a_max != 0.0f)
+    {
+      while (a_max > cvt_max * scale)
+        scale *= 2.0f;
+      while ((a_max <= cvt_max * scale * 0.5f) && (scale > 1e-18f))
+        scale *= 0.5f;
+    }
+    inv_s = 1.0f / scale;
+
+    // scale and round to bf16 (exact for bf16 models)
+    for (i=0; i<wx; i++)
+    {
+      float f = r_f32[i] * inv_s;
+      unsigned int u = *(unsigned int *)&f;
+      r_bf16[i] = (bf16_t)((u + 0x7fff + ((u >> 16) & 1)) >> 16);
+    }
+    cvt_w_data(r_d, r_type, r_bf16, w_type_bf16, wx, wx);
+    memset(r_d + sz_d, 0, W_ROW_SCALE_SZ);
+    *(float *)(r_d + sz_d) = scale;
+  }
+  free_check(r_f32);
+  free_check(r_bf16);
+}
+
+void cvt_w_data(void *d, enum e_w_type d_type, const void *s, enum e_w_type s_type, size_t ne, int wx)
 {
   // macro for short syntax
   #define CVT_TYP(ta, tb) ((s_type == w_type_##ta) && (d_type == w_type_##tb))
@@ -34,6 +90,12 @@ void cvt_w_data(void *d, enum e_w_type d_type, const void *s, enum e_w_type s_ty
   else if (CVT_TYP(bf16,  f12)) cvt_bf16_to_f12(d, s, ne);
   else if (CVT_TYP( f16,   f8)) cvt_f16_to_f8(d, s, ne);
   else if (CVT_TYP(bf16,   f8)) cvt_bf16_to_f8(d, s, ne);
+  else if (CVT_TYP( f16,   q8)) cvt_f16_to_q8(d, s, ne);
+  else if (CVT_TYP(bf16,   q8)) cvt_bf16_to_q8(d, s, ne);
+  else if (CVT_TYP( f16,   q4)) cvt_f16_to_q4(d, s, ne);
+  else if (CVT_TYP(bf16,   q4)) cvt_bf16_to_q4(d, s, ne);
+  else if (((s_type == w_type_f16) || (s_type == w_type_bf16)) && ((d_type == w_type_f12s) || (d_type == w_type_f8s)))
+    cvt_w_data_row_scaled(d, d_type, s, s_type, ne, wx);
   else
     msg_error("unsupported weight type conversion: %s to %s\n", 
       w_type_name[s_type], w_type_name[d_type]);
@@ -75,7 +137,7 @@ static void conv_matmul_check(enum e_simd_typ simd)
 {
   int i;
   int wx = 4096;
-  int wy = 200; 
+  int wy = 199;                        // not multiple of multi rows matmul rows count
   int ne = wx * wy;
   VAR_ALLOC(w, float, ne);
   VAR_ALLOC(v, float, wx);
@@ -86,12 +148,18 @@ static void conv_matmul_check(enum e_simd_typ simd)
   VAR_ALLOC(res_sf16, float, wy);
   VAR_ALLOC(res_f12, float, wy);
   VAR_ALLOC(res_f8, float, wy);
+  VAR_ALLOC(res_q8, float, wy);
+  VAR_ALLOC(res_q4, float, wy);
   VAR_ALLOC(w_f32, float, ne);
   VAR_ALLOC(w_f16, f16_t, ne);
   VAR_ALLOC(w_bf16, bf16_t, ne);
   VAR_ALLOC(w_sf16, sf16_t, ne);
   VAR_ALLOC(w_f12, f12_t, ne);
   VAR_ALLOC(w_f8, f8_t, ne);
+  VAR_ALLOC(w_q8, q8_t, (ne / Q8_BLOC_NE) * Q8_BLOC_SZ);
+  VAR_ALLOC(w_q4, q4_t, (ne / Q4_BLOC_NE) * Q4_BLOC_SZ);
+  VAR_ALLOC(w_f12s, unsigned char, (ne + (ne >> 1)) + wy * W_ROW_SCALE_SZ);
+  VAR_ALLOC(w_f8s, unsigned char, ne + wy * W_ROW_SCALE_SZ);
 
   // define a reference result using fpu and float32
   rand_seed(543);
@@ -115,7 +183,7 @@ static void conv_matmul_check(enum e_simd_typ simd)
     w_bf16[i] = *(unsigned *)(w + i) >> 16;
 
   zero_mem(w_f32, w_type_f32, ne);
-  cvt_w_data(w_f32, w_type_f32, w_bf16, w_type_bf16, ne);      // cvt bf16 to f32
+  cvt_w_data(w_f32, w_type_f32, w_bf16, w_type_bf16, ne, wx);  // cvt bf16 to f32
 
   zero_mem(res_bf16, w_type_f32, wy);
   matmul_procs.matmul_f32_f32(res_bf16, v, w_f32, wx, wy);     // mul f32(bf16)
@@ -131,7 +199,7 @@ static void conv_matmul_check(enum e_simd_typ simd)
   cvt_f32_to_f16(w_f16, w, ne);                                // init f16 weights
 
   zero_mem(w_f32, w_type_f32, ne);
-  cvt_w_data(w_f32, w_type_f32, w_f16, w_type_f16, ne);        // cvt f16 to f32(f16)
+  cvt_w_data(w_f32, w_type_f32, w_f16, w_type_f16, ne, wx);    // cvt f16 to f32(f16)
 
   zero_mem(res_f16, w_type_f32, wy);
   matmul_procs.matmul_f32_f32(res_f16, v, w_f32, wx, wy);      // mul f32(f16)
@@ -144,10 +212,10 @@ static void conv_matmul_check(enum e_simd_typ simd)
   // ------------------------
   // sf16
   zero_mem(w_sf16, w_type_sf16, ne);
-  cvt_w_data(w_sf16, w_type_sf16, w_f16, w_type_f16, ne);      // cvt f16 to sf16
+  cvt_w_data(w_sf16, w_type_sf16, w_f16, w_type_f16, ne, wx);  // cvt f16 to sf16
 
   zero_mem(w_f32, w_type_f32, ne);
-  cvt_w_data(w_f32, w_type_f32, w_sf16, w_type_sf16, ne);      // cvt sf16 to f32
+  cvt_w_data(w_f32, w_type_f32, w_sf16, w_type_sf16, ne, wx);  // cvt sf16 to f32
 
   zero_mem(res_sf16, w_type_f32, wy);
   matmul_procs.matmul_f32_f32(res_sf16, v, w_f32, wx, wy);     // mul f32(sf16)
@@ -160,7 +228,7 @@ static void conv_matmul_check(enum e_simd_typ simd)
   // ------------------------
   // bf16 to f12
   zero_mem(w_f12, w_type_f12, ne);
-  cvt_w_data(w_f12, w_type_f12, w_bf16, w_type_bf16, ne);      // cvt bf16 to f12
+  cvt_w_data(w_f12, w_type_f12, w_bf16, w_type_bf16, ne, wx);  // cvt bf16 to f12
 
   zero_mem(res_f12, w_type_f32, wy);
   matmul_procs.matmul_f32_f12(res_f12, v, w_f12, wx, wy);      // mul f12 to f32
@@ -169,7 +237,7 @@ static void conv_matmul_check(enum e_simd_typ simd)
   // ------------------------
   // f16 to f12
   zero_mem(w_f12, w_type_f12, ne);
-  cvt_w_data(w_f12, w_type_f12, w_f16, w_type_f16, ne);        // cvt f16 to f12
+  cvt_w_data(w_f12, w_type_f12, w_f16, w_type_f16, ne, wx);    // cvt f16 to f12
 
   zero_mem(res_f12, w_type_f32, wy);
   matmul_procs.matmul_f32_f12(res_f12, v, w_f12, wx, wy);      // mul f12 to f32
@@ -178,7 +246,7 @@ static void conv_matmul_check(enum e_simd_typ simd)
   // ------------------------
   // bf16 to f8
   zero_mem(w_f8, w_type_f8, ne);
-  cvt_w_data(w_f8, w_type_f8, w_bf16, w_type_bf16, ne);        // cvt bf16 to f8
+  cvt_w_data(w_f8, w_type_f8, w_bf16, w_type_bf16, ne, wx);    // cvt bf16 to f8
   
   zero_mem(res_f8, w_type_f32, wy);
   matmul_procs.matmul_f32_f8(res_f8, v, w_f8, wx, wy);         // mul f8 to f32
@@ -187,12 +255,78 @@ static void conv_matmul_check(enum e_simd_typ simd)
   // ------------------------
   // f16 to f8
   zero_mem(w_f8, w_type_f8, ne);
-  cvt_w_data(w_f8, w_type_f8, w_f16, w_type_f16, ne);          // cvt f16 to f8
+  cvt_w_data(w_f8, w_type_f8, w_f16, w_type_f16, ne, wx);      // cvt f16 to f8
 
   zero_mem(res_f8, w_type_f32, wy);
   matmul_procs.matmul_f32_f8(res_f8, v, w_f8, wx, wy);         // mul f8 to f32
   check_error(res_ref, res_f8, wy, 6.41f, 364.8f, "f8 f16  ", simd);    // cmp res f8
 
+  // ------------------------
+  // bf16 to q8
+  memset(w_q8, 0, (ne / Q8_BLOC_NE) * Q8_BLOC_SZ);
+  cvt_w_data(w_q8, w_type_q8, w_bf16, w_type_bf16, ne, wx);    // cvt bf16 to q8
+
+  zero_mem(res_q8, w_type_f32, wy);
+  matmul_procs.matmul_f32_q8(res_q8, v, w_q8, wx, wy);         // mul q8 to f32
+  check_error(res_ref, res_q8, wy, 1.46f, 82.3f, "q8 bf16 ", simd);    // cmp res f32 (simd: vec int8 quantized)
+
+  // ------------------------
+  // f16 to q8
+  memset(w_q8, 0, (ne / Q8_BLOC_NE) * Q8_BLOC_SZ);
+  cvt_w_data(w_q8, w_type_q8, w_f16, w_type_f16, ne, wx);      // cvt f16 to q8
+
+  zero_mem(res_q8, w_type_f32, wy);
+  matmul_procs.matmul_f32_q8(res_q8, v, w_q8, wx, wy);         // mul q8 to f32
+  check_error(res_ref, res_q8, wy, 1.23f, 74.5f, "q8 f16  ", simd);    // cmp res q8
+
+  // ------------------------
+  // bf16 to q4
+  memset(w_q4, 0, (ne / Q4_BLOC_NE) * Q4_BLOC_SZ);
+  cvt_w_data(w_q4, w_type_q4, w_bf16, w_type_bf16, ne, wx);    // cvt bf16 to q4
+
+  zero_mem(res_q4, w_type_f32, wy);
+  matmul_procs.matmul_f32_q4(res_q4, v, w_q4, wx, wy);         // mul q4 to f32
+  check_error(res_ref, res_q4, wy, 12.63f, 766.7f, "q4 bf16 ", simd);    // cmp res f32 (simd: vec int8 quantized)
+
+  // ------------------------
+  // f16 to q4
+  memset(w_q4, 0, (ne / Q4_BLOC_NE) * Q4_BLOC_SZ);
+  cvt_w_data(w_q4, w_type_q4, w_f16, w_type_f16, ne, wx);      // cvt f16 to q4
+
+  zero_mem(res_q4, w_type_f32, wy);
+  matmul_procs.matmul_f32_q4(res_q4, v, w_q4, wx, wy);         // mul q4 to f32
+  check_error(res_ref, res_q4, wy, 10.95f, 790.1f, "q4 f16  ", simd);    // cmp res q4
+
+  // ------------------------
+  // bf16 to f12s
+  cvt_w_data(w_f12s, w_type_f12s, w_bf16, w_type_bf16, ne, wx);  // cvt bf16 to f12s
+
+  zero_mem(res_f12, w_type_f32, wy);
+  matmul_procs.matmul_f32_f12s(res_f12, v, (f12_t *)w_f12s, wx, wy);  // mul f12s to f32
+  check_error(res_ref, res_f12, wy, 0.645f, 41.64f, "f12s bf16", simd);
+
+  // ------------------------
+  // f16 to f8s
+  cvt_w_data(w_f8s, w_type_f8s, w_f16, w_type_f16, ne, wx);      // cvt f16 to f8s
+
+  zero_mem(res_f8, w_type_f32, wy);
+  matmul_procs.matmul_f32_f8s(res_f8, v, w_f8s, wx, wy);       // mul f8s to f32
+  check_error(res_ref, res_f8, wy, 6.41f, 364.8f, "f8s f16 ", simd);
+
+  // ------------------------
+  // bf16 to f8s, weights out of f8 range (x16)
+  for (i=0; i<ne; i++)
+    if (ABS_F16(w_bf16[i]))
+      w_bf16[i] += 4 << 7;                                     // add 4 to exponent
+
+  cvt_w_data(w_f8s, w_type_f8s, w_bf16, w_type_bf16, ne, wx);    // cvt bf16 to f8s
+
+  zero_mem(res_f8, w_type_f32, wy);
+  matmul_procs.matmul_f32_f8s(res_f8, v, w_f8s, wx, wy);       // mul f8s to f32
+  for (i=0; i<wy; i++)
+    res_f8[i] *= 1.0f/16;
+  check_error(res_ref, res_f8, wy, 6.80f, 367.4f, "f8s bf16 x16", simd);
+
   free_check(w);
   free_check(v);
   free_check(res_ref);
@@ -202,12 +336,18 @@ static void conv_matmul_check(enum e_simd_typ simd)
   free_check(res_sf16);
   free_check(res_f12);
   free_check(res_f8);
+  free_check(res_q8);
+  free_check(res_q4);
   free_check(w_f32);
   free_check(w_f16);
   free_check(w_bf16);
   free_check(w_sf16);
   free_check(w_f12);
   free_check(w_f8);
+  free_check(w_q8);
+  free_check(w_q4);
+  free_check(w_f12s);
+  free_check(w_f8s);
   msg_info("conv/matmul %s checks done.\n", simd_typ_names[simd]);
 }
 
@@ -229,16 +369,32 @@ struct cpu_info_t
   int avx;
   int avx2;
 
+  //  simd 512 bits
+  int avx512;                          // F, DQ, BW and VL subsets (skylake-sp level)
+  int avx512_bf16;
+
   // other
   int f16c;
   int fma3;
+
+  char model[49];                      // brand string
 };
 
+// read XCR0, registers states saved by OS (call only if OSXSAVE cpuid bit set)
+#ifdef __GNUC__
+__attribute__((target("xsave")))
+#endif
+static unsigned long long get_xcr0(void)
+{
+  return _xgetbv(0);
+}
+
 // https://learn.microsoft.com/en-us/cpp/intrinsics/cpuid-cpuidex?view=msvc-170
 static void get_cpu_info(struct cpu_info_t *inf)
 {
   unsigned int info[4];
   unsigned int nIds;
+  int os_avx = 0, os_avx512 = 0;       // ymm, zmm/opmask registers states enabled by OS
 
   __cpuid(info, 0);
   nIds = info[0];  // gets the number of the highest valid function ID.
@@ -257,15 +413,43 @@ static void get_cpu_info(struct cpu_info_t *inf)
     inf->avx    = T_BIT(2, 28);
     inf->fma3   = T_BIT(2, 12);
     inf->f16c   = T_BIT(2, 29);
+    if (T_BIT(2, 27))                  // OSXSAVE, XCR0 readable
+    {
+      unsigned long long xcr0 = get_xcr0();
+      os_avx = (xcr0 & 0x06) == 0x06;                       // xmm, ymm
+      os_avx512 = os_avx && ((xcr0 & 0xe0) == 0xe0);        // opmask, zmm 0..15 high, zmm 16..31
+    }
+    // vex encoded instructions require ymm state support
+    inf->avx  = inf->avx && os_avx;
+    inf->fma3 = inf->fma3 && os_avx;
+    inf->f16c = inf->f16c && os_avx;
   }
 
   if (nIds >= 0x7)
   {
     __cpuidex(info, 0x7, 0);
-    inf->avx2   = T_BIT(1, 5);
+    inf->avx2   = T_BIT(1, 5) && os_avx;
+    inf->avx512 = T_BIT(1, 16) && T_BIT(1, 17) && T_BIT(1, 30) && T_BIT(1, 31) && os_avx512;
+    if (info[0] >= 1)                  // max sub leaf
+    {
+      __cpuidex(info, 0x7, 1);
+      inf->avx512_bf16 = inf->avx512 && T_BIT(0, 5);
+    }
   }
-  msg_info("CPU flags: f16c:%d fma3:%d, sse4.2:%d avx:%d avx2:%d\n", 
-           inf->f16c, inf->fma3, inf->sse42, inf->avx, inf->avx2);
+
+  // brand string
+  __cpuid(info, 0x80000000);
+  if (info[0] >= 0x80000004)
+  {
+    int i;
+    for (i=0; i<3; i++)
+    {
+      __cpuid(info, 0x80000002 + i);
+      memcpy(inf->model + i*16, info, 16);
+    }
+  }
+  msg_info("CPU flags: f16c:%d fma3:%d, sse4.2:%d avx:%d avx2:%d avx512:%d avx512_bf16:%d\n", 
+           inf->f16c, inf->fma3, inf->sse42, inf->avx, inf->avx2, inf->avx512, inf->avx512_bf16);
 }
 
 // select simd proc
@@ -290,20 +474,47 @@ static int select_simd(void *proc_list[], int max_simd, const char *func_name)
 // set matmul/converts procs for selected simd_typ
 static void set_mm_procs(enum e_simd_typ simd_typ)
 {
+  enum e_w_type t;
   #define SEL_SIMD(id) id[select_simd((void *)id, simd_typ, #id)]
 
   // set convert procs
-  matmul_procs.cvt_f16_to_f32  = SEL_SIMD(cvt_f16_to_f32_procs);
+  matmul_procs.cvt_f16_to_f32  = matmul_procs.cpu_f16c ? SEL_SIMD(cvt_f16_to_f32_procs) : cvt_f16_to_f32_procs[simd_fpu];
   matmul_procs.cvt_bf16_to_f32 = SEL_SIMD(cvt_bf16_to_f32_procs);
   matmul_procs.cvt_sf16_to_f32 = SEL_SIMD(cvt_sf16_to_f32_procs);
 
   // set matmul procs
-  matmul_procs.matmul_f32_f32  = SEL_SIMD(matmul_f32_f32_procs);
-  matmul_procs.matmul_f32_f16  = SEL_SIMD(matmul_f32_f16_procs);
-  matmul_procs.matmul_f32_bf16 = SEL_SIMD(matmul_f32_bf16_procs);
-  matmul_procs.matmul_f32_sf16 = SEL_SIMD(matmul_f32_sf16_procs);
-  matmul_procs.matmul_f32_f12  = SEL_SIMD(matmul_f32_f12_procs);
-  matmul_procs.matmul_f32_f8   = SEL_SIMD(matmul_f32_f8_procs);
+  for (t=0; t<w_type_COUNT; t++)
+    matmul_set_simd(t, simd_typ);
+}
+
+// set matmul function of d_type using simd_typ code version or lower if undefined
+enum e_simd_typ matmul_set_simd(enum e_w_type d_type, enum e_simd_typ simd_typ)
+{
+  int s = 0;
+  if (((d_type == w_type_f16) || (d_type == w_type_q8) || (d_type == w_type_q4)) && !matmul_procs.cpu_f16c)
+    simd_typ = simd_fpu;                         // sse/avx f16/q8/q4 code use f16c instructions
+
+  #define SET_MM_SIMD(typ, fn) case w_type_##typ: s = select_simd((void *)fn##_procs, simd_typ, #fn); matmul_procs.fn = fn##_procs[s]; break
+
+  switch (d_type)
+  {
+    SET_MM_SIMD(f32,  matmul_f32_f32);
+    SET_MM_SIMD(f16,  matmul_f32_f16);
+    SET_MM_SIMD(bf16, matmul_f32_bf16);
+    SET_MM_SIMD(sf16, matmul_f32_sf16);
+    SET_MM_SIMD(f12,  matmul_f32_f12);
+    SET_MM_SIMD(f8,   matmul_f32_f8);
+    SET_MM_SIMD(q8,   matmul_f32_q8);
+    SET_MM_SIMD(q4,   matmul_f32_q4);
+    SET_MM_SIMD(f12s, matmul_f32_f12s);
+    SET_MM_SIMD(f8s,  matmul_f32_f8s);
+    default:
+      msg_error("no matmul for weights type %d", d_type);
+  }
+  if ((d_type == w_type_bf16) && (s == simd_avx512) && matmul_procs.cpu_avx512_bf16 && matmul_f32_bf16_avx512_bf16)
+    matmul_procs.matmul_f32_bf16 = matmul_f32_bf16_avx512_bf16;
+  matmul_procs.mm_simd[d_type] = (enum e_simd_typ)s;
+  return (enum e_simd_typ)s;
 }
 
 // selec matmul and convert functions depending of simd mode
@@ -320,6 +531,8 @@ void matmul_init(enum e_simd_typ simd_typ)
 #endif
 
   matmul_procs.cpu_f16c = inf.f16c;              // set flag for user
+  matmul_procs.cpu_avx512_bf16 = inf.avx512_bf16;
+  memcpy(matmul_procs.cpu_model, inf.model, sizeof(inf.model));
   if (!inf.f16c || (simd_typ == simd_fpu))
   {
     if (!inf.f16c)
@@ -328,8 +541,12 @@ void matmul_init(enum e_simd_typ simd_typ)
   }
 
   // adjust simd_typ
-  if (simd_typ < 0) simd_typ = simd_avx2;        // auto to max
-  if (simd_typ > simd_avx2) simd_typ = simd_avx2; // truncate to max
+  if (simd_typ < 0) simd_typ = simd_avx512;      // auto to max
+  if (simd_typ > simd_avx512) simd_typ = simd_avx512; // truncate to max
+#ifndef MM_AVX512                                // no avx512 code
+  if (simd_typ == simd_avx512) simd_typ--;
+#endif
+  if ((simd_typ == simd_avx512) && !inf.avx512) simd_typ--;
   if ((simd_typ == simd_avx2) && !inf.avx2) simd_typ--;
   if ((simd_typ == simd_avx1) && !inf.avx) simd_typ--;
 
@@ -337,13 +554,14 @@ void matmul_init(enum e_simd_typ simd_typ)
   if (simd_typ > simd_sse) simd_typ = simd_sse;
 #endif
   matmul_procs.simd_set = simd_typ;              // save configured mode
+  matmul_procs.pf_dist = MM_PF_DIST_DEF;         // default, can be changed by user after init
 
 #if 0
   if (inf.avx2)                                  // debug: check all functions for all modes
   {
     enum e_simd_typ t;
     init_sw_f16c();
-    for (t=simd_fpu; t<=simd_avx2; t++)
+    for (t=simd_fpu; t<=simd_typ; t++)
     {
       set_mm_procs(t);
       init_conv_sf16();
@@ -357,6 +575,7 @@ void matmul_init(enum e_simd_typ simd_typ)
 
   // set user selected mode
   set_mm_procs(simd_typ);
+  vec_procs_init(simd_typ);
 
   // init conversions
   init_conv_sf16();
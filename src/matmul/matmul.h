@@ -6,9 +6,18 @@ enum e_simd_typ
   simd_sse,
   simd_avx1,
   simd_avx2,
+  simd_avx512,
   simd_n,
 };
 
+// AVX512 code require a recent compiler (gcc, visual studio 2017 or later)
+#if defined(__GNUC__) || (defined(_MSC_VER) && (_MSC_VER >= 1910))
+#define MM_AVX512
+#if defined(__GNUC__)
+#define MM_AVX512_BF16                 // AVX512_BF16 dot product code
+#endif
+#endif
+
 #define SIMD_LV 32                     // max used len_vec/or ne stride in matmul_xx/cvt_xx functions
 
 // ---------------------------
@@ -50,6 +59,12 @@ typedef void (* matmul_f32_f12_t)(float *res, const float *vec, const f12_t *mat
 // float32 * float8 => float32
 typedef void (* matmul_f32_f8_t)(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat);
 
+// float32 * q8 (int8 blocs with f16 scale) => float32
+typedef void (* matmul_f32_q8_t)(float *res, const float *vec, const q8_t *mat, int len_vec, int y_mat);
+
+// float32 * q4 (4 bits codes blocs with f16 scale and min) => float32
+typedef void (* matmul_f32_q4_t)(float *res, const float *vec, const q4_t *mat, int len_vec, int y_mat);
+
 // list of functions
 struct matmul_procs_t
 {
@@ -66,20 +81,31 @@ struct matmul_procs_t
   matmul_f32_sf16_t matmul_f32_sf16;
   matmul_f32_f12_t  matmul_f32_f12;
   matmul_f32_f8_t   matmul_f32_f8;
+  matmul_f32_q8_t   matmul_f32_q8;
+  matmul_f32_q4_t   matmul_f32_q4;
+  matmul_f32_f12_t  matmul_f32_f12s;  // f12 with row scale
+  matmul_f32_f8_t   matmul_f32_f8s;   // f8 with row scale
 
   // infos
   enum e_simd_typ simd_set;    // initialized mode
+  enum e_simd_typ mm_simd[w_type_COUNT]; // simd code version used by matmul of each weights type
   int cpu_f16c;                // 1: f16c support
+  int cpu_avx512_bf16;         // 1: AVX512_BF16 support (bf16 dot product used by avx512 bf16 matmul)
+  int pf_dist;                 // multi rows matmul prefetch distance in bytes, 0: disabled
+  char cpu_model[49];          // cpu brand string
 };
 
 // interface
 extern struct matmul_procs_t matmul_procs;
 
-// generic data types conversions
-void cvt_w_data(void *d, enum e_w_type d_type, const void *s, enum e_w_type s_type, size_t ne);
+// generic data types conversions, wx is raw size (used by row scaled formats)
+void cvt_w_data(void *d, enum e_w_type d_type, const void *s, enum e_w_type s_type, size_t ne, int wx);
 
 // init
 void matmul_init(enum e_simd_typ simd_typ);
 
+// set matmul function of d_type using simd_typ code version or lower if undefined (autotune), return used version
+enum e_simd_typ matmul_set_simd(enum e_w_type d_type, enum e_simd_typ simd_typ);
+
 // free some memory
 void matmul_exit(void);
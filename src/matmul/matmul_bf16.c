@@ -2,6 +2,7 @@
 #include "mm_hsum.h"
 #include "w_types.h"
 #include "matmul.h"
+#include "matmul_priv.h"
 
 // ------------------------------------------------------------------
 // conversion bf16 => f32
@@ -15,7 +16,7 @@ static void cvt_bf16_to_f32_fpu(float *f32, const bf16_t *bf16, size_t ne)
     ps[i] = (unsigned int)bf16[i] << 16;
 }
 
-static void cvt_bf16_to_f32_sse(float *f32, const bf16_t *bf16, size_t ne)
+static SIMD_SSE void cvt_bf16_to_f32_sse(float *f32, const bf16_t *bf16, size_t ne)
 {
   size_t i;
   for (i=0; i!=ne; i+=4)
@@ -28,7 +29,7 @@ static void cvt_bf16_to_f32_sse(float *f32, const bf16_t *bf16, size_t ne)
 #define GET_8BF16_AVX1(d) _mm256_castsi256_ps(_mm256_set_m128i(_mm_unpackhi_epi16(_mm_setzero_si128(), d), _mm_unpacklo_epi16(_mm_setzero_si128(), d)))
 
 // todo: use shuffle ?
-static void cvt_bf16_to_f32_avx1(float *f32, const bf16_t *bf16, size_t ne)
+static SIMD_AVX void cvt_bf16_to_f32_avx1(float *f32, const bf16_t *bf16, size_t ne)
 {
   size_t i;
   for (i=0; i!=ne; i+=8)
@@ -40,7 +41,7 @@ static void cvt_bf16_to_f32_avx1(float *f32, const bf16_t *bf16, size_t ne)
 
 #define GET_8BF16_AVX2(d) _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(d), 16))
 
-static void cvt_bf16_to_f32_avx2(float *f32, const bf16_t *bf16, size_t ne)
+static SIMD_AVX2 void cvt_bf16_to_f32_avx2(float *f32, const bf16_t *bf16, size_t ne)
 {
   size_t i;
   for (i=0; i!=ne; i+=8)
@@ -50,12 +51,27 @@ static void cvt_bf16_to_f32_avx2(float *f32, const bf16_t *bf16, size_t ne)
   }
 }
 
+#ifdef MM_AVX512
+#define GET_16BF16_AVX512(d) _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(d), 16))
+
+static SIMD_AVX512 void cvt_bf16_to_f32_avx512(float *f32, const bf16_t *bf16, size_t ne)
+{
+  size_t i;
+  for (i=0; i!=ne; i+=16)
+  {
+    __m256i d = _mm256_loadu_si256((__m256i *)(bf16 + i));
+    _mm512_storeu_ps(f32 + i, GET_16BF16_AVX512(d));
+  }
+}
+#endif
+
 const cvt_bf16_to_f32_t cvt_bf16_to_f32_procs[simd_n] =
 {
   cvt_bf16_to_f32_fpu,
   cvt_bf16_to_f32_sse,
   cvt_bf16_to_f32_avx1,
   cvt_bf16_to_f32_avx2,
+  AVX512_PROC(cvt_bf16_to_f32_avx512),
 };
 
 // ------------------------------------------------------------------
@@ -78,7 +94,7 @@ static void matmul_f32_bf16_fpu(float *res, const float *vec, const bf16_t *mat,
   }
 }
 
-static void matmul_f32_bf16_sse(float *res, const float *vec, const bf16_t *mat, int len_vec, int y_mat)
+static SIMD_SSE void matmul_f32_bf16_sse(float *res, const float *vec, const bf16_t *mat, int len_vec, int y_mat)
 {
   const bf16_t *m, *m_end = mat + y_mat * len_vec;
   for (m=mat; m!=m_end; m+=len_vec)
@@ -105,7 +121,7 @@ static void matmul_f32_bf16_sse(float *res, const float *vec, const bf16_t *mat,
   }
 }
 
-static void matmul_f32_bf16_avx1(float *res, const float *vec, const bf16_t *mat, int len_vec, int y_mat)
+static SIMD_AVX void matmul_f32_bf16_avx1(float *res, const float *vec, const bf16_t *mat, int len_vec, int y_mat)
 {
   const bf16_t *m, *m_end = mat + y_mat * len_vec;
   for (m=mat; m!=m_end; m+=len_vec)
@@ -125,7 +141,7 @@ static void matmul_f32_bf16_avx1(float *res, const float *vec, const bf16_t *mat
   }
 }
 
-static void matmul_f32_bf16_avx2(float *res, const float *vec, const bf16_t *mat, int len_vec, int y_mat)
+static SIMD_AVX2 void matmul_f32_bf16_avx2(float *res, const float *vec, const bf16_t *mat, int len_vec, int y_mat)
 {
   const bf16_t *m, *m_end = mat + y_mat * len_vec;
   for (m=mat; m!=m_end; m+=len_vec)
@@ -145,11 +161,200 @@ static void matmul_f32_bf16_avx2(float *res, const float *vec, const bf16_t *mat
   }
 }
 
+// MM_ROWS rows version
+static SIMD_AVX2 void matmul_f32_bf16_avx2_4r(float *res, const float *vec, const bf16_t *mat, int len_vec, int y_mat)
+{
+  const bf16_t *m, *m_end = mat + (y_mat & ~(MM_ROWS-1)) * len_vec;
+  int pf_dist = matmul_procs.pf_dist;
+  for (m=mat; m!=m_end; m+=MM_ROWS*len_vec, res+=MM_ROWS)
+  {
+    const bf16_t *m1 = m + len_vec, *m2 = m1 + len_vec, *m3 = m2 + len_vec;
+    __m256 acc00 = _mm256_setzero_ps(), acc01 = _mm256_setzero_ps();
+    __m256 acc10 = _mm256_setzero_ps(), acc11 = _mm256_setzero_ps();
+    __m256 acc20 = _mm256_setzero_ps(), acc21 = _mm256_setzero_ps();
+    __m256 acc30 = _mm256_setzero_ps(), acc31 = _mm256_setzero_ps();
+
+    int i;
+    for (i=0; i!=len_vec; i+=16)
+    {
+      __m256 v0 = _mm256_load_ps(vec + i    );
+      __m256 v1 = _mm256_load_ps(vec + i + 8);
+      if (pf_dist)
+      {
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(bf16_t));       // 128 bytes used per loop
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(bf16_t) + 64);
+      }
+      acc00 = _mm256_fmadd_ps(GET_8BF16_AVX2(_mm_load_si128((__m128i *)(m  + i    ))), v0, acc00);
+      acc01 = _mm256_fmadd_ps(GET_8BF16_AVX2(_mm_load_si128((__m128i *)(m  + i + 8))), v1, acc01);
+      acc10 = _mm256_fmadd_ps(GET_8BF16_AVX2(_mm_load_si128((__m128i *)(m1 + i    ))), v0, acc10);
+      acc11 = _mm256_fmadd_ps(GET_8BF16_AVX2(_mm_load_si128((__m128i *)(m1 + i + 8))), v1, acc11);
+      acc20 = _mm256_fmadd_ps(GET_8BF16_AVX2(_mm_load_si128((__m128i *)(m2 + i    ))), v0, acc20);
+      acc21 = _mm256_fmadd_ps(GET_8BF16_AVX2(_mm_load_si128((__m128i *)(m2 + i + 8))), v1, acc21);
+      acc30 = _mm256_fmadd_ps(GET_8BF16_AVX2(_mm_load_si128((__m128i *)(m3 + i    ))), v0, acc30);
+      acc31 = _mm256_fmadd_ps(GET_8BF16_AVX2(_mm_load_si128((__m128i *)(m3 + i + 8))), v1, acc31);
+    }
+    _mm_storeu_ps(res, hsum_ps_avx_4r(_mm256_add_ps(acc00, acc01), _mm256_add_ps(acc10, acc11),
+                                      _mm256_add_ps(acc20, acc21), _mm256_add_ps(acc30, acc31)));
+  }
+  if (y_mat & (MM_ROWS-1))
+    matmul_f32_bf16_avx2(res, vec, m_end, len_vec, y_mat & (MM_ROWS-1));
+}
+
+#ifdef MM_AVX512
+#define LOAD_16BF16_AVX512(m) GET_16BF16_AVX512(_mm256_loadu_si256((__m256i *)(m)))
+
+static SIMD_AVX512 void matmul_f32_bf16_avx512(float *res, const float *vec, const bf16_t *mat, int len_vec, int y_mat)
+{
+  const bf16_t *m, *m_end = mat + y_mat * len_vec;
+  for (m=mat; m!=m_end; m+=len_vec)
+  {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+
+    int i;
+    for (i=0; i!=len_vec; i+=32)
+    {
+      acc0 = _mm512_fmadd_ps(LOAD_16BF16_AVX512(m + i     ), _mm512_loadu_ps(vec + i     ), acc0);
+      acc1 = _mm512_fmadd_ps(LOAD_16BF16_AVX512(m + i + 16), _mm512_loadu_ps(vec + i + 16), acc1);
+    }
+    *res++ = hsum_ps_avx512_2x(acc0, acc1);
+  }
+}
+
+// MM_ROWS rows version
+static SIMD_AVX512 void matmul_f32_bf16_avx512_4r(float *res, const float *vec, const bf16_t *mat, int len_vec, int y_mat)
+{
+  const bf16_t *m, *m_end = mat + (y_mat & ~(MM_ROWS-1)) * len_vec;
+  int pf_dist = matmul_procs.pf_dist;
+  for (m=mat; m!=m_end; m+=MM_ROWS*len_vec, res+=MM_ROWS)
+  {
+    const bf16_t *m1 = m + len_vec, *m2 = m1 + len_vec, *m3 = m2 + len_vec;
+    __m512 acc00 = _mm512_setzero_ps(), acc01 = _mm512_setzero_ps();
+    __m512 acc10 = _mm512_setzero_ps(), acc11 = _mm512_setzero_ps();
+    __m512 acc20 = _mm512_setzero_ps(), acc21 = _mm512_setzero_ps();
+    __m512 acc30 = _mm512_setzero_ps(), acc31 = _mm512_setzero_ps();
+
+    int i;
+    for (i=0; i!=len_vec; i+=32)
+    {
+      __m512 v0 = _mm512_loadu_ps(vec + i     );
+      __m512 v1 = _mm512_loadu_ps(vec + i + 16);
+      if (pf_dist)
+      {
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(bf16_t));       // 256 bytes used per loop
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(bf16_t) + 64);
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(bf16_t) + 128);
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(bf16_t) + 192);
+      }
+      acc00 = _mm512_fmadd_ps(LOAD_16BF16_AVX512(m  + i     ), v0, acc00);
+      acc01 = _mm512_fmadd_ps(LOAD_16BF16_AVX512(m  + i + 16), v1, acc01);
+      acc10 = _mm512_fmadd_ps(LOAD_16BF16_AVX512(m1 + i     ), v0, acc10);
+      acc11 = _mm512_fmadd_ps(LOAD_16BF16_AVX512(m1 + i + 16), v1, acc11);
+      acc20 = _mm512_fmadd_ps(LOAD_16BF16_AVX512(m2 + i     ), v0, acc20);
+      acc21 = _mm512_fmadd_ps(LOAD_16BF16_AVX512(m2 + i + 16), v1, acc21);
+      acc30 = _mm512_fmadd_ps(LOAD_16BF16_AVX512(m3 + i     ), v0, acc30);
+      acc31 = _mm512_fmadd_ps(LOAD_16BF16_AVX512(m3 + i + 16), v1, acc31);
+    }
+    _mm_storeu_ps(res, hsum_ps_avx512_4r(_mm512_add_ps(acc00, acc01), _mm512_add_ps(acc10, acc11),
+                                         _mm512_add_ps(acc20, acc21), _mm512_add_ps(acc30, acc31)));
+  }
+  if (y_mat & (MM_ROWS-1))
+    matmul_f32_bf16_avx512(res, vec, m_end, len_vec, y_mat & (MM_ROWS-1));
+}
+#endif
+
+#ifdef MM_AVX512_BF16
+// AVX512_BF16 dot product version. vec is split in 2 bf16 parts (rounded value and rounding error),
+// the 2 dot products keep a precision near f32 (a single bf16 vec would lose 16 mantissa bits).
+
+// split 32 f32 at v to v_h + v_l bf16 vectors
+#define SPLIT_32_BF16(v, v_h, v_l) \
+{ \
+  __m512 _v0 = _mm512_loadu_ps(v), _v1 = _mm512_loadu_ps((v) + 16); \
+  __m512i _h = (__m512i)_mm512_cvtne2ps_pbh(_v1, _v0); \
+  _v0 = _mm512_sub_ps(_v0, GET_16BF16_AVX512(_mm512_castsi512_si256(_h))); \
+  _v1 = _mm512_sub_ps(_v1, GET_16BF16_AVX512(_mm512_extracti64x4_epi64(_h, 1))); \
+  v_h = (__m512bh)_h; \
+  v_l = _mm512_cvtne2ps_pbh(_v1, _v0); \
+}
+
+#define LOAD_32BF16_BH(m) (__m512bh)_mm512_loadu_si512((const void *)(m))
+
+static SIMD_AVX512_BF16 void matmul_f32_bf16_avx512_dp(float *res, const float *vec, const bf16_t *mat, int len_vec, int y_mat)
+{
+  const bf16_t *m, *m_end = mat + y_mat * len_vec;
+  for (m=mat; m!=m_end; m+=len_vec)
+  {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int i;
+    for (i=0; i!=len_vec; i+=32)
+    {
+      __m512bh v_h, v_l, d = LOAD_32BF16_BH(m + i);
+      SPLIT_32_BF16(vec + i, v_h, v_l);
+      acc0 = _mm512_dpbf16_ps(acc0, d, v_h);
+      acc1 = _mm512_dpbf16_ps(acc1, d, v_l);
+    }
+    *res++ = hsum_ps_avx512_2x(acc0, acc1);
+  }
+}
+
+// MM_ROWS rows version, vec split done once for all rows
+static SIMD_AVX512_BF16 void matmul_f32_bf16_avx512_dp_4r(float *res, const float *vec, const bf16_t *mat, int len_vec, int y_mat)
+{
+  const bf16_t *m, *m_end = mat + (y_mat & ~(MM_ROWS-1)) * len_vec;
+  int pf_dist = matmul_procs.pf_dist;
+  for (m=mat; m!=m_end; m+=MM_ROWS*len_vec, res+=MM_ROWS)
+  {
+    const bf16_t *m1 = m + len_vec, *m2 = m1 + len_vec, *m3 = m2 + len_vec;
+    __m512 acc00 = _mm512_setzero_ps(), acc01 = _mm512_setzero_ps();
+    __m512 acc10 = _mm512_setzero_ps(), acc11 = _mm512_setzero_ps();
+    __m512 acc20 = _mm512_setzero_ps(), acc21 = _mm512_setzero_ps();
+    __m512 acc30 = _mm512_setzero_ps(), acc31 = _mm512_setzero_ps();
+
+    int i;
+    for (i=0; i!=len_vec; i+=32)
+    {
+      __m512bh v_h, v_l, d;
+      SPLIT_32_BF16(vec + i, v_h, v_l);
+      if (pf_dist)
+      {
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(bf16_t));       // 256 bytes used per loop
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(bf16_t) + 64);
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(bf16_t) + 128);
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(bf16_t) + 192);
+      }
+      d = LOAD_32BF16_BH(m  + i);
+      acc00 = _mm512_dpbf16_ps(acc00, d, v_h);
+      acc01 = _mm512_dpbf16_ps(acc01, d, v_l);
+      d = LOAD_32BF16_BH(m1 + i);
+      acc10 = _mm512_dpbf16_ps(acc10, d, v_h);
+      acc11 = _mm512_dpbf16_ps(acc11, d, v_l);
+      d = LOAD_32BF16_BH(m2 + i);
+      acc20 = _mm512_dpbf16_ps(acc20, d, v_h);
+      acc21 = _mm512_dpbf16_ps(acc21, d, v_l);
+      d = LOAD_32BF16_BH(m3 + i);
+      acc30 = _mm512_dpbf16_ps(acc30, d, v_h);
+      acc31 = _mm512_dpbf16_ps(acc31, d, v_l);
+    }
+    _mm_storeu_ps(res, hsum_ps_avx512_4r(_mm512_add_ps(acc00, acc01), _mm512_add_ps(acc10, acc11),
+                                         _mm512_add_ps(acc20, acc21), _mm512_add_ps(acc30, acc31)));
+  }
+  if (y_mat & (MM_ROWS-1))
+    matmul_f32_bf16_avx512_dp(res, vec, m_end, len_vec, y_mat & (MM_ROWS-1));
+}
+
+const matmul_f32_bf16_t matmul_f32_bf16_avx512_bf16 = matmul_f32_bf16_avx512_dp_4r;
+#else
+const matmul_f32_bf16_t matmul_f32_bf16_avx512_bf16 = NULL;
+#endif
+
 // init functions list
 const matmul_f32_bf16_t matmul_f32_bf16_procs[simd_n] =
 {
   matmul_f32_bf16_fpu,
   matmul_f32_bf16_sse,
   matmul_f32_bf16_avx1,
-  matmul_f32_bf16_avx2
+  matmul_f32_bf16_avx2_4r,
+  AVX512_PROC(matmul_f32_bf16_avx512_4r),
 };
@@ -1,4 +1,5 @@
 #include <intrin.h>
+#include <stdbool.h>
 #include "mm_hsum.h"
 #include "w_types.h"
 #include "matmul.h"
@@ -12,6 +13,7 @@
 #define F12_CVT_ADD 0x3880            // f12 range 1.8626451e-009 to 7.9960938
 
 #define F12_CVT_MAX 4.0f              // max +/- converted value
+const float f12_cvt_max = F12_CVT_MAX;
 //#define F12_ERR_MAX f               // max convert error for F12_CVT_MAX value
 
 #define F16_4_00 17408                // 4.00 in float 16
@@ -69,7 +71,7 @@ static void matmul_f32_f12_fpu(float *res, const float *vec, const f12_t *mat, i
 // shuffle index
 #define SHI(d,c,b,a) ((d << 6) | (c << 4) | (b << 2) | a)
 
-static void matmul_f32_f12_sse(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat)
+static SIMD_SSE void matmul_f32_f12_sse(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat)
 {
   const unsigned char *e = (const unsigned char *)mat;
   int y;
@@ -136,7 +138,7 @@ static void matmul_f32_f12_sse(float *res, const float *vec, const f12_t *mat, i
 }
 
 // this is mostly sse + fma in avx (no gain vs sse only)
-static void matmul_f32_f12_avx(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat)
+static SIMD_AVX void matmul_f32_f12_avx(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat)
 {
   const unsigned char *e = (const unsigned char *)mat;
   int y;
@@ -198,7 +200,24 @@ static void matmul_f32_f12_avx(float *res, const float *vec, const f12_t *mat, i
   }
 }
 
-static void matmul_f32_f12_avx2(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat)
+// unpack 16 f12 (24 bytes at e) to 16 f32 in r_l (0..7), r_h (8..15)
+#define F12_UNPACK_16_AVX2(e, r_l, r_h) \
+{ \
+  __m128i _ld0 = _mm_loadu_si128((__m128i *)(e)); \
+  __m256i _m = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)((e) + 16))); \
+  r_l = _mm256_slli_epi32(_mm256_cvtepi8_epi32(_ld0), 4); \
+  r_h = _mm256_slli_epi32(_mm256_cvtepi8_epi32(_mm_shuffle_epi32(_ld0, SHI(3,2,3,2))), 4); \
+  r_l = _mm256_or_si256(r_l, _mm256_and_si256(_m, _mm256_set1_epi32(0xf))); \
+  r_h = _mm256_or_si256(r_h, _mm256_srli_epi32(_m, 4)); \
+  r_l = _mm256_and_si256(r_l, _mm256_set1_epi32(F12_CVT_MSK)); \
+  r_h = _mm256_and_si256(r_h, _mm256_set1_epi32(F12_CVT_MSK)); \
+  r_l = _mm256_add_epi32(r_l, _mm256_set1_epi32(F12_CVT_ADD)); \
+  r_h = _mm256_add_epi32(r_h, _mm256_set1_epi32(F12_CVT_ADD)); \
+  r_l = _mm256_slli_epi32(r_l, F12_CVT_LSL); \
+  r_h = _mm256_slli_epi32(r_h, F12_CVT_LSL); \
+}
+
+static SIMD_AVX2 void matmul_f32_f12_avx2(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat)
 {
   const unsigned char *e = (const unsigned char *)mat;
   int y;
@@ -210,31 +229,8 @@ static void matmul_f32_f12_avx2(float *res, const float *vec, const f12_t *mat,
     const float *v, *v_end = vec + len_vec;
     for (v=vec; v!=v_end; v+=16, e+=24)
     {
-      __m128i _ld0;
-      __m256i _r0h, _r0l, _m;
-
-      // unpack 16 f12 to 16 f32
-      _ld0 = _mm_loadu_si128((__m128i *)e);
-      _r0l = _mm256_cvtepi8_epi32(_ld0);
-      _r0h = _mm256_cvtepi8_epi32(_mm_shuffle_epi32(_ld0, SHI(3,2,3,2)));
-
-      _r0l = _mm256_slli_epi32(_r0l, 4);
-      _r0h = _mm256_slli_epi32(_r0h, 4);
-
-      _m = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(e + 16)));
-
-      _r0l = _mm256_or_si256(_r0l, _mm256_and_si256(_m, _mm256_set1_epi32(0xf)));
-      _r0h = _mm256_or_si256(_r0h, _mm256_srli_epi32(_m, 4));
-
-      _r0l = _mm256_and_si256(_r0l, _mm256_set1_epi32(F12_CVT_MSK));
-      _r0h = _mm256_and_si256(_r0h, _mm256_set1_epi32(F12_CVT_MSK));
-
-      _r0l = _mm256_add_epi32(_r0l, _mm256_set1_epi32(F12_CVT_ADD));
-      _r0h = _mm256_add_epi32(_r0h, _mm256_set1_epi32(F12_CVT_ADD));
-      
-      _r0l = _mm256_slli_epi32(_r0l, F12_CVT_LSL);
-      _r0h = _mm256_slli_epi32(_r0h, F12_CVT_LSL);
-
+      __m256i _r0h, _r0l;
+      F12_UNPACK_16_AVX2(e, _r0l, _r0h);
       acc0 = _mm256_fmadd_ps(_mm256_load_ps(v    ), _mm256_castsi256_ps(_r0l), acc0);
       acc1 = _mm256_fmadd_ps(_mm256_load_ps(v + 8), _mm256_castsi256_ps(_r0h), acc1);
     }
@@ -242,13 +238,224 @@ static void matmul_f32_f12_avx2(float *res, const float *vec, const f12_t *mat,
   }
 }
 
+// f12s row scale, stored after row datas (sz_d bytes)
+#define F12S_SCALE(e, sz_d) (*(const float *)((e) + (sz_d)))
+
+// MM_ROWS rows version, decode is the main cost, vec loaded once for all rows
+// sz_row: rows stride in bytes, r_scale: f12s rows, results are multiplied by rows scale
+static SIMD_AVX2 __inline void matmul_f32_f12_avx2_4r_rs(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat, int sz_row, bool r_scale)
+{
+  const unsigned char *e = (const unsigned char *)mat;
+  int sz_d = len_vec + (len_vec >> 1);           // f12 row datas size
+  int pf_dist = matmul_procs.pf_dist;
+  int y;
+  for (y=0; y<=y_mat-MM_ROWS; y+=MM_ROWS, e+=MM_ROWS*sz_row, res+=MM_ROWS)
+  {
+    const unsigned char *e0 = e, *e1 = e + sz_row, *e2 = e1 + sz_row, *e3 = e2 + sz_row;
+    __m256 acc00 = _mm256_setzero_ps(), acc01 = _mm256_setzero_ps();
+    __m256 acc10 = _mm256_setzero_ps(), acc11 = _mm256_setzero_ps();
+    __m256 acc20 = _mm256_setzero_ps(), acc21 = _mm256_setzero_ps();
+    __m256 acc30 = _mm256_setzero_ps(), acc31 = _mm256_setzero_ps();
+    const unsigned char *pf = e + pf_dist;
+
+    const float *v, *v_end = vec + len_vec;
+    for (v=vec; v!=v_end; v+=16, e0+=24, e1+=24, e2+=24, e3+=24, pf+=MM_ROWS*24)
+    {
+      __m256 v0 = _mm256_load_ps(v    );
+      __m256 v1 = _mm256_load_ps(v + 8);
+      __m256i _rl, _rh;
+      if (pf_dist)
+      {
+        _mm_prefetch((const char *)pf, _MM_HINT_T0);        // 96 bytes used per loop
+        _mm_prefetch((const char *)pf + 64, _MM_HINT_T0);
+      }
+      F12_UNPACK_16_AVX2(e0, _rl, _rh);
+      acc00 = _mm256_fmadd_ps(v0, _mm256_castsi256_ps(_rl), acc00);
+      acc01 = _mm256_fmadd_ps(v1, _mm256_castsi256_ps(_rh), acc01);
+      F12_UNPACK_16_AVX2(e1, _rl, _rh);
+      acc10 = _mm256_fmadd_ps(v0, _mm256_castsi256_ps(_rl), acc10);
+      acc11 = _mm256_fmadd_ps(v1, _mm256_castsi256_ps(_rh), acc11);
+      F12_UNPACK_16_AVX2(e2, _rl, _rh);
+      acc20 = _mm256_fmadd_ps(v0, _mm256_castsi256_ps(_rl), acc20);
+      acc21 = _mm256_fmadd_ps(v1, _mm256_castsi256_ps(_rh), acc21);
+      F12_UNPACK_16_AVX2(e3, _rl, _rh);
+      acc30 = _mm256_fmadd_ps(v0, _mm256_castsi256_ps(_rl), acc30);
+      acc31 = _mm256_fmadd_ps(v1, _mm256_castsi256_ps(_rh), acc31);
+    }
+    __m128 r = hsum_ps_avx_4r(_mm256_add_ps(acc00, acc01), _mm256_add_ps(acc10, acc11),
+                              _mm256_add_ps(acc20, acc21), _mm256_add_ps(acc30, acc31));
+    if (r_scale)
+      r = _mm_mul_ps(r, _mm_setr_ps(F12S_SCALE(e, sz_d), F12S_SCALE(e + sz_row, sz_d),
+                                    F12S_SCALE(e + 2*sz_row, sz_d), F12S_SCALE(e + 3*sz_row, sz_d)));
+    _mm_storeu_ps(res, r);
+  }
+  for (; y<y_mat; y++, e+=sz_row, res++)         // remaining rows
+  {
+    matmul_f32_f12_avx2(res, vec, (const f12_t *)e, len_vec, 1);
+    if (r_scale)
+      *res *= F12S_SCALE(e, sz_d);
+  }
+}
+
+static SIMD_AVX2 void matmul_f32_f12_avx2_4r(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat)
+{
+  matmul_f32_f12_avx2_4r_rs(res, vec, mat, len_vec, y_mat, len_vec + (len_vec >> 1), false);
+}
+
+#ifdef MM_AVX512
+// unpack 16 f12 (24 bytes at e) to 16 f32 in r. the 8 low nibbles bytes are loaded in 2 lanes
+// and shifted right by lsr (0 for elements 0..7, 4 for elements 8..15)
+#define F12_UNPACK_16_AVX512(e, r, lsr) \
+{ \
+  __m128i _l8 = _mm_loadl_epi64((__m128i *)((e) + 16)); \
+  __m512i _m = _mm512_srlv_epi32(_mm512_cvtepu8_epi32(_mm_unpacklo_epi64(_l8, _l8)), lsr); \
+  r = _mm512_slli_epi32(_mm512_cvtepi8_epi32(_mm_loadu_si128((__m128i *)(e))), 4); \
+  r = _mm512_or_si512(r, _mm512_and_si512(_m, _mm512_set1_epi32(0xf))); \
+  r = _mm512_and_si512(r, _mm512_set1_epi32(F12_CVT_MSK)); \
+  r = _mm512_add_epi32(r, _mm512_set1_epi32(F12_CVT_ADD)); \
+  r = _mm512_slli_epi32(r, F12_CVT_LSL); \
+}
+
+#define F12_LSR_AVX512 _mm512_set_epi32(4, 4, 4, 4, 4, 4, 4, 4, 0, 0, 0, 0, 0, 0, 0, 0)
+
+static SIMD_AVX512 void matmul_f32_f12_avx512(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat)
+{
+  const unsigned char *e = (const unsigned char *)mat;
+  __m512i lsr = F12_LSR_AVX512;
+  int y;
+  for (y=0; y<y_mat; y++)
+  {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+
+    const float *v, *v_end = vec + len_vec;
+    for (v=vec; v!=v_end; v+=32, e+=48)
+    {
+      __m512i _r0, _r1;
+      F12_UNPACK_16_AVX512(e     , _r0, lsr);
+      F12_UNPACK_16_AVX512(e + 24, _r1, lsr);
+      acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(v     ), _mm512_castsi512_ps(_r0), acc0);
+      acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(v + 16), _mm512_castsi512_ps(_r1), acc1);
+    }
+    *res++ = hsum_ps_avx512_2x(acc0, acc1);
+  }
+}
+
+// MM_ROWS rows version
+static SIMD_AVX512 __inline void matmul_f32_f12_avx512_4r_rs(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat, int sz_row, bool r_scale)
+{
+  const unsigned char *e = (const unsigned char *)mat;
+  int sz_d = len_vec + (len_vec >> 1);           // f12 row datas size
+  int pf_dist = matmul_procs.pf_dist;
+  __m512i lsr = F12_LSR_AVX512;
+  int y;
+  for (y=0; y<=y_mat-MM_ROWS; y+=MM_ROWS, e+=MM_ROWS*sz_row, res+=MM_ROWS)
+  {
+    const unsigned char *e0 = e, *e1 = e + sz_row, *e2 = e1 + sz_row, *e3 = e2 + sz_row;
+    __m512 acc00 = _mm512_setzero_ps(), acc01 = _mm512_setzero_ps();
+    __m512 acc10 = _mm512_setzero_ps(), acc11 = _mm512_setzero_ps();
+    __m512 acc20 = _mm512_setzero_ps(), acc21 = _mm512_setzero_ps();
+    __m512 acc30 = _mm512_setzero_ps(), acc31 = _mm512_setzero_ps();
+    const unsigned char *pf = e + pf_dist;
+
+    const float *v, *v_end = vec + len_vec;
+    for (v=vec; v!=v_end; v+=32, e0+=48, e1+=48, e2+=48, e3+=48, pf+=MM_ROWS*48)
+    {
+      __m512 v0 = _mm512_loadu_ps(v     );
+      __m512 v1 = _mm512_loadu_ps(v + 16);
+      __m512i _r0, _r1;
+      if (pf_dist)
+      {
+        _mm_prefetch((const char *)pf, _MM_HINT_T0);        // 192 bytes used per loop
+        _mm_prefetch((const char *)pf + 64, _MM_HINT_T0);
+        _mm_prefetch((const char *)pf + 128, _MM_HINT_T0);
+      }
+      F12_UNPACK_16_AVX512(e0     , _r0, lsr);
+      F12_UNPACK_16_AVX512(e0 + 24, _r1, lsr);
+      acc00 = _mm512_fmadd_ps(v0, _mm512_castsi512_ps(_r0), acc00);
+      acc01 = _mm512_fmadd_ps(v1, _mm512_castsi512_ps(_r1), acc01);
+      F12_UNPACK_16_AVX512(e1     , _r0, lsr);
+      F12_UNPACK_16_AVX512(e1 + 24, _r1, lsr);
+      acc10 = _mm512_fmadd_ps(v0, _mm512_castsi512_ps(_r0), acc10);
+      acc11 = _mm512_fmadd_ps(v1, _mm512_castsi512_ps(_r1), acc11);
+      F12_UNPACK_16_AVX512(e2     , _r0, lsr);
+      F12_UNPACK_16_AVX512(e2 + 24, _r1, lsr);
+      acc20 = _mm512_fmadd_ps(v0, _mm512_castsi512_ps(_r0), acc20);
+      acc21 = _mm512_fmadd_ps(v1, _mm512_castsi512_ps(_r1), acc21);
+      F12_UNPACK_16_AVX512(e3     , _r0, lsr);
+      F12_UNPACK_16_AVX512(e3 + 24, _r1, lsr);
+      acc30 = _mm512_fmadd_ps(v0, _mm512_castsi512_ps(_r0), acc30);
+      acc31 = _mm512_fmadd_ps(v1, _mm512_castsi512_ps(_r1), acc31);
+    }
+    __m128 r = hsum_ps_avx512_4r(_mm512_add_ps(acc00, acc01), _mm512_add_ps(acc10, acc11),
+                                 _mm512_add_ps(acc20, acc21), _mm512_add_ps(acc30, acc31));
+    if (r_scale)
+      r = _mm_mul_ps(r, _mm_setr_ps(F12S_SCALE(e, sz_d), F12S_SCALE(e + sz_row, sz_d),
+                                    F12S_SCALE(e + 2*sz_row, sz_d), F12S_SCALE(e + 3*sz_row, sz_d)));
+    _mm_storeu_ps(res, r);
+  }
+  for (; y<y_mat; y++, e+=sz_row, res++)         // remaining rows
+  {
+    matmul_f32_f12_avx512(res, vec, (const f12_t *)e, len_vec, 1);
+    if (r_scale)
+      *res *= F12S_SCALE(e, sz_d);
+  }
+}
+
+static SIMD_AVX512 void matmul_f32_f12_avx512_4r(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat)
+{
+  matmul_f32_f12_avx512_4r_rs(res, vec, mat, len_vec, y_mat, len_vec + (len_vec >> 1), false);
+}
+#endif
+
 // init functions list
 const matmul_f32_f12_t matmul_f32_f12_procs[simd_n] =
 {
   matmul_f32_f12_fpu,
   matmul_f32_f12_sse,
   matmul_f32_f12_avx,
-  matmul_f32_f12_avx2,
+  matmul_f32_f12_avx2_4r,
+  AVX512_PROC(matmul_f32_f12_avx512_4r),
+};
+
+// ------------------------------------------------------------------
+// f32 * f12s => f32, f12 rows with scale
+// ------------------------------------------------------------------
+
+// use selected f12 matmul row by row (fpu/sse/avx)
+
+static void matmul_f32_f12s(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat)
+{
+  const unsigned char *e = (const unsigned char *)mat;
+  int sz_d = len_vec + (len_vec >> 1);           // f12 datas size
+  int y;
+  for (y=0; y<y_mat; y++, e+=sz_d + W_ROW_SCALE_SZ)
+  {
+    matmul_procs.matmul_f32_f12(res, vec, (const f12_t *)e, len_vec, 1);
+    *res++ *= *(const float *)(e + sz_d);        // apply row scale
+  }
+}
+
+// multi rows versions, rows scales applied to results
+static SIMD_AVX2 void matmul_f32_f12s_avx2_4r(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat)
+{
+  matmul_f32_f12_avx2_4r_rs(res, vec, mat, len_vec, y_mat, len_vec + (len_vec >> 1) + W_ROW_SCALE_SZ, true);
+}
+
+#ifdef MM_AVX512
+static SIMD_AVX512 void matmul_f32_f12s_avx512_4r(float *res, const float *vec, const f12_t *mat, int len_vec, int y_mat)
+{
+  matmul_f32_f12_avx512_4r_rs(res, vec, mat, len_vec, y_mat, len_vec + (len_vec >> 1) + W_ROW_SCALE_SZ, true);
+}
+#endif
+
+const matmul_f32_f12_t matmul_f32_f12s_procs[simd_n] =
+{
+  matmul_f32_f12s,
+  NULL,
+  NULL,
+  matmul_f32_f12s_avx2_4r,
+  AVX512_PROC(matmul_f32_f12s_avx512_4r),
 };
 
 // ------------------------------------------------------------------
@@ -390,7 +597,7 @@ static _inline void pack_f12_cpu(unsigned char *e, const f12_t *f12)
 }
 
 // encode 16 x f12 to 24 bytes
-static _inline void pack_f12_sse(unsigned char *e, const f12_t *f12)
+static SIMD_SSE _inline void pack_f12_sse(unsigned char *e, const f12_t *f12)
 {
   const __m128i _sh = _mm_set_epi8(15, 13, 11, 9, 7, 5, 3, 1, 14, 12, 10, 8, 6, 4, 2, 0);
   __m128i _f12l, _f12h, _l, _h, _p;
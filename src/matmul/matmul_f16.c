@@ -18,26 +18,36 @@ static void cvt_f16_to_f32_fpu(float *f32, const f16_t *f16, size_t ne)
     f32[i] = lut_f16_to_f32[f16[i]];
 }
 
-static void cvt_f16_to_f32_sse(float *f32, const f16_t *f16, size_t ne)
+static SIMD_F16C void cvt_f16_to_f32_sse(float *f32, const f16_t *f16, size_t ne)
 {
   size_t i;
   for (i=0; i!=ne; i+=4)
     _mm_store_ps(f32 + i, _mm_cvtph_ps(_mm_loadl_epi64((__m128i *)(f16 + i))));
 }
 
-static void cvt_f16_to_f32_avx1(float *f32, const f16_t *f16, size_t ne)
+static SIMD_AVX void cvt_f16_to_f32_avx1(float *f32, const f16_t *f16, size_t ne)
 {
   size_t i;
   for (i=0; i!=ne; i+=8)
     _mm256_store_ps(f32 + i, _mm256_cvtph_ps(_mm_load_si128((__m128i *)(f16 + i))));
 }
 
+#ifdef MM_AVX512
+static SIMD_AVX512 void cvt_f16_to_f32_avx512(float *f32, const f16_t *f16, size_t ne)
+{
+  size_t i;
+  for (i=0; i!=ne; i+=16)
+    _mm512_storeu_ps(f32 + i, _mm512_cvtph_ps(_mm256_loadu_si256((__m256i *)(f16 + i))));
+}
+#endif
+
 const cvt_f16_to_f32_t cvt_f16_to_f32_procs[simd_n] =
 {
   cvt_f16_to_f32_fpu,
   cvt_f16_to_f32_sse,
   cvt_f16_to_f32_avx1,
   NULL,
+  AVX512_PROC(cvt_f16_to_f32_avx512),
 };
 
 // ------------------------------------------------------------------
@@ -58,7 +68,7 @@ static void matmul_f32_f16_fpu(float *res, const float *vec, const f16_t *mat, i
   }
 }
 
-static void matmul_f32_f16_sse(float *res, const float *vec, const f16_t *mat, int len_vec, int y_mat)
+static SIMD_F16C void matmul_f32_f16_sse(float *res, const float *vec, const f16_t *mat, int len_vec, int y_mat)
 {
   const f16_t *m, *m_end = mat + y_mat * len_vec;
   for (m=mat; m!=m_end; m+=len_vec)
@@ -71,7 +81,7 @@ static void matmul_f32_f16_sse(float *res, const float *vec, const f16_t *mat, i
   }
 }
 
-static void matmul_f32_f16_avx1(float *res, const float *vec, const f16_t *mat, int len_vec, int y_mat)
+static SIMD_AVX void matmul_f32_f16_avx1(float *res, const float *vec, const f16_t *mat, int len_vec, int y_mat)
 {
   const f16_t *m, *m_end = mat + y_mat * len_vec;
   for (m=mat; m!=m_end; m+=len_vec)
@@ -84,13 +94,92 @@ static void matmul_f32_f16_avx1(float *res, const float *vec, const f16_t *mat,
   }
 }
 
+// MM_ROWS rows version
+static SIMD_AVX void matmul_f32_f16_avx1_4r(float *res, const float *vec, const f16_t *mat, int len_vec, int y_mat)
+{
+  const f16_t *m, *m_end = mat + (y_mat & ~(MM_ROWS-1)) * len_vec;
+  int pf_dist = matmul_procs.pf_dist;
+  for (m=mat; m!=m_end; m+=MM_ROWS*len_vec, res+=MM_ROWS)
+  {
+    const f16_t *m1 = m + len_vec, *m2 = m1 + len_vec, *m3 = m2 + len_vec;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    int i;
+    for (i=0; i!=len_vec; i+=8)
+    {
+      __m256 v = _mm256_load_ps(vec + i);
+      if (pf_dist)
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(f16_t));  // 64 bytes used per loop
+      acc0 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_load_si128((__m128i *)(m  + i))), v, acc0);
+      acc1 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_load_si128((__m128i *)(m1 + i))), v, acc1);
+      acc2 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_load_si128((__m128i *)(m2 + i))), v, acc2);
+      acc3 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_load_si128((__m128i *)(m3 + i))), v, acc3);
+    }
+    _mm_storeu_ps(res, hsum_ps_avx_4r(acc0, acc1, acc2, acc3));
+  }
+  if (y_mat & (MM_ROWS-1))
+    matmul_f32_f16_avx1(res, vec, m_end, len_vec, y_mat & (MM_ROWS-1));
+}
+
+#ifdef MM_AVX512
+#define LOAD_16F16_AVX512(m) _mm512_cvtph_ps(_mm256_loadu_si256((__m256i *)(m)))
+
+static SIMD_AVX512 void matmul_f32_f16_avx512(float *res, const float *vec, const f16_t *mat, int len_vec, int y_mat)
+{
+  const f16_t *m, *m_end = mat + y_mat * len_vec;
+  for (m=mat; m!=m_end; m+=len_vec)
+  {
+    __m512 acc = _mm512_setzero_ps();
+    int i;
+    for (i=0; i!=len_vec; i+=16)
+      acc = _mm512_fmadd_ps(LOAD_16F16_AVX512(m + i), _mm512_loadu_ps(vec + i), acc);
+    *res++ = hsum_ps_avx512(acc);
+  }
+}
+
+// MM_ROWS rows version
+static SIMD_AVX512 void matmul_f32_f16_avx512_4r(float *res, const float *vec, const f16_t *mat, int len_vec, int y_mat)
+{
+  const f16_t *m, *m_end = mat + (y_mat & ~(MM_ROWS-1)) * len_vec;
+  int pf_dist = matmul_procs.pf_dist;
+  for (m=mat; m!=m_end; m+=MM_ROWS*len_vec, res+=MM_ROWS)
+  {
+    const f16_t *m1 = m + len_vec, *m2 = m1 + len_vec, *m3 = m2 + len_vec;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps();
+    __m512 acc3 = _mm512_setzero_ps();
+    int i;
+    for (i=0; i!=len_vec; i+=16)
+    {
+      __m512 v = _mm512_loadu_ps(vec + i);
+      if (pf_dist)
+      {
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(f16_t));  // 128 bytes used per loop
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(f16_t) + 64);
+      }
+      acc0 = _mm512_fmadd_ps(LOAD_16F16_AVX512(m  + i), v, acc0);
+      acc1 = _mm512_fmadd_ps(LOAD_16F16_AVX512(m1 + i), v, acc1);
+      acc2 = _mm512_fmadd_ps(LOAD_16F16_AVX512(m2 + i), v, acc2);
+      acc3 = _mm512_fmadd_ps(LOAD_16F16_AVX512(m3 + i), v, acc3);
+    }
+    _mm_storeu_ps(res, hsum_ps_avx512_4r(acc0, acc1, acc2, acc3));
+  }
+  if (y_mat & (MM_ROWS-1))
+    matmul_f32_f16_avx512(res, vec, m_end, len_vec, y_mat & (MM_ROWS-1));
+}
+#endif
+
 // init functions list
 const matmul_f32_f16_t matmul_f32_f16_procs[simd_n] =
 {
   matmul_f32_f16_fpu,
   matmul_f32_f16_sse,
-  matmul_f32_f16_avx1,
+  matmul_f32_f16_avx1_4r,
   NULL,
+  AVX512_PROC(matmul_f32_f16_avx512_4r),
 };
 
 // ------------------------------------------------------------------
@@ -124,18 +213,22 @@ static f16_t sw_cvt_f32_to_f16(float f32)
   return (f16_t)r;
 }
 
+static SIMD_F16C void cvt_f32_to_f16_f16c(f16_t *f16, const float *f32, size_t ne)
+{
+  size_t i;
+  for (i=0; i!=ne; i+=4)
+  {
+    __m128i h4 = _mm_cvtps_ph(_mm_loadu_ps(f32 + i), _MM_FROUND_TO_NEAREST_INT);  // convert to 4 float 16
+    _mm_storel_epi64((__m128i *)(f16 + i), h4);
+  }
+}
+
 // convert buffer f32 to f16
 void cvt_f32_to_f16(f16_t *f16, const float *f32, size_t ne)
 {
   size_t i;
   if (matmul_procs.cpu_f16c)
-  {
-    for (i=0; i!=ne; i+=4)
-    {
-      __m128i h4 = _mm_cvtps_ph(_mm_loadu_ps(f32 + i), _MM_FROUND_TO_NEAREST_INT);  // convert to 4 float 16
-      _mm_storel_epi64((__m128i *)(f16 + i), h4);
-    }
-  }
+    cvt_f32_to_f16_f16c(f16, f32, ne);
   else
   {
     for (i=0; i!=ne; i++)
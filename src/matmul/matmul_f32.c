@@ -2,6 +2,7 @@
 #include "mm_hsum.h"
 #include "w_types.h"
 #include "matmul.h"
+#include "matmul_priv.h"
 
 // ------------------------------------------------------------------
 // f32 * f32 => f32
@@ -20,7 +21,7 @@ static void matmul_f32_f32_fpu(float *res, const float *vec, const float *mat, i
   }
 }
 
-static void matmul_f32_f32_sse(float *res, const float *vec, const float *mat, int len_vec, int y_mat)
+static SIMD_SSE void matmul_f32_f32_sse(float *res, const float *vec, const float *mat, int len_vec, int y_mat)
 {
   const float *m, *m_end = mat + y_mat * len_vec;
   for (m=mat; m!=m_end; m+=len_vec)
@@ -33,7 +34,7 @@ static void matmul_f32_f32_sse(float *res, const float *vec, const float *mat, i
   }
 }
 
-static void matmul_f32_f32_avx1(float *res, const float *vec, const float *mat, int len_vec, int y_mat)
+static SIMD_AVX void matmul_f32_f32_avx1(float *res, const float *vec, const float *mat, int len_vec, int y_mat)
 {
   const float *m, *m_end = mat + y_mat * len_vec;
   for (m=mat; m!=m_end; m+=len_vec)
@@ -46,11 +47,93 @@ static void matmul_f32_f32_avx1(float *res, const float *vec, const float *mat,
   }
 }
 
+// MM_ROWS rows version
+static SIMD_AVX void matmul_f32_f32_avx1_4r(float *res, const float *vec, const float *mat, int len_vec, int y_mat)
+{
+  const float *m, *m_end = mat + (y_mat & ~(MM_ROWS-1)) * len_vec;
+  int pf_dist = matmul_procs.pf_dist;
+  for (m=mat; m!=m_end; m+=MM_ROWS*len_vec, res+=MM_ROWS)
+  {
+    const float *m1 = m + len_vec, *m2 = m1 + len_vec, *m3 = m2 + len_vec;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    int i;
+    for (i=0; i!=len_vec; i+=8)
+    {
+      __m256 v = _mm256_load_ps(vec + i);
+      if (pf_dist)
+      {
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(float));        // 128 bytes used per loop
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(float) + 64);
+      }
+      acc0 = _mm256_fmadd_ps(v, _mm256_load_ps(m  + i), acc0);
+      acc1 = _mm256_fmadd_ps(v, _mm256_load_ps(m1 + i), acc1);
+      acc2 = _mm256_fmadd_ps(v, _mm256_load_ps(m2 + i), acc2);
+      acc3 = _mm256_fmadd_ps(v, _mm256_load_ps(m3 + i), acc3);
+    }
+    _mm_storeu_ps(res, hsum_ps_avx_4r(acc0, acc1, acc2, acc3));
+  }
+  if (y_mat & (MM_ROWS-1))
+    matmul_f32_f32_avx1(res, vec, m_end, len_vec, y_mat & (MM_ROWS-1));
+}
+
+#ifdef MM_AVX512
+static SIMD_AVX512 void matmul_f32_f32_avx512(float *res, const float *vec, const float *mat, int len_vec, int y_mat)
+{
+  const float *m, *m_end = mat + y_mat * len_vec;
+  for (m=mat; m!=m_end; m+=len_vec)
+  {
+    __m512 acc = _mm512_setzero_ps();
+    int i;
+    for (i=0; i!=len_vec; i+=16)
+      acc = _mm512_fmadd_ps(_mm512_loadu_ps(vec + i), _mm512_loadu_ps(m + i), acc);
+    *res++ = hsum_ps_avx512(acc);
+  }
+}
+
+// MM_ROWS rows version
+static SIMD_AVX512 void matmul_f32_f32_avx512_4r(float *res, const float *vec, const float *mat, int len_vec, int y_mat)
+{
+  const float *m, *m_end = mat + (y_mat & ~(MM_ROWS-1)) * len_vec;
+  int pf_dist = matmul_procs.pf_dist;
+  for (m=mat; m!=m_end; m+=MM_ROWS*len_vec, res+=MM_ROWS)
+  {
+    const float *m1 = m + len_vec, *m2 = m1 + len_vec, *m3 = m2 + len_vec;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps();
+    __m512 acc3 = _mm512_setzero_ps();
+    int i;
+    for (i=0; i!=len_vec; i+=16)
+    {
+      __m512 v = _mm512_loadu_ps(vec + i);
+      if (pf_dist)
+      {
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(float));        // 256 bytes used per loop
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(float) + 64);
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(float) + 128);
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(float) + 192);
+      }
+      acc0 = _mm512_fmadd_ps(v, _mm512_loadu_ps(m  + i), acc0);
+      acc1 = _mm512_fmadd_ps(v, _mm512_loadu_ps(m1 + i), acc1);
+      acc2 = _mm512_fmadd_ps(v, _mm512_loadu_ps(m2 + i), acc2);
+      acc3 = _mm512_fmadd_ps(v, _mm512_loadu_ps(m3 + i), acc3);
+    }
+    _mm_storeu_ps(res, hsum_ps_avx512_4r(acc0, acc1, acc2, acc3));
+  }
+  if (y_mat & (MM_ROWS-1))
+    matmul_f32_f32_avx512(res, vec, m_end, len_vec, y_mat & (MM_ROWS-1));
+}
+#endif
+
 // init functions list
 const matmul_f32_f32_t matmul_f32_f32_procs[simd_n] =
 {
   matmul_f32_f32_fpu,
   matmul_f32_f32_sse,
-  matmul_f32_f32_avx1,
+  matmul_f32_f32_avx1_4r,
   NULL,
+  AVX512_PROC(matmul_f32_f32_avx512_4r),
 };
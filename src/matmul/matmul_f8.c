@@ -1,4 +1,5 @@
 #include <intrin.h>
+#include <stdbool.h>
 #include "mm_hsum.h"
 #include "w_types.h"
 #include "matmul.h"
@@ -29,6 +30,8 @@
 #define BF16_TO_F8_MAX BF16_4_00       // max BF16 value that can be converted to F8
 #endif
 
+const float f8_cvt_max = F8_CVT_MAX;
+
 // ------------------------------------------------------------------
 // f32 * f8 => f32
 // ------------------------------------------------------------------
@@ -49,7 +52,7 @@ static void matmul_f32_f8_fpu(float *res, const float *vec, const f8_t *mat, int
   }
 }
 
-static void matmul_f32_f8_sse(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat)
+static SIMD_SSE void matmul_f32_f8_sse(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat)
 {
   const f8_t *m, *m_end = mat + y_mat * len_vec;
   for (m=mat; m!=m_end; m+=len_vec)
@@ -81,7 +84,7 @@ static void matmul_f32_f8_sse(float *res, const float *vec, const f8_t *mat, int
   }
 }
 
-static void matmul_f32_f8_avx2(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat)
+static SIMD_AVX2 void matmul_f32_f8_avx2(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat)
 {
   const f8_t *m, *m_end = mat + y_mat * len_vec;
   for (m=mat; m!=m_end; m+=len_vec)
@@ -108,13 +111,187 @@ static void matmul_f32_f8_avx2(float *res, const float *vec, const f8_t *mat, in
   }
 }
 
+// f8s row scale, stored after row datas
+#define F8S_SCALE(m, len_vec) (*(const float *)((m) + (len_vec)))
+
+// 2 rows version (4 accumulators per row, 4 rows would use more than 16 registers)
+// sz_row: rows stride in bytes, r_scale: f8s rows, results are multiplied by rows scale
+static SIMD_AVX2 __inline void matmul_f32_f8_avx2_2r_rs(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat, int sz_row, bool r_scale)
+{
+  const f8_t *m, *m_end = mat + (y_mat & ~1) * sz_row;
+  int pf_dist = matmul_procs.pf_dist;
+  for (m=mat; m!=m_end; m+=2*sz_row, res+=2)
+  {
+    const f8_t *m1 = m + sz_row;
+    __m256 acc00 = _mm256_setzero_ps(), acc01 = _mm256_setzero_ps();
+    __m256 acc02 = _mm256_setzero_ps(), acc03 = _mm256_setzero_ps();
+    __m256 acc10 = _mm256_setzero_ps(), acc11 = _mm256_setzero_ps();
+    __m256 acc12 = _mm256_setzero_ps(), acc13 = _mm256_setzero_ps();
+    __m256 s0, s1;
+    __m128 r;
+    int i;
+
+    for (i=0; i!=len_vec; i+=32)
+    {
+      __m256 v0 = _mm256_load_ps(vec + i     );
+      __m256 v1 = _mm256_load_ps(vec + i + 8 );
+      __m256 v2 = _mm256_load_ps(vec + i + 16);
+      __m256 v3 = _mm256_load_ps(vec + i + 24);
+      if (pf_dist)
+        MM_PREFETCH(m, i*2);                        // 64 bytes used per loop
+      acc00 = _mm256_fmadd_ps(CVT_8F8(_mm_loadl_epi64((__m128i *)(m  + i     ))), v0, acc00);
+      acc01 = _mm256_fmadd_ps(CVT_8F8(_mm_loadl_epi64((__m128i *)(m  + i + 8 ))), v1, acc01);
+      acc02 = _mm256_fmadd_ps(CVT_8F8(_mm_loadl_epi64((__m128i *)(m  + i + 16))), v2, acc02);
+      acc03 = _mm256_fmadd_ps(CVT_8F8(_mm_loadl_epi64((__m128i *)(m  + i + 24))), v3, acc03);
+      acc10 = _mm256_fmadd_ps(CVT_8F8(_mm_loadl_epi64((__m128i *)(m1 + i     ))), v0, acc10);
+      acc11 = _mm256_fmadd_ps(CVT_8F8(_mm_loadl_epi64((__m128i *)(m1 + i + 8 ))), v1, acc11);
+      acc12 = _mm256_fmadd_ps(CVT_8F8(_mm_loadl_epi64((__m128i *)(m1 + i + 16))), v2, acc12);
+      acc13 = _mm256_fmadd_ps(CVT_8F8(_mm_loadl_epi64((__m128i *)(m1 + i + 24))), v3, acc13);
+    }
+    s0 = _mm256_add_ps(_mm256_add_ps(acc00, acc01), _mm256_add_ps(acc02, acc03));
+    s1 = _mm256_add_ps(_mm256_add_ps(acc10, acc11), _mm256_add_ps(acc12, acc13));
+    r = hsum_ps_avx_4r(s0, s1, s0, s1);
+    if (r_scale)
+      r = _mm_mul_ps(r, _mm_setr_ps(F8S_SCALE(m, len_vec), F8S_SCALE(m1, len_vec), 0, 0));
+    _mm_storel_pi((__m64 *)res, r);
+  }
+  if (y_mat & 1)
+  {
+    matmul_f32_f8_avx2(res, vec, m_end, len_vec, 1);
+    if (r_scale)
+      *res *= F8S_SCALE(m_end, len_vec);
+  }
+}
+
+static SIMD_AVX2 void matmul_f32_f8_avx2_2r(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat)
+{
+  matmul_f32_f8_avx2_2r_rs(res, vec, mat, len_vec, y_mat, len_vec, false);
+}
+
+#ifdef MM_AVX512
+// convert 16 FP8 to 16 FP32
+#define CVT_16F8(a) _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_and_si512(\
+  _mm512_cvtepi8_epi32(a), _mm512_set1_epi32(F8_CVT_MSK)), _mm512_set1_epi32(F8_CVT_ADD)), F8_CVT_LSL))
+
+#define LOAD_16F8_AVX512(m) CVT_16F8(_mm_loadu_si128((__m128i *)(m)))
+
+static SIMD_AVX512 void matmul_f32_f8_avx512(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat)
+{
+  const f8_t *m, *m_end = mat + y_mat * len_vec;
+  for (m=mat; m!=m_end; m+=len_vec)
+  {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    int i;
+    for (i=0; i!=len_vec; i+=32)
+    {
+      acc0 = _mm512_fmadd_ps(LOAD_16F8_AVX512(m + i     ), _mm512_loadu_ps(vec + i     ), acc0);
+      acc1 = _mm512_fmadd_ps(LOAD_16F8_AVX512(m + i + 16), _mm512_loadu_ps(vec + i + 16), acc1);
+    }
+    *res++ = hsum_ps_avx512_2x(acc0, acc1);
+  }
+}
+
+// MM_ROWS rows version (32 registers, 2 accumulators per row)
+static SIMD_AVX512 __inline void matmul_f32_f8_avx512_4r_rs(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat, int sz_row, bool r_scale)
+{
+  const f8_t *m, *m_end = mat + (y_mat & ~(MM_ROWS-1)) * sz_row;
+  int pf_dist = matmul_procs.pf_dist;
+  for (m=mat; m!=m_end; m+=MM_ROWS*sz_row, res+=MM_ROWS)
+  {
+    const f8_t *m1 = m + sz_row, *m2 = m1 + sz_row, *m3 = m2 + sz_row;
+    __m128 r;
+    __m512 acc00 = _mm512_setzero_ps(), acc01 = _mm512_setzero_ps();
+    __m512 acc10 = _mm512_setzero_ps(), acc11 = _mm512_setzero_ps();
+    __m512 acc20 = _mm512_setzero_ps(), acc21 = _mm512_setzero_ps();
+    __m512 acc30 = _mm512_setzero_ps(), acc31 = _mm512_setzero_ps();
+    int i;
+
+    for (i=0; i!=len_vec; i+=32)
+    {
+      __m512 v0 = _mm512_loadu_ps(vec + i     );
+      __m512 v1 = _mm512_loadu_ps(vec + i + 16);
+      if (pf_dist)
+      {
+        MM_PREFETCH(m, i*MM_ROWS);                // 128 bytes used per loop
+        MM_PREFETCH(m, i*MM_ROWS + 64);
+      }
+      acc00 = _mm512_fmadd_ps(LOAD_16F8_AVX512(m  + i     ), v0, acc00);
+      acc01 = _mm512_fmadd_ps(LOAD_16F8_AVX512(m  + i + 16), v1, acc01);
+      acc10 = _mm512_fmadd_ps(LOAD_16F8_AVX512(m1 + i     ), v0, acc10);
+      acc11 = _mm512_fmadd_ps(LOAD_16F8_AVX512(m1 + i + 16), v1, acc11);
+      acc20 = _mm512_fmadd_ps(LOAD_16F8_AVX512(m2 + i     ), v0, acc20);
+      acc21 = _mm512_fmadd_ps(LOAD_16F8_AVX512(m2 + i + 16), v1, acc21);
+      acc30 = _mm512_fmadd_ps(LOAD_16F8_AVX512(m3 + i     ), v0, acc30);
+      acc31 = _mm512_fmadd_ps(LOAD_16F8_AVX512(m3 + i + 16), v1, acc31);
+    }
+    r = hsum_ps_avx512_4r(_mm512_add_ps(acc00, acc01), _mm512_add_ps(acc10, acc11),
+                          _mm512_add_ps(acc20, acc21), _mm512_add_ps(acc30, acc31));
+    if (r_scale)
+      r = _mm_mul_ps(r, _mm_setr_ps(F8S_SCALE(m, len_vec), F8S_SCALE(m1, len_vec), F8S_SCALE(m2, len_vec), F8S_SCALE(m3, len_vec)));
+    _mm_storeu_ps(res, r);
+  }
+  for (; m!=mat + y_mat * sz_row; m+=sz_row, res++)        // remaining rows
+  {
+    matmul_f32_f8_avx512(res, vec, m, len_vec, 1);
+    if (r_scale)
+      *res *= F8S_SCALE(m, len_vec);
+  }
+}
+
+static SIMD_AVX512 void matmul_f32_f8_avx512_4r(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat)
+{
+  matmul_f32_f8_avx512_4r_rs(res, vec, mat, len_vec, y_mat, len_vec, false);
+}
+#endif
+
 // init functions list
 const matmul_f32_f8_t matmul_f32_f8_procs[simd_n] =
 {
   matmul_f32_f8_fpu,
   matmul_f32_f8_sse,
   NULL,
-  matmul_f32_f8_avx2,
+  matmul_f32_f8_avx2_2r,
+  AVX512_PROC(matmul_f32_f8_avx512_4r),
+};
+
+// ------------------------------------------------------------------
+// f32 * f8s => f32, f8 rows with scale
+// ------------------------------------------------------------------
+
+// use selected f8 matmul row by row (fpu/sse)
+
+static void matmul_f32_f8s(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat)
+{
+  const f8_t *m = mat;
+  int y;
+  for (y=0; y<y_mat; y++, m+=len_vec + W_ROW_SCALE_SZ)
+  {
+    matmul_procs.matmul_f32_f8(res, vec, m, len_vec, 1);
+    *res++ *= *(const float *)(m + len_vec);     // apply row scale
+  }
+}
+
+// multi rows versions, rows scales applied to results
+static SIMD_AVX2 void matmul_f32_f8s_avx2_2r(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat)
+{
+  matmul_f32_f8_avx2_2r_rs(res, vec, mat, len_vec, y_mat, len_vec + W_ROW_SCALE_SZ, true);
+}
+
+#ifdef MM_AVX512
+static SIMD_AVX512 void matmul_f32_f8s_avx512_4r(float *res, const float *vec, const f8_t *mat, int len_vec, int y_mat)
+{
+  matmul_f32_f8_avx512_4r_rs(res, vec, mat, len_vec, y_mat, len_vec + W_ROW_SCALE_SZ, true);
+}
+#endif
+
+const matmul_f32_f8_t matmul_f32_f8s_procs[simd_n] =
+{
+  matmul_f32_f8s,
+  NULL,
+  NULL,
+  matmul_f32_f8s_avx2_2r,
+  AVX512_PROC(matmul_f32_f8s_avx512_4r),
 };
 
 // ------------------------------------------------------------------
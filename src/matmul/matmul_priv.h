@@ -3,6 +3,26 @@
 
 #define ABS_F16(x) ((x) & 0x7FFF)      // abs for F16/BF16/SF16, clear sign bit
 
+// --------------------------------------
+// multi rows matmul: MM_ROWS rows are computed together, each vec chunk is loaded
+// once for all rows, rows datas of next group are prefetched at matmul_procs.pf_dist
+// bytes ahead (0: disabled) while current group is computed.
+
+#define MM_ROWS 4                      // rows computed together
+#define MM_PF_DIST_DEF 0               // default prefetch distance in bytes (hardware prefetch often enough)
+
+// prefetch cache line at pf_dist + ofs bytes from rows group start g
+#define MM_PREFETCH(g, ofs) _mm_prefetch((const char *)(g) + pf_dist + (ofs), _MM_HINT_T0)
+
+// --------------------------------------
+// simd_avx512 entry of functions lists, NULL if compiler do not support AVX512
+
+#ifdef MM_AVX512
+#define AVX512_PROC(f) f
+#else
+#define AVX512_PROC(f) NULL
+#endif
+
 // --------------------------------------
 // data conversion to float 32 functions
 
@@ -19,6 +39,13 @@ extern const matmul_f32_bf16_t matmul_f32_bf16_procs[simd_n];
 extern const matmul_f32_sf16_t matmul_f32_sf16_procs[simd_n];
 extern const matmul_f32_f12_t matmul_f32_f12_procs[simd_n];
 extern const matmul_f32_f8_t matmul_f32_f8_procs[simd_n];
+extern const matmul_f32_q8_t matmul_f32_q8_procs[simd_n];
+extern const matmul_f32_q4_t matmul_f32_q4_procs[simd_n];
+extern const matmul_f32_f12_t matmul_f32_f12s_procs[simd_n];
+extern const matmul_f32_f8_t matmul_f32_f8s_procs[simd_n];
+
+// bf16 matmul using AVX512_BF16 dot product, replace simd_avx512 version if cpu support it (NULL if no code)
+extern const matmul_f32_bf16_t matmul_f32_bf16_avx512_bf16;
 
 // --------------------------------------
 // SF16 conversions, code in matmul_sf16.c
@@ -39,10 +66,36 @@ void cvt_f32_to_f16(f16_t *f16, const float *f32, size_t ne);
 void init_conv_f12(void);
 void cvt_f16_to_f12(f12_t *f12, const f16_t *f16, size_t ne);
 void cvt_bf16_to_f12(f12_t *f12, const f16_t *f16, size_t ne);
+extern const float f12_cvt_max;        // max converted value
 
 // --------------------------------------
 // F8 conversions, code in matmul_f8.c
 
 void init_conv_f8(void);
 void cvt_f16_to_f8(f8_t *f8, const f16_t *f16, size_t ne);
-void cvt_bf16_to_f8(f8_t *f8, const bf16_t *bf16, size_t ne);
\ No newline at end of file
+void cvt_bf16_to_f8(f8_t *f8, const bf16_t *bf16, size_t ne);
+extern const float f8_cvt_max;         // max converted value
+// --------------------------------------
+// Q8 conversions, code in matmul_q8.c
+
+void cvt_f16_to_q8(q8_t *q8, const f16_t *f16, size_t ne);
+void cvt_bf16_to_q8(q8_t *q8, const bf16_t *bf16, size_t ne);
+
+// vec quantized to int8 blocs for q8/q4 simd integer dot products. vec is quantized once per
+// matmul call by chunks of QV_CHUNK_NE values (stack buffer, stay in L1/L2 cache).
+#define QV_BLOC_NE 32                  // values per bloc, same as Q8_BLOC_NE/Q4_BLOC_NE
+#define QV_CHUNK_NE 8192               // max values per chunk
+
+struct q8_vec_t
+{
+  __m128 ds[QV_CHUNK_NE/QV_BLOC_NE];   // for each bloc: scale, sum of f32 values, 0, 0
+  signed char q[QV_CHUNK_NE];          // int8 values
+};
+
+void quant_vec_sse(struct q8_vec_t *qv, const float *v, int ne);
+void quant_vec_avx2(struct q8_vec_t *qv, const float *v, int ne);
+// --------------------------------------
+// Q4 conversions, code in matmul_q4.c
+
+void cvt_f16_to_q4(q4_t *q4, const f16_t *f16, size_t ne);
+void cvt_bf16_to_q4(q4_t *q4, const bf16_t *bf16, size_t ne);
\ No newline at end of file
@@ -0,0 +1,357 @@
+#include <intrin.h>
+#include "mm_hsum.h"
+#include "w_types.h"
+#include "matmul.h"
+#include "matmul_priv.h"
+
+// Q4 format: 4 bits codes with one f16 scale and one f16 min for each bloc of Q4_BLOC_NE (32) values.
+// bloc in memory: f16 scale, f16 min, 16 bytes codes (20 bytes, 5 bits per value).
+// byte j of codes contain value j in low nibble and value j+16 in high nibble.
+// value = min + scale * code, scale = (max - min) / 15
+
+#define Q4_CODE_MAX 15
+
+// convert f16 bloc scale/min to f32 (can be zero or denormal)
+static _inline float q4_f16_val(const q4_t *p)
+{
+  unsigned int h = *(const unsigned short *)p;
+  unsigned int f32i = ((h & 0x7fff) << 13) + ((127 - 15) << 23);
+  float f = ((h & 0x7fff) < 0x400) ? (float)(h & 0x7fff) * 5.9604645e-8f : *(float *)&f32i;
+  return (h & 0x8000) ? -f : f;
+}
+
+#define Q4_SCALE(b) q4_f16_val(b)
+#define Q4_MIN(b) q4_f16_val((b) + 2)
+#define Q4_CODES(b) ((b) + 4)
+
+// ------------------------------------------------------------------
+// f32 * q4 => f32
+// sum(vec * (min + scale * code)) = scale * sum(vec * code) + min * sum(vec)
+// ------------------------------------------------------------------
+
+static void matmul_f32_q4_fpu(float *res, const float *vec, const q4_t *mat, int len_vec, int y_mat)
+{
+  const q4_t *m = mat;
+  int y;
+  for (y=0; y!=y_mat; y++)
+  {
+    float acc = 0;
+    int i, j;
+    for (i=0; i!=len_vec; i+=Q4_BLOC_NE, m+=Q4_BLOC_SZ)
+    {
+      const unsigned char *q = Q4_CODES(m);
+      const float *v = vec + i;
+      float acc_q = 0, acc_v = 0;
+      for (j=0; j<Q4_BLOC_NE/2; j++)
+      {
+        acc_q += v[j] * (q[j] & 0xf) + v[j + 16] * (q[j] >> 4);
+        acc_v += v[j] + v[j + 16];
+      }
+      acc += acc_q * Q4_SCALE(m) + acc_v * Q4_MIN(m);
+    }
+    *res++ = acc;
+  }
+}
+
+// ------------------------------------------------------------------
+// simd versions: vec quantized to int8 blocs (scale dv, f32 values sum sv), integer dot product
+// of codes and int8 vec with maddubs (codes <= 15, no int16 saturation), f16 scale/min converted
+// with F16C: sum(vec * (min + scale * code)) = scale * dv * sum(vec_i8 * code) + min * sv
+// ------------------------------------------------------------------
+
+// bloc f16 scale and min to f32 in elements 0 and 1
+#define Q4_SM_F16C(b) _mm_cvtph_ps(_mm_cvtsi32_si128(*(const int *)(b)))
+
+// return lane 1 of 4 vectors (min sums) in one vector
+#define Q4_MIN_4R(a,b,c,d) _mm_movehl_ps(_mm_unpacklo_ps(c, d), _mm_unpacklo_ps(a, b))
+
+static SIMD_F16C void matmul_f32_q4_sse(float *res, const float *vec, const q4_t *mat, int len_vec, int y_mat)
+{
+  struct q8_vec_t qv;
+  size_t sz_row = (size_t)(len_vec / Q4_BLOC_NE) * Q4_BLOC_SZ;
+  int c, y;
+  for (c=0; c<len_vec; c+=QV_CHUNK_NE)
+  {
+    int ne = ((len_vec - c) < QV_CHUNK_NE) ? len_vec - c : QV_CHUNK_NE;
+    const q4_t *m = mat + (size_t)(c / Q4_BLOC_NE) * Q4_BLOC_SZ;
+    quant_vec_sse(&qv, vec + c, ne);
+    for (y=0; y<y_mat; y++, m+=sz_row)
+    {
+      const q4_t *b = m;
+      __m128 acc = _mm_setzero_ps();
+      __m128 acc_m = _mm_setzero_ps();   // scale * dv, min * sv sums
+      float r;
+      int i;
+      for (i=0; i!=ne; i+=Q4_BLOC_NE, b+=Q4_BLOC_SZ)
+      {
+        __m128i q = _mm_loadu_si128((__m128i *)Q4_CODES(b));
+        __m128i q_l = _mm_and_si128(q, _mm_set1_epi8(0xf));                     // codes 0..15
+        __m128i q_h = _mm_and_si128(_mm_srli_epi16(q, 4), _mm_set1_epi8(0xf));  // codes 16..31
+        __m128i p = _mm_add_epi16(_mm_maddubs_epi16(q_l, _mm_load_si128((__m128i *)(qv.q + i))),
+                                  _mm_maddubs_epi16(q_h, _mm_load_si128((__m128i *)(qv.q + i + 16))));
+        __m128 f = _mm_mul_ps(Q4_SM_F16C(b), qv.ds[i / QV_BLOC_NE]);
+        acc = _mm_fmadd_ps(_mm_cvtepi32_ps(_mm_madd_epi16(p, _mm_set1_epi16(1))), _mm_shuffle_ps(f, f, 0), acc);
+        acc_m = _mm_add_ps(acc_m, f);
+      }
+      r = hsum_ps_sse(acc) + _mm_cvtss_f32(_mm_shuffle_ps(acc_m, acc_m, 1));
+      res[y] = c ? res[y] + r : r;
+    }
+  }
+}
+
+static SIMD_AVX void matmul_f32_q4_avx1(float *res, const float *vec, const q4_t *mat, int len_vec, int y_mat)
+{
+  struct q8_vec_t qv;
+  size_t sz_row = (size_t)(len_vec / Q4_BLOC_NE) * Q4_BLOC_SZ;
+  int c, y;
+  for (c=0; c<len_vec; c+=QV_CHUNK_NE)
+  {
+    int ne = ((len_vec - c) < QV_CHUNK_NE) ? len_vec - c : QV_CHUNK_NE;
+    const q4_t *m = mat + (size_t)(c / Q4_BLOC_NE) * Q4_BLOC_SZ;
+    quant_vec_sse(&qv, vec + c, ne);
+    for (y=0; y<y_mat; y++, m+=sz_row)
+    {
+      const q4_t *b = m;
+      __m256 acc = _mm256_setzero_ps();
+      __m128 acc_m = _mm_setzero_ps();
+      float r;
+      int i;
+      for (i=0; i!=ne; i+=Q4_BLOC_NE, b+=Q4_BLOC_SZ)
+      {
+        // no 256 bits integer instructions, 128 bits int dot products converted in one 256 bits op
+        __m128i q = _mm_loadu_si128((__m128i *)Q4_CODES(b));
+        __m128i p_l = _mm_madd_epi16(_mm_maddubs_epi16(_mm_and_si128(q, _mm_set1_epi8(0xf)),
+                                     _mm_load_si128((__m128i *)(qv.q + i))), _mm_set1_epi16(1));
+        __m128i p_h = _mm_madd_epi16(_mm_maddubs_epi16(_mm_and_si128(_mm_srli_epi16(q, 4), _mm_set1_epi8(0xf)),
+                                     _mm_load_si128((__m128i *)(qv.q + i + 16))), _mm_set1_epi16(1));
+        __m128 f = _mm_mul_ps(Q4_SM_F16C(b), qv.ds[i / QV_BLOC_NE]);
+        __m128 d = _mm_shuffle_ps(f, f, 0);
+        acc = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_set_m128i(p_h, p_l)), _mm256_set_m128(d, d), acc);
+        acc_m = _mm_add_ps(acc_m, f);
+      }
+      r = hsum_ps_avx1(acc) + _mm_cvtss_f32(_mm_shuffle_ps(acc_m, acc_m, 1));
+      res[y] = c ? res[y] + r : r;
+    }
+  }
+}
+
+// q4 bloc b dot product with quantized vec bloc v (scale and sum in ds), accumulated in acc/acc_m
+#define Q4_DOT_AVX2(acc, acc_m, b, v, ds) {\
+  __m256i q = _mm256_and_si256(_mm256_srlv_epi64(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)Q4_CODES(b))),\
+                               _mm256_setr_epi64x(0, 0, 4, 4)), _mm256_set1_epi8(0xf));     /* codes 0..15, 16..31 */\
+  __m128 f = _mm_mul_ps(Q4_SM_F16C(b), ds);\
+  acc = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_madd_epi16(_mm256_maddubs_epi16(q, v), _mm256_set1_epi16(1))),\
+                        _mm256_broadcastss_ps(f), acc);\
+  acc_m = _mm_add_ps(acc_m, f); }
+
+// MM_ROWS rows version
+static SIMD_AVX2 void matmul_f32_q4_avx2_4r(float *res, const float *vec, const q4_t *mat, int len_vec, int y_mat)
+{
+  struct q8_vec_t qv;
+  size_t sz_row = (size_t)(len_vec / Q4_BLOC_NE) * Q4_BLOC_SZ;
+  int pf_dist = matmul_procs.pf_dist;
+  int c, y;
+  for (c=0; c<len_vec; c+=QV_CHUNK_NE)
+  {
+    int ne = ((len_vec - c) < QV_CHUNK_NE) ? len_vec - c : QV_CHUNK_NE;
+    const q4_t *m = mat + (size_t)(c / Q4_BLOC_NE) * Q4_BLOC_SZ;
+    quant_vec_avx2(&qv, vec + c, ne);
+    for (y=0; y<(y_mat & ~(MM_ROWS-1)); y+=MM_ROWS, m+=MM_ROWS*sz_row)
+    {
+      const q4_t *b = m;
+      __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+      __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+      __m128 acc_m0 = _mm_setzero_ps(), acc_m1 = _mm_setzero_ps();
+      __m128 acc_m2 = _mm_setzero_ps(), acc_m3 = _mm_setzero_ps();
+      __m128 r;
+      int i;
+      for (i=0; i!=ne; i+=Q4_BLOC_NE, b+=Q4_BLOC_SZ)
+      {
+        __m256i v = _mm256_loadu_si256((__m256i *)(qv.q + i));
+        __m128 ds = qv.ds[i / QV_BLOC_NE];
+        if (pf_dist)
+          MM_PREFETCH(m, (i / Q4_BLOC_NE) * Q4_BLOC_SZ * MM_ROWS);     // 80 bytes used per loop
+        Q4_DOT_AVX2(acc0, acc_m0, b           , v, ds);
+        Q4_DOT_AVX2(acc1, acc_m1, b +   sz_row, v, ds);
+        Q4_DOT_AVX2(acc2, acc_m2, b + 2*sz_row, v, ds);
+        Q4_DOT_AVX2(acc3, acc_m3, b + 3*sz_row, v, ds);
+      }
+      r = _mm_add_ps(hsum_ps_avx_4r(acc0, acc1, acc2, acc3), Q4_MIN_4R(acc_m0, acc_m1, acc_m2, acc_m3));
+      _mm_storeu_ps(res + y, c ? _mm_add_ps(_mm_loadu_ps(res + y), r) : r);
+    }
+    for (; y<y_mat; y++, m+=sz_row)
+    {
+      const q4_t *b = m;
+      __m256 acc = _mm256_setzero_ps();
+      __m128 acc_m = _mm_setzero_ps();
+      float r;
+      int i;
+      for (i=0; i!=ne; i+=Q4_BLOC_NE, b+=Q4_BLOC_SZ)
+        Q4_DOT_AVX2(acc, acc_m, b, _mm256_loadu_si256((__m256i *)(qv.q + i)), qv.ds[i / QV_BLOC_NE]);
+      r = hsum_ps_avx1(acc) + _mm_cvtss_f32(_mm_shuffle_ps(acc_m, acc_m, 1));
+      res[y] = c ? res[y] + r : r;
+    }
+  }
+}
+
+#ifdef MM_AVX512
+// 2 q4 blocs b dot product with quantized vec blocs v (scales and sums in ds0/ds1), accumulated in acc/acc_m
+#define Q4_DOT2_AVX512(acc, acc_m, b, v, ds0, ds1) {\
+  __m512i q = _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)Q4_CODES(b)))),\
+                                 _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)Q4_CODES((b) + Q4_BLOC_SZ))), 1);\
+  __m128 f0 = _mm_mul_ps(Q4_SM_F16C(b), ds0);\
+  __m128 f1 = _mm_mul_ps(Q4_SM_F16C((b) + Q4_BLOC_SZ), ds1);\
+  q = _mm512_and_si512(_mm512_srlv_epi64(q, _mm512_setr_epi64(0, 0, 4, 4, 0, 0, 4, 4)), _mm512_set1_epi8(0xf));\
+  acc = _mm512_fmadd_ps(_mm512_cvtepi32_ps(_mm512_madd_epi16(_mm512_maddubs_epi16(q, v), _mm512_set1_epi16(1))),\
+                        _mm512_insertf32x8(_mm512_castps256_ps512(_mm256_broadcastss_ps(f0)), _mm256_broadcastss_ps(f1), 1), acc);\
+  acc_m = _mm_add_ps(acc_m, _mm_add_ps(f0, f1)); }
+
+// MM_ROWS rows version, 2 blocs per loop
+static SIMD_AVX512 void matmul_f32_q4_avx512_4r(float *res, const float *vec, const q4_t *mat, int len_vec, int y_mat)
+{
+  struct q8_vec_t qv;
+  size_t sz_row = (size_t)(len_vec / Q4_BLOC_NE) * Q4_BLOC_SZ;
+  int pf_dist = matmul_procs.pf_dist;
+  int c, y;
+  for (c=0; c<len_vec; c+=QV_CHUNK_NE)
+  {
+    int ne = ((len_vec - c) < QV_CHUNK_NE) ? len_vec - c : QV_CHUNK_NE;
+    int ne2 = ne & ~(2*Q4_BLOC_NE - 1);                          // blocs pairs
+    const q4_t *m = mat + (size_t)(c / Q4_BLOC_NE) * Q4_BLOC_SZ;
+    quant_vec_avx2(&qv, vec + c, ne);
+    for (y=0; y<(y_mat & ~(MM_ROWS-1)); y+=MM_ROWS, m+=MM_ROWS*sz_row)
+    {
+      const q4_t *b = m;
+      __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+      __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+      __m128 acc_m0 = _mm_setzero_ps(), acc_m1 = _mm_setzero_ps();
+      __m128 acc_m2 = _mm_setzero_ps(), acc_m3 = _mm_setzero_ps();
+      __m128 r;
+      int i;
+      for (i=0; i!=ne2; i+=2*Q4_BLOC_NE, b+=2*Q4_BLOC_SZ)
+      {
+        __m512i v = _mm512_loadu_si512((__m512i *)(qv.q + i));
+        __m128 ds0 = qv.ds[i / QV_BLOC_NE], ds1 = qv.ds[i / QV_BLOC_NE + 1];
+        if (pf_dist)
+        {
+          MM_PREFETCH(m, (i / Q4_BLOC_NE) * Q4_BLOC_SZ * MM_ROWS);   // 160 bytes used per loop
+          MM_PREFETCH(m, (i / Q4_BLOC_NE) * Q4_BLOC_SZ * MM_ROWS + 64);
+        }
+        Q4_DOT2_AVX512(acc0, acc_m0, b           , v, ds0, ds1);
+        Q4_DOT2_AVX512(acc1, acc_m1, b +   sz_row, v, ds0, ds1);
+        Q4_DOT2_AVX512(acc2, acc_m2, b + 2*sz_row, v, ds0, ds1);
+        Q4_DOT2_AVX512(acc3, acc_m3, b + 3*sz_row, v, ds0, ds1);
+      }
+      r = _mm_add_ps(hsum_ps_avx512_4r(acc0, acc1, acc2, acc3), Q4_MIN_4R(acc_m0, acc_m1, acc_m2, acc_m3));
+      if (i != ne)                                               // odd blocs count
+      {
+        __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+        __m256 a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+        __m256i v = _mm256_loadu_si256((__m256i *)(qv.q + i));
+        __m128 ds = qv.ds[i / QV_BLOC_NE];
+        acc_m0 = acc_m1 = acc_m2 = acc_m3 = _mm_setzero_ps();
+        Q4_DOT_AVX2(a0, acc_m0, b           , v, ds);
+        Q4_DOT_AVX2(a1, acc_m1, b +   sz_row, v, ds);
+        Q4_DOT_AVX2(a2, acc_m2, b + 2*sz_row, v, ds);
+        Q4_DOT_AVX2(a3, acc_m3, b + 3*sz_row, v, ds);
+        r = _mm_add_ps(r, _mm_add_ps(hsum_ps_avx_4r(a0, a1, a2, a3), Q4_MIN_4R(acc_m0, acc_m1, acc_m2, acc_m3)));
+      }
+      _mm_storeu_ps(res + y, c ? _mm_add_ps(_mm_loadu_ps(res + y), r) : r);
+    }
+    for (; y<y_mat; y++, m+=sz_row)
+    {
+      const q4_t *b = m;
+      __m256 acc = _mm256_setzero_ps();
+      __m128 acc_m = _mm_setzero_ps();
+      float r;
+      int i;
+      for (i=0; i!=ne; i+=Q4_BLOC_NE, b+=Q4_BLOC_SZ)
+        Q4_DOT_AVX2(acc, acc_m, b, _mm256_loadu_si256((__m256i *)(qv.q + i)), qv.ds[i / QV_BLOC_NE]);
+      r = hsum_ps_avx1(acc) + _mm_cvtss_f32(_mm_shuffle_ps(acc_m, acc_m, 1));
+      res[y] = c ? res[y] + r : r;
+    }
+  }
+}
+#endif
+
+// init functions list
+const matmul_f32_q4_t matmul_f32_q4_procs[simd_n] =
+{
+  matmul_f32_q4_fpu,
+  matmul_f32_q4_sse,
+  matmul_f32_q4_avx1,
+  matmul_f32_q4_avx2_4r,
+  AVX512_PROC(matmul_f32_q4_avx512_4r),
+};
+
+// ------------------------------------------------------------------
+// Q4 conversions
+// ------------------------------------------------------------------
+
+#include "l_util.h"
+
+// quantize one bloc of f32 values
+static void cvt_f32_to_q4_bloc(q4_t *q4, const float *f32)
+{
+  unsigned char *q = Q4_CODES(q4);
+  float s[4];                          // cvt_f32_to_f16 convert 4 values
+  f16_t h[4];
+  float v_min = f32[0], v_max = f32[0], d, inv_d, v_m;
+  int i;
+
+  for (i=1; i<Q4_BLOC_NE; i++)
+  {
+    if (f32[i] < v_min) v_min = f32[i];
+    if (f32[i] > v_max) v_max = f32[i];
+  }
+  if (!(v_min >= -65504.0f) || !((v_max - v_min) <= 65504.0f))   // f16 range, also catch NAN
+    msg_error("conversion to Q4 out of range");
+
+  // scale and min rounded to f16, values quantized using rounded values
+  s[0] = (v_max - v_min) / Q4_CODE_MAX;
+  s[1] = v_min;
+  s[2] = s[3] = 0;
+  cvt_f32_to_f16(h, s, 4);
+  ((f16_t *)q4)[0] = h[0];
+  ((f16_t *)q4)[1] = h[1];
+  d = Q4_SCALE(q4);
+  v_m = Q4_MIN(q4);
+  inv_d = (d != 0.0f) ? 1.0f / d : 0.0f;
+
+  for (i=0; i<Q4_BLOC_NE/2; i++)
+  {
+    int k_l = (int)((f32[i]      - v_m) * inv_d + 0.5f);
+    int k_h = (int)((f32[i + 16] - v_m) * inv_d + 0.5f);
+    if (k_l < 0) k_l = 0;
+    if (k_l > Q4_CODE_MAX) k_l = Q4_CODE_MAX;
+    if (k_h < 0) k_h = 0;
+    if (k_h > Q4_CODE_MAX) k_h = Q4_CODE_MAX;
+    q[i] = (unsigned char)(k_l | (k_h << 4));
+  }
+}
+
+// convert buffer f16 to q4, ne must be multiple of Q4_BLOC_NE
+void cvt_f16_to_q4(q4_t *q4, const f16_t *f16, size_t ne)
+{
+  __m256 _f32[Q4_BLOC_NE/8];           // need AVX aligned buffer if simd used
+  float *f32 = (float *)_f32;
+  size_t i;
+  for (i=0; i<ne; i+=Q4_BLOC_NE, q4+=Q4_BLOC_SZ)
+  {
+    matmul_procs.cvt_f16_to_f32(f32, f16 + i, Q4_BLOC_NE);
+    cvt_f32_to_q4_bloc(q4, f32);
+  }
+}
+
+// convert buffer bf16 to q4, ne must be multiple of Q4_BLOC_NE
+void cvt_bf16_to_q4(q4_t *q4, const bf16_t *bf16, size_t ne)
+{
+  __m256 _f32[Q4_BLOC_NE/8];
+  float *f32 = (float *)_f32;
+  size_t i;
+  for (i=0; i<ne; i+=Q4_BLOC_NE, q4+=Q4_BLOC_SZ)
+  {
+    matmul_procs.cvt_bf16_to_f32(f32, bf16 + i, Q4_BLOC_NE);
+    cvt_f32_to_q4_bloc(q4, f32);
+  }
+}
@@ -0,0 +1,284 @@
+#include <intrin.h>
+#include "mm_hsum.h"
+#include "w_types.h"
+#include "matmul.h"
+#include "matmul_priv.h"
+
+// Q8 format: int8 values with one f16 scale for each bloc of Q8_BLOC_NE (32) values.
+// bloc in memory: f16 scale (2 bytes) followed by 32 int8 (34 bytes, 8.5 bits per value).
+// value = scale * int8, scale = max(abs(bloc values)) / 127
+
+#define Q8_INT_MAX 127
+
+// get bloc scale as f32, scale is positive f16 (can be zero or denormal)
+static _inline float q8_scale(const q8_t *b)
+{
+  unsigned int h = *(const unsigned short *)b;
+  unsigned int f32i = (h << 13) + ((127 - 15) << 23);
+  if (h < 0x400)                       // zero or denormal f16
+    return (float)h * 5.9604645e-8f;   // h * 2^-24
+  return *(float *)&f32i;
+}
+
+// ------------------------------------------------------------------
+// f32 * q8 => f32
+// ------------------------------------------------------------------
+
+static void matmul_f32_q8_fpu(float *res, const float *vec, const q8_t *mat, int len_vec, int y_mat)
+{
+  const q8_t *m = mat;
+  int y;
+  for (y=0; y!=y_mat; y++)
+  {
+    float acc = 0;
+    int i, j;
+    for (i=0; i!=len_vec; i+=Q8_BLOC_NE, m+=Q8_BLOC_SZ)
+    {
+      const signed char *q = (const signed char *)(m + 2);
+      float acc_b = 0;
+      for (j=0; j<Q8_BLOC_NE; j++)
+        acc_b += vec[i + j] * q[j];
+      acc += acc_b * q8_scale(m);
+    }
+    *res++ = acc;
+  }
+}
+
+// ------------------------------------------------------------------
+// vec quantization to int8 blocs: scale = max(abs(bloc values)) / 127, the f32 values sum of
+// each bloc is also stored (used for q4 min).
+// ------------------------------------------------------------------
+
+SIMD_SSE void quant_vec_sse(struct q8_vec_t *qv, const float *v, int ne)
+{
+  const __m128 abs_msk = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  int i;
+  for (i=0; i<ne; i+=QV_BLOC_NE, v+=QV_BLOC_NE)
+  {
+    __m128 v0 = _mm_load_ps(v     ), v1 = _mm_load_ps(v +  4);
+    __m128 v2 = _mm_load_ps(v +  8), v3 = _mm_load_ps(v + 12);
+    __m128 v4 = _mm_load_ps(v + 16), v5 = _mm_load_ps(v + 20);
+    __m128 v6 = _mm_load_ps(v + 24), v7 = _mm_load_ps(v + 28);
+    __m128 a = _mm_max_ps(_mm_max_ps(_mm_max_ps(_mm_and_ps(v0, abs_msk), _mm_and_ps(v1, abs_msk)),
+                                     _mm_max_ps(_mm_and_ps(v2, abs_msk), _mm_and_ps(v3, abs_msk))),
+                          _mm_max_ps(_mm_max_ps(_mm_and_ps(v4, abs_msk), _mm_and_ps(v5, abs_msk)),
+                                     _mm_max_ps(_mm_and_ps(v6, abs_msk), _mm_and_ps(v7, abs_msk))));
+    float a_max, sum = hsum_ps_sse(_mm_add_ps(_mm_add_ps(_mm_add_ps(v0, v1), _mm_add_ps(v2, v3)),
+                                              _mm_add_ps(_mm_add_ps(v4, v5), _mm_add_ps(v6, v7))));
+    __m128 s;
+    __m128i q_l, q_h;
+
+    a = _mm_max_ps(a, _mm_movehl_ps(a, a));
+    a_max = _mm_cvtss_f32(_mm_max_ss(a, _mm_shuffle_ps(a, a, 1)));
+    s = _mm_set1_ps((a_max != 0.0f) ? Q8_INT_MAX / a_max : 0.0f);
+    qv->ds[i / QV_BLOC_NE] = _mm_setr_ps(a_max / Q8_INT_MAX, sum, 0, 0);
+
+    q_l = _mm_packs_epi16(_mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(v0, s)), _mm_cvtps_epi32(_mm_mul_ps(v1, s))),
+                          _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(v2, s)), _mm_cvtps_epi32(_mm_mul_ps(v3, s))));
+    q_h = _mm_packs_epi16(_mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(v4, s)), _mm_cvtps_epi32(_mm_mul_ps(v5, s))),
+                          _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(v6, s)), _mm_cvtps_epi32(_mm_mul_ps(v7, s))));
+    _mm_store_si128((__m128i *)(qv->q + i     ), q_l);
+    _mm_store_si128((__m128i *)(qv->q + i + 16), q_h);
+  }
+}
+
+SIMD_AVX2 void quant_vec_avx2(struct q8_vec_t *qv, const float *v, int ne)
+{
+  const __m256 abs_msk = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256i perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);   // reorder packs lanes
+  int i;
+  for (i=0; i<ne; i+=QV_BLOC_NE, v+=QV_BLOC_NE)
+  {
+    __m256 v0 = _mm256_load_ps(v     ), v1 = _mm256_load_ps(v +  8);
+    __m256 v2 = _mm256_load_ps(v + 16), v3 = _mm256_load_ps(v + 24);
+    __m256 a = _mm256_max_ps(_mm256_max_ps(_mm256_and_ps(v0, abs_msk), _mm256_and_ps(v1, abs_msk)),
+                             _mm256_max_ps(_mm256_and_ps(v2, abs_msk), _mm256_and_ps(v3, abs_msk)));
+    __m128 a4 = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    float a_max, sum = hsum_ps_avx_4x(v0, v1, v2, v3);
+    __m256 s;
+    __m256i q;
+
+    a4 = _mm_max_ps(a4, _mm_movehl_ps(a4, a4));
+    a_max = _mm_cvtss_f32(_mm_max_ss(a4, _mm_shuffle_ps(a4, a4, 1)));
+    s = _mm256_set1_ps((a_max != 0.0f) ? Q8_INT_MAX / a_max : 0.0f);
+    qv->ds[i / QV_BLOC_NE] = _mm_setr_ps(a_max / Q8_INT_MAX, sum, 0, 0);
+
+    q = _mm256_packs_epi16(_mm256_packs_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(v0, s)), _mm256_cvtps_epi32(_mm256_mul_ps(v1, s))),
+                           _mm256_packs_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(v2, s)), _mm256_cvtps_epi32(_mm256_mul_ps(v3, s))));
+    _mm256_storeu_si256((__m256i *)(qv->q + i), _mm256_permutevar8x32_epi32(q, perm));
+  }
+}
+
+// ------------------------------------------------------------------
+// f32 * q8 simd versions: vec quantized to int8 blocs, integer dot product of each bloc
+// (maddubs using abs(w) and sign(w) applied to vec), f16 scales converted with F16C.
+// ------------------------------------------------------------------
+
+// bloc f16 scale to f32 in low element
+#define Q8_SCALE_F16C(b) _mm_cvtph_ps(_mm_cvtsi32_si128(*(const unsigned short *)(b)))
+
+static SIMD_F16C void matmul_f32_q8_sse(float *res, const float *vec, const q8_t *mat, int len_vec, int y_mat)
+{
+  struct q8_vec_t qv;
+  size_t sz_row = (size_t)(len_vec / Q8_BLOC_NE) * Q8_BLOC_SZ;
+  int c, y;
+  for (c=0; c<len_vec; c+=QV_CHUNK_NE)
+  {
+    int ne = ((len_vec - c) < QV_CHUNK_NE) ? len_vec - c : QV_CHUNK_NE;
+    const q8_t *m = mat + (size_t)(c / Q8_BLOC_NE) * Q8_BLOC_SZ;
+    quant_vec_sse(&qv, vec + c, ne);
+    for (y=0; y<y_mat; y++, m+=sz_row)
+    {
+      const q8_t *b = m;
+      __m128 acc = _mm_setzero_ps();
+      int i;
+      for (i=0; i!=ne; i+=Q8_BLOC_NE, b+=Q8_BLOC_SZ)
+      {
+        __m128i w_l = _mm_loadu_si128((__m128i *)(b + 2));         // 16 int8 0..15
+        __m128i w_h = _mm_loadu_si128((__m128i *)(b + 2 + 16));    // 16 int8 16..31
+        __m128i v_l = _mm_load_si128((__m128i *)(qv.q + i));
+        __m128i v_h = _mm_load_si128((__m128i *)(qv.q + i + 16));
+        __m128i p = _mm_add_epi32(_mm_madd_epi16(_mm_maddubs_epi16(_mm_sign_epi8(w_l, w_l), _mm_sign_epi8(v_l, w_l)), _mm_set1_epi16(1)),
+                                  _mm_madd_epi16(_mm_maddubs_epi16(_mm_sign_epi8(w_h, w_h), _mm_sign_epi8(v_h, w_h)), _mm_set1_epi16(1)));
+        __m128 d = _mm_mul_ss(Q8_SCALE_F16C(b), qv.ds[i / QV_BLOC_NE]);
+        acc = _mm_fmadd_ps(_mm_cvtepi32_ps(p), _mm_shuffle_ps(d, d, 0), acc);
+      }
+      res[y] = c ? res[y] + hsum_ps_sse(acc) : hsum_ps_sse(acc);
+    }
+  }
+}
+
+// int8 dot product of q8 bloc b with quantized vec bloc v (scale in ds), accumulated in acc
+static SIMD_AVX2 __inline __m256 q8_dot_avx2(__m256 acc, const q8_t *b, __m256i v, __m128 ds)
+{
+  __m256i w = _mm256_loadu_si256((__m256i *)(b + 2));
+  __m256i p = _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_sign_epi8(w, w), _mm256_sign_epi8(v, w)), _mm256_set1_epi16(1));
+  return _mm256_fmadd_ps(_mm256_cvtepi32_ps(p), _mm256_broadcastss_ps(_mm_mul_ss(Q8_SCALE_F16C(b), ds)), acc);
+}
+
+// MM_ROWS rows version
+static SIMD_AVX2 void matmul_f32_q8_avx2_4r(float *res, const float *vec, const q8_t *mat, int len_vec, int y_mat)
+{
+  struct q8_vec_t qv;
+  size_t sz_row = (size_t)(len_vec / Q8_BLOC_NE) * Q8_BLOC_SZ;
+  int pf_dist = matmul_procs.pf_dist;
+  int c, y;
+  for (c=0; c<len_vec; c+=QV_CHUNK_NE)
+  {
+    int ne = ((len_vec - c) < QV_CHUNK_NE) ? len_vec - c : QV_CHUNK_NE;
+    const q8_t *m = mat + (size_t)(c / Q8_BLOC_NE) * Q8_BLOC_SZ;
+    quant_vec_avx2(&qv, vec + c, ne);
+    for (y=0; y<(y_mat & ~(MM_ROWS-1)); y+=MM_ROWS, m+=MM_ROWS*sz_row)
+    {
+      const q8_t *b = m;
+      __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+      __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+      __m128 r;
+      int i;
+      for (i=0; i!=ne; i+=Q8_BLOC_NE, b+=Q8_BLOC_SZ)
+      {
+        __m256i v = _mm256_loadu_si256((__m256i *)(qv.q + i));
+        __m128 ds = qv.ds[i / QV_BLOC_NE];
+        if (pf_dist)
+        {
+          MM_PREFETCH(m, (i / Q8_BLOC_NE) * Q8_BLOC_SZ * MM_ROWS);   // 136 bytes used per loop
+          MM_PREFETCH(m, (i / Q8_BLOC_NE) * Q8_BLOC_SZ * MM_ROWS + 64);
+        }
+        acc0 = q8_dot_avx2(acc0, b           , v, ds);
+        acc1 = q8_dot_avx2(acc1, b +   sz_row, v, ds);
+        acc2 = q8_dot_avx2(acc2, b + 2*sz_row, v, ds);
+        acc3 = q8_dot_avx2(acc3, b + 3*sz_row, v, ds);
+      }
+      r = hsum_ps_avx_4r(acc0, acc1, acc2, acc3);
+      _mm_storeu_ps(res + y, c ? _mm_add_ps(_mm_loadu_ps(res + y), r) : r);
+    }
+    for (; y<y_mat; y++, m+=sz_row)
+    {
+      const q8_t *b = m;
+      __m256 acc = _mm256_setzero_ps();
+      int i;
+      for (i=0; i!=ne; i+=Q8_BLOC_NE, b+=Q8_BLOC_SZ)
+        acc = q8_dot_avx2(acc, b, _mm256_loadu_si256((__m256i *)(qv.q + i)), qv.ds[i / QV_BLOC_NE]);
+      res[y] = c ? res[y] + hsum_ps_avx1(acc) : hsum_ps_avx1(acc);
+    }
+  }
+}
+
+// init functions list
+const matmul_f32_q8_t matmul_f32_q8_procs[simd_n] =
+{
+  matmul_f32_q8_fpu,
+  matmul_f32_q8_sse,
+  NULL,
+  matmul_f32_q8_avx2_4r,
+  NULL,
+};
+
+// ------------------------------------------------------------------
+// Q8 conversions
+// ------------------------------------------------------------------
+
+#include <math.h>
+#include "l_util.h"
+
+// quantize one bloc of f32 values
+static void cvt_f32_to_q8_bloc(q8_t *q8, const float *f32)
+{
+  signed char *q = (signed char *)(q8 + 2);
+  float s[4];                          // cvt_f32_to_f16 convert 4 values
+  f16_t h[4];
+  float a_max = 0, d, inv_d;
+  int i;
+
+  for (i=0; i<Q8_BLOC_NE; i++)
+  {
+    float a = fabsf(f32[i]);
+    if (a > a_max)
+      a_max = a;
+  }
+  if (!(a_max <= 65504.0f))            // f16 scale max, also catch NAN
+    msg_error("conversion to Q8 out of range");
+
+  // scale rounded to f16, values quantized using rounded scale
+  s[0] = a_max / Q8_INT_MAX;
+  s[1] = s[2] = s[3] = 0;
+  cvt_f32_to_f16(h, s, 4);
+  *(f16_t *)q8 = h[0];
+  d = q8_scale(q8);
+  inv_d = (d != 0.0f) ? 1.0f / d : 0.0f;
+
+  for (i=0; i<Q8_BLOC_NE; i++)
+  {
+    float f = f32[i] * inv_d;
+    int k = (int)(f + ((f >= 0.0f) ? 0.5f : -0.5f));
+    if (k > Q8_INT_MAX) k = Q8_INT_MAX;
+    if (k < -Q8_INT_MAX) k = -Q8_INT_MAX;
+    q[i] = (signed char)k;
+  }
+}
+
+// convert buffer f16 to q8, ne must be multiple of Q8_BLOC_NE
+void cvt_f16_to_q8(q8_t *q8, const f16_t *f16, size_t ne)
+{
+  __m256 _f32[Q8_BLOC_NE/8];           // need AVX aligned buffer if simd used
+  float *f32 = (float *)_f32;
+  size_t i;
+  for (i=0; i<ne; i+=Q8_BLOC_NE, q8+=Q8_BLOC_SZ)
+  {
+    matmul_procs.cvt_f16_to_f32(f32, f16 + i, Q8_BLOC_NE);
+    cvt_f32_to_q8_bloc(q8, f32);
+  }
+}
+
+// convert buffer bf16 to q8, ne must be multiple of Q8_BLOC_NE
+void cvt_bf16_to_q8(q8_t *q8, const bf16_t *bf16, size_t ne)
+{
+  __m256 _f32[Q8_BLOC_NE/8];
+  float *f32 = (float *)_f32;
+  size_t i;
+  for (i=0; i<ne; i+=Q8_BLOC_NE, q8+=Q8_BLOC_SZ)
+  {
+    matmul_procs.cvt_bf16_to_f32(f32, bf16 + i, Q8_BLOC_NE);
+    cvt_f32_to_q8_bloc(q8, f32);
+  }
+}
@@ -33,7 +33,7 @@ static void cvt_sf16_to_f32_fpu(float *f32, const sf16_t *sf16, size_t ne)
 #define CVT_4SF16(a) _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_and_si128(\
   _mm_cvtepi16_epi32(a), _mm_set1_epi32(SF16_CVT_MSK)), _mm_set1_epi32(SF16_CVT_ADD)), SF16_CVT_LSL))
 
-static void cvt_sf16_to_f32_sse(float *f32, const sf16_t *sf16, size_t ne)
+static SIMD_SSE void cvt_sf16_to_f32_sse(float *f32, const sf16_t *sf16, size_t ne)
 {
   size_t i;
   for (i=0; i!=ne; i+=4)
@@ -44,19 +44,33 @@ static void cvt_sf16_to_f32_sse(float *f32, const sf16_t *sf16, size_t ne)
 #define CVT_8SF16(a) _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_and_si256(\
   _mm256_cvtepi16_epi32(a), _mm256_set1_epi32(SF16_CVT_MSK)), _mm256_set1_epi32(SF16_CVT_ADD)), SF16_CVT_LSL))
 
-static void cvt_sf16_to_f32_avx2(float *f32, const sf16_t *sf16, size_t ne)
+static SIMD_AVX2 void cvt_sf16_to_f32_avx2(float *f32, const sf16_t *sf16, size_t ne)
 {
   size_t i;
   for (i=0; i!=ne; i+=8)
     _mm256_store_ps(f32 + i, CVT_8SF16(_mm_load_si128((__m128i *)(sf16 + i))));
 }
 
+#ifdef MM_AVX512
+// convert 16 SF16 to 16 FP32
+#define CVT_16SF16(a) _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_and_si512(\
+  _mm512_cvtepi16_epi32(a), _mm512_set1_epi32(SF16_CVT_MSK)), _mm512_set1_epi32(SF16_CVT_ADD)), SF16_CVT_LSL))
+
+static SIMD_AVX512 void cvt_sf16_to_f32_avx512(float *f32, const sf16_t *sf16, size_t ne)
+{
+  size_t i;
+  for (i=0; i!=ne; i+=16)
+    _mm512_storeu_ps(f32 + i, CVT_16SF16(_mm256_loadu_si256((__m256i *)(sf16 + i))));
+}
+#endif
+
 const cvt_sf16_to_f32_t cvt_sf16_to_f32_procs[simd_n] =
 {
   cvt_sf16_to_f32_fpu,
   cvt_sf16_to_f32_sse,
   NULL,
   cvt_sf16_to_f32_avx2,
+  AVX512_PROC(cvt_sf16_to_f32_avx512),
 };
 
 // ------------------------------------------------------------------
@@ -79,7 +93,7 @@ static void matmul_f32_sf16_fpu(float *res, const float *vec, const sf16_t *mat,
   }
 }
 
-static void matmul_f32_sf16_sse(float *res, const float *vec, const sf16_t *mat, int len_vec, int y_mat)
+static SIMD_SSE void matmul_f32_sf16_sse(float *res, const float *vec, const sf16_t *mat, int len_vec, int y_mat)
 {
   const sf16_t *m, *m_end = mat + y_mat * len_vec;
   for (m=mat; m!=m_end; m+=len_vec)
@@ -100,7 +114,7 @@ static void matmul_f32_sf16_sse(float *res, const float *vec, const sf16_t *mat,
   }
 }
 
-static void matmul_f32_sf16_avx2(float *res, const float *vec, const sf16_t *mat, int len_vec, int y_mat)
+static SIMD_AVX2 void matmul_f32_sf16_avx2(float *res, const float *vec, const sf16_t *mat, int len_vec, int y_mat)
 {
   const sf16_t *m, *m_end = mat + y_mat * len_vec;
   for (m=mat; m!=m_end; m+=len_vec)
@@ -113,6 +127,55 @@ static void matmul_f32_sf16_avx2(float *res, const float *vec, const sf16_t *mat
   }
 }
 
+#ifdef MM_AVX512
+#define LOAD_16SF16_AVX512(m) CVT_16SF16(_mm256_loadu_si256((__m256i *)(m)))
+
+static SIMD_AVX512 void matmul_f32_sf16_avx512(float *res, const float *vec, const sf16_t *mat, int len_vec, int y_mat)
+{
+  const sf16_t *m, *m_end = mat + y_mat * len_vec;
+  for (m=mat; m!=m_end; m+=len_vec)
+  {
+    __m512 acc = _mm512_setzero_ps();
+    int i;
+    for (i=0; i!=len_vec; i+=16)
+      acc = _mm512_fmadd_ps(_mm512_loadu_ps(vec + i), LOAD_16SF16_AVX512(m + i), acc);
+    *res++ = hsum_ps_avx512(acc);
+  }
+}
+
+// MM_ROWS rows version
+static SIMD_AVX512 void matmul_f32_sf16_avx512_4r(float *res, const float *vec, const sf16_t *mat, int len_vec, int y_mat)
+{
+  const sf16_t *m, *m_end = mat + (y_mat & ~(MM_ROWS-1)) * len_vec;
+  int pf_dist = matmul_procs.pf_dist;
+  for (m=mat; m!=m_end; m+=MM_ROWS*len_vec, res+=MM_ROWS)
+  {
+    const sf16_t *m1 = m + len_vec, *m2 = m1 + len_vec, *m3 = m2 + len_vec;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps();
+    __m512 acc3 = _mm512_setzero_ps();
+    int i;
+    for (i=0; i!=len_vec; i+=16)
+    {
+      __m512 v = _mm512_loadu_ps(vec + i);
+      if (pf_dist)
+      {
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(sf16_t));  // 128 bytes used per loop
+        MM_PREFETCH(m, i*MM_ROWS*sizeof(sf16_t) + 64);
+      }
+      acc0 = _mm512_fmadd_ps(v, LOAD_16SF16_AVX512(m  + i), acc0);
+      acc1 = _mm512_fmadd_ps(v, LOAD_16SF16_AVX512(m1 + i), acc1);
+      acc2 = _mm512_fmadd_ps(v, LOAD_16SF16_AVX512(m2 + i), acc2);
+      acc3 = _mm512_fmadd_ps(v, LOAD_16SF16_AVX512(m3 + i), acc3);
+    }
+    _mm_storeu_ps(res, hsum_ps_avx512_4r(acc0, acc1, acc2, acc3));
+  }
+  if (y_mat & (MM_ROWS-1))
+    matmul_f32_sf16_avx512(res, vec, m_end, len_vec, y_mat & (MM_ROWS-1));
+}
+#endif
+
 // init functions list
 const matmul_f32_sf16_t matmul_f32_sf16_procs[simd_n] =
 {
@@ -120,6 +183,7 @@ const matmul_f32_sf16_t matmul_f32_sf16_procs[simd_n] =
   matmul_f32_sf16_sse,
   NULL,
   matmul_f32_sf16_avx2,
+  AVX512_PROC(matmul_f32_sf16_avx512_4r),
 };
 
 // ------------------------------------------------------------------
@@ -0,0 +1,384 @@
+// matmul kernels micro benchmark, standalone program (build: make -f make_gcc.txt mm_bench)
+// time matmul_f32_<fmt> functions for all weights formats at every available simd level,
+// using model matrix shapes, on one thread and on all threads (rows split like lw_matmul).
+// report effective weights read GB/s, GFLOP/s and % of memory read bandwidth measured with a
+// STREAM like read kernel. results are displayed and saved as JSON.
+// usage: mm_bench [out_file.json] [num_threads]
+// note: each thread init its rows part of matrix first, so memory is allocated in thread node
+// by the OS first touch policy (numa_alloc_wd is not used to keep benchmark model independant).
+
+#ifdef MM_BENCH
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <omp.h>
+#include <intrin.h>
+#include "mm_hsum.h"
+#include "l_util.h"
+#include "mem_alloc.h"
+#include "w_types.h"
+#include "matmul.h"
+#include "matmul_priv.h"
+
+#define BENCH_MIN_TIME 0.25                      // min measure time for one result (seconds)
+#define BW_BUFF_NE ((size_t)128 << 20)           // read bandwidth test floats count (512 Mb)
+#define BW_STREAMS 4                             // read streams per thread
+#define BW_ALIGN (32 * BW_STREAMS)               // thread part floats count alignment
+
+static const char *simd_names[simd_n] = { "fpu", "sse", "avx", "avx2", "avx512" };
+
+// tested matrix shapes (rows x columns), llama3 8B sizes
+static const struct { int wy; int wx; const char *name; } shapes[] =
+{
+  {   4096,  4096, "dim x dim" },
+  {   4096, 14336, "dim x hidden_dim" },
+  { 128256,  4096, "vocab x dim" },
+};
+#define N_SHAPES (sizeof(shapes) / sizeof(shapes[0]))
+
+typedef void (* mm_proc_t)(float *res, const float *vec, const void *mat, int len_vec, int y_mat);
+
+static mm_proc_t get_mm_proc(enum e_w_type d_type)
+{
+  switch (d_type)
+  {
+    case w_type_f32:  return (mm_proc_t)matmul_procs.matmul_f32_f32;
+    case w_type_f16:  return (mm_proc_t)matmul_procs.matmul_f32_f16;
+    case w_type_bf16: return (mm_proc_t)matmul_procs.matmul_f32_bf16;
+    case w_type_sf16: return (mm_proc_t)matmul_procs.matmul_f32_sf16;
+    case w_type_f12:  return (mm_proc_t)matmul_procs.matmul_f32_f12;
+    case w_type_f8:   return (mm_proc_t)matmul_procs.matmul_f32_f8;
+    case w_type_q8:   return (mm_proc_t)matmul_procs.matmul_f32_q8;
+    case w_type_q4:   return (mm_proc_t)matmul_procs.matmul_f32_q4;
+    case w_type_f12s: return (mm_proc_t)matmul_procs.matmul_f32_f12s;
+    case w_type_f8s:  return (mm_proc_t)matmul_procs.matmul_f32_f8s;
+    default:
+      msg_error("no matmul for weights type %d", d_type);
+  }
+  return NULL;
+}
+
+// size in bytes of one matrix row
+static size_t row_sizeof(enum e_w_type d_type, int wx)
+{
+  switch (d_type)
+  {
+    case w_type_f12:  return wx + (wx >> 1);
+    case w_type_q8:   return (wx / Q8_BLOC_NE) * Q8_BLOC_SZ;
+    case w_type_q4:   return (wx / Q4_BLOC_NE) * Q4_BLOC_SZ;
+    case w_type_f12s: return wx + (wx >> 1) + W_ROW_SCALE_SZ;
+    case w_type_f8s:  return wx + W_ROW_SCALE_SZ;
+    default:          return (size_t)wx * w_type_sizeof[d_type];
+  }
+}
+
+// -------------------------------------------
+// memory read bandwidth, STREAM like sum of buffer
+
+// sum of b[ne], ne multiple of BW_ALIGN. b is read by BW_STREAMS streams (parts of ne/BW_STREAMS
+// floats), 2 accumulators per stream to not be limited by add latency. one version per simd
+// level, the read bandwidth is the best result (widest loads can be required to reach max).
+typedef float (* read_sum_t)(const float *b, size_t ne);
+
+static SIMD_SSE float read_sum_sse(const float *b, size_t ne)
+{
+  size_t dn = ne / BW_STREAMS;
+  const float *b1 = b + dn, *b2 = b1 + dn, *b3 = b2 + dn;
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+  __m128 s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+  __m128 s4 = _mm_setzero_ps(), s5 = _mm_setzero_ps();
+  __m128 s6 = _mm_setzero_ps(), s7 = _mm_setzero_ps();
+  size_t i;
+  for (i=0; i!=dn; i+=8)
+  {
+    s0 = _mm_add_ps(s0, _mm_load_ps(b  + i    ));
+    s1 = _mm_add_ps(s1, _mm_load_ps(b  + i + 4));
+    s2 = _mm_add_ps(s2, _mm_load_ps(b1 + i    ));
+    s3 = _mm_add_ps(s3, _mm_load_ps(b1 + i + 4));
+    s4 = _mm_add_ps(s4, _mm_load_ps(b2 + i    ));
+    s5 = _mm_add_ps(s5, _mm_load_ps(b2 + i + 4));
+    s6 = _mm_add_ps(s6, _mm_load_ps(b3 + i    ));
+    s7 = _mm_add_ps(s7, _mm_load_ps(b3 + i + 4));
+  }
+  return hsum_ps_sse_4x(_mm_add_ps(s0, s4), _mm_add_ps(s1, s5), _mm_add_ps(s2, s6), _mm_add_ps(s3, s7));
+}
+
+static SIMD_AVX2 float read_sum_avx2(const float *b, size_t ne)
+{
+  size_t dn = ne / BW_STREAMS;
+  const float *b1 = b + dn, *b2 = b1 + dn, *b3 = b2 + dn;
+  __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+  __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+  __m256 s4 = _mm256_setzero_ps(), s5 = _mm256_setzero_ps();
+  __m256 s6 = _mm256_setzero_ps(), s7 = _mm256_setzero_ps();
+  size_t i;
+  for (i=0; i!=dn; i+=16)
+  {
+    s0 = _mm256_add_ps(s0, _mm256_load_ps(b  + i    ));
+    s1 = _mm256_add_ps(s1, _mm256_load_ps(b  + i + 8));
+    s2 = _mm256_add_ps(s2, _mm256_load_ps(b1 + i    ));
+    s3 = _mm256_add_ps(s3, _mm256_load_ps(b1 + i + 8));
+    s4 = _mm256_add_ps(s4, _mm256_load_ps(b2 + i    ));
+    s5 = _mm256_add_ps(s5, _mm256_load_ps(b2 + i + 8));
+    s6 = _mm256_add_ps(s6, _mm256_load_ps(b3 + i    ));
+    s7 = _mm256_add_ps(s7, _mm256_load_ps(b3 + i + 8));
+  }
+  return hsum_ps_avx_4x(_mm256_add_ps(s0, s4), _mm256_add_ps(s1, s5), _mm256_add_ps(s2, s6), _mm256_add_ps(s3, s7));
+}
+
+#ifdef MM_AVX512
+static SIMD_AVX512 float read_sum_avx512(const float *b, size_t ne)
+{
+  size_t dn = ne / BW_STREAMS;
+  const float *b1 = b + dn, *b2 = b1 + dn, *b3 = b2 + dn;
+  __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+  __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+  __m512 s4 = _mm512_setzero_ps(), s5 = _mm512_setzero_ps();
+  __m512 s6 = _mm512_setzero_ps(), s7 = _mm512_setzero_ps();
+  size_t i;
+  for (i=0; i!=dn; i+=32)
+  {
+    s0 = _mm512_add_ps(s0, _mm512_loadu_ps(b  + i     ));
+    s1 = _mm512_add_ps(s1, _mm512_loadu_ps(b  + i + 16));
+    s2 = _mm512_add_ps(s2, _mm512_loadu_ps(b1 + i     ));
+    s3 = _mm512_add_ps(s3, _mm512_loadu_ps(b1 + i + 16));
+    s4 = _mm512_add_ps(s4, _mm512_loadu_ps(b2 + i     ));
+    s5 = _mm512_add_ps(s5, _mm512_loadu_ps(b2 + i + 16));
+    s6 = _mm512_add_ps(s6, _mm512_loadu_ps(b3 + i     ));
+    s7 = _mm512_add_ps(s7, _mm512_loadu_ps(b3 + i + 16));
+  }
+  return hsum_ps_avx512_2x(_mm512_add_ps(_mm512_add_ps(s0, s4), _mm512_add_ps(s1, s5)),
+                           _mm512_add_ps(_mm512_add_ps(s2, s6), _mm512_add_ps(s3, s7)));
+}
+#endif
+
+static const read_sum_t read_sum_procs[simd_n] =
+{
+  NULL,
+  read_sum_sse,
+  NULL,
+  read_sum_avx2,
+  AVX512_PROC(read_sum_avx512),
+};
+
+// return read bandwidth in GB/s using n_thrd threads (best run, like STREAM)
+static double read_bw(read_sum_t read_sum, const float *b, size_t ne, int n_thrd)
+{
+  size_t dn = (ne / n_thrd) & ~(BW_ALIGN-1);
+  volatile float sum = 0;                        // keep result used
+  double t0 = omp_get_wtime(), t_min = 1e9, t;
+  do
+  {
+    float s = 0;
+    int i;
+    t = omp_get_wtime();
+    #pragma omp parallel for reduction(+:s) num_threads(n_thrd)
+    for (i=0; i<n_thrd; i++)
+      s += read_sum(b + i * dn, dn);
+    t = omp_get_wtime() - t;
+    sum += s;
+    if (t < t_min)
+      t_min = t;
+  }
+  while ((omp_get_wtime() - t0) < 4*BENCH_MIN_TIME);
+  return ((double)dn * n_thrd * sizeof(float)) / (t_min * 1e9);
+}
+
+// -------------------------------------------
+// matrix init and matmul timing
+
+// init dy rows of matrix with random weights in d_type format
+static void init_rows(char *m, enum e_w_type d_type, int wx, int dy, unsigned int seed)
+{
+  size_t sz_row = row_sizeof(d_type, wx);
+  VAR_ALLOC(r_f32, float, wx);
+  VAR_ALLOC(r_f16, f16_t, wx);
+  int i, y;
+
+  for (y=0; y<dy; y++, m+=sz_row)
+  {
+    for (i=0; i<wx; i++)                         // values in range -0.05..0.05
+    {
+      seed = seed * 1103515245 + 12345;
+      r_f32[i] = ((int)(seed >> 8) - (1 << 23)) * (0.05f / (1 << 23));
+    }
+    cvt_f32_to_f16(r_f16, r_f32, wx);
+    if (d_type == w_type_f32)
+      memcpy(m, r_f32, sz_row);
+    else
+    if (d_type == w_type_f16)
+      memcpy(m, r_f16, sz_row);
+    else
+    if (d_type == w_type_bf16)
+    {
+      for (i=0; i<wx; i++)
+        ((bf16_t *)m)[i] = (bf16_t)(*(unsigned int *)(r_f32 + i) >> 16);
+    }
+    else
+      cvt_w_data(m, d_type, r_f16, w_type_f16, wx, wx);
+  }
+  free_check(r_f32);
+  free_check(r_f16);
+}
+
+// return average time in seconds of matmul using n_thrd threads
+static double time_matmul(mm_proc_t mm, float *res, const float *vec, const char *m, size_t sz_row, int wx, int wy, int n_thrd)
+{
+  int dy = (wy + n_thrd - 1) / n_thrd;
+  int n_run = -1;                                // first run not measured (cache/tlb warm up)
+  double t0 = 0, t;
+  do
+  {
+    int i;
+    #pragma omp parallel for num_threads(n_thrd)
+    for (i=0; i<n_thrd; i++)
+    {
+      int y = i * dy;
+      int n = ((y + dy) <= wy) ? dy : wy - y;
+      if (n > 0)
+        mm(res + y, vec, m + y * sz_row, wx, n);
+    }
+    if (++n_run == 0)
+      t0 = omp_get_wtime();
+    t = omp_get_wtime() - t0;
+  }
+  while (!n_run || (t < BENCH_MIN_TIME));
+  return t / n_run;
+}
+
+// -------------------------------------------
+// main
+
+int main(int argc, char **argv)
+{
+  const char *out_name = (argc > 1) ? argv[1] : "mm_bench.json";
+  int n_thrd = (argc > 2) ? atoi(argv[2]) : omp_get_max_threads();
+  int thrd_list[2], n_thrd_list;
+  double bw[2];                                  // read bandwidth for thrd_list
+  enum e_simd_typ bw_simd[2];                    // simd level of best read bandwidth
+  enum e_simd_typ simd_max, s;
+  float *vec, *res;
+  bool first = true;
+  FILE *fp;
+  int i, j, t;
+
+  if (n_thrd < 1)
+    n_thrd = 1;
+  thrd_list[0] = 1;
+  thrd_list[1] = n_thrd;
+  n_thrd_list = (n_thrd > 1) ? 2 : 1;
+
+  // init once (conversions self check), kernels of each simd level are then selected with matmul_set_simd
+  matmul_init(-1);
+  simd_max = matmul_procs.simd_set;
+  if (matmul_procs.cpu_f16c)
+    init_sw_f16c();                              // used by fpu f16 code, init by matmul_init if no F16C
+
+  fp = fopen(out_name, "w");
+  if (!fp)
+    msg_error("can't create file %s", out_name);
+
+  // memory read bandwidth reference
+  {
+    VAR_ALLOC(b, float, BW_BUFF_NE);
+    size_t dn = (BW_BUFF_NE / n_thrd) & ~(BW_ALIGN-1);
+    #pragma omp parallel for num_threads(n_thrd)
+    for (i=0; i<n_thrd; i++)                     // first touch in thread node
+      memset(b + i * dn, 0, dn * sizeof(float));
+    for (t=0; t<n_thrd_list; t++)
+    {
+      bw[t] = 0;
+      bw_simd[t] = simd_sse;
+      for (s=simd_sse; s<=simd_max; s++)         // best of simd levels
+      {
+        double r;
+        if (!read_sum_procs[s])
+          continue;
+        r = read_bw(read_sum_procs[s], b, BW_BUFF_NE, thrd_list[t]);
+        if (r > bw[t])
+        {
+          bw[t] = r;
+          bw_simd[t] = s;
+        }
+      }
+      msg_info("read bandwidth %d thread(s): %.2f GB/s (%s)\n", thrd_list[t], bw[t], simd_names[bw_simd[t]]);
+    }
+    free_check(b);
+  }
+
+  fprintf(fp, "{\n  \"simd_max\": \"%s\",\n  \"read_bw\": [", simd_names[simd_max]);
+  for (t=0; t<n_thrd_list; t++)
+    fprintf(fp, "%s{ \"threads\": %d, \"gbs\": %.3f, \"simd\": \"%s\" }", t ? ", " : "", thrd_list[t], bw[t], simd_names[bw_simd[t]]);
+  fprintf(fp, "],\n  \"results\": [\n");
+
+  for (i=0; i<(int)N_SHAPES; i++)
+  {
+    int wx = shapes[i].wx, wy = shapes[i].wy;
+    vec = (float *)malloc_check(wx * sizeof(float));
+    res = (float *)malloc_check(wy * sizeof(float));
+    for (j=0; j<wx; j++)
+      vec[j] = rand1s();
+
+    for (j=0; j<w_type_COUNT; j++)
+    {
+      enum e_w_type d_type = (enum e_w_type)j;
+      size_t sz_row = row_sizeof(d_type, wx);
+      double sz_mat = (double)sz_row * wy;
+      int dy = (wy + n_thrd - 1) / n_thrd;
+      enum e_simd_typ s_prev = -1;
+      char *m;
+
+      if ((d_type == w_type_f16) && !matmul_procs.cpu_f16c)
+        continue;
+
+      // init matrix, each thread init own rows part
+      m = (char *)malloc_check(sz_row * wy);
+      #pragma omp parallel for num_threads(n_thrd)
+      for (t=0; t<n_thrd; t++)
+      {
+        int y = t * dy;
+        int n = ((y + dy) <= wy) ? dy : wy - y;
+        if (n > 0)
+          init_rows(m + y * sz_row, d_type, wx, n, 1234 + t);
+      }
+
+      for (s=simd_fpu; s<=simd_max; s++)
+      {
+        mm_proc_t mm;
+        enum e_simd_typ s_lv = matmul_set_simd(d_type, s);   // simd level of used code
+        if ((s_lv == simd_fpu) && ((d_type == w_type_f12s) || (d_type == w_type_f8s)))  // f12/f8 matmul used row by row
+          s_lv = matmul_set_simd((d_type == w_type_f8s) ? w_type_f8 : w_type_f12, s);
+        if (s_lv == s_prev)                      // no code for this simd level, same as lower level
+          continue;
+        s_prev = s_lv;
+        mm = get_mm_proc(d_type);
+
+        for (t=0; t<n_thrd_list; t++)
+        {
+          double tm = time_matmul(mm, res, vec, m, sz_row, wx, wy, thrd_list[t]);
+          double gbs = sz_mat / (tm * 1e9);
+          double gflops = (2.0 * wx * wy) / (tm * 1e9);
+          double pc = 100.0 * gbs / bw[t];
+          msg_info("%6dx%-5d %-4s %-4s thrd:%3d  %8.3f ms  %7.2f GB/s  %7.2f GFLOP/s  %5.1f%% bw\n",
+                   wy, wx, w_type_name[d_type], simd_names[s_lv], thrd_list[t], tm * 1e3, gbs, gflops, pc);
+          fprintf(fp, "%s    { \"shape\": \"%s\", \"rows\": %d, \"cols\": %d, \"type\": \"%s\", \"simd\": \"%s\", "
+                      "\"threads\": %d, \"ms\": %.4f, \"gbs\": %.3f, \"gflops\": %.3f, \"bw_pc\": %.1f }",
+                  first ? "" : ",\n", shapes[i].name, wy, wx, w_type_name[d_type], simd_names[s_lv],
+                  thrd_list[t], tm * 1e3, gbs, gflops, pc);
+          first = false;
+        }
+      }
+      free_check(m);
+    }
+    free_check(vec);
+    free_check(res);
+  }
+  matmul_exit();
+  fprintf(fp, "\n  ]\n}\n");
+  fclose(fp);
+  msg_info("results saved in %s\n", out_name);
+  return 0;
+}
+
+#endif // MM_BENCH
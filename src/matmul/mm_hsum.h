@@ -7,6 +7,30 @@
 #ifndef MM_USE_FMA
 #define _mm_fmadd_ps(a,b,c) _mm_add_ps(c,_mm_mul_ps(a,b))
 #define _mm256_fmadd_ps(a,b,c) _mm256_add_ps(c,_mm256_mul_ps(a,b))
+#define _mm512_fmadd_ps(a,b,c) _mm512_add_ps(c,_mm512_mul_ps(a,b))
+#endif
+
+// instruction set of simd code functions. allow gcc to build the generic code for a baseline cpu
+// (portable build, see make_gcc.txt), simd code versions are only called if supported (cpuid check).
+#ifdef __GNUC__
+#ifdef MM_USE_FMA
+#define SIMD_T_FMA ",fma"
+#else
+#define SIMD_T_FMA
+#endif
+#define SIMD_SSE  __attribute__((target("sse4.2" SIMD_T_FMA)))
+#define SIMD_AVX  __attribute__((target("avx,f16c" SIMD_T_FMA)))
+#define SIMD_AVX2 __attribute__((target("avx2,f16c,fma")))
+#define SIMD_F16C SIMD_AVX             // sse code using f16c conversions (all f16c cpus support avx)
+#define SIMD_AVX512 __attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx2,f16c,fma")))
+#define SIMD_AVX512_BF16 __attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx512bf16,avx2,f16c,fma")))
+#else
+#define SIMD_SSE
+#define SIMD_AVX
+#define SIMD_AVX2
+#define SIMD_F16C
+#define SIMD_AVX512
+#define SIMD_AVX512_BF16
 #endif
 
 // ------------------------------------------------------------------
@@ -16,7 +40,7 @@
 
 #if 1
 
-static __inline float hsum_ps_sse(__m128 v)
+static SIMD_SSE __inline float hsum_ps_sse(__m128 v)
 {
   __m128 shuf = _mm_movehdup_ps(v);            // broadcast elements 3,1 to 2,0
   __m128 sums = _mm_add_ps(v, shuf);
@@ -25,7 +49,7 @@ static __inline float hsum_ps_sse(__m128 v)
   return _mm_cvtss_f32(sums);
 }
 
-static __inline float hsum_ps_avx1(__m256 v) 
+static SIMD_AVX __inline float hsum_ps_avx1(__m256 v) 
 {
   __m128 vlow  = _mm256_castps256_ps128(v);
   __m128 vhigh = _mm256_extractf128_ps(v, 1);  // high 128
@@ -38,13 +62,13 @@ static __inline float hsum_ps_avx1(__m256 v)
 // FPU.
 // note: can be faster than AVX/SSE versions (compiler optimized ?).
 
-static __inline float hsum_ps_sse(__m128 v)
+static SIMD_SSE __inline float hsum_ps_sse(__m128 v)
 {
   float *sum_4 = (float *)&v;
   return sum_4[0] + sum_4[1] + sum_4[2] + sum_4[3];
 }
 
-static __inline float hsum_ps_avx1(__m256 v)
+static SIMD_AVX __inline float hsum_ps_avx1(__m256 v)
 {
   float *sum_8 = (float *)&v;
   return sum_8[0] + sum_8[1] + sum_8[2] + sum_8[3] + sum_8[4] + sum_8[5] + sum_8[6] + sum_8[7];
@@ -58,3 +82,25 @@ static __inline float hsum_ps_avx1(__m256 v)
 #define hsum_ps_avx_2x(a,b) hsum_ps_avx1(_mm256_add_ps(a,b))
 #define hsum_ps_avx_4x(a,b,c,d) hsum_ps_avx1(_mm256_add_ps(_mm256_add_ps(a,b),_mm256_add_ps(c,d)))
 
+// ------------------------------------------------------------------
+// transposed horizontal sums of 4 rows accumulators, return the 4 sums in one vector.
+// same additions order than hsum_ps_avx1/hsum_ps_sse (same result).
+// ------------------------------------------------------------------
+
+static SIMD_SSE __inline __m128 hsum_ps_sse_4r(__m128 a, __m128 b, __m128 c, __m128 d)
+{
+  return _mm_hadd_ps(_mm_hadd_ps(a, b), _mm_hadd_ps(c, d));
+}
+
+#define HSUM_LH(v) _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1))
+#define hsum_ps_avx_4r(a,b,c,d) hsum_ps_sse_4r(HSUM_LH(a),HSUM_LH(b),HSUM_LH(c),HSUM_LH(d))
+
+// ------------------------------------------------------------------
+// AVX512 horizontal sums, 512 bits accumulators are first reduced to 256 bits
+// ------------------------------------------------------------------
+
+#define HSUM_512(v) _mm256_add_ps(_mm512_castps512_ps256(v), _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1)))
+#define hsum_ps_avx512(v) hsum_ps_avx1(HSUM_512(v))
+#define hsum_ps_avx512_2x(a,b) hsum_ps_avx512(_mm512_add_ps(a,b))
+#define hsum_ps_avx512_4r(a,b,c,d) hsum_ps_avx_4r(HSUM_512(a),HSUM_512(b),HSUM_512(c),HSUM_512(d))
+
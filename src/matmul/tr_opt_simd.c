@@ -3,12 +3,14 @@
 #ifdef USE_SA_SIMD
 
 #include <math.h>
+#include <float.h>
 #include <intrin.h>
 #include <stdbool.h>
 #include "mm_hsum.h"
 #include "transformer.h"
 #include "matmul.h"
 #include "tr_opt_simd.h"
+#include "vec_simd.h"
 
 static void head_att_opt_fpu(float *xb, int n_tok, float *att, const float *q, const float *k, const float *v, const struct transformer_config_t *p)
 {
@@ -29,12 +31,7 @@ static void head_att_opt_fpu(float *xb, int n_tok, float *att, const float *q, c
   }
 
   // softmax the scores to get attention weights, from 0..pos inclusively
-  for (t=0; t<n_tok; t++)                        // softmax exp and sum
-  {
-    float e = expf((att[t] - att_max)/sqrt_head_size);
-    att[t] = e;
-    att_e_sum += e;
-  }
+  att_e_sum = vec_procs.vec_exp_sum(att, att, n_tok, att_max, 1.0f/sqrt_head_size);
 
   // weighted sum of the values, accumulate xb for t = 0..pos inclusively
   for (t=0; t<n_tok; t++, v += kv_dim)
@@ -48,116 +45,212 @@ static void head_att_opt_fpu(float *xb, int n_tok, float *att, const float *q, c
   }
 }
 
+// sse and avx versions: single pass online softmax. scores are computed for a tile of ATT_TILE
+// tokens, the max and exp sum are updated and xb accumulator is rescaled when max change, then
+// the tile values are accumulated. each k/v row is read once, att buffer is not used.
+
+#define ATT_TILE 64                              // tokens per tile (k tile 32Kb for head_size 128)
+
 // sse
-static void head_att_opt_sse(float *xb, int n_tok, float *att, const float *q, const float *k, const float *v, const struct transformer_config_t *p)
+static SIMD_SSE void head_att_opt_sse(float *xb, int n_tok, float *att, const float *q, const float *k, const float *v, const struct transformer_config_t *p)
 {
-  float att_max = -1e10;                         // softmax max att value
-  float att_e_sum = 0;                           // softmax exp diff sum
+  float sc[ATT_TILE];                            // tile scores, then exp
+  float att_max = -FLT_MAX;                      // softmax running max att value
+  float att_e_sum = 0;                           // softmax running exp diff sum
+  float inv_sqrt = 1.0f / p->sqrt_head_size;
   int kv_dim = p->kv_dim;
   int head_size = p->head_size;
-  int t;
-  float sqrt_head_size = p->sqrt_head_size;
+  int t0, j;
+  __m128 r;
 
-  const float *m, *m_end = k + n_tok * kv_dim;
-  float *a = att;
-  for (m=k; m!=m_end; m+=kv_dim)
+  for (j=0; j<head_size; j+=4)
+    _mm_store_ps(xb + j, _mm_setzero_ps());
+
+  for (t0=0; t0<n_tok; t0+=ATT_TILE)
   {
-    __m128 acc = _mm_setzero_ps();
-    float r;
-    int i;
-    for (i=0; i!=head_size; i+=4)
-      acc = _mm_fmadd_ps(_mm_load_ps(q + i), _mm_load_ps(m + i), acc);
-    r = hsum_ps_sse(acc);
-    *a++ = r;
-    if (r > att_max)
-      att_max = r;
+    int t, nt = (n_tok - t0) < ATT_TILE ? (n_tok - t0) : ATT_TILE;
+    float m = att_max;
+
+    // tile scores
+    for (t=0; t<nt; t++, k+=kv_dim)
+    {
+      __m128 acc = _mm_setzero_ps();
+      for (j=0; j!=head_size; j+=4)
+        acc = _mm_fmadd_ps(_mm_load_ps(q + j), _mm_load_ps(k + j), acc);
+      sc[t] = hsum_ps_sse(acc) * inv_sqrt;
+      if (sc[t] > m)
+        m = sc[t];
+    }
+
+    // max changed, rescale sum and accumulator
+    if (m > att_max)
+    {
+      if (t0)
+      {
+        float e = expf(att_max - m);
+        att_e_sum *= e;
+        r = _mm_set1_ps(e);
+        for (j=0; j<head_size; j+=4)
+          _mm_store_ps(xb + j, _mm_mul_ps(_mm_load_ps(xb + j), r));
+      }
+      att_max = m;
+    }
+    att_e_sum += vec_procs.vec_exp_sum(sc, sc, nt, att_max, 1.0f);
+
+    // weighted sum of the values
+    for (t=0; t<nt; t++, v+=kv_dim)
+    {
+      __m128 a = _mm_set1_ps(sc[t]);
+      for (j=0; j<head_size; j+=4)
+        _mm_store_ps(xb + j, _mm_fmadd_ps(a, _mm_load_ps(v + j), _mm_load_ps(xb + j)));
+    }
   }
 
-  // softmax the scores to get attention weights, from 0..pos inclusively
-  for (t=0; t<n_tok; t++)                        // softmax exp and sum
-  {
-    float e = expf((att[t] - att_max)/sqrt_head_size);
-    att[t] = e;
-    att_e_sum += e;
-  }
-
-  // weighted sum of the values, accumulate xb for t = 0..pos inclusively
-  for (t=0; t<n_tok; t++, v += kv_dim)
-  {
-    float a = att[t] / att_e_sum;
-    __m128 _a = _mm_set1_ps(a);
-    if (!t)
-    {
-      int j;
-      for (j=0; j<head_size; j+=4)
-        _mm_store_ps(xb + j, _mm_mul_ps(_a, _mm_load_ps(v + j)));
-    }
-    else
-    {
-      int j;
-      for (j=0; j<head_size; j+=4)
-        _mm_store_ps(xb + j, _mm_add_ps(_mm_load_ps(xb + j), _mm_mul_ps(_a, _mm_load_ps(v + j))));
-    }
-  }
+  // normalize
+  r = _mm_set1_ps(1.0f / att_e_sum);
+  for (j=0; j<head_size; j+=4)
+    _mm_store_ps(xb + j, _mm_mul_ps(_mm_load_ps(xb + j), r));
 }
 
 // avx/avx2
-static void head_att_opt_avx(float *xb, int n_tok, float *att, const float *q, const float *k, const float *v, const struct transformer_config_t *p)
+static SIMD_AVX void head_att_opt_avx(float *xb, int n_tok, float *att, const float *q, const float *k, const float *v, const struct transformer_config_t *p)
 {
-  float att_max = -1e10;                         // softmax max att value
-  float att_e_sum = 0;                           // softmax exp diff sum
+  float sc[ATT_TILE];                            // tile scores, then exp
+  float att_max = -FLT_MAX;                      // softmax running max att value
+  float att_e_sum = 0;                           // softmax running exp diff sum
+  float inv_sqrt = 1.0f / p->sqrt_head_size;
   int kv_dim = p->kv_dim;
   int head_size = p->head_size;
-  int t;
-  float sqrt_head_size = p->sqrt_head_size;
+  int t0, j;
+  __m256 r;
+
+  for (j=0; j<head_size; j+=8)
+    _mm256_store_ps(xb + j, _mm256_setzero_ps());
 
-  const float *m, *m_end = k + n_tok * kv_dim;
-  float *a = att;
-  for (m=k; m!=m_end; m+=kv_dim)
+  for (t0=0; t0<n_tok; t0+=ATT_TILE)
   {
-    __m256 acc = _mm256_setzero_ps();
-    float r;
-    int i;
-    for (i=0; i!=head_size; i+=8)
-      acc = _mm256_fmadd_ps(_mm256_load_ps(q + i), _mm256_load_ps(m + i), acc);
-    r = hsum_ps_avx1(acc);
-    *a++ = r;
-    if (r > att_max)
-      att_max = r;
+    int t, nt = (n_tok - t0) < ATT_TILE ? (n_tok - t0) : ATT_TILE;
+    float m = att_max;
+
+    // tile scores
+    for (t=0; t<nt; t++, k+=kv_dim)
+    {
+      __m256 acc = _mm256_setzero_ps();
+      for (j=0; j!=head_size; j+=8)
+        acc = _mm256_fmadd_ps(_mm256_load_ps(q + j), _mm256_load_ps(k + j), acc);
+      sc[t] = hsum_ps_avx1(acc) * inv_sqrt;
+      if (sc[t] > m)
+        m = sc[t];
+    }
+
+    // max changed, rescale sum and accumulator
+    if (m > att_max)
+    {
+      if (t0)
+      {
+        float e = expf(att_max - m);
+        att_e_sum *= e;
+        r = _mm256_set1_ps(e);
+        for (j=0; j<head_size; j+=8)
+          _mm256_store_ps(xb + j, _mm256_mul_ps(_mm256_load_ps(xb + j), r));
+      }
+      att_max = m;
+    }
+    att_e_sum += vec_procs.vec_exp_sum(sc, sc, nt, att_max, 1.0f);
+
+    // weighted sum of the values
+    for (t=0; t<nt; t++, v+=kv_dim)
+    {
+      __m256 a = _mm256_set1_ps(sc[t]);
+      for (j=0; j<head_size; j+=8)
+        _mm256_store_ps(xb + j, _mm256_fmadd_ps(a, _mm256_load_ps(v + j), _mm256_load_ps(xb + j)));
+    }
   }
 
-  // softmax the scores to get attention weights, from 0..pos inclusively
-  for (t=0; t<n_tok; t++)                        // softmax exp and sum
-  {
-    float e = expf((att[t] - att_max)/sqrt_head_size);
-    att[t] = e;
-    att_e_sum += e;
-  }
-
-  // weighted sum of the values, accumulate xb for t = 0..pos inclusively
-  for (t=0; t<n_tok; t++, v += kv_dim)
-  {
-    float a = att[t] / att_e_sum;
-    __m256 _a = _mm256_set1_ps(a);
-    if (!t)
-    {
-      int j;
-      for (j=0; j<head_size; j+=8)
-        _mm256_store_ps(xb + j, _mm256_mul_ps(_a, _mm256_load_ps(v + j)));
-    }
-    else
-    {
-      int j;
-      for (j=0; j<head_size; j+=8)
-        _mm256_store_ps(xb + j, _mm256_add_ps(_mm256_load_ps(xb + j), _mm256_mul_ps(_a, _mm256_load_ps(v + j))));
-    }
-  }
+  // normalize
+  r = _mm256_set1_ps(1.0f / att_e_sum);
+  for (j=0; j<head_size; j+=8)
+    _mm256_store_ps(xb + j, _mm256_mul_ps(_mm256_load_ps(xb + j), r));
 }
 
+#ifdef MM_AVX512
+// avx512, head_size not multiple of 16 use avx version
+static SIMD_AVX512 void head_att_opt_avx512(float *xb, int n_tok, float *att, const float *q, const float *k, const float *v, const struct transformer_config_t *p)
+{
+  float sc[ATT_TILE];                            // tile scores, then exp
+  float att_max = -FLT_MAX;                      // softmax running max att value
+  float att_e_sum = 0;                           // softmax running exp diff sum
+  float inv_sqrt = 1.0f / p->sqrt_head_size;
+  int kv_dim = p->kv_dim;
+  int head_size = p->head_size;
+  int t0, j;
+  __m512 r;
+
+  if (head_size & 15)
+  {
+    head_att_opt_avx(xb, n_tok, att, q, k, v, p);
+    return;
+  }
+
+  for (j=0; j<head_size; j+=16)
+    _mm512_storeu_ps(xb + j, _mm512_setzero_ps());
+
+  for (t0=0; t0<n_tok; t0+=ATT_TILE)
+  {
+    int t, nt = (n_tok - t0) < ATT_TILE ? (n_tok - t0) : ATT_TILE;
+    float m = att_max;
+
+    // tile scores
+    for (t=0; t<nt; t++, k+=kv_dim)
+    {
+      __m512 acc = _mm512_setzero_ps();
+      for (j=0; j!=head_size; j+=16)
+        acc = _mm512_fmadd_ps(_mm512_loadu_ps(q + j), _mm512_loadu_ps(k + j), acc);
+      sc[t] = hsum_ps_avx512(acc) * inv_sqrt;
+      if (sc[t] > m)
+        m = sc[t];
+    }
+
+    // max changed, rescale sum and accumulator
+    if (m > att_max)
+    {
+      if (t0)
+      {
+        float e = expf(att_max - m);
+        att_e_sum *= e;
+        r = _mm512_set1_ps(e);
+        for (j=0; j<head_size; j+=16)
+          _mm512_storeu_ps(xb + j, _mm512_mul_ps(_mm512_loadu_ps(xb + j), r));
+      }
+      att_max = m;
+    }
+    att_e_sum += vec_procs.vec_exp_sum(sc, sc, nt, att_max, 1.0f);
+
+    // weighted sum of the values
+    for (t=0; t<nt; t++, v+=kv_dim)
+    {
+      __m512 a = _mm512_set1_ps(sc[t]);
+      for (j=0; j<head_size; j+=16)
+        _mm512_storeu_ps(xb + j, _mm512_fmadd_ps(a, _mm512_loadu_ps(v + j), _mm512_loadu_ps(xb + j)));
+    }
+  }
+
+  // normalize
+  r = _mm512_set1_ps(1.0f / att_e_sum);
+  for (j=0; j<head_size; j+=16)
+    _mm512_storeu_ps(xb + j, _mm512_mul_ps(_mm512_loadu_ps(xb + j), r));
+}
+#endif
+
 head_att_opt_t head_att_opt = NULL;
 
 void init_head_att_opt(enum e_simd_typ simd_typ)
 {
+#ifdef MM_AVX512
+  if (simd_typ == simd_avx512)
+    head_att_opt = head_att_opt_avx512;
+  else
+#endif
   if (simd_typ >= simd_avx1)
     head_att_opt = head_att_opt_avx;
   else
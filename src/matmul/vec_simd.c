@@ -0,0 +1,580 @@
+// simd optimized vector functions (max, exp, softmax, norm, residual, swiglu, rope)
+
+#include <math.h>
+#include <float.h>
+#include <intrin.h>
+#include <stdbool.h>
+#include "mm_hsum.h"
+#include "w_types.h"
+#include "matmul.h"
+#include "vec_simd.h"
+
+struct vec_procs_t vec_procs = { 0 };
+
+// ------------------------------------------------------------------
+// exp approximation (cephes expf), range reduction exp(x) = 2^n * exp(r), |r| <= ln(2)/2
+// and polynomial, relative error < 2e-7. input clamped to [ln(FLT_MIN) .. 88], no denormal.
+// ------------------------------------------------------------------
+
+#define EXP_HI  88.0f
+#define EXP_LO -87.33654f
+#define EXP_LOG2E 1.44269504088896341f
+#define EXP_C1  0.693359375f
+#define EXP_C2 -2.12194440e-4f
+#define EXP_P0  1.9875691500e-4f
+#define EXP_P1  1.3981999507e-3f
+#define EXP_P2  8.3334519073e-3f
+#define EXP_P3  4.1665795894e-2f
+#define EXP_P4  1.6666665459e-1f
+#define EXP_P5  5.0000001201e-1f
+
+// scalar version, used for vectors tail
+static _inline float exp_fast(float x)
+{
+  float fx, y, z;
+  int n;
+  if (x < EXP_LO) x = EXP_LO;
+  if (x > EXP_HI) x = EXP_HI;
+  fx = floorf(x * EXP_LOG2E + 0.5f);
+  x = x - fx * EXP_C1 - fx * EXP_C2;
+  z = x * x;
+  y = (((((EXP_P0 * x + EXP_P1) * x + EXP_P2) * x + EXP_P3) * x + EXP_P4) * x + EXP_P5) * z + x + 1.0f;
+  n = ((int)fx + 127) << 23;
+  return y * *(float *)&n;
+}
+
+static SIMD_SSE _inline __m128 exp_ps_sse(__m128 x)
+{
+  __m128 fx, y, z;
+  __m128i n;
+  x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(EXP_LO)), _mm_set1_ps(EXP_HI));
+  fx = _mm_floor_ps(_mm_fmadd_ps(x, _mm_set1_ps(EXP_LOG2E), _mm_set1_ps(0.5f)));
+  x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(EXP_C1)));
+  x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(EXP_C2)));
+  z = _mm_mul_ps(x, x);
+  y = _mm_fmadd_ps(_mm_set1_ps(EXP_P0), x, _mm_set1_ps(EXP_P1));
+  y = _mm_fmadd_ps(y, x, _mm_set1_ps(EXP_P2));
+  y = _mm_fmadd_ps(y, x, _mm_set1_ps(EXP_P3));
+  y = _mm_fmadd_ps(y, x, _mm_set1_ps(EXP_P4));
+  y = _mm_fmadd_ps(y, x, _mm_set1_ps(EXP_P5));
+  y = _mm_fmadd_ps(y, z, _mm_add_ps(x, _mm_set1_ps(1.0f)));
+  n = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(127)), 23);
+  return _mm_mul_ps(y, _mm_castsi128_ps(n));
+}
+
+static SIMD_AVX2 _inline __m256 exp_ps_avx2(__m256 x)
+{
+  __m256 fx, y, z;
+  __m256i n;
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_LO)), _mm256_set1_ps(EXP_HI));
+  fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(EXP_LOG2E), _mm256_set1_ps(0.5f)));
+  x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(EXP_C1)));
+  x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(EXP_C2)));
+  z = _mm256_mul_ps(x, x);
+  y = _mm256_fmadd_ps(_mm256_set1_ps(EXP_P0), x, _mm256_set1_ps(EXP_P1));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P2));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P3));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P4));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P5));
+  y = _mm256_fmadd_ps(y, z, _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+  n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+
+// ------------------------------------------------------------------
+// max
+// ------------------------------------------------------------------
+
+static float vec_max_fpu(const float *x, int n)
+{
+  float max = -FLT_MAX;
+  int i;
+  for (i=0; i<n; i++)
+    if (x[i] > max)
+      max = x[i];
+  return max;
+}
+
+// note: _mm_max_ps return second operand if NAN, NAN values are ignored as in fpu version
+static SIMD_SSE float vec_max_sse(const float *x, int n)
+{
+  __m128 m = _mm_set1_ps(-FLT_MAX);
+  float max, r[4];
+  int i;
+  for (i=0; i<=n-4; i+=4)
+    m = _mm_max_ps(_mm_loadu_ps(x + i), m);
+  _mm_storeu_ps(r, m);
+  max = vec_max_fpu(r, 4);
+  for (; i<n; i++)
+    if (x[i] > max)
+      max = x[i];
+  return max;
+}
+
+static SIMD_AVX float vec_max_avx(const float *x, int n)
+{
+  __m256 m = _mm256_set1_ps(-FLT_MAX);
+  float max, r[8];
+  int i;
+  for (i=0; i<=n-8; i+=8)
+    m = _mm256_max_ps(_mm256_loadu_ps(x + i), m);
+  _mm256_storeu_ps(r, m);
+  max = vec_max_fpu(r, 8);
+  for (; i<n; i++)
+    if (x[i] > max)
+      max = x[i];
+  return max;
+}
+
+// ------------------------------------------------------------------
+// exp and sum
+// ------------------------------------------------------------------
+
+static float vec_exp_sum_fpu(float *y, const float *x, int n, float ofs, float k)
+{
+  float sum = 0;
+  int i;
+  for (i=0; i<n; i++)
+  {
+    float e = expf((x[i] - ofs) * k);
+    if (y)
+      y[i] = e;
+    sum += e;
+  }
+  return sum;
+}
+
+static SIMD_SSE float vec_exp_sum_sse(float *y, const float *x, int n, float ofs, float k)
+{
+  __m128 _ofs = _mm_set1_ps(ofs);
+  __m128 _k = _mm_set1_ps(k);
+  __m128 acc = _mm_setzero_ps();
+  float sum;
+  int i;
+  for (i=0; i<=n-4; i+=4)
+  {
+    __m128 e = exp_ps_sse(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(x + i), _ofs), _k));
+    if (y)
+      _mm_storeu_ps(y + i, e);
+    acc = _mm_add_ps(acc, e);
+  }
+  sum = hsum_ps_sse(acc);
+  for (; i<n; i++)
+  {
+    float e = exp_fast((x[i] - ofs) * k);
+    if (y)
+      y[i] = e;
+    sum += e;
+  }
+  return sum;
+}
+
+static SIMD_AVX2 float vec_exp_sum_avx2(float *y, const float *x, int n, float ofs, float k)
+{
+  __m256 _ofs = _mm256_set1_ps(ofs);
+  __m256 _k = _mm256_set1_ps(k);
+  __m256 acc = _mm256_setzero_ps();
+  float sum;
+  int i;
+  for (i=0; i<=n-8; i+=8)
+  {
+    __m256 e = exp_ps_avx2(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(x + i), _ofs), _k));
+    if (y)
+      _mm256_storeu_ps(y + i, e);
+    acc = _mm256_add_ps(acc, e);
+  }
+  sum = hsum_ps_avx1(acc);
+  for (; i<n; i++)
+  {
+    float e = exp_fast((x[i] - ofs) * k);
+    if (y)
+      y[i] = e;
+    sum += e;
+  }
+  return sum;
+}
+
+// ------------------------------------------------------------------
+// scale
+// ------------------------------------------------------------------
+
+static void vec_scale_fpu(float *x, int n, float k)
+{
+  int i;
+  for (i=0; i<n; i++)
+    x[i] *= k;
+}
+
+static SIMD_SSE void vec_scale_sse(float *x, int n, float k)
+{
+  __m128 _k = _mm_set1_ps(k);
+  int i;
+  for (i=0; i<=n-4; i+=4)
+    _mm_storeu_ps(x + i, _mm_mul_ps(_mm_loadu_ps(x + i), _k));
+  for (; i<n; i++)
+    x[i] *= k;
+}
+
+static SIMD_AVX void vec_scale_avx(float *x, int n, float k)
+{
+  __m256 _k = _mm256_set1_ps(k);
+  int i;
+  for (i=0; i<=n-8; i+=8)
+    _mm256_storeu_ps(x + i, _mm256_mul_ps(_mm256_loadu_ps(x + i), _k));
+  for (; i<n; i++)
+    x[i] *= k;
+}
+
+// ------------------------------------------------------------------
+// add, residual
+// ------------------------------------------------------------------
+
+static void vec_add_fpu(float *a, const float *b, int n)
+{
+  int i;
+  for (i=0; i<n; i++)
+    a[i] += b[i];
+}
+
+static SIMD_SSE void vec_add_sse(float *a, const float *b, int n)
+{
+  int i;
+  for (i=0; i<=n-4; i+=4)
+    _mm_storeu_ps(a + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  for (; i<n; i++)
+    a[i] += b[i];
+}
+
+static SIMD_AVX void vec_add_avx(float *a, const float *b, int n)
+{
+  int i;
+  for (i=0; i<=n-8; i+=8)
+    _mm256_storeu_ps(a + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  for (; i<n; i++)
+    a[i] += b[i];
+}
+
+static void vec_mul_add_fpu(float *a, const float *b, float k, int n)
+{
+  int i;
+  for (i=0; i<n; i++)
+    a[i] += b[i] * k;
+}
+
+static SIMD_SSE void vec_mul_add_sse(float *a, const float *b, float k, int n)
+{
+  __m128 _k = _mm_set1_ps(k);
+  int i;
+  for (i=0; i<=n-4; i+=4)
+    _mm_storeu_ps(a + i, _mm_fmadd_ps(_mm_loadu_ps(b + i), _k, _mm_loadu_ps(a + i)));
+  for (; i<n; i++)
+    a[i] += b[i] * k;
+}
+
+static SIMD_AVX void vec_mul_add_avx(float *a, const float *b, float k, int n)
+{
+  __m256 _k = _mm256_set1_ps(k);
+  int i;
+  for (i=0; i<=n-8; i+=8)
+    _mm256_storeu_ps(a + i, _mm256_fmadd_ps(_mm256_loadu_ps(b + i), _k, _mm256_loadu_ps(a + i)));
+  for (; i<n; i++)
+    a[i] += b[i] * k;
+}
+
+// ------------------------------------------------------------------
+// sum of squares, rms norm
+// ------------------------------------------------------------------
+
+static float vec_sq_sum_fpu(const float *a, int n)
+{
+  float sq_sum = 0.0f;
+  int i;
+  for (i=0; i<n; i++)
+    sq_sum += a[i] * a[i];
+  return sq_sum;
+}
+
+static SIMD_SSE float vec_sq_sum_sse(const float *a, int n)
+{
+  __m128 acc = _mm_setzero_ps();
+  float sq_sum;
+  int i;
+  for (i=0; i<=n-4; i+=4)
+  {
+    __m128 v = _mm_loadu_ps(a + i);
+    acc = _mm_fmadd_ps(v, v, acc);
+  }
+  sq_sum = hsum_ps_sse(acc);
+  for (; i<n; i++)
+    sq_sum += a[i] * a[i];
+  return sq_sum;
+}
+
+static SIMD_AVX float vec_sq_sum_avx(const float *a, int n)
+{
+  __m256 acc = _mm256_setzero_ps();
+  float sq_sum;
+  int i;
+  for (i=0; i<=n-8; i+=8)
+  {
+    __m256 v = _mm256_loadu_ps(a + i);
+    acc = _mm256_fmadd_ps(v, v, acc);
+  }
+  sq_sum = hsum_ps_avx1(acc);
+  for (; i<n; i++)
+    sq_sum += a[i] * a[i];
+  return sq_sum;
+}
+
+static float vec_add_sq_sum_fpu(float *a, const float *b, int n)
+{
+  float sq_sum = 0;
+  int i;
+  for (i=0; i<n; i++)
+  {
+    float sum = a[i] + b[i];
+    a[i] = sum;
+    sq_sum += sum * sum;
+  }
+  return sq_sum;
+}
+
+static SIMD_SSE float vec_add_sq_sum_sse(float *a, const float *b, int n)
+{
+  __m128 acc = _mm_setzero_ps();
+  float sq_sum;
+  int i;
+  for (i=0; i<=n-4; i+=4)
+  {
+    __m128 v = _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    _mm_storeu_ps(a + i, v);
+    acc = _mm_fmadd_ps(v, v, acc);
+  }
+  sq_sum = hsum_ps_sse(acc);
+  for (; i<n; i++)
+  {
+    a[i] += b[i];
+    sq_sum += a[i] * a[i];
+  }
+  return sq_sum;
+}
+
+static SIMD_AVX float vec_add_sq_sum_avx(float *a, const float *b, int n)
+{
+  __m256 acc = _mm256_setzero_ps();
+  float sq_sum;
+  int i;
+  for (i=0; i<=n-8; i+=8)
+  {
+    __m256 v = _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    _mm256_storeu_ps(a + i, v);
+    acc = _mm256_fmadd_ps(v, v, acc);
+  }
+  sq_sum = hsum_ps_avx1(acc);
+  for (; i<n; i++)
+  {
+    a[i] += b[i];
+    sq_sum += a[i] * a[i];
+  }
+  return sq_sum;
+}
+
+static void vec_norm_scale_fpu(float *o, const float *a, float k, const float *w, int n)
+{
+  int i;
+  for (i=0; i<n; i++)
+    o[i] = (a[i] * k) * w[i];
+}
+
+static SIMD_SSE void vec_norm_scale_sse(float *o, const float *a, float k, const float *w, int n)
+{
+  __m128 _k = _mm_set1_ps(k);
+  int i;
+  for (i=0; i<=n-4; i+=4)
+    _mm_storeu_ps(o + i, _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(a + i), _k), _mm_loadu_ps(w + i)));
+  for (; i<n; i++)
+    o[i] = (a[i] * k) * w[i];
+}
+
+static SIMD_AVX void vec_norm_scale_avx(float *o, const float *a, float k, const float *w, int n)
+{
+  __m256 _k = _mm256_set1_ps(k);
+  int i;
+  for (i=0; i<=n-8; i+=8)
+    _mm256_storeu_ps(o + i, _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(a + i), _k), _mm256_loadu_ps(w + i)));
+  for (; i<n; i++)
+    o[i] = (a[i] * k) * w[i];
+}
+
+// ------------------------------------------------------------------
+// SwiGLU non-linearity a = a * (1.0f / (1.0f + exp(-a))) * b
+// ------------------------------------------------------------------
+
+static void vec_swiglu_fpu(float *a, const float *b, int n)
+{
+  int i;
+  for (i=0; i<n; i++)
+    a[i] = (a[i] / (1.0f + expf(-a[i]))) * b[i];
+}
+
+static SIMD_SSE void vec_swiglu_sse(float *a, const float *b, int n)
+{
+  __m128 one = _mm_set1_ps(1.0f);
+  __m128 sgn = _mm_set1_ps(-0.0f);
+  int i;
+  for (i=0; i<=n-4; i+=4)
+  {
+    __m128 x = _mm_loadu_ps(a + i);
+    __m128 e = exp_ps_sse(_mm_xor_ps(x, sgn));
+    _mm_storeu_ps(a + i, _mm_mul_ps(_mm_div_ps(x, _mm_add_ps(one, e)), _mm_loadu_ps(b + i)));
+  }
+  for (; i<n; i++)
+    a[i] = (a[i] / (1.0f + exp_fast(-a[i]))) * b[i];
+}
+
+static SIMD_AVX2 void vec_swiglu_avx2(float *a, const float *b, int n)
+{
+  __m256 one = _mm256_set1_ps(1.0f);
+  __m256 sgn = _mm256_set1_ps(-0.0f);
+  int i;
+  for (i=0; i<=n-8; i+=8)
+  {
+    __m256 x = _mm256_loadu_ps(a + i);
+    __m256 e = exp_ps_avx2(_mm256_xor_ps(x, sgn));
+    _mm256_storeu_ps(a + i, _mm256_mul_ps(_mm256_div_ps(x, _mm256_add_ps(one, e)), _mm256_loadu_ps(b + i)));
+  }
+  for (; i<n; i++)
+    a[i] = (a[i] / (1.0f + exp_fast(-a[i]))) * b[i];
+}
+
+// ------------------------------------------------------------------
+// RoPE, rotate (x, y) pairs: x' = x*cos - y*sin, y' = x*sin + y*cos
+// pairs are (i, i + head_size/2) in each head (rotate_half, q/k weights order in .safetensors),
+// sin_cos contains head_size/2 sin values followed by head_size/2 cos values.
+// ------------------------------------------------------------------
+
+#define ROPE_FPU(p) { float x = (p)[j], y = (p)[j+h2]; (p)[j] = x*c - y*s; (p)[j+h2] = x*s + y*c; }
+
+static void vec_rope_fpu(float *a, float *b, const float *sin_cos, int head_size, int a_dim, int b_dim)
+{
+  int h2 = head_size / 2;
+  int i, j;
+  for (i=0; i<a_dim; i+=head_size)
+    for (j=0; j<h2; j++)
+    {
+      float s = sin_cos[j];           // get sin
+      float c = sin_cos[j+h2];        // get cos
+      ROPE_FPU(a + i);                // rotate a (query)
+      if (i < b_dim)
+        ROPE_FPU(b + i);              // rotate b (key)
+    }
+}
+
+#define ROPE_SSE(p) { __m128 x = _mm_loadu_ps(p), y = _mm_loadu_ps((p) + h2);\
+  _mm_storeu_ps(p, _mm_sub_ps(_mm_mul_ps(x, c), _mm_mul_ps(y, s)));\
+  _mm_storeu_ps((p) + h2, _mm_add_ps(_mm_mul_ps(x, s), _mm_mul_ps(y, c))); }
+
+static SIMD_SSE void vec_rope_sse(float *a, float *b, const float *sin_cos, int head_size, int a_dim, int b_dim)
+{
+  int h2 = head_size / 2;
+  int i, j;
+  if (h2 & 3)
+  {
+    vec_rope_fpu(a, b, sin_cos, head_size, a_dim, b_dim);
+    return;
+  }
+  for (i=0; i<a_dim; i+=head_size)
+    for (j=0; j<h2; j+=4)
+    {
+      __m128 s = _mm_loadu_ps(sin_cos + j);
+      __m128 c = _mm_loadu_ps(sin_cos + h2 + j);
+      ROPE_SSE(a + i + j);
+      if (i < b_dim)
+        ROPE_SSE(b + i + j);
+    }
+}
+
+#define ROPE_AVX(p) { __m256 x = _mm256_loadu_ps(p), y = _mm256_loadu_ps((p) + h2);\
+  _mm256_storeu_ps(p, _mm256_sub_ps(_mm256_mul_ps(x, c), _mm256_mul_ps(y, s)));\
+  _mm256_storeu_ps((p) + h2, _mm256_add_ps(_mm256_mul_ps(x, s), _mm256_mul_ps(y, c))); }
+
+static SIMD_AVX void vec_rope_avx(float *a, float *b, const float *sin_cos, int head_size, int a_dim, int b_dim)
+{
+  int h2 = head_size / 2;
+  int i, j;
+  if (h2 & 7)
+  {
+    vec_rope_sse(a, b, sin_cos, head_size, a_dim, b_dim);
+    return;
+  }
+  for (i=0; i<a_dim; i+=head_size)
+    for (j=0; j<h2; j+=8)
+    {
+      __m256 s = _mm256_loadu_ps(sin_cos + j);
+      __m256 c = _mm256_loadu_ps(sin_cos + h2 + j);
+      ROPE_AVX(a + i + j);
+      if (i < b_dim)
+        ROPE_AVX(b + i + j);
+    }
+}
+
+// ------------------------------------------------------------------
+// softmax
+// ------------------------------------------------------------------
+
+// convert x * k to probabilities 0..1 with x elements sum = 1
+void vec_softmax(float *x, int n, float k)
+{
+  float max = vec_procs.vec_max(x, n);
+  float sum = vec_procs.vec_exp_sum(x, x, n, max, k);
+  vec_procs.vec_scale(x, n, 1.0f / sum);
+}
+
+// ------------------------------------------------------------------
+// init
+// ------------------------------------------------------------------
+
+void vec_procs_init(enum e_simd_typ simd_typ)
+{
+  if (simd_typ >= simd_avx2)                     // avx512: avx2 code
+  {
+    vec_procs.vec_max = vec_max_avx;
+    vec_procs.vec_exp_sum = vec_exp_sum_avx2;
+    vec_procs.vec_scale = vec_scale_avx;
+    vec_procs.vec_swiglu = vec_swiglu_avx2;
+  }
+  else
+  if (simd_typ == simd_avx1)                     // integer exp part require avx2
+  {
+    vec_procs.vec_max = vec_max_avx;
+    vec_procs.vec_exp_sum = vec_exp_sum_sse;
+    vec_procs.vec_scale = vec_scale_avx;
+    vec_procs.vec_swiglu = vec_swiglu_sse;
+  }
+  else
+  if (simd_typ == simd_sse)
+  {
+    vec_procs.vec_max = vec_max_sse;
+    vec_procs.vec_exp_sum = vec_exp_sum_sse;
+    vec_procs.vec_scale = vec_scale_sse;
+    vec_procs.vec_swiglu = vec_swiglu_sse;
+  }
+  else
+  {
+    vec_procs.vec_max = vec_max_fpu;
+    vec_procs.vec_exp_sum = vec_exp_sum_fpu;
+    vec_procs.vec_scale = vec_scale_fpu;
+    vec_procs.vec_swiglu = vec_swiglu_fpu;
+  }
+
+  // functions without integer simd code, same for avx1/avx2
+  #define SET_VEC_PROC(name)\
+    vec_procs.name = (simd_typ >= simd_avx1) ? name##_avx : (simd_typ == simd_sse) ? name##_sse : name##_fpu
+
+  SET_VEC_PROC(vec_add);
+  SET_VEC_PROC(vec_mul_add);
+  SET_VEC_PROC(vec_sq_sum);
+  SET_VEC_PROC(vec_add_sq_sum);
+  SET_VEC_PROC(vec_norm_scale);
+  SET_VEC_PROC(vec_rope);
+}
@@ -0,0 +1,45 @@
+// -----------------------------------------------------
+// simd optimized vector functions (code in vec_simd.c)
+
+struct vec_procs_t
+{
+  // return max of x[n]
+  float (* vec_max)(const float *x, int n);
+
+  // return sum of exp((x[i] - ofs) * k), y[i] = exp((x[i] - ofs) * k) stored if y not NULL (y can be x)
+  float (* vec_exp_sum)(float *y, const float *x, int n, float ofs, float k);
+
+  // x[i] *= k
+  void (* vec_scale)(float *x, int n, float k);
+
+  // a[i] += b[i]
+  void (* vec_add)(float *a, const float *b, int n);
+
+  // a[i] += b[i] * k
+  void (* vec_mul_add)(float *a, const float *b, float k, int n);
+
+  // return sum of a[i]^2
+  float (* vec_sq_sum)(const float *a, int n);
+
+  // a[i] += b[i], return sum of a[i]^2 (residual connection and next rms norm sum)
+  float (* vec_add_sq_sum)(float *a, const float *b, int n);
+
+  // o[i] = a[i] * k * w[i] (rms norm scale)
+  void (* vec_norm_scale)(float *o, const float *a, float k, const float *w, int n);
+
+  // a[i] = swiglu(a[i]) * b[i]
+  void (* vec_swiglu)(float *a, const float *b, int n);
+
+  // RoPE rotate heads of a[a_dim] and b[b_dim] using sin_cos[head_size] (sin[head_size/2], cos[head_size/2]),
+  // rotated pairs are (i, i + head_size/2) in each head (rotate_half)
+  void (* vec_rope)(float *a, float *b, const float *sin_cos, int head_size, int a_dim, int b_dim);
+};
+
+// interface (defined by matmul_init())
+extern struct vec_procs_t vec_procs;
+
+// convert x * k to probabilities 0..1 with x elements sum = 1
+void vec_softmax(float *x, int n, float k);
+
+// init
+void vec_procs_init(enum e_simd_typ simd_typ);
@@ -7,11 +7,16 @@ enum e_w_type
   w_type_sf16,
   w_type_f12,
   w_type_f8,
+  w_type_q8,
+  w_type_q4,
+  w_type_f12s,                         // f12 with row scale
+  w_type_f8s,                          // f8 with row scale
   w_type_COUNT,
 };
 
 // types sizeof
-static const unsigned int w_type_sizeof[w_type_COUNT] = { 4, 2, 2, 2, 2, 1 };
+// note: q8/q4 use blocs with f16 scale, f12s/f8s rows end with scale, datas size must be computed using wd_ne_sizeof
+static const unsigned int w_type_sizeof[w_type_COUNT] = { 4, 2, 2, 2, 2, 1, 1, 1, 2, 1 };
 
 // names of types (in matmul.c)
 extern const char *w_type_name[w_type_COUNT];
@@ -22,3 +27,17 @@ typedef unsigned short bf16_t;
 typedef unsigned short sf16_t;
 typedef unsigned short f12_t;
 typedef unsigned char f8_t;
+typedef unsigned char q8_t;            // q8 blocs, f16 scale followed by Q8_BLOC_NE int8 values
+
+// q8 bloc format
+#define Q8_BLOC_NE 32                  // values per bloc
+#define Q8_BLOC_SZ 34                  // bloc size in bytes (f16 scale + 32 int8)
+
+typedef unsigned char q4_t;            // q4 blocs, f16 scale and min followed by Q4_BLOC_NE 4 bits codes
+
+// q4 bloc format
+#define Q4_BLOC_NE 32                  // values per bloc
+#define Q4_BLOC_SZ 20                  // bloc size in bytes (f16 scale + f16 min + 32 x 4 bits)
+
+// f12s/f8s rows: f12/f8 datas scaled by power of 2 to max converted range, followed by row scale (float)
+#define W_ROW_SCALE_SZ 16              // row scale size in bytes (padded to keep rows 16 bytes aligned)
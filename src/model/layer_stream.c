@@ -0,0 +1,245 @@
+// layer streaming for models larger than memory
+// Streamed weights are allocated for n_buf layers (pipeline depth + 1). While layer L is computed,
+// io thread read layers L+1..L+depth in the other buffers, buffer of L is released when L+1 start.
+
+#include <stdio.h>
+#include <string.h>
+#include "l_util.h"
+#include "mem_alloc.h"
+#include "model.h"
+#include "matmul.h"
+#include "omp_numa.h"
+#include "io_async.h"
+#include "w_src.h"
+#include "layer_stream.h"
+
+#define CVT_ALIGN 4096                 // tensor data alignment in converted weights file
+
+// layer buffer
+struct lay_buf_t
+{
+  int layer_id;                        // loaded/loading layer
+  bool io_err;                         // load error in io thread
+  volatile int ready;                  // 1 when datas loaded
+};
+
+static struct
+{
+  int n_buf;                           // layer buffers
+  int n_layers;
+  int64_t sz_l;                        // streamed size for one layer
+  int64_t cvt_ofs[LAYER_STREAM_NW];    // tensor offset in converted layer bloc, -1 if read in .safetensors
+  int64_t cvt_sz_l;                    // converted layer bloc size
+  struct w_src_t *src;                 // [n_layers][LAYER_STREAM_NW]
+  struct lay_buf_t *buf;               // [n_buf]
+  int cur_layer;                       // layer in use, -1 if none
+  bool io_started;
+
+  // stats
+  int64_t n_load;                      // layers loaded
+  volatile int io_ms;                  // io thread read time
+  int n_stall;                         // count of waits
+  int stall_ms;                        // total wait time
+} ls = { 0 };
+
+// get streamed weights list
+static void get_w_list(struct w_dat_t **wl)
+{
+  struct transformer_weights_t *w = &model.transformer.weights;
+  wl[0] = &w->wq;
+  wl[1] = &w->wk;
+  wl[2] = &w->wv;
+  wl[3] = &w->wo;
+  wl[4] = &w->w1;
+  wl[5] = &w->w2;
+  wl[6] = &w->w3;
+}
+
+int layer_stream_init(void)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  int depth = model.config.layer_stream;
+  struct w_dat_t wd = { 0 };
+  int64_t ne[LAYER_STREAM_NW];
+  int wx[LAYER_STREAM_NW];
+  int i, n_src;
+
+  if (depth <= 0)
+    return 0;
+  if (p->moe.num_experts)
+    msg_error("layer streaming is not supported for MoE models, use moe_page_mem");
+
+  adjust_range_int(&depth, "layer_stream", 1, 8);
+  ls.n_buf = depth + 1;
+  ls.n_layers = p->n_layers;
+  if (ls.n_buf >= ls.n_layers)
+  {
+    msg_info("layer streaming: depth %d allow all layers resident, streaming disabled.\n", depth);
+    ls.n_buf = 0;
+    return 0;
+  }
+
+  // tensors elements count and raw size, same order as get_w_list
+  ne[0] = (int64_t)p->n_heads    * p->head_size * p->dim;  // wq
+  ne[1] = (int64_t)p->n_kv_heads * p->head_size * p->dim;  // wk
+  ne[2] = ne[1];                                           // wv
+  ne[3] = ne[0];                                           // wo
+  ne[4] = (int64_t)p->hidden_dim * p->dim;                 // w1
+  ne[5] = ne[4];                                           // w2
+  ne[6] = ne[4];                                           // w3
+  for (i=0; i<LAYER_STREAM_NW; i++)
+    wx[i] = p->dim;
+  wx[3] = p->n_heads * p->head_size;                       // wo
+  wx[5] = p->hidden_dim;                                   // w2
+
+  // weights which format is converted are saved in converted file
+  // note: get_w_list order match enum e_lw_class order
+  for (i=0; i<LAYER_STREAM_NW; i++)
+  {
+    size_t sz;
+    wd.d_type = p->lw_cls_type[i];
+    wd.wx = wx[i];
+    sz = wd_ne_sizeof(&wd, ne[i]);
+    ls.sz_l += sz;
+    ls.cvt_ofs[i] = -1;
+    if (wd.d_type != p->torch_type)
+    {
+      ls.cvt_ofs[i] = ls.cvt_sz_l;
+      ls.cvt_sz_l += (sz + (CVT_ALIGN-1)) & ~(int64_t)(CVT_ALIGN-1);
+    }
+  }
+
+  msg_info("layer streaming: depth %d, %d/%d layers resident (%.2f Gb)\n", depth, ls.n_buf, ls.n_layers,
+           ((double)ls.sz_l * ls.n_buf) / (1024.0*1024.0*1024.0));
+
+  // sources
+  n_src = ls.n_layers * LAYER_STREAM_NW;
+  ls.src = (struct w_src_t *)malloc_check(n_src * sizeof(struct w_src_t));
+  for (i=0; i<n_src; i++)
+    ls.src[i].file_id = -1;
+
+  ls.buf = (struct lay_buf_t *)calloc_check(ls.n_buf * sizeof(struct lay_buf_t));
+  ls.cur_layer = -1;
+
+  w_src_init("layers", ls.cvt_sz_l * ls.n_layers);
+  return ls.n_buf;
+}
+
+void layer_stream_exit(void)
+{
+  if (!ls.n_buf)
+    return;
+  if (ls.io_started)
+    io_async_exit();
+  w_src_exit();
+  free_check(ls.src);
+  free_check(ls.buf);
+  memset(&ls, 0, sizeof(ls));
+}
+
+// --------------------------
+// load
+
+struct w_src_t *layer_stream_src(const struct w_dat_t *wd, int layer_id, int64_t *cvt_ofs)
+{
+  struct w_dat_t *wl[LAYER_STREAM_NW];
+  int i;
+
+  get_w_list(wl);
+  for (i=0; i<LAYER_STREAM_NW; i++)
+    if (wd == wl[i])
+    {
+      *cvt_ofs = (ls.cvt_ofs[i] < 0) ? -1 : ls.cvt_sz_l * layer_id + ls.cvt_ofs[i];
+      return &ls.src[layer_id * LAYER_STREAM_NW + i];
+    }
+  return NULL;
+}
+
+// io thread job: load layer streamed weights in buffer
+static void load_buf_job(void *arg)
+{
+  struct lay_buf_t *b = (struct lay_buf_t *)arg;
+  struct w_dat_t *wl[LAYER_STREAM_NW];
+  int z = (int)(b - ls.buf);
+  int i, t0 = time_in_ms();
+
+  get_w_list(wl);
+  for (i=0; i<LAYER_STREAM_NW; i++)
+    if (!w_src_read(&ls.src[b->layer_id * LAYER_STREAM_NW + i], wl[i], z))
+    {
+      b->io_err = true;                // error reported by main thread
+      break;
+    }
+  ls.io_ms += time_in_ms() - t0;
+}
+
+static void post_load(struct lay_buf_t *b, int layer_id)
+{
+  b->layer_id = layer_id;
+  io_async_post(load_buf_job, b, &b->ready);
+  ls.n_load++;
+}
+
+void layer_stream_start(void)
+{
+  int i, n_src = ls.n_layers * LAYER_STREAM_NW;
+
+  for (i=0; i<n_src; i++)
+    if (!W_SRC_DEFINED(&ls.src[i]))
+      msg_error("layer streaming: uncomplete layers weight data load");
+
+  w_src_start();
+  io_async_init();
+  ls.io_started = true;
+
+  // start load of first layers window
+  for (i=0; i<ls.n_buf; i++)
+    post_load(&ls.buf[i], i);
+}
+
+// --------------------------
+// run
+
+int layer_stream_get(int layer_id)
+{
+  struct lay_buf_t *b = NULL;
+  int i;
+
+  // release previous layer buffer, load next layer after window
+  if ((ls.cur_layer >= 0) && (ls.cur_layer != layer_id))
+  {
+    for (i=0; i<ls.n_buf; i++)
+      if (ls.buf[i].layer_id == ls.cur_layer)
+        post_load(&ls.buf[i], (ls.cur_layer + ls.n_buf) % ls.n_layers);
+  }
+  ls.cur_layer = layer_id;
+
+  for (i=0; i<ls.n_buf; i++)
+    if (ls.buf[i].layer_id == layer_id)
+      b = &ls.buf[i];
+  CHECK(b);                            // layers not requested in forward order
+
+  if (!b->ready)
+  {
+    int t0 = time_in_ms();
+    io_async_wait(&b->ready);
+    ls.stall_ms += time_in_ms() - t0;
+    ls.n_stall++;
+  }
+  if (b->io_err)
+    msg_error("layer streaming: layer %d read error", layer_id);
+  return (int)(b - ls.buf);
+}
+
+void layer_stream_disp_stats(void)
+{
+  if (ls.n_load)
+  {
+    double sz_gb = ((double)ls.sz_l * ls.n_load) / (1024.0*1024.0*1024.0);
+    double io_s = ls.io_ms * 0.001;
+    msg_info("layer streaming: depth %d, layers loaded %lld (%.2f Gb), io time %.2fs (%.2f Gb/s)\n",
+             ls.n_buf - 1, ls.n_load, sz_gb, io_s, (io_s > 0.0) ? sz_gb / io_s : 0.0);
+    msg_info("layer streaming: stalls %d, stall time %.2fs, io overlap %.1f%%\n", ls.n_stall, ls.stall_ms * 0.001,
+             ls.io_ms ? (100.0 * (ls.io_ms - ls.stall_ms)) / ls.io_ms : 100.0);
+  }
+}
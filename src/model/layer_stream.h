@@ -0,0 +1,29 @@
+// layer streaming: only a window of layers weights (wq/wk/wv/wo/w1/w2/w3) is resident in memory,
+// next layers are read by io thread while current layer is computed (sources defined with w_src).
+
+#define LAYER_STREAM_NW 7              // wq, wk, wv, wo, w1, w2, w3
+
+// init streaming, return count of resident layer buffers (0 if streaming unused)
+int layer_stream_init(void);
+
+// free streaming datas, stop io thread
+void layer_stream_exit(void);
+
+// --------------------------
+// load
+
+// get source of layer tensor and offset in converted weights file, NULL if wd is not streamed (require w_src.h)
+struct w_src_t *layer_stream_src(const struct w_dat_t *wd, int layer_id, int64_t *cvt_ofs);
+
+// check all layers sources are defined, start io thread and load first layers
+void layer_stream_start(void);
+
+// --------------------------
+// run
+
+// get layer weights (wait if load in progress), return z index in streamed weights.
+// layers must be requested in forward order, buffer of previous layer is released for next load.
+int layer_stream_get(int layer_id);
+
+// display streaming statistics (user info)
+void layer_stream_disp_stats(void);
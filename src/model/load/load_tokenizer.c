@@ -43,27 +43,57 @@ static int str_dic_add(struct str_dic_t *dic, const char *str, int len, int allo
 // ------------------------------------
 // tokens
 
-// sort / bsearch tokens
-static int cmp_tokens(const void *a, const void *b)
+// token string hash (FNV-1a)
+static _inline unsigned int str_hash(const char *s)
 {
-  const struct tok_index_t *ta = (const struct tok_index_t *)a;
-  const struct tok_index_t *tb = (const struct tok_index_t *)b;
-  return strcmp(ta->str, tb->str);
+  unsigned int h = 2166136261;
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 16777619;
+  return h;
 }
 
-// sort token list for bsearch
-static void sort_token_list(struct tokenizer_t *t)
+// build token strings hash table, size is power of 2 with load factor <= 0.5
+static void hash_token_list(struct tokenizer_t *t)
 {
-  qsort(t->tok_index, t->tok_index_list_size, sizeof(struct tok_index_t), cmp_tokens);
+  unsigned int sz = 1024;
+  int i;
+  while (sz < (unsigned int)t->tok_index_list_size * 2)
+    sz *= 2;
+  t->tok_hash = (int *)malloc_check(sz * sizeof(int));
+  t->tok_hash_mask = sz - 1;
+  memset(t->tok_hash, 0xff, sz * sizeof(int));   // -1: empty
+
+  for (i=0; i<t->tok_index_list_size; i++)
+  {
+    const char *str = t->tok_index[i].str;
+    unsigned int h = str_hash(str) & t->tok_hash_mask;
+    int k;
+    while ((k = t->tok_hash[h]) >= 0)
+    {
+      if (!strcmp(t->tok_index[k].str, str))
+        break;                                   // same string defined for 2 tokens, keep lowest id
+      h = (h + 1) & t->tok_hash_mask;
+    }
+    if (k < 0)
+      t->tok_hash[h] = i;
+  }
 }
 
 // find a token id from utf8 string, return -1 if not found
 int tokenizer_find_token_id(const char *str)
 {
   const struct tokenizer_t *t = &model.tokenizer;
-  struct tok_index_t tok = { str, 0 };
-  struct tok_index_t *res = bsearch(&tok, t->tok_index, t->tok_index_list_size, sizeof(struct tok_index_t), cmp_tokens);
-  return res ? res->tok_id : -1;
+  unsigned int h = str_hash(str) & t->tok_hash_mask;
+  int k;
+  if (!t->tok_hash)                              // vocab not loaded
+    return -1;
+  while ((k = t->tok_hash[h]) >= 0)
+  {
+    if (!strcmp(t->tok_index[k].str, str))
+      return k;
+    h = (h + 1) & t->tok_hash_mask;
+  }
+  return -1;
 }
 
 // find a special token from string and check is special token
@@ -91,40 +121,131 @@ const char *tokenizer_get_token_str(int token_id)
   const struct tokenizer_t *t = &model.tokenizer;
   if ((unsigned int)token_id >= (unsigned int)t->tok_index_list_size)
     return "<unk>";                              // should never occur
-  return t->tok_index[t->tok_index[token_id].id_to_sort].str;
+  return t->tok_index[token_id].str;
+}
+
+// ------------------------------------
+// special tokens trie
+
+// add a trie node, return node index
+static int sp_trie_add_node(struct tokenizer_t *t, int c)
+{
+  struct sp_trie_t *n;
+  if (!(t->sp_trie_n & 255))
+    t->sp_trie = (struct sp_trie_t *)realloc_check(t->sp_trie, (t->sp_trie_n + 256) * sizeof(struct sp_trie_t));
+  n = &t->sp_trie[t->sp_trie_n];
+  n->c = c;
+  n->tok_id = -1;
+  n->child = 0;
+  n->next = 0;
+  return t->sp_trie_n++;
+}
+
+// build special tokens trie. special tokens are searched in text only at '<' char.
+static void build_sp_trie(struct tokenizer_t *t)
+{
+  int id;
+  sp_trie_add_node(t, 0);                        // root
+  for (id=t->id_special_base; id<=t->id_special_last; id++)
+  {
+    const unsigned char *s = (const unsigned char *)tokenizer_get_token_str(id);
+    int i_n = 0;
+    if (*s != '<')
+      continue;
+    for (; *s; s++)
+    {
+      int i_c = t->sp_trie[i_n].child;
+      while (i_c && (t->sp_trie[i_c].c != *s))
+        i_c = t->sp_trie[i_c].next;
+      if (!i_c)
+      {
+        i_c = sp_trie_add_node(t, *s);           // note: can realloc sp_trie
+        t->sp_trie[i_c].next = t->sp_trie[i_n].child;
+        t->sp_trie[i_n].child = i_c;
+      }
+      i_n = i_c;
+    }
+    if (t->sp_trie[i_n].tok_id < 0)              // keep lowest id if same string
+      t->sp_trie[i_n].tok_id = id;
+  }
+}
+
+// find special token starting text, return token id and set end of token string in text, -1 if not found
+// if many special tokens strings are prefix of text, lowest token id is returned.
+int tokenizer_find_sp_token_prefix(const char *text, const char **end)
+{
+  const struct tokenizer_t *t = &model.tokenizer;
+  const unsigned char *s = (const unsigned char *)text;
+  int i_n = 0, id = -1;
+  for (; *s; s++)
+  {
+    int i_c = t->sp_trie[i_n].child;
+    while (i_c && (t->sp_trie[i_c].c != *s))
+      i_c = t->sp_trie[i_c].next;
+    if (!i_c)
+      break;
+    i_n = i_c;
+    if ((t->sp_trie[i_n].tok_id >= 0) && ((id < 0) || (t->sp_trie[i_n].tok_id < id)))
+    {
+      id = t->sp_trie[i_n].tok_id;
+      *end = (const char *)s + 1;
+    }
+  }
+  return id;
 }
 
 // ------------------------------------
 // merges
 
-// sort / bsearch merges
-static int cmp_merges(const void *a, const void *b)
+// hash of merge tokens pair
+static _inline unsigned int merge_hash(int l_id, int r_id)
 {
-  const struct merge_id_t *ma = (const struct merge_id_t *)a;
-  const struct merge_id_t *mb = (const struct merge_id_t *)b;
-  if (ma->tok_id_l > mb->tok_id_l)
-    return 1;
-  if (ma->tok_id_l < mb->tok_id_l)
-    return -1;
-  if (ma->tok_id_r > mb->tok_id_r)
-    return 1;
-  if (ma->tok_id_r < mb->tok_id_r)
-    return -1;
-  return 0;
+  unsigned int h = (unsigned int)l_id * 0x9e3779b1 ^ (unsigned int)r_id * 0x85ebca77;
+  return h ^ (h >> 15);
 }
 
-// sort merge strings for bsearch
-static void sort_merge_list(struct tokenizer_t *t)
+// build merge pairs hash table, size is power of 2 with load factor <= 0.5
+static void hash_merge_list(struct tokenizer_t *t)
 {
-  qsort(t->merge.id_list, t->merge.list_size, sizeof(struct merge_id_t), cmp_merges);
+  unsigned int sz = 1024;
+  int i;
+  while (sz < (unsigned int)t->merge.list_size * 2)
+    sz *= 2;
+  t->merge.hash = (int *)malloc_check(sz * sizeof(int));
+  t->merge.hash_mask = sz - 1;
+  memset(t->merge.hash, 0xff, sz * sizeof(int));  // -1: empty
+
+  for (i=0; i<t->merge.list_size; i++)
+  {
+    const struct merge_id_t *m_id = &t->merge.id_list[i];
+    unsigned int h = merge_hash(m_id->tok_id_l, m_id->tok_id_r) & t->merge.hash_mask;
+    int k;
+    while ((k = t->merge.hash[h]) >= 0)
+    {
+      const struct merge_id_t *m = &t->merge.id_list[k];
+      if ((m->tok_id_l == m_id->tok_id_l) && (m->tok_id_r == m_id->tok_id_r))
+        break;                                   // duplicate pair, keep first (lowest merge_id)
+      h = (h + 1) & t->merge.hash_mask;
+    }
+    if (k < 0)
+      t->merge.hash[h] = i;
+  }
 }
 
 // find merge datas, return NULL if not found
 const struct merge_id_t *bpe_find_merge(int l_id, int r_id)
 {
   const struct tokenizer_t *t = &model.tokenizer;
-  struct merge_id_t merge = { l_id, r_id, 0 };
-  return bsearch(&merge, t->merge.id_list, t->merge.list_size, sizeof(struct merge_id_t), cmp_merges);
+  unsigned int h = merge_hash(l_id, r_id) & t->merge.hash_mask;
+  int k;
+  while ((k = t->merge.hash[h]) >= 0)
+  {
+    const struct merge_id_t *m = &t->merge.id_list[k];
+    if ((m->tok_id_l == l_id) && (m->tok_id_r == r_id))
+      return m;
+    h = (h + 1) & t->merge.hash_mask;
+  }
+  return NULL;
 }
 
 // ------------------------------------
@@ -398,24 +519,17 @@ void load_tokenizer(const char *file_name)
       t->tok_index = (struct tok_index_t *)realloc_check(t->tok_index, i * sizeof(struct tok_index_t));
       t->tok_index_list_size = i;
 
-      // convert string offset in dic to string pointers, required because use of qsort and bsearch
+      // convert string offset in dic to string pointers, required because dic realloc during load
       for (i=0; i<t->tok_index_list_size; i++)
       {
         int dic_ofs = t->tok_index[i].tok_id;
         t->tok_index[i].str = &t->dic_tokens.buff[dic_ofs];  // set pointer to string
-        t->tok_index[i].tok_id = i;                          // set id before sort
-        t->tok_index[i].id_to_sort = 0;
+        t->tok_index[i].tok_id = i;
       }
       
-      // sort token list for bsearch
-      sort_token_list(t);
-
-      // set id_to_sort, used to get token string from token index in sorted table
-      for (i=0; i<t->tok_index_list_size; i++)
-      {
-        CHECK(t->tok_index[t->tok_index[i].tok_id].id_to_sort == 0);
-        t->tok_index[t->tok_index[i].tok_id].id_to_sort = i;
-      }
+      // build token strings hash table and special tokens trie
+      hash_token_list(t);
+      build_sp_trie(t);
     }
     else
     // --------------------------------
@@ -431,8 +545,8 @@ void load_tokenizer(const char *file_name)
       }
       while (!inf.is_arr_end && js_read_param(h, &inf));  // read next
 
-      // sort merge strings for bsearch
-      sort_merge_list(t);
+      // build merge pairs hash table
+      hash_merge_list(t);
     }
   }
 
@@ -1,5 +1,8 @@
 // find merge datas, return NULL if not found (code in load_tokenizer.c)
 const struct merge_id_t *bpe_find_merge(int l_id, int r_id);
 
+// find special token starting text, return token id and set end of token string in text, -1 if not found
+int tokenizer_find_sp_token_prefix(const char *text, const char **end);
+
 // load (private to tokenizer.c, defined in load_tokenizer.c)
 void load_tokenizer(const char *file_name);
@@ -11,6 +11,9 @@
 #include "matmul.h"
 #include "omp_numa.h"
 #include "load_transformer.h"
+#include "w_src.h"
+#include "moe_page.h"
+#include "layer_stream.h"
 
 // ----------------------------------------------
 // init config with config.json
@@ -52,6 +55,12 @@ void load_checkpoint_config(void)
     CHECK_KEY("model_type", "mixtral");
     p->moe.num_experts = GET_KEY_I32("num_local_experts");   // 8 (mixtral 8x7b)
     p->moe.top_k       = GET_KEY_I32("num_experts_per_tok"); // 2 (mixtral 8x7b)
+    p->moe.skip_th     = model.config.moe_skip_th;           // adaptive routing threshold
+    if (p->moe.skip_th > 0.0f)
+    {
+      adjust_range_f32(&p->moe.skip_th, "moe_skip_th", 0.0f, 0.5f);
+      msg_info("MoE adaptive routing: skip experts with normalized weight < %.3f\n", p->moe.skip_th);
+    }
   }
   else
   if (model_id == model_id_qwen2)
@@ -135,7 +144,10 @@ struct tens_inf_t
   int64_t data_ofs[2];                 // data offset in file
 };
 
-// temporary buffer used to transpose or convert float format
+// temporary buffer used to convert float format, conversion is done by chunks of rows to limit
+// memory used at load (large embeddings/classifier tensors)
+#define CVT_CHUNK_SZ (16*1024*1024)    // max chunk size read in file
+
 static struct
 {
   void *w;
@@ -152,34 +164,82 @@ static void tmp_realloc(int64_t sz)
   }
 }
 
-// ---------------------------------------------------------------
-// safetensors q/k weights/bias data are permuted in python using:
+// note: safetensors q/k weights/bias datas are permuted in python using:
 // w.view(dim1, dim2).reshape(n_heads, dim1 // n_heads // 2, 2, dim2).transpose(1, 2).reshape(dim1, dim2)
-// here operation is reversed for format used in transformer.c math
-static void inv_reshape_4_transpose_12(char *wd, const char *ws, size_t sz_wx, int wy, int n_heads)
+// they are used without reverse permutation, RoPE rotate (i, i + head_size/2) pairs (rotate_half).
+
+// define chunk rows count and get file/memory row sizes, alloc chunk buffers
+static int cvt_chunk_init(const struct tens_inf_t *ti, const struct w_dat_t *wd, size_t *sz_rs, size_t *sz_rd)
 {
-  int a, b, c;
-  int na = n_heads;
-  int nb = (wy / n_heads) / 2;
-  int nc = 2;
-  
-  for (a=0; a<na; a++)
-    for (b=0; b<nb; b++)
-      for (c=0; c<nc; c++)
+  int ny;
+  *sz_rs = (size_t)wd->wx * w_type_sizeof[ti->d_type];   // row size in file
+  *sz_rd = wd_ne_sizeof(wd, wd->wx);                      // row size in memory
+  ny = (int)(CVT_CHUNK_SZ / *sz_rs);
+  if (ny < 1)
+    ny = 1;
+  if (ny > wd->wy)
+    ny = wd->wy;
+  tmp_realloc((int64_t)ny * (*sz_rs + *sz_rd));
+  return ny;
+}
+
+// check tensor shape and binary size match with expected format
+static void check_tensor(const struct tens_inf_t *ti, const struct w_dat_t *wd)
+{
+  size_t ne = (size_t)ti->shape[1] * ti->shape[0];
+  size_t sz_ld = ne * w_type_sizeof[ti->d_type]; // data size in file
+
+  // check shape
+  if ((ti->shape[0] != wd->wx) || (ti->shape[1] != wd->wy))
+    msg_error("%s: w sizes: [%d, %d], expected [%d, %d]\n", ti->name, ti->shape[0], ti->shape[1], wd->wx, wd->wy);
+
+  // check binary size match with expected format
+  if (sz_ld != (ti->data_ofs[1] - ti->data_ofs[0]))
+    msg_error("tensor binary size missmatch");
+}
+
+// weights read at run time (MoE paging, layer streaming): define where to read datas.
+// if convert is required, datas are saved in converted weights file.
+static void load_weights_src(file_t *file, const struct tens_inf_t *ti, const struct w_dat_t *wd, struct w_src_t *src, int64_t cvt_ofs)
+{
+  bool cvt = ti->d_type != wd->d_type;
+  size_t ne = (size_t)ti->shape[1] * ti->shape[0];
+
+  check_tensor(ti, wd);
+  if (!cvt)                                      // read in .safetensors file
+    w_src_def(src, file->seek_ofs + ti->data_ofs[0]);
+  else
+  {
+    if (cvt_ofs < 0)
+      msg_error("%s: undefined converted data offset", ti->name);  // is assert
+
+    if (w_src_cvt_valid())                       // already converted
+      w_src_def_cvt(src, cvt_ofs, NULL, wd_ne_sizeof(wd, ne));
+    else
+    {
+      // convert and write by chunks, first chunk define src
+      struct w_src_t s_chunk;
+      size_t sz_rs, sz_rd;
+      int y, n, ny = cvt_chunk_init(ti, wd, &sz_rs, &sz_rd);
+      char *tmp0 = (char *)tmp_buff.w;
+      char *tmp1 = tmp0 + (size_t)ny * sz_rs;
+      f_seek(file, file->seek_ofs + ti->data_ofs[0], SEEK_SET);
+      for (y=0; y<wd->wy; y+=n)
       {
-        //size_t id = (size_t)a*nb*nc + c*nb + b;
-        size_t id = ((size_t)a*nc + c)*nb + b;
-        memcpy(wd, ws + id * sz_wx, sz_wx);
-        wd += sz_wx;
+        n = ((wd->wy - y) < ny) ? wd->wy - y : ny;
+        f_read(tmp0, (size_t)n * sz_rs, file);
+        cvt_w_data(tmp1, wd->d_type, tmp0, ti->d_type, (size_t)n * wd->wx, wd->wx);
+        w_src_def_cvt(y ? &s_chunk : src, cvt_ofs + (int64_t)y * sz_rd, tmp1, (size_t)n * sz_rd);
       }
+    }
+  }
 }
 
-// load weights datas in file format and convert to expected memory format, transpose if tr != NULL
-static void load_weights_cvt(file_t *file, const struct tens_inf_t *ti, int layer_id, struct w_dat_t *wd, bool optional, int tr_n_heads)
+// load weights datas in file format and convert to expected memory format
+static void load_weights_cvt(file_t *file, const struct tens_inf_t *ti, int layer_id, struct w_dat_t *wd, bool optional)
 {
   bool cvt = ti->d_type != wd->d_type;           // test if convert type required
   size_t ne = (size_t)ti->shape[1] * ti->shape[0];
-  size_t sz_ld = ne * w_type_sizeof[ti->d_type]; // data size in file
   
   // skip data if optional and not required (mem not allocated) (ex: rope freq)
   if (!wd->wx)
@@ -189,78 +249,101 @@ static void load_weights_cvt(file_t *file, const struct tens_inf_t *ti, int laye
     return;
   }
 
-  // check shape and seek to datas in file
-  if ((ti->shape[0] != wd->wx) || (ti->shape[1] != wd->wy))
-    msg_error("%s: w sizes: [%d, %d], expected [%d, %d]\n", ti->name, ti->shape[0], ti->shape[1], wd->wx, wd->wy);
+  // layers with different types (w_policy), load in layer datas
+  if (wd->z_wd)
+  {
+    check_tensor(ti, wd);
+    load_weights_cvt(file, ti, 0, &wd->z_wd[layer_id], optional);
+    wd->ne += ne;
+    return;
+  }
 
-  // check binary size match with expected format
-  if (sz_ld != (ti->data_ofs[1] - ti->data_ofs[0]))
-    msg_error("tensor binary size missmatch");
+  // layer streaming, streamed weights are read at run time
+  if (model.transformer.config.stream_nbuf)
+  {
+    int64_t cvt_ofs;
+    struct w_src_t *src = layer_stream_src(wd, layer_id, &cvt_ofs);
+    if (src)
+    {
+      load_weights_src(file, ti, wd, src, cvt_ofs);
+      return;
+    }
+  }
+
+  check_tensor(ti, wd);
 
   // seek to datas in file
   f_seek(file, file->seek_ofs + ti->data_ofs[0], SEEK_SET);
 
   // load and convert datas
-  if (!cvt && !tr_n_heads)                       // direct load without conversion possible
+  if (!cvt)                                      // direct load without conversion possible
     numa_cpy_wd_z(wd, layer_id, NULL, file);
   else
   {
     // get weight pointer, can be used directly only if single node used (single continuous buffer)
     char *w = (wd->nn == 1) ? (char *)wd->lp[0].p + wd->lp[0].sz_l * layer_id : NULL;
-    char *d_cvt, *s_tr, *d_tr, *res;             // convert/transpose source/dest buffers and final result
-    
-    // get working buffers
-    void *tmp0, *tmp1;
-    tmp_realloc(sz_ld * 2);
-    tmp0 = (char *)tmp_buff.w;
-    tmp1 = (char *)tmp_buff.w + sz_ld;
+    size_t sz_rs, sz_rd;
+    int y, n, ny = cvt_chunk_init(ti, wd, &sz_rs, &sz_rd);
+    char *tmp0 = (char *)tmp_buff.w;
+    char *tmp1 = tmp0 + (size_t)ny * sz_rs;
 
-    // load data in tmp0
-    f_read(tmp0, sz_ld, file);
-
-    if (cvt && tr_n_heads)                       // convert + transpose
-    {
-      d_cvt = tmp1;
-      s_tr = tmp1;
-      d_tr = w ? w : tmp0;
-      res = d_tr;
-    }
-    else
-    if (cvt)                                     // convert only
-    {
-      d_cvt = w ? w : tmp1;                      // copy result in w
-      res = d_cvt;
-    }
-    else                                         // transpose only
+    // load and convert by chunks of rows, result in w if possible else copied in thread parts
+    for (y=0; y<wd->wy; y+=n)
     {
-      s_tr = tmp0;                               // source is load buffer
-      d_tr = w ? w : tmp1;
-      res = d_tr;
+      n = ((wd->wy - y) < ny) ? wd->wy - y : ny;
+      f_read(tmp0, (size_t)n * sz_rs, file);
+      if (w)
+      {
+        cvt_w_data(w + (size_t)y * sz_rd, wd->d_type, tmp0, ti->d_type, (size_t)n * wd->wx, wd->wx);
+        wd->ne += (size_t)n * wd->wx;
+      }
+      else
+      {
+        cvt_w_data(tmp1, wd->d_type, tmp0, ti->d_type, (size_t)n * wd->wx, wd->wx);
+        numa_cpy_wd_rows(wd, layer_id, y, n, tmp1);
+      }
     }
+  }
+}
 
-    // convert load format to memory format
-    if (cvt)
-      cvt_w_data(d_cvt, wd->d_type, tmp0, ti->d_type, ne);
+// token embeddings kept in file (emb_disk), source used to load classifier if lm_head.weight undefined
+static struct
+{
+  char *file_name;
+  int64_t seek_ofs;
+  struct tens_inf_t ti;
+} emb_ld = { 0 };
 
-    // reverse permutation
-    if (tr_n_heads)
-    {
-      if (wd->wy == 1)      // bias datas
-        inv_reshape_4_transpose_12(d_tr, s_tr, w_type_sizeof[wd->d_type], wd->wx, tr_n_heads);
-      else                  // weights datas
-        inv_reshape_4_transpose_12(d_tr, s_tr, wd_ne_sizeof(wd, wd->wx), wd->wy, tr_n_heads);
-    }
+static void def_emb_src(const char *file_name, const file_t *file, const struct tens_inf_t *ti)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  size_t sz_ld = (size_t)ti->shape[1] * ti->shape[0] * w_type_sizeof[ti->d_type];
 
-    if (res == w)
-      wd->ne += ne;
-    else
-      numa_cpy_wd_z(wd, layer_id, res, NULL);    // copy result
-  }
+  if ((ti->shape[0] != p->dim) || (ti->shape[1] != p->vocab_size))
+    msg_error("%s: w sizes: [%d, %d], expected [%d, %d]\n", ti->name, ti->shape[0], ti->shape[1], p->dim, p->vocab_size);
+  if (sz_ld != (ti->data_ofs[1] - ti->data_ofs[0]))
+    msg_error("tensor binary size missmatch");
+
+  emb_ld.file_name = str_alloc(file_name, (int)strlen(file_name));
+  emb_ld.seek_ofs = file->seek_ofs;
+  emb_ld.ti = *ti;
+  emb_ld.ti.name = "model.embed_tokens.weight";
+  w_src_emb_def(file_name, file->seek_ofs + ti->data_ofs[0], ti->d_type, ti->shape[0]);
+}
+
+// load embeddings in classifier (tied embeddings with emb_disk)
+static void load_emb_wcls(struct w_dat_t *wcls)
+{
+  file_t f = { 0 };
+  f_open(&f, emb_ld.file_name, "rb");
+  f.seek_ofs = emb_ld.seek_ofs;
+  load_weights_cvt(&f, &emb_ld.ti, 0, wcls, false);
+  f_close(&f);
 }
 
 // load layer weights
 static void load_layer_weights(file_t *file, const struct tens_inf_t *t_inf, const char *js_key, 
-                               struct transformer_weights_t *w, int n_heads, int n_kv_heads, int n_experts)
+                               struct transformer_weights_t *w, int n_experts)
 {
   char *e;
   int layer_id = strtol(js_key, &e, 10);   // get layer id in key name
@@ -268,56 +351,64 @@ static void load_layer_weights(file_t *file, const struct tens_inf_t *t_inf, con
   js_key += l;                             // pass layer number
 
   // test name and load w if name match and return
-  #define W_TST_LD(_key, _w, _opt, _tr)\
-    if (!strcmp(js_key, _key)) { load_weights_cvt(file, t_inf, layer_id, &_w, _opt, _tr); return; }
+  #define W_TST_LD(_key, _w, _opt)\
+    if (!strcmp(js_key, _key)) { load_weights_cvt(file, t_inf, layer_id, &_w, _opt); return; }
 
   // debug: display json keys
   // msg_info("load layer %d:tensort name \"%s\"\n", layer_id, js_key);
 
   // attention weights
-  W_TST_LD(".input_layernorm.weight"         , w->rms_att, false, 0);
-  W_TST_LD(".self_attn.rotary_emb.inv_freq"  , w->rope_if, true , 0);
+  W_TST_LD(".input_layernorm.weight"         , w->rms_att, false);
+  W_TST_LD(".self_attn.rotary_emb.inv_freq"  , w->rope_if, true );
   
   // qkv weights
-  W_TST_LD(".self_attn.q_proj.weight"        , w->wq     , false, n_heads);
-  W_TST_LD(".self_attn.k_proj.weight"        , w->wk     , false, n_kv_heads);
-  W_TST_LD(".self_attn.v_proj.weight"        , w->wv     , false, 0);
+  W_TST_LD(".self_attn.q_proj.weight"        , w->wq     , false);
+  W_TST_LD(".self_attn.k_proj.weight"        , w->wk     , false);
+  W_TST_LD(".self_attn.v_proj.weight"        , w->wv     , false);
 
   // (optional) qkv bias
-  W_TST_LD(".self_attn.q_proj.bias"          , w->bq     , false, n_heads);
-  W_TST_LD(".self_attn.k_proj.bias"          , w->bk     , false, n_kv_heads);
-  W_TST_LD(".self_attn.v_proj.bias"          , w->bv     , false, 0);
+  W_TST_LD(".self_attn.q_proj.bias"          , w->bq     , false);
+  W_TST_LD(".self_attn.k_proj.bias"          , w->bk     , false);
+  W_TST_LD(".self_attn.v_proj.bias"          , w->bv     , false);
 
-  W_TST_LD(".self_attn.o_proj.weight"        , w->wo     , false, 0);
-  W_TST_LD(".post_attention_layernorm.weight", w->rms_ffn, false, 0);
+  W_TST_LD(".self_attn.o_proj.weight"        , w->wo     , false);
+  W_TST_LD(".post_attention_layernorm.weight", w->rms_ffn, false);
 
   // w1/w2/w3
   if (!n_experts)  // not MoE
   {
-    W_TST_LD(".mlp.gate_proj.weight" , w->w1, false, 0);
-    W_TST_LD(".mlp.down_proj.weight" , w->w2, false, 0);
-    W_TST_LD(".mlp.up_proj.weight"   , w->w3, false, 0);
+    W_TST_LD(".mlp.gate_proj.weight" , w->w1, false);
+    W_TST_LD(".mlp.down_proj.weight" , w->w2, false);
+    W_TST_LD(".mlp.up_proj.weight"   , w->w3, false);
   }
   else             // MoE
   {
-    W_TST_LD(".block_sparse_moe.gate.weight" , w->moe_gate, false, 0);
+    W_TST_LD(".block_sparse_moe.gate.weight" , w->moe_gate, false);
 
     // experts w1/w2/w3
     if (!memcmp(js_key, ".block_sparse_moe.experts.", 26))
     {
       struct w_dat_t *wx;
       char *e;
+      int w_id;
       int exp_id = strtol((js_key += 26), &e, 10);  // get expert id
       if ((js_key == e) || (exp_id >= n_experts))
         msg_error("MoE invalid expert id");
 
-      if      (!strcmp(e, ".w1.weight")) wx = &w->w1;
-      else if (!strcmp(e, ".w2.weight")) wx = &w->w2;
-      else if (!strcmp(e, ".w3.weight")) wx = &w->w3;
+      if      (!strcmp(e, ".w1.weight")) { wx = &w->w1; w_id = 0; }
+      else if (!strcmp(e, ".w2.weight")) { wx = &w->w2; w_id = 1; }
+      else if (!strcmp(e, ".w3.weight")) { wx = &w->w3; w_id = 2; }
       else
         msg_error("MoE invalid weight identifier");
 
-      load_weights_cvt(file, t_inf, layer_id * n_experts + exp_id, wx, false, 0);
+      if (model.transformer.config.moe.page_slots)  // expert paging
+      {
+        int64_t cvt_ofs;
+        struct w_src_t *src = moe_page_src(layer_id, exp_id, w_id, &cvt_ofs);
+        load_weights_src(file, t_inf, wx, src, cvt_ofs);
+      }
+      else
+        load_weights_cvt(file, t_inf, layer_id * n_experts + exp_id, wx, false);
       return;
     }
   }
@@ -366,7 +457,7 @@ static void load_weights_info(struct h_json_t *h, struct js_read_inf_t *j_inf, s
   while (!j_inf->is_lev_end && js_read_param(h, j_inf));  // read next
 }
 
-static void load_file_st(const char *file_name, struct transformer_weights_t *weights, int n_heads, int n_kv_heads, int n_experts)
+static void load_file_st(const char *file_name, struct transformer_weights_t *weights, int n_experts)
 {
   file_t f = { 0 };
   struct js_read_inf_t j_inf = { 0 };
@@ -410,25 +501,28 @@ static void load_file_st(const char *file_name, struct transformer_weights_t *we
     if ((l = KEY_EQ(t_inf.name, "model.layers."))) // layer data
     {
       load_weights_info(h, &j_inf, &t_inf);
-      load_layer_weights(&f, &t_inf, t_inf.name + l, weights, n_heads, n_kv_heads, n_experts);
+      load_layer_weights(&f, &t_inf, t_inf.name + l, weights, n_experts);
     }
     else
     if (KEY_EQ(t_inf.name, "model.embed_tokens.weight"))
     {
       load_weights_info(h, &j_inf, &t_inf);
-      load_weights_cvt(&f, &t_inf, 0, &weights->token_emb, false, 0);
+      if (model.transformer.config.emb_disk)     // rows read at run time
+        def_emb_src(file_name, &f, &t_inf);
+      else
+        load_weights_cvt(&f, &t_inf, 0, &weights->token_emb, false);
     }
     else
     if (KEY_EQ(t_inf.name, "lm_head.weight"))
     {
       load_weights_info(h, &j_inf, &t_inf);
-      load_weights_cvt(&f, &t_inf, 0, &weights->wcls, false, 0);
+      load_weights_cvt(&f, &t_inf, 0, &weights->wcls, false);
     }
     else
     if (KEY_EQ(t_inf.name, "model.norm.weight"))
     {
       load_weights_info(h, &j_inf, &t_inf);
-      load_weights_cvt(&f, &t_inf, 0, &weights->rms_final, false, 0);
+      load_weights_cvt(&f, &t_inf, 0, &weights->rms_final, false);
     }
     else
     if (!KEY_EQ(t_inf.name, "__metadata__"))     // is ignored
@@ -452,16 +546,26 @@ static void check_load(struct transformer_weights_t *w, struct transformer_confi
   if (p->moe.num_experts)
     chk_ne_loaded(&w->moe_gate);
 
-  chk_ne_loaded(&w->token_emb);
+  if (!p->emb_disk)
+    chk_ne_loaded(&w->token_emb);
+  else
+  if (!emb_ld.file_name)
+    msg_error("token embeddings not found in .safetensors files");
   chk_ne_loaded(&w->rms_att);
-  chk_ne_loaded(&w->wq);
-  chk_ne_loaded(&w->wk);
-  chk_ne_loaded(&w->wv);
-  chk_ne_loaded(&w->wo);
   chk_ne_loaded(&w->rms_ffn);
-  chk_ne_loaded(&w->w1);
-  chk_ne_loaded(&w->w2);
-  chk_ne_loaded(&w->w3);
+  if (!p->stream_nbuf)                 // else checked in layer_stream_start
+  {
+    chk_ne_loaded(&w->wq);
+    chk_ne_loaded(&w->wk);
+    chk_ne_loaded(&w->wv);
+    chk_ne_loaded(&w->wo);
+    if (!p->moe.page_slots)            // else checked in moe_page_start
+    {
+      chk_ne_loaded(&w->w1);
+      chk_ne_loaded(&w->w2);
+      chk_ne_loaded(&w->w3);
+    }
+  }
   chk_ne_loaded(&w->rms_final);
 
   // rope
@@ -483,10 +587,26 @@ static void check_load(struct transformer_weights_t *w, struct transformer_confi
   else
   {
     msg_info("info: classifier use embed_tokens.weight.\n");
-    free_wd(&w->wcls);
-    w->wcls = w->token_emb;
+    if (p->emb_disk)                   // embeddings kept resident as classifier only
+    {
+      load_emb_wcls(&w->wcls);
+      chk_ne_loaded(&w->wcls);
+      w->token_emb = w->wcls;
+      w_src_emb_exit();
+      p->emb_disk = false;
+      msg_info("emb_disk: embeddings used as classifier are kept in memory.\n");
+    }
+    else
+    {
+      free_wd(&w->wcls);
+      w->wcls = w->token_emb;
+    }
   }
 
+  if (p->emb_disk)
+    msg_info("token embeddings read in file for each token (%.3f Gb not loaded)\n",
+             (emb_ld.ti.data_ofs[1] - emb_ld.ti.data_ofs[0]) / (1024.0*1024.0*1024.0));
+
   // optional bias
   if (w->bq.ne)
   {
@@ -528,14 +648,28 @@ void load_checkpoint_weights(void)
     if ((l < 0) || (l == sizeof(path_name)))
       msg_error(".safetensors path + name too long or invalid format");
     
+    // expert paging or layer streaming, weights are read in file at run time
+    if (config->moe.page_slots || config->stream_nbuf)
+      w_src_set_file(path_name);
+
     // load part
-    load_file_st(path_name, weights, config->n_heads, config->n_kv_heads, config->moe.num_experts);
+    load_file_st(path_name, weights, config->moe.num_experts);
   }
 
   // check all loaded
   check_load(weights, config);
 
+  // expert paging, start io and load resident experts
+  if (config->moe.page_slots)
+    moe_page_start();
+
+  // layer streaming, start io and load first layers
+  if (config->stream_nbuf)
+    layer_stream_start();
+
   // free temporary buffer
+  free_check(emb_ld.file_name);
+  memset(&emb_ld, 0, sizeof(emb_ld));
   free_check(tmp_buff.w);
   tmp_buff.w = NULL;
   tmp_buff.sz_alloc = 0;
@@ -0,0 +1,350 @@
+// matmul kernels/threads autotune
+// Candidates are the simd code versions of each matmul used by the model (sse/avx/avx2/avx512, avx2/avx512
+// versions compute multiple rows per block), the multi rows prefetch distance and the threads count per node.
+// Winners are saved in a profile file named with CPU model, loaded on later runs (autotune = 1).
+
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+#include "l_util.h"
+#include "mem_alloc.h"
+#include "json.h"
+#include "model.h"
+#include "matmul.h"
+#include "omp_numa.h"
+#include "mm_tune.h"
+
+#define TUNE_MIN_TIME 0.15             // min measure time in seconds for one candidate
+#define TUNE_MAX_SZ (256*1024*1024)    // max test matrix size in bytes (must exceed cpu caches)
+
+// prefetch distances candidates
+static const int pf_dist_list[] = { 0, 256, 512, 1024, 2048 };
+#define N_PF_DIST (sizeof(pf_dist_list) / sizeof(pf_dist_list[0]))
+
+// tuning profile
+static struct
+{
+  char name[256];                      // file name
+  int mm_simd[w_type_COUNT];           // simd version of matmul for each weights type, -1 if undefined
+  int pf_dist;                         // -1 if undefined
+  int num_procs;                       // 0 if undefined
+  int n_nodes;                         // nodes count used for num_procs
+  bool save;                           // modified, need save
+} tp = { 0 };
+
+// define profile file name, CPU model without spaces and special chars
+static void def_profile_name(const char *dir)
+{
+  char cpu[sizeof(matmul_procs.cpu_model)];
+  const char *s = matmul_procs.cpu_model;
+  int l = 0;
+  bool sep = false;
+
+  for (; *s; s++)
+  {
+    if (((*s >= 'a') && (*s <= 'z')) || ((*s >= 'A') && (*s <= 'Z')) || ((*s >= '0') && (*s <= '9')))
+    {
+      if (sep && l)
+        cpu[l++] = '_';
+      cpu[l++] = *s;
+      sep = false;
+    }
+    else
+      sep = true;
+  }
+  cpu[l] = 0;
+
+  l = _snprintf(tp.name, sizeof(tp.name), "%s/mm_tune_%s.json", dir, l ? cpu : "cpu");
+  if ((l < 0) || (l == sizeof(tp.name)))
+    msg_error("autotune_dir path too long");
+}
+
+// load profile if file exist
+static void load_profile(void)
+{
+  struct h_json_t *h;
+  FILE *fp = fopen(tp.name, "rb");
+  int i;
+  if (!fp)
+    return;
+  fclose(fp);
+
+  h = js_load_file(tp.name, false);
+  for (i=0; i<w_type_COUNT; i++)
+  {
+    char key[32];
+    sprintf(key, "mm_simd.%s", w_type_name[i]);
+    if (js_find_key_list(h, key))
+      tp.mm_simd[i] = js_get_num_value_i32(h);
+  }
+  if (js_find_key_list(h, "pf_dist"))
+    tp.pf_dist = js_get_num_value_i32(h);
+  if (js_find_key_list(h, "num_procs"))
+    tp.num_procs = js_get_num_value_i32(h);
+  if (js_find_key_list(h, "n_nodes"))
+    tp.n_nodes = js_get_num_value_i32(h);
+  js_close(h);
+  msg_info("autotune: profile %s loaded\n", tp.name);
+}
+
+static void save_profile(void)
+{
+  bool first = true;
+  FILE *fp = fopen(tp.name, "w");
+  int i;
+  if (!fp)
+  {
+    msg_info("autotune: can't create file %s\n", tp.name);
+    return;
+  }
+  fprintf(fp, "{\n  \"cpu_model\": \"%s\",\n  \"mm_simd\": {", matmul_procs.cpu_model);
+  for (i=0; i<w_type_COUNT; i++)
+    if (tp.mm_simd[i] >= 0)
+    {
+      fprintf(fp, "%s \"%s\": %d", first ? "" : ",", w_type_name[i], tp.mm_simd[i]);
+      first = false;
+    }
+  fprintf(fp, " },\n  \"pf_dist\": %d,\n  \"num_procs\": %d,\n  \"n_nodes\": %d\n}\n", tp.pf_dist, tp.num_procs, tp.n_nodes);
+  fclose(fp);
+  msg_info("autotune: profile saved in %s\n", tp.name);
+}
+
+int mm_tune_init(void)
+{
+  const struct run_conf_t *conf = &model.config;
+  enum e_w_type t;
+
+  if (!conf->autotune)
+    return conf->num_procs;
+
+  memset(&tp, 0, sizeof(tp));
+  for (t=0; t<w_type_COUNT; t++)
+    tp.mm_simd[t] = -1;
+  tp.pf_dist = -1;
+  def_profile_name(conf->autotune_dir ? conf->autotune_dir : ".");
+  if (conf->autotune == 1)                       // 2: always tune again
+    load_profile();
+
+  // apply profile, user defined simd_mode/mm_pf_dist/num_procs are kept
+  for (t=0; t<w_type_COUNT; t++)
+    if (tp.mm_simd[t] >= 0)
+      matmul_set_simd(t, (tp.mm_simd[t] < (int)matmul_procs.simd_set) ? tp.mm_simd[t] : matmul_procs.simd_set);
+  if ((tp.pf_dist >= 0) && (conf->mm_pf_dist < 0))
+    matmul_procs.pf_dist = tp.pf_dist;
+  if ((conf->num_procs <= 0) && (conf->numa_nodes <= 0) && tp.num_procs)
+  {
+    if (!numa.n_procs)
+      init_numa_info();                          // get numa hardware config
+    if (tp.n_nodes == numa.n_nodes)
+      return tp.num_procs;
+    msg_info("autotune: profile threads count ignored (tuned for %d nodes, %d found)\n", tp.n_nodes, numa.n_nodes);
+    tp.num_procs = 0;                            // tune again for current nodes
+  }
+  return conf->num_procs;
+}
+
+// --------------------------
+// measures
+
+static int tn_id[MAX_NUMA_PROCS];      // thread local index in node
+
+// return best time in ms of matmul of all wd thread parts using mm.
+// threads with node local index >= tpn are idle, their parts are computed by active threads of same node.
+static double time_mm(const struct w_dat_t *wd, mm_proc_t mm, const float *vec, float *res, int tpn)
+{
+  int i, n_thrd = numa_map.n_threads;
+  double t0 = omp_get_wtime(), t_best = 1e9;
+
+  do
+  {
+    double t = omp_get_wtime();
+    #pragma omp parallel for
+    for (i=0; i<n_thrd; i++)
+    {
+      int j;
+      if (tn_id[i] >= tpn)
+        continue;
+      for (j=i; j<n_thrd; j++)
+        if ((numa_map.tid_to_node_id[j] == numa_map.tid_to_node_id[i]) && ((tn_id[j] % tpn) == tn_id[i]))
+        {
+          int y = j * wd->dy;
+          int dy = WD_GET_DY(y, wd->dy, wd->wy);
+          if (dy > 0)
+            mm(res + y, vec, wd->lp[j].p, wd->wx, dy);
+        }
+    }
+    t = omp_get_wtime() - t;
+    if (t < t_best)
+      t_best = t;
+  }
+  while ((omp_get_wtime() - t0) < TUNE_MIN_TIME);
+  return t_best * 1000.0;
+}
+
+// alloc test matrix using weights type d_type, rows count limited to TUNE_MAX_SZ
+static void alloc_test_wd(struct w_dat_t *wd, int wy, int wx, enum e_w_type d_type)
+{
+  int i;
+  memset(wd, 0, sizeof(*wd));
+  wd->d_type = d_type;
+  wd->wx = wx;
+  if ((double)wy * wd_ne_sizeof(wd, wx) > TUNE_MAX_SZ)
+    wy = (int)(TUNE_MAX_SZ / wd_ne_sizeof(wd, wx));
+  numa_alloc_wd(wd, 1, wy, wx, d_type, true);
+
+  // fill with valid values for all types (f16 1.06, bf16/f32 0.0115, no denormals)
+  #pragma omp parallel for
+  for (i=0; i<numa_map.n_threads; i++)
+  {
+    int y = i * wd->dy;
+    int dy = WD_GET_DY(y, wd->dy, wd->wy);
+    if (dy > 0)
+      memset(wd->lp[i].p, 0x3c, (size_t)dy * wd_ne_sizeof(wd, wx));
+  }
+}
+
+// tune simd version of d_type matmul
+static void tune_mm_simd(enum e_w_type d_type, int wy, int wx, const float *vec, float *res)
+{
+  struct w_dat_t wd;
+  int s, s_best = -1, s_min = (matmul_procs.simd_set > simd_fpu) ? simd_sse : simd_fpu;
+  double t_best = 0;
+  mm_proc_t mm_prev = NULL;
+
+  alloc_test_wd(&wd, wy, wx, d_type);
+  msg_info("autotune: %-4s matmul %dx%d:", w_type_name[d_type], wd.wy, wx);
+  for (s=matmul_procs.simd_set; s>=s_min; s--)
+  {
+    double t;
+    mm_proc_t mm;
+    if ((int)matmul_set_simd(d_type, s) != s)  // undefined, same code as lower version
+      continue;
+    mm = get_mm_proc(d_type);
+    if (mm == mm_prev)                           // same code as upper version
+      continue;
+    mm_prev = mm;
+    t = time_mm(&wd, mm, vec, res, numa_map.n_threads);
+    msg_info(" s%d %.2fms", s, t);
+    if ((s_best < 0) || (t < t_best))
+    {
+      s_best = s;
+      t_best = t;
+    }
+  }
+  msg_info("\n");
+  if (s_best < 0)                                // only one version
+    s_best = matmul_set_simd(d_type, matmul_procs.simd_set);
+  matmul_set_simd(d_type, s_best);
+  tp.mm_simd[d_type] = s_best;
+  free_wd(&wd);
+}
+
+int mm_tune_run(void)
+{
+  const struct run_conf_t *conf = &model.config;
+  const struct transformer_config_t *p = &model.transformer.config;
+  int wy_ff = p->hidden_dim * (p->moe.num_experts ? p->moe.top_k : 1);  // ffn rows read per token
+  int i, n, c, tpn, n_procs = 0;
+  float *vec, *res;
+
+  if (!conf->autotune)
+    return 0;
+
+  // thread local index in node
+  for (i=0; i<numa_map.n_threads; i++)
+  {
+    int j;
+    tn_id[i] = 0;
+    for (j=0; j<i; j++)
+      tn_id[i] += numa_map.tid_to_node_id[j] == numa_map.tid_to_node_id[i];
+  }
+
+  // input vector sized for dim and hidden_dim (w2 shape)
+  n = (p->dim > p->hidden_dim) ? p->dim : p->hidden_dim;
+  vec = (float *)malloc_check(n * sizeof(float));
+  res = (float *)malloc_check(((p->vocab_size > wy_ff) ? p->vocab_size : wy_ff) * sizeof(float));
+  for (i=0; i<n; i++)
+    vec[i] = rand1s();
+
+  // matmul simd version for each used type, measured on ffn or classifier shape
+  if (tp.mm_simd[p->em_type] < 0)
+  {
+    tune_mm_simd(p->em_type, p->vocab_size, p->dim, vec, res);
+    tp.save = true;
+  }
+  for (c=0; c<lw_class_count; c++)
+  {
+    enum e_w_type t = p->lw_cls_type[c];
+    if ((c == lw_class_moe_gate) && !p->moe.num_experts)
+      continue;
+    if (tp.mm_simd[t] < 0)
+    {
+      tune_mm_simd(t, wy_ff, p->dim, vec, res);
+      tp.save = true;
+    }
+  }
+  if (p->ly_ovr && (tp.mm_simd[p->ly_type] < 0))
+  {
+    tune_mm_simd(p->ly_type, wy_ff, p->dim, vec, res);
+    tp.save = true;
+  }
+
+  // prefetch distance and threads per node, measured on w1 shape
+  if ((tp.pf_dist < 0) || (!tp.num_procs && (conf->num_procs <= 0) && (conf->numa_nodes <= 0)))
+  {
+    struct w_dat_t wd;
+    mm_proc_t mm = get_mm_proc(p->lw_cls_type[lw_class_w1]);
+    double t, t_best = 0;
+    int tpn_max = numa_map.nt_mp;
+
+    alloc_test_wd(&wd, wy_ff, p->dim, p->lw_cls_type[lw_class_w1]);
+    if (tp.pf_dist < 0)
+    {
+      msg_info("autotune: prefetch distance:");
+      for (i=0; i<(int)N_PF_DIST; i++)
+      {
+        matmul_procs.pf_dist = pf_dist_list[i];
+        t = time_mm(&wd, mm, vec, res, tpn_max);
+        msg_info(" %d %.2fms", pf_dist_list[i], t);
+        if (!i || (t < t_best))
+        {
+          tp.pf_dist = pf_dist_list[i];
+          t_best = t;
+        }
+      }
+      msg_info("\n");
+      matmul_procs.pf_dist = (conf->mm_pf_dist < 0) ? tp.pf_dist : conf->mm_pf_dist;
+      tp.save = true;
+    }
+
+    if (!tp.num_procs && (conf->num_procs <= 0) && (conf->numa_nodes <= 0))
+    {
+      int n_nodes = numa_map.n_threads / tpn_max;
+      int tpn_best = tpn_max;
+      msg_info("autotune: threads per node:");
+      for (tpn=tpn_max; (tpn >= 1) && (tpn >= tpn_max/2); tpn--)
+      {
+        t = time_mm(&wd, mm, vec, res, tpn);
+        msg_info(" %d %.2fms", tpn, t);
+        if ((tpn == tpn_max) || (t < t_best))
+        {
+          tpn_best = tpn;
+          t_best = t;
+        }
+      }
+      msg_info("\n");
+      tp.num_procs = tpn_best * n_nodes;
+      tp.n_nodes = n_nodes;
+      tp.save = true;
+      if (tp.num_procs != numa_map.n_threads)
+        n_procs = tp.num_procs;
+    }
+    free_wd(&wd);
+  }
+
+  free_check(vec);
+  free_check(res);
+  if (tp.save)
+    save_profile();
+  return n_procs;
+}
@@ -0,0 +1,9 @@
+// matmul kernels/threads autotune: best simd code version for each used weights type, prefetch
+// distance and threads count are measured on model shapes and saved in a per host profile file.
+
+// load profile (if autotune enabled) and set tuned matmul functions, return num_procs to use for numa init
+int mm_tune_init(void);
+
+// after numa init, tune values missing in profile and save it.
+// return tuned num_procs if numa must be initialized again with a different threads count, else 0.
+int mm_tune_run(void);
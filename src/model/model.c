@@ -37,6 +37,39 @@ static enum e_model_id get_model_id(const char *str)
   return -1;
 }
 
+// get weights type from name
+static enum e_w_type get_w_type(const char *str)
+{
+  enum e_w_type t;
+  for (t=0; t<w_type_COUNT; t++)
+    if (!strcmp(str, w_type_name[t]))
+      return t;
+  msg_error("undefined weights type: %s", str);
+  return w_type_COUNT;
+}
+
+// read optional per tensor format policy
+static void load_w_policy(struct h_json_t *h)
+{
+  struct run_conf_t *conf = &model.config;
+  char key[64];
+  int i;
+
+  for (i=0; i<lw_class_count; i++)
+  {
+    conf->w_policy.cls_type[i] = w_type_COUNT;
+    sprintf(key, "w_policy.%s", lw_class_name[i]);
+    if (js_find_key_list(h, key))
+      conf->w_policy.cls_type[i] = get_w_type(js_get_key_value_str_tmp(h));
+  }
+
+  // layers list override
+  conf->w_policy.ly_type = w_type_COUNT;
+  conf->w_policy.n_layers = js_find_read_int_array_key_list(h, "w_policy.layers", conf->w_policy.layers, W_POLICY_MAX_LAYERS);
+  if (conf->w_policy.n_layers > 0)
+    conf->w_policy.ly_type = get_w_type((js_find_key_list_check(h, "w_policy.layers_type"), js_get_key_value_str_tmp(h)));
+}
+
 // read run configuration from json file
 static void load_run_config(const char *file_name)
 {
@@ -65,6 +98,18 @@ static void load_run_config(const char *file_name)
   // set or override rope freq
   conf->GET_KEY_F32(rope_set);
 
+  // optional MoE adaptive routing
+  if (js_find_key_list(h, "moe_skip_th"))
+    conf->moe_skip_th = js_get_num_value_f32(h);
+
+  // optional MoE expert paging
+  if (js_find_key_list(h, "moe_page_mem"))
+    conf->moe_page_mem = js_get_num_value_f32(h);
+
+  // optional layer streaming
+  if (js_find_key_list(h, "layer_stream"))
+    conf->layer_stream = js_get_num_value_i32(h);
+
   // sampler
   sconf->GET_KEY_F32(temperature);
   sconf->GET_KEY_F32(topp);
@@ -86,11 +131,43 @@ static void load_run_config(const char *file_name)
   conf->GET_KEY_BOOL(cvt_sf16);
   conf->GET_KEY_BOOL(cvt_f12);
   conf->GET_KEY_BOOL(cvt_f8);
+  // optional
+  if (js_find_key_list(h, "cvt_q8"))
+    conf->cvt_q8 = js_get_num_value_bool(h);
+  if (js_find_key_list(h, "cvt_q4"))
+    conf->cvt_q4 = js_get_num_value_bool(h);
+  if (js_find_key_list(h, "cvt_row_scale"))
+    conf->cvt_row_scale = js_get_num_value_bool(h);
+  if (js_find_key_list(h, "w_fuse"))
+    conf->w_fuse = js_get_num_value_bool(h);
+  if (js_find_key_list(h, "emb_disk"))
+    conf->emb_disk = js_get_num_value_bool(h);
+  load_w_policy(h);
+
+  // optional two stages classifier
+  conf->wcls_shadow = w_type_COUNT;
+  if (js_find_key_list(h, "wcls_shadow"))
+  {
+    const char *t_name = js_get_key_value_str_tmp(h);
+    if (*t_name)                       // empty string = disable
+      conf->wcls_shadow = get_w_type(t_name);
+  }
+  conf->wcls_rescore = 256;
+  if (js_find_key_list(h, "wcls_rescore"))
+    conf->wcls_rescore = js_get_num_value_i32(h);
 
   // hardware parameters
   conf->GET_KEY_I32(num_procs);
   conf->GET_KEY_I32(numa_nodes);
   conf->GET_KEY_I32(simd_mode);
+  // optional
+  conf->mm_pf_dist = -1;
+  if (js_find_key_list(h, "mm_pf_dist"))
+    conf->mm_pf_dist = js_get_num_value_i32(h);
+  if (js_find_key_list(h, "autotune"))
+    conf->autotune = js_get_num_value_i32(h);
+  if (js_find_key_list(h, "autotune_dir"))
+    conf->autotune_dir = js_get_key_value_str_alloc(h);
 
   // run mode
   conf->GET_KEY_I32(run_mode);
@@ -104,7 +181,12 @@ static void load_run_config(const char *file_name)
   conf->GET_KEY_BOOL(tok_disp_prob);
 
   if (conf->run_mode == run_mode_generate)
+  {
     conf->GET_KEY_STR(gen_mode_prompt);
+    // optional
+    if (js_find_key_list(h, "gen_eval_nll"))
+      conf->gen_eval_nll = js_get_num_value_bool(h);
+  }
   else
   if (conf->run_mode == run_mode_chat)
   {
@@ -168,6 +250,7 @@ static void free_run_config(void)
   free_check(conf->token_eos_str);
   free_check(conf->token_eot_str);
   free_check(conf->gen_mode_prompt);
+  free_check(conf->autotune_dir);
   free_check(model.sampler.conf.ch_restrict);
 
   // chat strings
@@ -203,6 +286,8 @@ void build_model(const char *conf_file_name)
 
   // init matmul and conversions fonctions
   matmul_init(conf->simd_mode);
+  if (conf->mm_pf_dist >= 0)
+    matmul_procs.pf_dist = conf->mm_pf_dist;
 
   // build tokenizer
   build_tokenizer();
@@ -228,6 +313,9 @@ void build_model(const char *conf_file_name)
   // init the sampler
   build_sampler();
 
+  // init classifier, restricted to tokens allowed by sampler
+  build_classifier(model.sampler.tk_select);
+
   // adjust run_steps
   if (conf->gen_run_steps <= 0)
     conf->gen_run_steps = transformer->config.seq_len;
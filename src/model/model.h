@@ -23,6 +23,9 @@ enum e_model_id
 
 extern const char *model_id_names[model_id_count];
 
+// max count of layers in w_policy layers list
+#define W_POLICY_MAX_LAYERS 64
+
 // application run mode
 enum e_run_mode
 {
@@ -82,17 +85,47 @@ struct run_conf_t
   // set or override rope freq
   float rope_set;                  // set/change rope inv freq value, ignored if 0
 
+  // MoE adaptive routing (optional)
+  float moe_skip_th;               // skip secondary experts with normalized weight < moe_skip_th (0 = disable)
+
+  // MoE expert paging (optional)
+  float moe_page_mem;              // memory budget in Gb for resident experts w1/w2/w3 (0 = disable, all experts loaded)
+
+  // layer streaming (optional)
+  int layer_stream;                // count of layers read in advance while current layer computed (0 = disable, all layers loaded)
+
   // sampler config defined in sampler struct
 
   // load parameters
   bool cvt_sf16;                   // convert model to sfloat16 at load
   bool cvt_f12;                    // convert model to float12 at load
   bool cvt_f8;                     // convert model to float8 at load
+  bool cvt_q8;                     // convert model to int8 with f16 scale per 32 values bloc at load (optional)
+  bool cvt_q4;                     // convert model to 4 bits with f16 scale/min per 32 values bloc at load (optional)
+  bool cvt_row_scale;              // with cvt_f12/cvt_f8, scale each row to f12/f8 range (no range limit) (optional)
+  bool w_fuse;                     // load time weights fusion (qkv, w1/w3, rms norm weights) (optional)
+  bool emb_disk;                   // token embeddings rows read in model file, not loaded in memory (optional)
+
+  // per tensor format policy (optional), override cvt_xx type, w_type_COUNT if undefined
+  struct
+  {
+    enum e_w_type cls_type[lw_class_count]; // type for each layer weights class
+    enum e_w_type ly_type;         // type used for all layer weights of layers list
+    int n_layers;                  // layers list size
+    int layers[W_POLICY_MAX_LAYERS]; // layers list, negative id count from end (-1 = last layer)
+  } w_policy;
+
+  // two stages classifier (optional)
+  enum e_w_type wcls_shadow;       // type of classifier low precision copy used to select candidates (w_type_COUNT = disable)
+  int wcls_rescore;                // count of best candidates logits computed with classifier
 
   // hardware parameters
   int num_procs;                   // num procs used for threads
   int numa_nodes;                  // num numa nodes to init
-  int simd_mode;                   // -1: best auto, 0:off(fpu) 1:sse 2:avx
+  int simd_mode;                   // -1: best auto, 0:off(fpu) 1:sse 2:avx 3:avx2 4:avx512
+  int mm_pf_dist;                  // matmul prefetch distance in bytes, 0: disabled, -1: default
+  int autotune;                    // matmul kernels/threads autotune, 0: off, 1: use or create host profile, 2: tune again
+  char *autotune_dir;              // directory of autotune profile files (NULL: current directory)
 
   // checks
   bool test_nan_logits;            // test for NAN at sampling in all logits results
@@ -110,6 +143,7 @@ struct run_conf_t
  
   // generate mode config
   char *gen_mode_prompt;           // init prompt for generate run_mode
+  bool gen_eval_nll;               // teacher forced evaluation of prompt, display perplexity (optional)
 
   // chat mode config
   struct chat_cfg_t chat;
@@ -139,3 +173,6 @@ void chat(void);
 
 // generation loop
 void generate(void);
+
+// synthetic benchmark with random weights (bench.c)
+void bench(int argc, char *argv[]);
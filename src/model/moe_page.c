@@ -0,0 +1,302 @@
+// MoE expert paging
+// Only a part of the experts of each layer is kept resident in memory (LRU resident set sized by
+// moe_page_mem budget). Experts are read on demand by a background io thread in w1/w2/w3 slots,
+// next layer experts are predicted and prefetched while current layer experts are computed.
+
+#include <stdio.h>
+#include <string.h>
+#include "l_util.h"
+#include "mem_alloc.h"
+#include "model.h"
+#include "matmul.h"
+#include "omp_numa.h"
+#include "io_async.h"
+#include "w_src.h"
+#include "moe_page.h"
+
+// resident expert slot
+struct exp_slot_t
+{
+  int exp_id;                          // resident/loading expert id, -1 if empty
+  int64_t last_use;                    // LRU counter
+  int64_t pin;                         // request counter, slot can't be evicted during same request
+  bool prefetched;                     // loaded by prefetch and not yet used
+  bool io_err;                         // load error in io thread
+  volatile int ready;                  // 1 when datas loaded
+};
+
+static struct
+{
+  int n_slots;                         // resident experts per layer
+  int n_layers;
+  int n_experts;
+  size_t sz_w;                         // w1/w2/w3 tensor size in memory format
+  struct w_src_t *src;                 // [n_layers][n_experts][MOE_PAGE_NW]
+  struct exp_slot_t *slots;            // [n_layers][n_slots]
+  int *pf_slots;                       // prefetch slots list
+  int64_t use_ctr;                     // LRU counter
+  int64_t req_ctr;                     // request counter
+  bool io_started;
+
+  // stats
+  int64_t n_req;                       // experts requests
+  int64_t n_hit;                       // resident and ready
+  int64_t n_pend;                      // resident but load in progress (prefetched)
+  int64_t n_miss;                      // loaded on demand
+  int64_t n_pf_load;                   // prefetch loads
+  int64_t n_pf_used;                   // prefetch loads used
+  int n_stall;                         // count of waits
+  int stall_ms;                        // total wait time
+} pg = { 0 };
+
+// get max memory size of w1/w2/w3 tensor (sizes differ if types differ or if format use rows scale)
+static size_t get_sz_w(const struct transformer_config_t *p)
+{
+  struct w_dat_t wd = { 0 };
+  size_t sz_w = 0;
+  int i;
+  for (i=0; i<MOE_PAGE_NW; i++)
+  {
+    size_t sz;
+    wd.d_type = p->lw_cls_type[lw_class_w1 + i];
+    wd.wx = (i == 1) ? p->hidden_dim : p->dim;   // w2 : w1/w3
+    sz = wd_ne_sizeof(&wd, (size_t)p->hidden_dim * p->dim);
+    if (sz > sz_w)
+      sz_w = sz;
+  }
+  return sz_w;
+}
+
+int moe_page_init(void)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  double mem = model.config.moe_page_mem;
+  int i, n_src;
+  int64_t sz_exp;                      // size of one expert w1/w2/w3
+  bool cvt;
+
+  if ((mem <= 0.0) || !p->moe.num_experts)
+    return 0;
+
+  pg.n_layers = p->n_layers;
+  pg.n_experts = p->moe.num_experts;
+  pg.sz_w = get_sz_w(p);
+  sz_exp = (int64_t)pg.sz_w * MOE_PAGE_NW;
+  pg.n_slots = (int)((mem * (1024.0*1024.0*1024.0)) / ((double)sz_exp * pg.n_layers));
+
+  if (pg.n_slots >= pg.n_experts)
+  {
+    msg_info("MoE paging: memory budget allow all experts resident, paging disabled.\n");
+    pg.n_slots = 0;
+    return 0;
+  }
+  if (pg.n_slots < p->moe.top_k)
+    msg_error("MoE paging: moe_page_mem %.2f Gb too small, minimum is %.2f Gb",
+              mem, ((double)sz_exp * pg.n_layers * p->moe.top_k) / (1024.0*1024.0*1024.0));
+
+  msg_info("MoE paging: %d/%d experts resident per layer (%.2f Gb)\n", pg.n_slots, pg.n_experts,
+           ((double)sz_exp * pg.n_layers * pg.n_slots) / (1024.0*1024.0*1024.0));
+
+  // sources
+  n_src = pg.n_layers * pg.n_experts * MOE_PAGE_NW;
+  pg.src = (struct w_src_t *)malloc_check(n_src * sizeof(struct w_src_t));
+  for (i=0; i<n_src; i++)
+    pg.src[i].file_id = -1;
+
+  // slots
+  pg.slots = (struct exp_slot_t *)calloc_check(pg.n_layers * pg.n_slots * sizeof(struct exp_slot_t));
+  for (i=0; i<pg.n_layers * pg.n_slots; i++)
+    pg.slots[i].exp_id = -1;
+  pg.pf_slots = (int *)malloc_check(pg.n_experts * sizeof(int));
+
+  // converted experts file required if memory format differ from .safetensors format
+  cvt = (p->lw_cls_type[lw_class_w1] != p->torch_type)
+     || (p->lw_cls_type[lw_class_w2] != p->torch_type)
+     || (p->lw_cls_type[lw_class_w3] != p->torch_type);
+  w_src_init(cvt ? "moe_experts" : NULL, (int64_t)n_src * pg.sz_w);
+  return pg.n_slots;
+}
+
+void moe_page_exit(void)
+{
+  if (!pg.n_slots)
+    return;
+  if (pg.io_started)
+    io_async_exit();
+  w_src_exit();
+  free_check(pg.src);
+  free_check(pg.slots);
+  free_check(pg.pf_slots);
+  memset(&pg, 0, sizeof(pg));
+}
+
+// --------------------------
+// load
+
+struct w_src_t *moe_page_src(int layer_id, int exp_id, int w_id, int64_t *cvt_ofs)
+{
+  int id = (layer_id * pg.n_experts + exp_id) * MOE_PAGE_NW + w_id;
+  *cvt_ofs = (int64_t)id * pg.sz_w;
+  return &pg.src[id];
+}
+
+// io thread job: load expert w1/w2/w3 in slot
+static void load_slot_job(void *arg)
+{
+  struct transformer_weights_t *w = &model.transformer.weights;
+  struct w_dat_t *wd[MOE_PAGE_NW] = { &w->w1, &w->w2, &w->w3 };
+  struct exp_slot_t *slot = (struct exp_slot_t *)arg;
+  int z = (int)(slot - pg.slots);      // z index = layer_id * n_slots + slot id
+  int layer_id = z / pg.n_slots;
+  int i;
+
+  for (i=0; i<MOE_PAGE_NW; i++)
+  {
+    const struct w_src_t *src = &pg.src[(layer_id * pg.n_experts + slot->exp_id) * MOE_PAGE_NW + i];
+    if (!w_src_read(src, wd[i], z))
+    {
+      slot->io_err = true;             // error reported by main thread
+      break;
+    }
+  }
+}
+
+void moe_page_start(void)
+{
+  int i, n_src = pg.n_layers * pg.n_experts * MOE_PAGE_NW;
+
+  for (i=0; i<n_src; i++)
+    if (!W_SRC_DEFINED(&pg.src[i]))
+      msg_error("MoE paging: uncomplete experts weight data load");
+
+  w_src_start();
+  io_async_init();
+  pg.io_started = true;
+
+  // preload first experts of each layer
+  for (i=0; i<pg.n_layers * pg.n_slots; i++)
+  {
+    struct exp_slot_t *slot = &pg.slots[i];
+    slot->exp_id = i % pg.n_slots;
+    io_async_post(load_slot_job, slot, &slot->ready);
+  }
+  for (i=0; i<pg.n_layers * pg.n_slots; i++)
+    moe_page_wait(i / pg.n_slots, i % pg.n_slots);
+}
+
+// --------------------------
+// run
+
+// find slot to evict in layer, LRU not pinned by current request
+static int get_free_slot(struct exp_slot_t *sl)
+{
+  int i, s_id = -1;
+  for (i=0; i<pg.n_slots; i++)
+  {
+    if (sl[i].pin == pg.req_ctr)
+      continue;
+    if (sl[i].exp_id < 0)
+      return i;                        // empty
+    if ((s_id < 0) || (sl[i].last_use < sl[s_id].last_use))
+      s_id = i;
+  }
+  CHECK(s_id >= 0);                    // n <= n_slots
+  return s_id;
+}
+
+void moe_page_request(int layer_id, const int *exp_ids, int n, int *slots, bool prefetch)
+{
+  struct exp_slot_t *sl = &pg.slots[layer_id * pg.n_slots];
+  int i, j;
+
+  CHECK(n <= pg.n_slots);
+  if (!slots)
+    slots = pg.pf_slots;
+
+  // find resident experts and pin them
+  pg.req_ctr++;
+  for (i=0; i<n; i++)
+  {
+    slots[i] = -1;
+    for (j=0; j<pg.n_slots; j++)
+      if (sl[j].exp_id == exp_ids[i])
+      {
+        slots[i] = j;
+        sl[j].pin = pg.req_ctr;
+        break;
+      }
+  }
+
+  for (i=0; i<n; i++)
+  {
+    struct exp_slot_t *slot;
+    if (slots[i] >= 0)                 // resident
+    {
+      slot = &sl[slots[i]];
+      if (!prefetch)
+      {
+        if (slot->ready)
+          pg.n_hit++;
+        else
+          pg.n_pend++;
+        if (slot->prefetched)
+        {
+          pg.n_pf_used++;
+          slot->prefetched = false;
+        }
+      }
+    }
+    else                               // load required
+    {
+      slots[i] = get_free_slot(sl);
+      slot = &sl[slots[i]];
+      if (!slot->ready && (slot->exp_id >= 0))
+      {
+        if (prefetch)                  // evict slot in load, cancel prefetch
+        {
+          slots[i] = -1;
+          continue;
+        }
+        io_async_wait(&slot->ready);
+      }
+      slot->exp_id = exp_ids[i];
+      slot->pin = pg.req_ctr;
+      slot->prefetched = prefetch;
+      io_async_post(load_slot_job, slot, &slot->ready);
+      if (prefetch)
+        pg.n_pf_load++;
+      else
+        pg.n_miss++;
+    }
+    slot->last_use = ++pg.use_ctr;
+  }
+  if (!prefetch)
+    pg.n_req += n;
+}
+
+int moe_page_wait(int layer_id, int slot_id)
+{
+  int z = layer_id * pg.n_slots + slot_id;
+  struct exp_slot_t *slot = &pg.slots[z];
+  if (!slot->ready)
+  {
+    int t0 = time_in_ms();
+    io_async_wait(&slot->ready);
+    pg.stall_ms += time_in_ms() - t0;
+    pg.n_stall++;
+  }
+  if (slot->io_err)
+    msg_error("MoE paging: layer %d expert %d read error", layer_id, slot->exp_id);
+  return z;
+}
+
+void moe_page_disp_stats(void)
+{
+  if (pg.n_req)
+  {
+    msg_info("MoE paging: requests %lld, hit %.1f%%, prefetch pending %.1f%%, miss %.1f%%\n",
+             pg.n_req, (100.0 * pg.n_hit) / pg.n_req, (100.0 * pg.n_pend) / pg.n_req, (100.0 * pg.n_miss) / pg.n_req);
+    msg_info("MoE paging: prefetch loads %lld (used %.1f%%), stalls %d, stall time %.2fs\n",
+             pg.n_pf_load, pg.n_pf_load ? (100.0 * pg.n_pf_used) / pg.n_pf_load : 0.0, pg.n_stall, pg.stall_ms * 0.001);
+  }
+}
@@ -0,0 +1,32 @@
+// MoE expert paging: keep a resident set of experts per layer in memory,
+// non resident experts are loaded on demand by io thread (sources defined with w_src).
+
+#define MOE_PAGE_NW 3                  // w1, w2, w3
+
+// init paging using memory budget, return count of resident experts per layer (0 if paging unused)
+int moe_page_init(void);
+
+// free paging datas, stop io thread
+void moe_page_exit(void);
+
+// --------------------------
+// load
+
+// get source of expert tensor and offset in converted weights file (require w_src.h)
+struct w_src_t *moe_page_src(int layer_id, int exp_id, int w_id, int64_t *cvt_ofs);
+
+// check all experts sources are defined, start io thread and preload resident set
+void moe_page_start(void);
+
+// --------------------------
+// run
+
+// get resident slots for layer experts list, post load of non resident experts.
+// if prefetch, slots can be NULL and loads are done in background.
+void moe_page_request(int layer_id, const int *exp_ids, int n, int *slots, bool prefetch);
+
+// wait slot loaded, return w1/w2/w3 z index
+int moe_page_wait(int layer_id, int slot);
+
+// display paging statistics (user info)
+void moe_page_disp_stats(void);
@@ -7,11 +7,20 @@
 #include "matmul.h"
 #include "omp_numa.h"
 
-// return sizeof wd ne elements in bytes (usage required where f12 can be used)
+// return sizeof wd ne elements in bytes (usage required where f12/q8/q4/f12s/f8s can be used)
+// note: for f12s/f8s, ne must be multiple of wd->wx
 size_t wd_ne_sizeof(const struct w_dat_t *wd, size_t ne)
 {
   if (wd->d_type == w_type_f12)
     return ne + (ne >> 1);                       // special case for f12, 1.5 byte per float
+  if (wd->d_type == w_type_q8)
+    return (ne / Q8_BLOC_NE) * Q8_BLOC_SZ;       // special case for q8, ne is multiple of SIMD_LV
+  if (wd->d_type == w_type_q4)
+    return (ne / Q4_BLOC_NE) * Q4_BLOC_SZ;       // special case for q4
+  if (wd->d_type == w_type_f12s)
+    return ne + (ne >> 1) + (ne / wd->wx) * W_ROW_SCALE_SZ;  // f12 + rows scale
+  if (wd->d_type == w_type_f8s)
+    return ne + (ne / wd->wx) * W_ROW_SCALE_SZ;  // f8 + rows scale
   return ne * w_type_sizeof[wd->d_type];
 }
 
@@ -119,6 +128,56 @@ void numa_cpy_wd_z(struct w_dat_t *wd, int z_id, const void *s, file_t *f)
   }
 }
 
+// copy rows y..y+ny-1 of one z unit to weight node memory (rows can be in different thread parts)
+void numa_cpy_wd_rows(struct w_dat_t *wd, int z_id, int y, int ny, const void *s)
+{
+  size_t sz_wx = wd_ne_sizeof(wd, wd->wx);
+  const char *_s = (const char *)s;
+  while (ny > 0)
+  {
+    int t = y / wd->dy;                          // thread part
+    int r = y - t * wd->dy;                      // row in part
+    int n = wd->dy - r;                          // rows until part end
+    char *p = (char *)wd->lp[t].p + (size_t)z_id * wd->lp[t].sz_l + (size_t)r * sz_wx;
+    if (n > ny)
+      n = ny;
+    memcpy(p, _s, (size_t)n * sz_wx);
+    _s += (size_t)n * sz_wx;
+    wd->ne += (size_t)n * wd->wx;
+    y += n;
+    ny -= n;
+  }
+}
+
+bool numa_read_wd_z(struct w_dat_t *wd, int z_id, file_t *f, int64_t ofs)
+{
+  size_t sz_wx = wd_ne_sizeof(wd, wd->wx);
+
+  if (wd->nn == 1)    // single data pointer
+  {
+    char *p = (char *)wd->lp[0].p + (size_t)z_id * wd->lp[0].sz_l;
+    return f_read_at(f, ofs, p, (size_t)wd->wy * sz_wx);
+  }
+  else
+  {
+    int i;
+    for (i=0; i<numa_map.n_threads; i++)
+    {
+      char *p = (char *)wd->lp[i].p + (size_t)z_id * wd->lp[i].sz_l;
+      int y = i * wd->dy;
+      int dy = WD_GET_DY(y, wd->dy, wd->wy);
+      if (dy > 0)
+      {
+        size_t sz_bloc = (size_t)dy * sz_wx;
+        if (!f_read_at(f, ofs, p, sz_bloc))
+          return false;
+        ofs += sz_bloc;
+      }
+    }
+  }
+  return true;
+}
+
 // ------------------------------------
 // thread list definition
 
@@ -212,7 +271,8 @@ void omp_proc_bind_numa_check(void)
 // init OMP for numa configuration
 void numa_init_omp(int cfg_n_procs, int cfg_n_nodes)
 {
-  init_numa_info();                 // get numa hardware config
+  if (!numa.n_procs)                // can be called again (autotune, bench)
+    init_numa_info();               // get numa hardware config
   numa_def_thread_map(cfg_n_procs, cfg_n_nodes);  // init numa run configuration
   numa_disp_thread_map();          // display map
 
@@ -23,6 +23,12 @@ void numa_alloc_wd(struct w_dat_t *wd, int nz, int wy, int wx, enum e_w_type w_t
 // copy or load datas to weights for one z unit (layer).
 void numa_cpy_wd_z(struct w_dat_t *wd, int z_id, const void *s, file_t *f);
 
+// copy rows y..y+ny-1 of one z unit to weight node memory
+void numa_cpy_wd_rows(struct w_dat_t *wd, int z_id, int y, int ny, const void *s);
+
+// read datas at file offset for one z unit, no error trap and ne not updated (usable in io thread)
+bool numa_read_wd_z(struct w_dat_t *wd, int z_id, file_t *f, int64_t ofs);
+
 // init OMP for numa configuration
 void numa_init_omp(int cfg_n_procs, int cfg_n_nodes);
 
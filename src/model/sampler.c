@@ -1,7 +1,11 @@
 #include <stdlib.h>
+#include <math.h>
+#include <float.h>
 #include "l_util.h"
 #include "mem_alloc.h"
 #include "model.h"
+#include "matmul.h"
+#include "vec_simd.h"
 #include "utf8.h"
 
 #define EN_TOK(i) (sampler->tk_select[(i) >> 5] & (1 << ((i) & 31)))
@@ -51,32 +55,37 @@ static struct prob_index_t *sample_argmax(void)
   return pi;
 }
 
-// sampler_sample the token given the logits and some hyperparameters
-struct prob_index_t *sampler_sample(void)
-{
-  int vocab_size = model.transformer.config.vocab_size;
-  float *logits = model.transformer.state.logits;
-  struct sampler_t *sampler = &model.sampler;
-  struct sampler_conf_t *cfg = &sampler->conf;
-  struct prob_index_t *probindex = sampler->probindex;
-  bool topp_eos = cfg->topp_eos;
-  float cutoff, prob_sum, eos_prob, r;
-  int i, n;
+// get pointer to modifiable temperature scaled logit of token
+typedef float *(*get_logit_t)(int token);
 
-  // nan check
-  if (model.config.test_nan_logits && !check_no_nan_f32(logits, vocab_size))
-    msg_info("<logits contain NAN>");
+// logit in full logits array
+static float *logit_full(int token)
+{
+  return &model.transformer.state.logits[token];
+}
 
-  // apply temperature
-  if (cfg->temperature <= 0.01f)
-    return sample_argmax();
+// logit in modified logits list, added from classifier logit if not in list
+static float *logit_ovr(int token)
+{
+  struct sampler_t *sampler = &model.sampler;
+  struct logit_ovr_t *o = sampler->l_ovr;
+  int i;
+  for (i=0; i<sampler->n_l_ovr; i++)
+    if (o[i].index == token)
+      return &o[i].l;
+  o = &o[sampler->n_l_ovr++];
+  o->index = token;
+  o->l0 = transformer_get_logit(token) * model.transformer.config.cls_k_temp;
+  o->l = o->l0;
+  return &o->l;
+}
 
-  if ((cfg->temperature <= 0.99f) || (cfg->temperature >= 1.01f))
-  {
-    float k = 1.0f / cfg->temperature;
-    for (i=0; i<vocab_size; i++) 
-      logits[i] *= k;
-  }
+// apply eos_amp and repeat penalty to temperature scaled logits, return true if topp_eos forced
+static bool apply_logits_mods(get_logit_t get_l)
+{
+  const struct sampler_conf_t *cfg = &model.sampler.conf;
+  bool topp_eos = false;
+  int i;
 
   // apply eos_amp 
   if (cfg->eos_amp > 0.01f)
@@ -87,10 +96,11 @@ struct prob_index_t *sampler_sample(void)
       float w = (float)(nt_samp - cfg->eos_amp_n) / cfg->eos_amp_n;
       float ki = 1.0f + w * cfg->eos_amp;
       float kd = 1.0f - w * cfg->eos_amp;
-      int eos = model.config.token_eos;
-      int eot = model.config.token_eot;
-      if (logits[eos] > 0) logits[eos] *= ki; else logits[eos] *= kd;
-      if (logits[eot] > 0) logits[eot] *= ki; else logits[eot] *= kd;
+      float *l;
+      l = get_l(model.config.token_eos);
+      if (*l > 0) *l *= ki; else *l *= kd;
+      l = get_l(model.config.token_eot);
+      if (*l > 0) *l *= ki; else *l *= kd;
       topp_eos = true;                 // force topp_eos
     }
   }
@@ -108,47 +118,83 @@ struct prob_index_t *sampler_sample(void)
       int l = utf8_char_len(tokenizer_decode(ct[i].token_id));
       if (l >= 4)                      // apply on long piece only
       {
-        if (logits[i] >= 0)
-          logits[i] *= kd;             // decrease value
+        float *lg = get_l(i);
+        if (*lg >= 0)
+          *lg *= kd;                   // decrease value
         else
-          logits[i] *= ki;
+          *lg *= ki;
       }
     }
   }
+  return topp_eos;
+}
 
-  // apply softmax to the logits to get the probabilities for next token
-  softmax(logits, vocab_size);
-
-  // quicksort indices in descending order of probabilities
-  // values smaller than (1 - cfg->topp) / (n - 1) cannot be part of the result
-  // so for efficiency we crop these out as candidates before sorting
-  cutoff = (1.0f - cfg->topp) / (vocab_size - 1);
-  n = 0;
-  for (i=0; i<vocab_size; i++)
+// move the m largest probabilities of pi[n] at list start (not sorted), quickselect
+static void select_top_m(struct prob_index_t *pi, int n, int m)
+{
+  int lo = 0, hi = n - 1, k = m - 1;
+  while (lo < hi)
   {
-    float prob = logits[i];
-    if (prob >= cutoff)
+    float pv = pi[(lo + hi) >> 1].prob;
+    int i = lo, j = hi;
+    while (i <= j)
     {
-      if (sampler->tk_select && !EN_TOK(i))
-        continue;
-      probindex[n].index = i;
-      probindex[n].prob = prob;
-      n++;
+      while (pi[i].prob > pv) i++;
+      while (pi[j].prob < pv) j--;
+      if (i <= j)
+      {
+        struct prob_index_t t = pi[i];
+        pi[i++] = pi[j];
+        pi[j--] = t;
+      }
     }
+    if (k <= j)                        // pi[lo..j] >= pv
+      hi = j;
+    else
+    if (k >= i)                        // pi[i..hi] <= pv
+      lo = i;
+    else
+      break;
   }
-  qsort(probindex, n, sizeof(struct prob_index_t), compare);
+}
+
+// sort probindex[n] list, apply topk/topp and random sample.
+// return NULL if more than n_exact first tokens of sorted list are required (list not complete)
+static struct prob_index_t *sample_top_list(int n, bool topp_eos, int n_exact)
+{
+  struct sampler_t *sampler = &model.sampler;
+  struct sampler_conf_t *cfg = &sampler->conf;
+  struct prob_index_t *probindex = sampler->probindex;
+  float prob_sum, eos_prob, r;
+  int i, n_list = n, n_srt = 0, bloc;
 
   // apply topk
   if (cfg->topk && (n > cfg->topk))
     n = cfg->topk;
 
+  // list is sorted by blocs when required by topp (partial sort)
+  bloc = cfg->topk ? n : 64;
+
   // truncate the list where cumulative probability exceeds topp
   prob_sum = 0;
   eos_prob = 0;
   for (i=0; i<n; i++) 
   {
-    int index = probindex[i].index;
-    float prob = probindex[i].prob;
+    int index;
+    float prob;
+
+    if (i == n_srt)                    // sort next bloc of largest probabilities
+    {
+      int m = (n - n_srt < bloc) ? n : n_srt + bloc;
+      if (m < n_list)
+        select_top_m(probindex + n_srt, n_list - n_srt, m - n_srt);
+      qsort(probindex + n_srt, m - n_srt, sizeof(struct prob_index_t), compare);
+      n_srt = m;
+      bloc *= 4;
+    }
+
+    index = probindex[i].index;
+    prob = probindex[i].prob;
     prob_sum += prob;
 
     if (    (index == model.config.token_eos)
@@ -166,6 +212,8 @@ struct prob_index_t *sampler_sample(void)
     if (prob_sum >= cfg->topp)
       break;                           // we've exceeded topp by including last_idx
   }
+  if (((i < n) ? (i + 1) : n) > n_exact)
+    return NULL;
   n = i;                               // n = n_topp - 1
  
   // random sample from the truncated list
@@ -180,6 +228,158 @@ struct prob_index_t *sampler_sample(void)
   return &probindex[i];
 }
 
+// sample using merged classifier per thread statistics (max, sum_exp, top logits lists), do not
+// require a full pass on logits. return NULL if top lists do not contain enough tokens.
+static struct prob_index_t *sample_cls_stats(void)
+{
+  const struct transformer_runstate_t *ts = &model.transformer.state;
+  const struct cls_stats_t *st = ts->cls_stats;
+  int n_st = ts->cls_n_stats;
+  float k = model.transformer.config.cls_k_temp;
+  struct sampler_t *sampler = &model.sampler;
+  struct sampler_conf_t *cfg = &sampler->conf;
+  struct prob_index_t *probindex = sampler->probindex;
+  bool topp_eos = cfg->topp_eos, complete = true;
+  float ref = -FLT_MAX, cutoff;
+  double sum = 0, inv_sum;
+  int i, j, n = 0, n_valid = CLS_TOPK;
+
+  // greedy, argmax of threads max
+  if (cfg->temperature <= 0.01f)
+  {
+    j = 0;
+    for (i=1; i<n_st; i++)
+      if (st[i].max > st[j].max)
+        j = i;
+    probindex->index = st[j].top_tk[0];
+    probindex->prob = 1.0f;
+    return probindex;
+  }
+
+  // merge threads top lists and sum_exp, temperature scaled logits relative to ref max
+  for (i=0; i<n_st; i++)
+    if (st[i].max > ref)
+      ref = st[i].max;
+  ref *= k;
+  for (i=0; i<n_st; i++)
+  {
+    if (!st[i].n)
+      continue;
+    sum += st[i].sum_exp * exp(st[i].max * k - ref);
+    if (!st[i].complete)
+    {
+      complete = false;                // only first n_valid tokens of merged sorted list are exact
+      if (st[i].n < n_valid)
+        n_valid = st[i].n;
+    }
+    for (j=0; j<st[i].n; j++)
+    {
+      probindex[n].index = st[i].top_tk[j];
+      probindex[n++].prob = st[i].top_l[j] * k;
+    }
+  }
+
+  // apply eos_amp and repeat penalty on modified logits list, update sum and top list
+  sampler->n_l_ovr = 0;
+  if (apply_logits_mods(logit_ovr))
+    topp_eos = true;
+  for (i=0; i<sampler->n_l_ovr; i++)
+  {
+    const struct logit_ovr_t *o = &sampler->l_ovr[i];
+    if (!(o->l != o->l0))
+      continue;
+    sum += exp(o->l - ref) - exp(o->l0 - ref);
+    if (o->l < o->l0)
+      n_valid--;                       // a non listed token can replace it in top list
+    for (j=0; j<n; j++)
+      if (probindex[j].index == o->index)
+        break;
+    if (j == n)
+      probindex[n++].index = o->index;
+    probindex[j].prob = o->l;
+  }
+
+  // probabilities, crop values smaller than (1 - cfg->topp) / (n - 1)
+  cutoff = (1.0f - cfg->topp) / (model.transformer.config.vocab_size - 1);
+  inv_sum = 1.0 / sum;
+  for (i=0, j=0; i<n; i++)
+  {
+    float prob = (float)(exp(probindex[i].prob - ref) * inv_sum);
+    if (prob >= cutoff)
+    {
+      probindex[j].index = probindex[i].index;
+      probindex[j++].prob = prob;
+    }
+  }
+
+  // list contain all tokens >= cutoff if complete or if cropped before n_valid
+  if (complete || (j < n_valid))
+    n_valid = j;
+  else
+  if (n_valid >= j)
+    n_valid = j - 1;                   // tokens after list end may exist
+  return sample_top_list(j, topp_eos, n_valid);
+}
+
+// sampler_sample the token given the logits and some hyperparameters
+struct prob_index_t *sampler_sample(void)
+{
+  int vocab_size = model.transformer.config.vocab_size;
+  float *logits = model.transformer.state.logits;
+  struct sampler_t *sampler = &model.sampler;
+  struct sampler_conf_t *cfg = &sampler->conf;
+  struct prob_index_t *probindex = sampler->probindex;
+  bool topp_eos = cfg->topp_eos;
+  float cutoff;
+  int i, n;
+
+  // sample from classifier statistics
+  if (model.transformer.state.cls_n_stats)
+  {
+    struct prob_index_t *pi = sample_cls_stats();
+    if (pi)
+      return pi;
+    transformer_def_logits();          // top lists too small, use all logits
+  }
+
+  // nan check
+  if (model.config.test_nan_logits && !check_no_nan_f32(logits, vocab_size))
+    msg_info("<logits contain NAN>");
+
+  // apply temperature
+  if (cfg->temperature <= 0.01f)
+    return sample_argmax();
+
+  if ((cfg->temperature <= 0.99f) || (cfg->temperature >= 1.01f))
+    vec_procs.vec_scale(logits, vocab_size, 1.0f / cfg->temperature);
+
+  // apply eos_amp and repeat penalty
+  if (apply_logits_mods(logit_full))
+    topp_eos = true;
+
+  // apply softmax to the logits to get the probabilities for next token
+  vec_softmax(logits, vocab_size, 1.0f);
+
+  // quicksort indices in descending order of probabilities
+  // values smaller than (1 - cfg->topp) / (n - 1) cannot be part of the result
+  // so for efficiency we crop these out as candidates before sorting
+  cutoff = (1.0f - cfg->topp) / (vocab_size - 1);
+  n = 0;
+  for (i=0; i<vocab_size; i++)
+  {
+    float prob = logits[i];
+    if (prob >= cutoff)
+    {
+      if (sampler->tk_select && !EN_TOK(i))
+        continue;
+      probindex[n].index = i;
+      probindex[n].prob = prob;
+      n++;
+    }
+  }
+  return sample_top_list(n, topp_eos, n);
+}
+
 // -------------------------------------------
 // init sampler
 
@@ -223,6 +423,7 @@ void build_sampler(void)
 
   // alloc working ddtas
   sampler->probindex = malloc_check(model.transformer.config.vocab_size * sizeof(struct prob_index_t));
+  sampler->l_ovr = malloc_check((cfg->repeat_penalty_n + 2) * sizeof(struct logit_ovr_t));
 
   // init rng
   sampler->rng_state = cfg->rand_seed;
@@ -256,6 +457,10 @@ void build_sampler(void)
     if (!n_codes || (n_codes > 256))
       msg_error("ch_restrict string containd invalid utf8 encoding or more than 256 characters");
 
+    // get allowed chars codes
+    for (i=0; i<n_codes; i++)
+      s += utf8_char_decode(s, &r_codes[i]);
+
     // alloc binary array
     n_msk = (vocab_max + 31) / 32;
     msk = calloc_check(n_msk * sizeof(int));
@@ -286,4 +491,5 @@ void free_sampler(void)
 {
   free_check(model.sampler.probindex);
   free_check(model.sampler.tk_select);
+  free_check(model.sampler.l_ovr);
 }
\ No newline at end of file
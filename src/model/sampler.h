@@ -25,6 +25,14 @@ struct sampler_conf_t
   char *ch_restrict;               // if string defined, define ascii + allowed chars list in sampled tokens.
 };
 
+// logit modified by eos_amp or repeat penalty (sampling from classifier statistics)
+struct logit_ovr_t
+{
+  int index;                       // token id
+  float l0;                        // logit before modification
+  float l;                         // modified logit
+};
+
 struct sampler_t
 {
   struct sampler_conf_t conf;      // config
@@ -32,6 +40,8 @@ struct sampler_t
   uint64_t rng_state;
   struct prob_index_t *probindex;  // buffer used in top-p sampling
   int *tk_select;                  // binary array for restricted tokens, (NULL if unused)
+  struct logit_ovr_t *l_ovr;       // modified logits list (repeat_penalty_n + 2,)
+  int n_l_ovr;                     // count of modified logits
 };
 
 void build_sampler(void);
@@ -69,7 +69,6 @@ static void char_encode_mt_list(const char *text)
 {
   struct tokenizer_t *t = &model.tokenizer;
 
-mt_encode_continue:
   while (*text)
   {
     char utf8_char[8];
@@ -78,18 +77,13 @@ mt_encode_continue:
     // convert special tokens string to single token.
     if (*text == '<')
     {
-      int id;
-      for (id=t->id_special_base; id<=t->id_special_last; id++)
+      const char *c;
+      int id = tokenizer_find_sp_token_prefix(text, &c);
+      if (id >= 0)
       {
-        const char *s = tokenizer_get_token_str(id);
-        const char *c = text;
-        for (;*s && (*s == *c); s++, c++);
-        if (!*s)
-        {
-          mt_add_token(id, false);
-          text = c;
-          goto mt_encode_continue;           // exit double loop
-        }
+        mt_add_token(id, false);
+        text = c;
+        continue;
       }
     }
 
@@ -120,11 +114,90 @@ mt_encode_continue:
   }
 }
 
-// encode text, define tokeniser token list
+// ------------------------------------
+// merge candidates priority queue (binary min heap on score, then list index for leftmost first)
+
+#define CAND_LT(a, b) (((a).score < (b).score) || (((a).score == (b).score) && ((a).i < (b).i)))
+
+// add merge candidate of token i with next token
+static void heap_push(struct mt_list_t *mt_list, int i)
+{
+  const struct m_tok_t *mt = &mt_list->mt[i];
+  struct mt_cand_t c, *h;
+  int k;
+
+  if (mt->score < 0)                             // no merge
+    return;
+
+  if (mt_list->n_heap == mt_list->n_heap_alloc)
+  {
+    mt_list->n_heap_alloc += 1024;
+    mt_list->heap = (struct mt_cand_t *)realloc_check(mt_list->heap, mt_list->n_heap_alloc * sizeof(struct mt_cand_t));
+  }
+
+  c.score = mt->score;
+  c.i = i;
+  c.n_upd = mt->n_upd;
+
+  // sift up
+  h = mt_list->heap;
+  for (k = mt_list->n_heap++; k > 0; )
+  {
+    int p = (k - 1) >> 1;
+    if (!CAND_LT(c, h[p]))
+      break;
+    h[k] = h[p];
+    k = p;
+  }
+  h[k] = c;
+}
+
+// remove best merge candidate from heap top
+static void heap_pop(struct mt_list_t *mt_list)
+{
+  struct mt_cand_t *h = mt_list->heap;
+  int n = --mt_list->n_heap;
+  struct mt_cand_t c = h[n];
+  int k = 0;
+
+  // sift down
+  while (1)
+  {
+    int j = 2*k + 1;
+    if (j >= n)
+      break;
+    if ((j + 1 < n) && CAND_LT(h[j+1], h[j]))
+      j++;
+    if (!CAND_LT(h[j], c))
+      break;
+    h[k] = h[j];
+    k = j;
+  }
+  h[k] = c;
+}
+
+// update merge score of token i with next token and add new candidate
+static void update_m_score(struct mt_list_t *mt_list, int i)
+{
+  struct m_tok_t *mt = &mt_list->mt[i];
+  mt->n_upd++;                                   // obsolete previous candidates
+  if (mt->i_next >= 0)
+    set_m_score(mt, mt_list->mt[mt->i_next].tok_id);
+  else
+    mt->score = -1;
+  heap_push(mt_list, i);
+}
+
+// encode text, define tokeniser token list
 void tokenizer_encode(const char *text)
 {
   struct tokenizer_t *t = &model.tokenizer;
-  t->mt_list.n_list = 0;                         // reset list size
+  struct mt_list_t *mt_list = &t->mt_list;
+  struct m_tok_t *mt;
+  int i, n;
+
+  mt_list->n_list = 0;                           // reset list size
+  mt_list->n_heap = 0;
 
   CHECK(text && text[0]);
   if (!text || !text[0])                         // should not occur
@@ -135,43 +208,52 @@ void tokenizer_encode(const char *text)
   PRINT_TL();
 
   // --------------------------------------------
-  // merge token pairs
-  while (1)                                      // repeat until no merge found
+  // link tokens and init merge candidates
+  mt = mt_list->mt;
+  n = mt_list->n_list;
+  for (i=0; i<n; i++)
   {
-    int score = t->merge.list_size;              // max score value (min score is best merge)
-    int i, i_best = -1, i_max = t->mt_list.n_list - 1;
-
-    for (i=0; (i<i_max) && score; i++)
-    {
-      struct m_tok_t *mt = &t->mt_list.mt[i];
-      if ((mt->score >= 0) && (mt->score < score))
-      {
-        score = mt->score;
-        i_best = i;
-      }
-    }
+    mt[i].i_prev = i - 1;
+    mt[i].i_next = (i < n-1) ? i + 1 : -1;
+    mt[i].n_upd = 0;
+    heap_push(mt_list, i);
+  }
 
-    PRINT_TL();
-    if (i_best < 0)                              // no merge found
-      break;
+  // --------------------------------------------
+  // merge token pairs, lowest score first, leftmost first if same score
+  while (mt_list->n_heap)                        // repeat until no merge found
+  {
+    struct mt_cand_t c = mt_list->heap[0];
+    struct m_tok_t *m;
+    int i_r;
 
-    // concat list
-    for (i=i_best+1; i<i_max; i++)
-      t->mt_list.mt[i] = t->mt_list.mt[i+1];
-    t->mt_list.n_list--;
+    heap_pop(mt_list);
+    m = &mt[c.i];
+    if ((m->tok_id < 0) || (m->n_upd != c.n_upd))
+      continue;                                  // token merged or score changed since candidate added
 
-    // replace token
-    t->mt_list.mt[i_best].tok_id = t->mt_list.mt[i_best].tok_id_m;
-    PRINT_TL();
+    // replace token and unlink merged right token
+    i_r = m->i_next;
+    m->tok_id = m->tok_id_m;
+    m->i_next = mt[i_r].i_next;
+    if (m->i_next >= 0)
+      mt[m->i_next].i_prev = c.i;
+    mt[i_r].tok_id = -1;
 
     // update score with next
-    set_m_score(&t->mt_list.mt[i_best], t->mt_list.mt[i_best+1].tok_id);
+    update_m_score(mt_list, c.i);
 
     // update score of previous
-    if (i_best > 0)
-      set_m_score(&t->mt_list.mt[i_best-1], t->mt_list.mt[i_best].tok_id);
+    if (m->i_prev >= 0)
+      update_m_score(mt_list, m->i_prev);
   }
-}
+
+  // compact list (first token is never removed)
+  for (n=0, i=0; i>=0; i=mt[i].i_next)
+    mt[n++] = mt[i];
+  mt_list->n_list = n;
+  PRINT_TL();
+}
 
 // return token string.
 // input bin buff can be small (2 chars) as is used only to receive one 8 bits binary value
@@ -265,8 +347,12 @@ void free_tokenizer(void)
   struct tokenizer_t *t = &model.tokenizer;
   free_check(t->dic_tokens.buff);
   free_check(t->tok_index);
+  free_check(t->tok_hash);
+  free_check(t->sp_trie);
   free_check(t->merge.id_list);
+  free_check(t->merge.hash);
   free_check(t->mt_list.mt);
+  free_check(t->mt_list.heap);
 }
 
 #if 0
@@ -11,8 +11,16 @@ struct str_dic_t
 struct tok_index_t
 {
   const char *str;                     // to string in tokenizer_t dic_tokens
-  int tok_id;                          // origin tokenizer index (non sorted list)
-  int id_to_sort;                      // origin index to sorted position (tok_id to str convert)
+  int tok_id;                          // tokenizer index
+};
+
+// special tokens strings trie node (childs are linked with next)
+struct sp_trie_t
+{
+  int c;                               // node char
+  int tok_id;                          // special token id if string end at this node, else -1
+  int child;                           // first child node index, 0 if none (0 is root)
+  int next;                            // next sibling node index, 0 if none
 };
 
 // merge tokens id
@@ -30,6 +38,17 @@ struct m_tok_t
   int score;                           // merge score with righ token
   int tok_id;                          // token id
   int tok_id_m;                        // token id if merge with righ token
+  int i_prev;                          // previous token index in list during merges (-1 if none)
+  int i_next;                          // next token index in list during merges (-1 if none)
+  int n_upd;                           // score update count, used to detect obsolete merge candidates
+};
+
+// merge candidate in encode priority queue
+struct mt_cand_t
+{
+  int score;                           // merge score (lower is first merged)
+  int i;                               // left token index in mt list
+  int n_upd;                           // left token n_upd value when candidate was added
 };
 
 // merge tokens id list
@@ -38,6 +57,11 @@ struct mt_list_t
   struct m_tok_t *mt;
   int n_list;
   int n_alloc;
+
+  // merge candidates binary heap
+  struct mt_cand_t *heap;
+  int n_heap;
+  int n_heap_alloc;
 };
 
 // BPE tokenizer datas
@@ -48,6 +72,12 @@ struct tokenizer_t
   struct str_dic_t dic_tokens;         // token string list
   struct tok_index_t *tok_index;       // token id list
   int tok_index_list_size;
+  int *tok_hash;                       // open addressing hash table of token id (-1 if empty)
+  unsigned int tok_hash_mask;          // hash table size - 1
+
+  // special tokens prefix search trie
+  struct sp_trie_t *sp_trie;
+  int sp_trie_n;
   
   // merge list
   struct
@@ -55,6 +85,8 @@ struct tokenizer_t
     struct merge_id_t *id_list;        // merge tokens id
     int list_size;
     int n_alloc;
+    int *hash;                         // open addressing hash table of id_list index (-1 if empty)
+    unsigned int hash_mask;            // hash table size - 1
   } merge;
 
   int id_special_base;                 // start index of special tokens not in model.vocab list
@@ -4,72 +4,98 @@
 #ifdef INC_THRD_BATCH
 
 // define qkv for self attention
-static _inline void opt_compute_qkv(float *q, float *k, float *v, const float *xb, const struct transformer_weights_t *w, int layer_id, mm_proc_t matmul_lw)
+static _inline void opt_compute_qkv(float *q, float *k, float *v, const float *xb, const struct transformer_weights_t *w, int layer_id)
 {
+  const struct w_dat_t *wq = &w->wq, *wk = &w->wk, *wv = &w->wv;
+  int zq = layer_id, zk = layer_id, zv = layer_id;
   int n_thrd = numa_map.n_threads;
   int i;
   CHECK(n_thrd <= w->wk.wy);
 
+  // select layer datas if layers types differ
+  WD_SEL_Z(wq, zq);
+  WD_SEL_Z(wk, zk);
+  WD_SEL_Z(wv, zv);
+
   #pragma omp parallel for
   for (i=0; i<n_thrd; i++)
   {
     const struct w_part_t *lp;
     const char *_p;
-    int y = i*w->wk.dy;
-    int dy = WD_GET_DY(y, w->wk.dy, w->wk.wy);
-    size_t ofs;
+    int y = i*wk->dy;
+    int dy = WD_GET_DY(y, wk->dy, wk->wy);   // same for k and v (same wy)
 
-    lp = &w->wk.lp[i];
-    ofs = (size_t)layer_id * lp->sz_l;   // same for k and v  (same wy)
-    _p = (const char *)lp->p + ofs;
-    matmul_lw(k + y, xb, _p, w->wk.wx, dy);
+    lp = &wk->lp[i];
+    _p = (const char *)lp->p + (size_t)zk * lp->sz_l;
+    wk->mm_proc(k + y, xb, _p, wk->wx, dy);
 
-    lp = &w->wv.lp[i];
-    _p = (const char *)lp->p + ofs;
-    matmul_lw(v + y, xb, _p, w->wv.wx, dy);
+    lp = &wv->lp[i];
+    _p = (const char *)lp->p + (size_t)zv * lp->sz_l;
+    wv->mm_proc(v + y, xb, _p, wv->wx, dy);
 
     if (q)
     {
-      y = i*w->wq.dy;
-      dy = WD_GET_DY(y, w->wq.dy, w->wq.wy);
-      lp = &w->wq.lp[i];
-      _p = (const char *)lp->p + (size_t)layer_id * lp->sz_l;
-      matmul_lw(q + y, xb, _p, w->wq.wx, dy);
+      y = i*wq->dy;
+      dy = WD_GET_DY(y, wq->dy, wq->wy);
+      lp = &wq->lp[i];
+      _p = (const char *)lp->p + (size_t)zq * lp->sz_l;
+      wq->mm_proc(q + y, xb, _p, wq->wx, dy);
     }
   }
 }
 
 // in xb, work hb2, out hb
-static _inline void opt_compute_w1_w3_swiglu(float *hb, float *hb2, const float *xb, const struct transformer_weights_t *w, int layer_id, mm_proc_t matmul_lw)
+static _inline void opt_compute_w1_w3_swiglu(float *hb, float *hb2, const float *xb, const struct transformer_weights_t *w, int layer_id)
 {
+  const struct w_dat_t *w1 = &w->w1, *w3 = &w->w3;
+  int z1 = layer_id, z3 = layer_id;
   int n_thrd = numa_map.n_threads;
+  bool w13_fused = (model.transformer.config.w_fuse & W_FUSE_W13) != 0;
   int i;
   CHECK(n_thrd <= w->w1.wy);
 
+  // select layer datas if layers types differ
+  WD_SEL_Z(w1, z1);
+  WD_SEL_Z(w3, z3);
+
   #pragma omp parallel for
   for (i=0; i<n_thrd; i++)
   {
     const struct w_part_t *lp;
     const char *_p;
-    int y = i*w->w1.dy;
-    int dy = WD_GET_DY(y, w->w1.dy, w->w1.wy);
-    int wx = w->w1.wx;
-    int x, x1;
-    size_t ofs;
+    int y = i*w1->dy;
+    int dy = WD_GET_DY(y, w1->dy, w1->wy);   // same for w1/w3 (same wy)
+    int wx = w1->wx;
 
-    lp = &w->w1.lp[i];
-    ofs = (size_t)layer_id * lp->sz_l;   // same for w1/w3 (same wy)
-    _p = (const char *)lp->p + ofs;
-    matmul_lw(hb + y, xb, _p, wx, dy);
+    if (w13_fused)
+    {
+      // w1/w3 interleaved by blocs of W_FUSE_BY rows, swiglu each bloc
+      size_t sz_wx = wd_ne_sizeof(w1, wx);
+      int b;
+      _p = (const char *)w1->lp[i].p + (size_t)z1 * w1->lp[i].sz_l;
+      for (b=0; b<dy; b+=W_FUSE_BY)
+      {
+        int nb = ((dy - b) < W_FUSE_BY) ? dy - b : W_FUSE_BY;
+        w1->mm_proc(hb + y + b, xb, _p, wx, nb);
+        _p += (size_t)nb * sz_wx;
+        w3->mm_proc(hb2 + y + b, xb, _p, wx, nb);
+        _p += (size_t)nb * sz_wx;
+        vec_procs.vec_swiglu(hb + y + b, hb2 + y + b, nb);
+      }
+    }
+    else
+    {
+      lp = &w1->lp[i];
+      _p = (const char *)lp->p + (size_t)z1 * lp->sz_l;
+      w1->mm_proc(hb + y, xb, _p, wx, dy);
 
-    lp = &w->w3.lp[i];
-    _p = (const char *)lp->p + ofs;
-    matmul_lw(hb2 + y, xb, _p, wx, dy);
+      lp = &w3->lp[i];
+      _p = (const char *)lp->p + (size_t)z3 * lp->sz_l;
+      w3->mm_proc(hb2 + y, xb, _p, wx, dy);
 
-    // swiglu
-    x1 = y+dy;
-    for (x=y; x<x1; x++)
-      hb[x] = swiglu(hb[x]) * hb2[x];
+      // swiglu
+      vec_procs.vec_swiglu(hb + y, hb2 + y, dy);
+    }
   }
 }
 
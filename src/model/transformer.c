@@ -1,11 +1,18 @@
 #include <math.h>
 #include <stdlib.h>
+#include <float.h>
 #include "l_util.h"
 #include "mem_alloc.h"
 #include "model.h"
 #include "load_transformer.h"
 #include "omp_numa.h"
 #include "matmul.h"
+#include "vec_simd.h"
+#include "moe_page.h"
+#include "layer_stream.h"
+#include "mm_tune.h"
+#include "w_fuse.h"
+#include "w_src.h"
 
 #ifdef USE_SA_SIMD
 #include "tr_opt_simd.h"
@@ -44,11 +51,18 @@ static void alloc_run_state(void)
   if (p->rope_theta)                          // else expect defined in transformer_weights_t.rope_if
     ST_ALLOC(float, s->rope_freq, p->head_size / 2);      // 64
   ST_ALLOC(float, s->rope_sin_cos, p->head_size);         // 128
+  if (p->rope_theta)                          // sin/cos for all positions
+    ST_ALLOC(float, s->rope_tab, (int64_t)p->seq_len * p->head_size);  // 2048 * 128
   ST_ALLOC(struct ctoken_t, s->cache.tokens, p->seq_len); // 2048
   if (p->moe.num_experts)    // MeO mixtral
   {
     s->moe.exp_logits = malloc_check(p->moe.num_experts*sizeof(float));
     s->moe.exp_probs  = malloc_check(p->moe.num_experts*sizeof(struct exp_prob_t));
+    if (p->moe.page_slots)
+    {
+      s->moe.exp_ids   = malloc_check(p->moe.num_experts*sizeof(int));
+      s->moe.exp_slots = malloc_check(p->moe.num_experts*sizeof(int));
+    }
   }
   // single threaded main process
   s->logits = malloc_check(p->vocab_size * sizeof(float)); // 32000
@@ -67,15 +81,107 @@ static void free_run_state(struct transformer_runstate_t *s)
   numa_free(s->att);
   numa_free(s->rope_freq);
   numa_free(s->rope_sin_cos);
+  numa_free(s->rope_tab);
   numa_free(s->cache.tokens);
   free_check(s->moe.exp_logits);
   free_check(s->moe.exp_probs);
+  free_check(s->moe.exp_ids);
+  free_check(s->moe.exp_slots);
   free_check(s->logits);
+  free_check(s->cls_ids);
+  free_check(s->cls_logits);
+  free_check(s->cls_stats);
 }
 
 // ------------------------------------
 // allocate transformer weight datas
 
+#ifdef _GCC_BLD
+// GCC produce "-incompatible-pointer-types" warning if no cast used.
+#define FN_MUL (mm_proc_t)
+#define FN_CVT (void (*)(float *, const void *, size_t))
+#else
+// VS do not warn. (that seem to be correct behavehour because function arguments are compatible).
+#define FN_MUL
+#define FN_CVT
+#endif
+
+// names of layer weights classes, must match enum e_lw_class
+const char *lw_class_name[lw_class_count] = { "wq", "wk", "wv", "wo", "w1", "w2", "w3", "moe_gate" };
+
+// get matmul function for weights data type
+mm_proc_t get_mm_proc(enum e_w_type d_type)
+{
+  switch (d_type)
+  {
+    case w_type_f32:  return FN_MUL matmul_procs.matmul_f32_f32;
+    case w_type_f16:  return FN_MUL matmul_procs.matmul_f32_f16;
+    case w_type_bf16: return FN_MUL matmul_procs.matmul_f32_bf16;
+    case w_type_sf16: return FN_MUL matmul_procs.matmul_f32_sf16;
+    case w_type_f12:  return FN_MUL matmul_procs.matmul_f32_f12;
+    case w_type_f8:   return FN_MUL matmul_procs.matmul_f32_f8;
+    case w_type_q8:   return FN_MUL matmul_procs.matmul_f32_q8;
+    case w_type_q4:   return FN_MUL matmul_procs.matmul_f32_q4;
+    case w_type_f12s: return FN_MUL matmul_procs.matmul_f32_f12s;
+    case w_type_f8s:  return FN_MUL matmul_procs.matmul_f32_f8s;
+    default:
+      msg_error("no matmul for weights type %d", d_type);
+  }
+  return NULL;
+}
+
+// get layer weights class tensor sizes
+static void get_lw_shape(enum e_lw_class c, int *wy, int *wx)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  *wx = p->dim;
+  switch (c)
+  {
+    case lw_class_wq:       *wy = p->n_heads * p->head_size; break;
+    case lw_class_wk:
+    case lw_class_wv:       *wy = p->n_kv_heads * p->head_size; break;
+    case lw_class_wo:       *wy = p->dim; *wx = p->n_heads * p->head_size; break;
+    case lw_class_w1:
+    case lw_class_w3:       *wy = p->hidden_dim; break;
+    case lw_class_w2:       *wy = p->dim; *wx = p->hidden_dim; break;
+    case lw_class_moe_gate: *wy = p->moe.num_experts; break;
+    default:
+      msg_error("undefined layer weights class %d", c);
+  }
+}
+
+// alloc weights used with matmul
+static void alloc_mm_wd(struct w_dat_t *wd, int nz, int wy, int wx, enum e_w_type w_type)
+{
+  numa_alloc_wd(wd, nz, wy, wx, w_type, true);
+  wd->mm_proc = get_mm_proc(w_type);
+}
+
+// alloc layer weights of class c, use one w_dat_t per z unit if w_policy define layers override
+static void alloc_lw(struct w_dat_t *wd, enum e_lw_class c, int nz)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  enum e_w_type w_type = p->lw_cls_type[c];
+  int wy, wx;
+
+  get_lw_shape(c, &wy, &wx);
+  if (!p->ly_ovr)
+    alloc_mm_wd(wd, nz, wy, wx, w_type);
+  else
+  {
+    int z, nz_l = nz / p->n_layers;    // z units per layer (experts count if MoE)
+    wd->z_wd = (struct w_dat_t *)calloc_check(nz * sizeof(struct w_dat_t));
+    for (z=0; z<nz; z++)
+      alloc_mm_wd(&wd->z_wd[z], 1, wy, wx, p->ly_ovr[z / nz_l] ? p->ly_type : w_type);
+    wd->d_type = w_type;
+    wd->wx = wx;
+    wd->wy = wy;
+    wd->nz = nz;
+    wd->dy = wd->z_wd[0].dy;
+    wd->mm_proc = get_mm_proc(w_type);
+  }
+}
+
 // alloc memory for transformer weights
 // - single dim 1 (rms_att, rms_ffn, rms_final) are converted once to float 32.
 // - single dim > 1 (token_emb, wcls) are keept in torch load format or 16 bits minimal format.
@@ -87,31 +193,44 @@ static void alloc_transformer(void)
   struct transformer_weights_t *w = &model.transformer.weights;
   
   int nl = p->n_layers;
-  int nw = nl;                         // num w1/w2/w3
+  int nl_s = nl;                       // num streamed weights layers (wq/wk/wv/wo/w1/w2/w3)
+  int nw;                              // num w1/w2/w3
+
+  if (p->ly_ovr && (p->stream_nbuf || p->moe.page_slots))
+    msg_error("w_policy layers list is not supported with layer streaming or MoE paging");
+
+  if (p->stream_nbuf)                  // layer streaming, alloc stream_nbuf layers for streamed weights
+    nl_s = p->stream_nbuf;
+  nw = nl_s;
   if (p->moe.num_experts)              // MoE used (mixtral)
   {
-    nw *= p->moe.num_experts;          // alloc num_experts w1/w2/w3 per layer
-    numa_alloc_wd(&w->moe_gate, nl , p->moe.num_experts           , p->dim , p->lw_type, true);
+    if (p->moe.page_slots)
+      nw *= p->moe.page_slots;         // expert paging, alloc page_slots resident w1/w2/w3 per layer
+    else
+      nw *= p->moe.num_experts;        // alloc num_experts w1/w2/w3 per layer
+    alloc_lw(&w->moe_gate, lw_class_moe_gate, nl);
   }
 
+  // layer weights, sizes defined by class (get_lw_shape)
+  alloc_lw(&w->wq, lw_class_wq, nl_s);
+  alloc_lw(&w->wk, lw_class_wk, nl_s);
+  alloc_lw(&w->wv, lw_class_wv, nl_s);
+  alloc_lw(&w->wo, lw_class_wo, nl_s);
+  alloc_lw(&w->w1, lw_class_w1, nw);
+  alloc_lw(&w->w2, lw_class_w2, nw);
+  alloc_lw(&w->w3, lw_class_w3, nw);
+
   // size[nz][wy][wx]:          nz                  wy                wx (raw)  type
-  numa_alloc_wd(&w->token_emb ,  1 , p->vocab_size                , p->dim , p->em_type, true);
+  if (!p->emb_disk)                    // else rows read in file
+    alloc_mm_wd(&w->token_emb ,  1 , p->vocab_size                , p->dim , p->em_type);
   numa_alloc_wd(&w->rms_att   , nl , 1                            , p->dim , w_type_f32, false);
-  numa_alloc_wd(&w->wq        , nl , p->n_heads    * p->head_size , p->dim , p->lw_type, true);
-  numa_alloc_wd(&w->wk        , nl , p->n_kv_heads * p->head_size , p->dim , p->lw_type, true);
-  numa_alloc_wd(&w->wv        , nl , p->n_kv_heads * p->head_size , p->dim , p->lw_type, true);
-  
-  numa_alloc_wd(&w->wo        , nl , p->dim ,    p->n_heads * p->head_size , p->lw_type, true);
   numa_alloc_wd(&w->rms_ffn   , nl , 1                            , p->dim , w_type_f32, false);
-  numa_alloc_wd(&w->w1        , nw , p->hidden_dim                , p->dim , p->lw_type, true);
-  numa_alloc_wd(&w->w2        , nw , p->dim ,                p->hidden_dim , p->lw_type, true);
-  numa_alloc_wd(&w->w3        , nw , p->hidden_dim                , p->dim , p->lw_type, true);
   numa_alloc_wd(&w->rms_final ,  1 , 1                            , p->dim , w_type_f32, false);
   if (!p->rope_theta)
     numa_alloc_wd(&w->rope_if , nl , 1                   , p->head_size / 2, w_type_f32, false);
 
   // optional classifier if not same as token_emb
-  numa_alloc_wd(&w->wcls      ,  1 , p->vocab_size                , p->dim , p->em_type, true);
+  alloc_mm_wd(&w->wcls        ,  1 , p->vocab_size                , p->dim , p->em_type);
 
   // optional qkv bias
   numa_alloc_wd(&w->bq        , nl , 1,       p->n_heads    * p->head_size , w_type_f32, false);
@@ -125,6 +244,12 @@ void free_wd(struct w_dat_t *wd)
   int i;
   for (i=0; i<wd->nn; i++)
     numa_free(wd->p_node[i]);
+  if (wd->z_wd)
+  {
+    for (i=0; i<wd->nz; i++)
+      free_wd(&wd->z_wd[i]);
+    free_check(wd->z_wd);
+  }
 }
 
 // free transformer datas
@@ -133,6 +258,9 @@ void free_transformer(void)
   struct transformer_t *t = &model.transformer;
   struct transformer_weights_t *w = &t->weights;
 
+  moe_page_exit();
+  layer_stream_exit();
+  w_src_emb_exit();
   free_wd(&w->moe_gate);
   free_wd(&w->token_emb);
   free_wd(&w->rms_att);
@@ -151,6 +279,7 @@ void free_transformer(void)
   // optional classifier
   if (w->wcls.lp[0].p != w->token_emb.lp[0].p)  // test if not w->token_emb
     free_wd(&w->wcls);
+  free_wd(&w->wcls_sh);
   
   // optional qkv bias
   if (w->bq.ne)
@@ -162,11 +291,14 @@ void free_transformer(void)
 
   // free the struct transformer_runstate_t buffers
   free_run_state(&t->state);
+  free_check(t->config.ly_ovr);
+  free_check(t->config.cls_map);
 }
 
 // ------------------------------------
 // RoPE relative positional encoding:
-// complex-valued rotate q and k in each head.
+// complex-valued rotate q and k in each head. q/k weights are used in .safetensors order, rotated
+// pairs are (i, i + head_size/2) (rotate_half).
 
 // init RoPE freq
 static void init_RoPE(float *freq, float rope_theta, int head_size)
@@ -176,91 +308,69 @@ static void init_RoPE(float *freq, float rope_theta, int head_size)
     *freq = (float)(1.0 / pow(rope_theta, (double)i / head_size));
 }
 
-// define rope sin/cos for pos
+// define rope sin/cos for pos, sin_cos[n_freq*2] is n_freq sin followed by n_freq cos
 void set_RoPE_pos(float *sin_cos, int pos, const float *freq, int n_freq)
 {
   int i;
-  for (i=0; i<n_freq; i++, freq++, sin_cos+=2)
+  for (i=0; i<n_freq; i++)
   {
-    float f = *freq * pos;
-    sin_cos[0] = sinf(f);
-    sin_cos[1] = cosf(f);
+    float f = freq[i] * pos;
+    sin_cos[i] = sinf(f);
+    sin_cos[i + n_freq] = cosf(f);
   }
 }
 
+// init RoPE sin/cos table for all positions (seq_len * head_size)
+static void init_RoPE_tab(float *tab, const float *freq, int head_size, int seq_len)
+{
+  int pos;
+  for (pos=0; pos<seq_len; pos++, tab+=head_size)
+    set_RoPE_pos(tab, pos, freq, head_size/2);
+}
+
 // apply RoPE on a, b vectors list
 void RoPE(float *a, float *b, const float *sin_cos, int head_size, int a_dim, int b_dim)
 {
-  int i = 0;
   CHECK(b_dim <= a_dim);
-  do
-  {
-    int j;
-    for (j=0; j != head_size; j+=2, i+=2) 
-    {
-      float x = a[i];
-      float y = a[i+1];               // rotate a (query)
-      float s = sin_cos[j];           // get sin
-      float c = sin_cos[j+1];         // get cos
-      a[i]   = x*c - y*s;
-      a[i+1] = x*s + y*c;
-      if (i < b_dim)
-      {
-        x = b[i];
-        y = b[i+1];                   // rotate b (key)
-        b[i]   = x*c - y*s;
-        b[i+1] = x*s + y*c;
-      }
-    }
-  }
-  while (i != a_dim);
+  vec_procs.vec_rope(a, b, sin_cos, head_size, a_dim, b_dim);
 }
 
 // ------------------------------------
-// neural net block functions
+// neural net block functions (simd code in vec_simd.c)
 
 // add vectors a + b => a
-static void vec_add(float *a, const float *b, int n)
+static _inline void vec_add(float *a, const float *b, int n)
 {
-  int i;
-  for (i=0; i<n; i++)
-    a[i] += b[i];
+  vec_procs.vec_add(a, b, n);
 }
 
 // calculate sum of squares
-static float vec_get_sq_sum(const float *a, int n)
+static _inline float vec_get_sq_sum(const float *a, int n)
 {
-  float sq_sum = 0.0f;
-  int i;
-  for (i=0; i<n; i++)
-    sq_sum += a[i] * a[i];
-  return sq_sum;
+  return vec_procs.vec_sq_sum(a, n);
 }
 
 // add vectors a + b => a + get sq_sum
-static float vec_add_get_sq_sum(float *a, const float *b, int n)
+static _inline float vec_add_get_sq_sum(float *a, const float *b, int n)
 {
-  float sq_sum = 0;
-  int i;
-  for (i=0; i<n; i++)
-  {
-    float sum = a[i] + b[i];
-    a[i] = sum;
-    sq_sum += sum * sum;
-  }
-  return sq_sum;
+  return vec_procs.vec_add_sq_sum(a, b, n);
 }
 
-// normalize and scale
+// normalize and scale, weight NULL if folded in next matmul weights (w_fuse)
 static void norm_scale(float *o, const float *a, float sq_sum, float rms_norm_eps, const float *weight, int size)
 {
   // scale factor
   float k = 1.0f / sqrtf((sq_sum/size) + rms_norm_eps);
-  int i;
 
   // normalize and scale
-  for (i=0; i<size; i++)
-    o[i] = (a[i] * k) * weight[i];
+  if (weight)
+    vec_procs.vec_norm_scale(o, a, k, weight, size);
+  else
+  {
+    int i;
+    for (i=0; i<size; i++)
+      o[i] = a[i] * k;
+  }
 }
 
 // single head attention.
@@ -300,7 +410,7 @@ static void head_attention(int h, uint64_t s_kv_ofs)
   }
 
   // softmax the scores to get attention weights, from 0..pos inclusively
-  softmax(att, s->cache.n_tokens);
+  vec_softmax(att, s->cache.n_tokens, 1.0f);
 
   // weighted sum of the values, accumulate xb for t = 0..pos inclusively
   for (t=0; t<s->cache.n_tokens; t++, v += p->kv_dim)
@@ -340,10 +450,12 @@ static void multihead_attention(uint64_t s_kv_ofs)
 }
 
 // splitted multi threaded matmul
-static void lw_matmul(float *d, const float *s, const struct w_dat_t *wd, int layer_id, mm_proc_t mm_proc)
+static void lw_matmul(float *d, const float *s, const struct w_dat_t *wd, int layer_id)
 {
   int i, n_thrd = wd->wy < numa_map.n_threads ? wd->wy : numa_map.n_threads;
 
+  WD_SEL_Z(wd, layer_id);
+
   #pragma omp parallel for
   for (i=0; i<n_thrd; i++)
   {
@@ -351,7 +463,187 @@ static void lw_matmul(float *d, const float *s, const struct w_dat_t *wd, int la
     const char *p = (const char *)lp->p + (size_t)layer_id * lp->sz_l;
     int y = i * wd->dy;
     int dy = WD_GET_DY(y, wd->dy, wd->wy);
-    mm_proc(d + y, s, p, wd->wx, dy);
+    wd->mm_proc(d + y, s, p, wd->wx, dy);
+  }
+}
+
+// select ids of the n largest values of a[ne] (not sorted), use min heap of ids
+static void select_top_n(int *ids, int n, const float *a, int ne)
+{
+  int i, j, k;
+
+  // sift down ids[i] in heap of size n
+  #define HEAP_SIFT(i)\
+    for (j=i; (k=2*j+1)<n; j=k)\
+    {\
+      int t;\
+      if ((k+1 < n) && (a[ids[k+1]] < a[ids[k]])) k++;\
+      if (a[ids[j]] <= a[ids[k]]) break;\
+      t = ids[j]; ids[j] = ids[k]; ids[k] = t;\
+    }
+
+  for (i=0; i<n; i++)
+    ids[i] = i;
+  for (i=n/2-1; i>=0; i--)
+    HEAP_SIFT(i);
+  for (i=n; i<ne; i++)
+    if (a[i] > a[ids[0]])
+    {
+      ids[0] = i;
+      HEAP_SIFT(0);
+    }
+}
+
+// two stages classifier: logits approximated using wcls low precision copy, then logits of the
+// best candidates are computed with wcls. other logits keep approximated values.
+static void classifier_two_stage(float *logits, const float *x)
+{
+  const struct transformer_weights_t *w = &model.transformer.weights;
+  const struct w_dat_t *wd = &w->wcls;
+  int *ids = model.transformer.state.cls_ids;
+  int i, n = model.transformer.config.cls_rescore;
+  size_t sz_wx = wd_ne_sizeof(wd, wd->wx);
+
+  lw_matmul(logits, x, &w->wcls_sh, 0);
+  select_top_n(ids, n, logits, wd->wy);
+
+  #pragma omp parallel for
+  for (i=0; i<n; i++)
+  {
+    int y = ids[i];
+    const char *p = (const char *)wd->lp[y / wd->dy].p + (size_t)(y % wd->dy) * sz_wx;
+    wd->mm_proc(logits + y, x, p, wd->wx, 1);
+  }
+}
+
+// compute statistics of classifier part logits l[n] (rows y0..y0+n-1)
+static void cls_part_stats(struct cls_stats_t *st, const float *l, int y0, int n)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  int i;
+
+  st->max = -FLT_MAX;
+  st->sum_exp = 0;
+  st->n = 0;
+  st->complete = true;
+  if (n <= 0)
+    return;
+
+  #define CLS_TOKEN(y) (p->cls_map ? p->cls_map[y] : (y))
+
+  if (!p->cls_topk)                    // greedy, argmax only
+  {
+    int i_max = 0;
+    for (i=1; i<n; i++)
+      if (l[i] > l[i_max])
+        i_max = i;
+    st->max = l[i_max];
+    st->n = 1;
+    st->complete = (n == 1);
+    st->top_l[0] = l[i_max];
+    st->top_tk[0] = CLS_TOKEN(y0 + i_max);
+    return;
+  }
+
+  st->max = vec_procs.vec_max(l, n);
+  st->sum_exp = vec_procs.vec_exp_sum(NULL, l, n, st->max, p->cls_k_temp);
+
+  st->n = (n < p->cls_topk) ? n : p->cls_topk;
+  st->complete = (st->n == n);
+  select_top_n(st->top_tk, st->n, l, n);
+  for (i=0; i<st->n; i++)
+  {
+    int j = st->top_tk[i];
+    st->top_l[i] = l[j];
+    st->top_tk[i] = CLS_TOKEN(y0 + j);
+  }
+}
+
+// classifier with statistics computed by each thread on its part (max, sum_exp, top logits list),
+// sampler merge thread results and do not need to scan all logits. if mm is false, logits
+// are already computed.
+static void classifier_stats(float *logits, const float *x, bool mm)
+{
+  const struct w_dat_t *wd = &model.transformer.weights.wcls;
+  struct transformer_runstate_t *s = &model.transformer.state;
+  int i, n_thrd = (wd->wy < numa_map.n_threads) ? wd->wy : numa_map.n_threads;
+
+  #pragma omp parallel for
+  for (i=0; i<n_thrd; i++)
+  {
+    int y = i * wd->dy;
+    int dy = WD_GET_DY(y, wd->dy, wd->wy);
+    if (mm && (dy > 0))
+      wd->mm_proc(logits + y, x, wd->lp[i].p, wd->wx, dy);
+    cls_part_stats(&s->cls_stats[i], logits + y, y, dy);
+  }
+  s->cls_n_stats = n_thrd;
+}
+
+// get logit of token in classifier output l
+static float get_cls_logit(const float *l, int token)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  int a, b;
+
+  if (!p->cls_map)
+    return l[token];
+
+  // binary search in cls_map (ascending token ids)
+  a = 0;
+  b = model.transformer.weights.wcls.wy - 1;
+  while (a <= b)
+  {
+    int m = (a + b) >> 1;
+    if (p->cls_map[m] == token)
+      return l[m];
+    if (p->cls_map[m] < token)
+      a = m + 1;
+    else
+      b = m - 1;
+  }
+  return -FLT_MAX;                     // not allowed token
+}
+
+// get classifier logit of token
+float transformer_get_logit(int token)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  const struct transformer_runstate_t *s = &model.transformer.state;
+  return get_cls_logit(p->cls_map ? s->cls_logits : s->logits, token);
+}
+
+// define all tokens logits in state logits
+void transformer_def_logits(void)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  struct transformer_runstate_t *s = &model.transformer.state;
+  int i;
+
+  if (!p->cls_map)                     // logits computed by classifier
+    return;
+
+  // restricted tokens, classifier contain only allowed tokens rows
+  for (i=0; i<p->vocab_size; i++)
+    s->logits[i] = -FLT_MAX;
+  for (i=0; i<model.transformer.weights.wcls.wy; i++)
+    s->logits[p->cls_map[i]] = s->cls_logits[i];
+}
+
+// teacher forced evaluation, add negative log likelihood of token with last forward logits
+// (forward called with def_logits, before sampler modifications)
+void transformer_eval_nll(int token)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  struct transformer_runstate_t *s = &model.transformer.state;
+  const float *logits = p->cls_map ? s->cls_logits : s->logits;
+  int n = model.transformer.weights.wcls.wy;
+  float max = vec_procs.vec_max(logits, n);
+  float l = get_cls_logit(logits, token);
+  if (l > -FLT_MAX)                    // not counted if token not allowed
+  {
+    s->eval.nll_sum += max + logf(vec_procs.vec_exp_sum(NULL, logits, n, max, 1.0f)) - l;
+    s->eval.n_nll++;
   }
 }
 
@@ -365,10 +657,29 @@ static int moe_compare(const void *_a, const void *_b)
   return 0;
 }
 
-// SwiGLU non-linearity x * (1.0f / (1.0f + expf(-x)));
-static _inline float swiglu(float x)
+// MoE expert paging: predict next layer experts using current ffn input with next layer gate
+// (residual stream change slowly between layers), prefetch them while current layer is computed.
+static void moe_page_prefetch(int layer_id)
 {
-  return (x / (1.0f + expf(-x)));
+  const struct transformer_config_t *p = &model.transformer.config;
+  const struct transformer_weights_t *w = &model.transformer.weights;
+  struct transformer_runstate_t *s = &model.transformer.state;
+  float *logits = s->moe.exp_logits;
+  int i, j;
+
+  lw_matmul(logits, s->xb, &w->moe_gate, layer_id);
+
+  // select top_k experts (softmax not required for order)
+  for (i=0; i<p->moe.top_k; i++)
+  {
+    int e = 0;
+    for (j=1; j<p->moe.num_experts; j++)
+      if (logits[j] > logits[e])
+        e = j;
+    s->moe.exp_ids[i] = e;
+    logits[e] = -FLT_MAX;
+  }
+  moe_page_request(layer_id, s->moe.exp_ids, p->moe.top_k, NULL, true);
 }
 
 // token cache, save list of injected + generated tokens history.
@@ -396,6 +707,9 @@ static int update_token_cache(int token, bool is_sampled)
 // define pointer to y raw in weight datas and x raw size
 #define WDL_Y(id, y) (const void *)((char *)w->id.lp[0].p + (size_t)(y) * w->id.wx * w_type_sizeof[w->id.d_type]), w->id.wx
 
+// rms norm weights of layer y, NULL if folded in next matmul weights
+#define WDL_NORM(id, y, fold) ((p->w_fuse & (fold)) ? NULL : (const float *)w->id.lp[0].p + (size_t)(y) * w->id.wx), w->id.wx
+
 void forward(int token, bool is_sampled, bool def_logits)
 {
   struct transformer_t *transformer = &model.transformer;
@@ -405,6 +719,7 @@ void forward(int token, bool is_sampled, bool def_logits)
   int id_exit = def_logits ? -1 : (p->n_layers - 1);
   int pos, layer_id;
   float sq_sum;
+  const float *sin_cos;
 
   if (s->cache.n_tokens == p->seq_len)                 // context max size reached
 #ifdef PACK_KV_CACHE
@@ -413,6 +728,7 @@ void forward(int token, bool is_sampled, bool def_logits)
   {
     memset(s->logits, 0, p->vocab_size * sizeof(float));
     s->logits[model.config.token_eot] = 1.0;           // force return eot
+    s->cls_n_stats = 0;                                // sampler use logits
     return;
   }
 #endif
@@ -421,12 +737,14 @@ void forward(int token, bool is_sampled, bool def_logits)
   pos = update_token_cache(token, is_sampled);
   CHECK(pos < p->seq_len); 
 
-  // update rope freqs for pos
-  if (p->rope_theta)
-    set_RoPE_pos(s->rope_sin_cos, pos, s->rope_freq, p->head_size/2);
+  // rope sin/cos for pos
+  sin_cos = p->rope_theta ? s->rope_tab + (size_t)pos * p->head_size : s->rope_sin_cos;
   
   // ----------------------------------
   // define the token embedding into x
+  if (p->emb_disk)                                     // read in model file
+    w_src_emb_read(s->x, token);
+  else
   if (w->token_emb.nn == 1)                            // single node (contiguous buffer)
     p->def_embeddings(s->x, WDL_Y(token_emb, token));  // token * p->dim, p->dim
   else
@@ -438,7 +756,7 @@ void forward(int token, bool is_sampled, bool def_logits)
     p->def_embeddings(s->x, p_emb, w->token_emb.wx);
   }
 
-  sq_sum = vec_get_sq_sum(s->x, w->token_emb.wx);  // get x sum square for first norm
+  sq_sum = vec_get_sq_sum(s->x, p->dim);           // get x sum square for first norm
 
   // ----------------------------------
   // forward all the layers
@@ -447,10 +765,11 @@ void forward(int token, bool is_sampled, bool def_logits)
     size_t s_kv_ofs;                             // layer kv offset in states
     float *k, *v;                                // key and value in cache
     bool def_q = layer_id != id_exit;
+    int lw_id = p->stream_nbuf ? layer_stream_get(layer_id) : layer_id;  // layer weights z index (streamed weights)
     
     // ----------------------------------
     // attention rmsnorm
-    norm_scale(s->xb, s->x, sq_sum, p->rms_norm_eps, WDL_Y(rms_att, layer_id)); // p->dim
+    norm_scale(s->xb, s->x, sq_sum, p->rms_norm_eps, WDL_NORM(rms_att, layer_id, W_FUSE_NORM_ATT)); // p->dim
 
     // get key and value point to the kv cache to update
     s_kv_ofs = (size_t)layer_id * p->seq_len * p->kv_dim;   // kv cache layer offset for convenience
@@ -458,13 +777,13 @@ void forward(int token, bool is_sampled, bool def_logits)
     v = s->v_cache + s_kv_ofs + pos * p->kv_dim;
 
 #ifdef USE_THRD_BATCH
-    opt_compute_qkv(def_q ? s->q : NULL, k, v, s->xb, w, layer_id, p->matmul_lw);
+    opt_compute_qkv(def_q ? s->q : NULL, k, v, s->xb, w, lw_id);
 #else
     // qkv matmuls for this position
-    lw_matmul(k, s->xb, &w->wk, layer_id, p->matmul_lw); // p->dim, p->kv_dim
-    lw_matmul(v, s->xb, &w->wv, layer_id, p->matmul_lw); // p->dim, p->kv_dim
+    lw_matmul(k, s->xb, &w->wk, lw_id); // p->dim, p->kv_dim
+    lw_matmul(v, s->xb, &w->wv, lw_id); // p->dim, p->kv_dim
     if (def_q)
-      lw_matmul(s->q, s->xb, &w->wq, layer_id, p->matmul_lw); // p->dim, p->dim
+      lw_matmul(s->q, s->xb, &w->wq, lw_id); // p->dim, p->dim
 #endif
 
     // optional qkv bias
@@ -483,43 +802,41 @@ void forward(int token, bool is_sampled, bool def_logits)
     // if logits not needed (tokens injection), on last layer update only k and exit
     if (!def_q)
     {
-      RoPE(k, NULL, s->rope_sin_cos, p->head_size, p->kv_dim, 0);
+      RoPE(k, NULL, sin_cos, p->head_size, p->kv_dim, 0);
       return;
     }
 #endif
 
     // RoPE relative positional encoding: complex-valued rotate q and k in each head
-    RoPE(s->q, k, s->rope_sin_cos, p->head_size, p->dim, p->kv_dim);
+    RoPE(s->q, k, sin_cos, p->head_size, p->dim, p->kv_dim);
 
     // multihead attention. iterate over all heads, result stored in s->xb
     multihead_attention(s_kv_ofs);
 
     // final matmul to get the output of the attention
-    lw_matmul(s->xb2, s->xb, &w->wo, layer_id, p->matmul_lw); // p->dim, p->dim
+    lw_matmul(s->xb2, s->xb, &w->wo, lw_id); // p->dim, p->dim
 
     // residual connection back into x + sq_sum
     sq_sum = vec_add_get_sq_sum(s->x, s->xb2, p->dim);
 
     // ffn rmsnorm
-    norm_scale(s->xb, s->x, sq_sum, p->rms_norm_eps, WDL_Y(rms_ffn, layer_id)); // p->dim
+    norm_scale(s->xb, s->x, sq_sum, p->rms_norm_eps, WDL_NORM(rms_ffn, layer_id, W_FUSE_NORM_FFN)); // p->dim
 
     // !MoE
     if (!p->moe.num_experts)
     {
 #ifdef USE_THRD_BATCH
-      opt_compute_w1_w3_swiglu(s->hb, s->hb2, s->xb, w, layer_id, p->matmul_lw);
+      opt_compute_w1_w3_swiglu(s->hb, s->hb2, s->xb, w, lw_id);
 #else
-      int i;
       // Now for FFN in PyTorch we have: self.w2(F.silu(self.w1(x)) * self.w3(x))
-      lw_matmul(s->hb,  s->xb, &w->w1, layer_id, p->matmul_lw); // p->dim, p->hidden_dim
-      lw_matmul(s->hb2, s->xb, &w->w3, layer_id, p->matmul_lw); // p->dim, p->hidden_dim
+      lw_matmul(s->hb,  s->xb, &w->w1, lw_id); // p->dim, p->hidden_dim
+      lw_matmul(s->hb2, s->xb, &w->w3, lw_id); // p->dim, p->hidden_dim
 
       // SwiGLU non-linearity
-      for (i=0; i<p->hidden_dim; i++)
-        s->hb[i] = swiglu(s->hb[i]) * s->hb2[i];
+      vec_procs.vec_swiglu(s->hb, s->hb2, p->hidden_dim);
 #endif
-      // final p->matmul_lw to get the output of the ffn
-      lw_matmul(s->xb, s->hb, &w->w2, layer_id, p->matmul_lw);  // p->hidden_dim, p->dim
+      // final matmul to get the output of the ffn
+      lw_matmul(s->xb, s->hb, &w->w2, lw_id);  // p->hidden_dim, p->dim
 
       // residual connection + sq_sum
       sq_sum = vec_add_get_sq_sum(s->x, s->xb, p->dim);
@@ -527,10 +844,11 @@ void forward(int token, bool is_sampled, bool def_logits)
     else // MoE
     {
       int i, n_experts = p->moe.num_experts;
+      int n_eval = p->moe.top_k;           // count of evaluated experts
       float sum_prob = 0.0f;
 
-      lw_matmul(s->moe.exp_logits, s->xb, &w->moe_gate, layer_id, p->matmul_lw);
-      softmax(s->moe.exp_logits, n_experts);
+      lw_matmul(s->moe.exp_logits, s->xb, &w->moe_gate, layer_id);
+      vec_softmax(s->moe.exp_logits, n_experts, 1.0f);
       for (i=0; i<n_experts; i++)
       {
         s->moe.exp_probs[i].exp_id = i;
@@ -542,28 +860,59 @@ void forward(int token, bool is_sampled, bool def_logits)
       for (i=0; i<p->moe.top_k; i++)
         sum_prob += s->moe.exp_probs[i].prob;
 
-      for (i=0; i<p->moe.top_k; i++)
+      // adaptive routing: skip secondary experts with low normalized weight.
+      // probs are sorted, then all experts following the first skipped one are also skipped.
+      if (p->moe.skip_th > 0.0f)
       {
-        int j, index = layer_id * n_experts + s->moe.exp_probs[i].exp_id;
+        float keep_prob = s->moe.exp_probs[0].prob;   // first expert always evaluated
+        float w_skip;
+        for (n_eval=1; n_eval<p->moe.top_k; n_eval++)
+        {
+          float prob = s->moe.exp_probs[n_eval].prob;
+          if (prob < p->moe.skip_th * sum_prob)
+            break;
+          keep_prob += prob;
+        }
+        w_skip = (sum_prob - keep_prob) / sum_prob;   // skipped normalized weight
+        s->moe.n_exp_skip += p->moe.top_k - n_eval;
+        s->moe.w_skip_sum += w_skip;
+        if (w_skip > s->moe.w_skip_max)
+          s->moe.w_skip_max = w_skip;
+        sum_prob = keep_prob;                         // re-normalize on evaluated experts
+      }
+      s->moe.n_exp_eval += n_eval;
+
+      // expert paging: get resident slots (post loads if not resident), prefetch next layer experts
+      if (p->moe.page_slots)
+      {
+        for (i=0; i<n_eval; i++)
+          s->moe.exp_ids[i] = s->moe.exp_probs[i].exp_id;
+        moe_page_request(layer_id, s->moe.exp_ids, n_eval, s->moe.exp_slots, false);
+        if ((layer_id + 1) < p->n_layers)
+          moe_page_prefetch(layer_id + 1);
+      }
+
+      for (i=0; i<n_eval; i++)
+      {
+        int index = p->moe.page_slots ? moe_page_wait(layer_id, s->moe.exp_slots[i])
+                                         : layer_id * n_experts + s->moe.exp_probs[i].exp_id;
         float k;
 
 #ifdef USE_THRD_BATCH
-        opt_compute_w1_w3_swiglu(s->hb, s->hb2, s->xb, w, index, p->matmul_lw);
+        opt_compute_w1_w3_swiglu(s->hb, s->hb2, s->xb, w, index);
 #else
-        lw_matmul(s->hb, s->xb, &w->w1, index, p->matmul_lw);
-        lw_matmul(s->hb2, s->xb, &w->w3, index, p->matmul_lw);
+        lw_matmul(s->hb, s->xb, &w->w1, index);
+        lw_matmul(s->hb2, s->xb, &w->w3, index);
 
         // SwiGLU non-linearity
-        for (j=0; j<p->hidden_dim; j++)
-          s->hb[j] = swiglu(s->hb[j]) * s->hb2[j];
+        vec_procs.vec_swiglu(s->hb, s->hb2, p->hidden_dim);
 #endif
-        // final p->matmul_lw to get the output of the ffn
-        lw_matmul(s->xb2, s->hb, &w->w2, index, p->matmul_lw);  // p->hidden_dim, p->dim
+        // final matmul to get the output of the ffn
+        lw_matmul(s->xb2, s->hb, &w->w2, index);  // p->hidden_dim, p->dim
 
         // residual connection
         k = s->moe.exp_probs[i].prob / sum_prob;
-        for (j=0; j<p->dim; j++)
-          s->x[j] += s->xb2[j] * k;
+        vec_procs.vec_mul_add(s->x, s->xb2, k, p->dim);
       }
 
       // sq_sum
@@ -574,22 +923,58 @@ void forward(int token, bool is_sampled, bool def_logits)
   // final rmsnorm
   norm_scale(s->x, s->x, sq_sum, p->rms_norm_eps, w->rms_final.lp[0].p, w->rms_final.wx); // p->dim
 
-  // classifier into logits
-  lw_matmul(s->logits, s->x, &w->wcls, 0, p->matmul_em); // p->dim, p->vocab_size
+  // classifier into logits (restricted tokens: classifier contain only allowed tokens rows)
+  {
+    float *logits = p->cls_map ? s->cls_logits : s->logits;
+    if (p->cls_rescore)
+    {
+      classifier_two_stage(logits, s->x);
+      if (p->cls_stats)
+        classifier_stats(logits, s->x, false);
+    }
+    else
+    if (p->cls_stats)
+      classifier_stats(logits, s->x, true);    // fused matmul and statistics
+    else
+      lw_matmul(logits, s->x, &w->wcls, 0);    // p->dim, wcls.wy
+    if (!p->cls_stats)
+      transformer_def_logits();
+  }
 #if 0
   omp_proc_bind_numa_check();                 // debug check
 #endif
 }
 
-#ifdef _GCC_BLD
-// GCC produce "-incompatible-pointer-types" warning if no cast used.
-#define FN_MUL (mm_proc_t)
-#define FN_CVT (void (*)(float *, const void *, size_t))
-#else
-// VS do not warn. (that seem to be correct behavehour because function arguments are compatible).
-#define FN_MUL
-#define FN_CVT
-#endif
+// display forward statistics (user info)
+void transformer_disp_stats(void)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  const struct transformer_runstate_t *s = &model.transformer.state;
+
+  // MoE adaptive routing, skipped weight is the quality loss indicator
+  if (p->moe.num_experts && (p->moe.skip_th > 0.0f))
+  {
+    int64_t n_exp = s->moe.n_exp_eval + s->moe.n_exp_skip;
+    int64_t n_route = n_exp / p->moe.top_k;    // count of token * layer routings
+    if (n_route)
+      msg_info("MoE routing: experts evaluated %lld, skipped %lld (%.1f%%), skipped weight avg: %.4f max: %.4f\n",
+               s->moe.n_exp_eval, s->moe.n_exp_skip, (100.0 * s->moe.n_exp_skip) / n_exp,
+               s->moe.w_skip_sum / n_route, s->moe.w_skip_max);
+  }
+
+  // teacher forced evaluation of prompt
+  if (s->eval.n_nll)
+    msg_info("eval: prompt perplexity %.4f (%lld tokens, mean nll %.4f)\n",
+             exp(s->eval.nll_sum / s->eval.n_nll), s->eval.n_nll, s->eval.nll_sum / s->eval.n_nll);
+
+  // MoE expert paging
+  if (p->moe.page_slots)
+    moe_page_disp_stats();
+
+  // layer streaming
+  if (p->stream_nbuf)
+    layer_stream_disp_stats();
+}
 
 // dummy convert function, only copy
 static void data_cvt_buff_f32_to_f32(float *f32, const float *_f32, size_t ne)
@@ -597,6 +982,54 @@ static void data_cvt_buff_f32_to_f32(float *f32, const float *_f32, size_t ne)
   memcpy(f32, _f32, ne*sizeof(float));
 }
 
+// check model weights can be converted to d_type at load
+static void check_policy_type(enum e_w_type d_type)
+{
+  enum e_w_type t_type = model.transformer.config.torch_type;
+  if ((d_type == w_type_f16) && !matmul_procs.cpu_f16c)
+    msg_error("w_policy: fp16 format require CPU F16C support");
+  if ((d_type == t_type) || (d_type == w_type_f32))
+    return;
+  if ((t_type == w_type_f32) || (d_type == w_type_f16) || (d_type == w_type_bf16) 
+   || ((d_type == w_type_sf16) && (t_type != w_type_f16)))
+    msg_error("w_policy: conversion of %s model to %s is not supported", w_type_name[t_type], w_type_name[d_type]);
+}
+
+// define layer weights types using optional w_policy, classes not defined use lw_type
+static void init_w_policy(void)
+{
+  struct transformer_config_t *p = &model.transformer.config;
+  const struct run_conf_t *conf = &model.config;
+  int i;
+
+  for (i=0; i<lw_class_count; i++)
+  {
+    p->lw_cls_type[i] = p->lw_type;
+    if (conf->w_policy.cls_type[i] != w_type_COUNT)
+    {
+      check_policy_type(conf->w_policy.cls_type[i]);
+      p->lw_cls_type[i] = conf->w_policy.cls_type[i];
+    }
+  }
+
+  // layers list override
+  if (conf->w_policy.n_layers > 0)
+  {
+    check_policy_type(conf->w_policy.ly_type);
+    p->ly_type = conf->w_policy.ly_type;
+    p->ly_ovr = (bool *)calloc_check(p->n_layers * sizeof(bool));
+    for (i=0; i<conf->w_policy.n_layers; i++)
+    {
+      int l = conf->w_policy.layers[i];
+      if (l < 0)
+        l += p->n_layers;
+      if ((l < 0) || (l >= p->n_layers))
+        msg_error("w_policy: layer %d out of range", conf->w_policy.layers[i]);
+      p->ly_ovr[l] = true;
+    }
+  }
+}
+
 // init math/convert functions depending of weights data types
 static void init_wd_types_procs(void)
 {
@@ -607,24 +1040,14 @@ static void init_wd_types_procs(void)
   p->lw_type = p->torch_type;
 
   if (p->torch_type == w_type_f16)
-  {
-    p->matmul_lw = FN_MUL matmul_procs.matmul_f32_f16;
-    p->matmul_em = FN_MUL matmul_procs.matmul_f32_f16;
     p->def_embeddings = FN_CVT matmul_procs.cvt_f16_to_f32;
-  }
   else
   if (p->torch_type == w_type_bf16)
-  {
-    p->matmul_lw = FN_MUL matmul_procs.matmul_f32_bf16;
-    p->matmul_em = FN_MUL matmul_procs.matmul_f32_bf16;
     p->def_embeddings = FN_CVT matmul_procs.cvt_bf16_to_f32;
-  }
   else
   if (p->torch_type == w_type_f32)
   {
     // note: using float for weights double model size, support added to test TinyLlama version 0.4 (v1.0 && 1.1 are in bfloat)
-    p->matmul_lw = FN_MUL matmul_procs.matmul_f32_f32;
-    p->matmul_em = FN_MUL matmul_procs.matmul_f32_f32;
     p->def_embeddings = FN_CVT data_cvt_buff_f32_to_f32; // this is useless, but keep general convert code structure
   }
   else
@@ -644,49 +1067,385 @@ static void init_wd_types_procs(void)
 
     p->em_type = w_type_sf16;
     p->lw_type = w_type_sf16;
-    p->matmul_lw = FN_MUL matmul_procs.matmul_f32_sf16;
-    p->matmul_em = FN_MUL matmul_procs.matmul_f32_sf16;
     p->def_embeddings = FN_CVT matmul_procs.cvt_sf16_to_f32;
     msg_info("model converted to small float16.\n");
   }
 
   // convert to sf8 option
   // note: can combine with cvt_sf16, then embeddings will be sf16 and layer weights f8
+  if (model.config.cvt_q4)
+  {
+    p->lw_type = w_type_q4;
+    msg_info("model weights converted to q4.\n");
+  }
+  else
+  if (model.config.cvt_q8)
+  {
+    p->lw_type = w_type_q8;
+    msg_info("model weights converted to q8.\n");
+  }
+  else
+  if (model.config.cvt_f8 && model.config.cvt_row_scale)
+  {
+    p->lw_type = w_type_f8s;
+    msg_info("model weights converted to float8 with rows scale.\n");
+  }
+  else
   if (model.config.cvt_f8)
   {
     p->lw_type = w_type_f8;
-    p->matmul_lw = FN_MUL matmul_procs.matmul_f32_f8;
     msg_info("model weights converted to float8.\n");
   }
   else
+  if (model.config.cvt_f12 && model.config.cvt_row_scale)
+  {
+    p->lw_type = w_type_f12s;
+    msg_info("model weights converted to float12 with rows scale.\n");
+  }
+  else
   if (model.config.cvt_f12)
   {
     p->lw_type = w_type_f12;
-    p->matmul_lw = FN_MUL matmul_procs.matmul_f32_f12;
     msg_info("model weights converted to float12.\n");
   }
+
+  // per tensor class/layers types
+  init_w_policy();
 }
 
-void build_transformer(void)
+// restricted tokens: keep only rows of allowed tokens in classifier (tk_select binary array)
+static void compact_wcls(const int *tk_select)
 {
   struct transformer_config_t *p = &model.transformer.config;
+  struct transformer_weights_t *w = &model.transformer.weights;
+  struct w_dat_t wc = { 0 };
+  size_t sz_wx = wd_ne_sizeof(&w->wcls, w->wcls.wx);
+  int i, j, n = 0;
+
+  p->cls_map = (int *)malloc_check(p->vocab_size * sizeof(int));
+  for (i=0; i<p->vocab_size; i++)
+    if (tk_select[i >> 5] & (1 << (i & 31)))
+      p->cls_map[n++] = i;
+  if (!n)
+    msg_error("ch_restrict: no allowed token");
+
+  // copy allowed rows in each thread part
+  alloc_mm_wd(&wc, 1, n, w->wcls.wx, w->wcls.d_type);
+  for (i=0; i<numa_map.n_threads; i++)
+  {
+    int y = i * wc.dy;
+    int dy = WD_GET_DY(y, wc.dy, wc.wy);
+    for (j=0; j<dy; j++)
+    {
+      int r = p->cls_map[y + j];
+      const char *s = (const char *)w->wcls.lp[r / w->wcls.dy].p + (size_t)(r % w->wcls.dy) * sz_wx;
+      memcpy((char *)wc.lp[i].p + (size_t)j * sz_wx, s, sz_wx);
+    }
+  }
+  wc.ne = (size_t)n * wc.wx;
+
+  if (w->wcls.lp[0].p != w->token_emb.lp[0].p)  // free if not w->token_emb
+    free_wd(&w->wcls);
+  w->wcls = wc;
+  model.transformer.state.cls_logits = (float *)malloc_check(n * sizeof(float));
+  msg_info("restricted tokens: classifier use %d/%d rows\n", n, p->vocab_size);
+}
 
-  // load config
-  load_checkpoint_config();
+// init optional two stages classifier, create wcls low precision copy
+static void init_wcls_shadow(void)
+{
+  struct transformer_config_t *p = &model.transformer.config;
+  struct transformer_weights_t *w = &model.transformer.weights;
+  enum e_w_type sh_type = model.config.wcls_shadow;
+  int i;
+
+  if (sh_type == w_type_COUNT)
+    return;
+  if ((w->wcls.d_type != w_type_f16) && (w->wcls.d_type != w_type_bf16))
+    msg_error("wcls_shadow: classifier type must be fp16 or bf16");
+
+  p->cls_rescore = model.config.wcls_rescore;
+  adjust_range_int(&p->cls_rescore, "wcls_rescore", 16, 4096);
+  if (p->cls_rescore > w->wcls.wy)
+    p->cls_rescore = w->wcls.wy;
+  model.transformer.state.cls_ids = malloc_check(p->cls_rescore * sizeof(int));
+  if (model.sampler.conf.topk > p->cls_rescore)
+    msg_info("wcls_rescore: warning, sampler topk %d > %d rescored logits\n", model.sampler.conf.topk, p->cls_rescore);
+
+  // convert each thread part, same split as wcls
+  alloc_mm_wd(&w->wcls_sh, 1, w->wcls.wy, w->wcls.wx, sh_type);
+  for (i=0; i<numa_map.n_threads; i++)
+  {
+    int y = i * w->wcls.dy;
+    int dy = WD_GET_DY(y, w->wcls.dy, w->wcls.wy);
+    if (dy > 0)
+      cvt_w_data(w->wcls_sh.lp[i].p, sh_type, w->wcls.lp[i].p, w->wcls.d_type, (size_t)dy * w->wcls.wx, w->wcls.wx);
+  }
+  msg_info("two stages classifier: %s copy, %d logits rescored\n", w_type_name[sh_type], p->cls_rescore);
+}
+
+// display weights memory plan (user info).
+// token generation speed is memory bandwidth limited, expected speed is estimated from weights size read for one token.
+static void disp_w_plan(void)
+{
+  struct transformer_config_t *p = &model.transformer.config;
+  struct w_dat_t wd = { 0 };
+  double sz_l = 0, sz_tok = 0, sz_tok_m = 0;     // layers size, read per token size, same in model format
+  double sz_exit = 0;                            // last layer size not read if no logits (all except wk/wv)
+  double n_exp = 1, n_exp_tok = 1;               // w1/w2/w3 count per layer, count read per token
+  double sz_em;
+  int c, l;
+
+  if (p->moe.num_experts)
+  {
+    n_exp = p->moe.num_experts;
+    n_exp_tok = p->moe.top_k;
+  }
+
+  msg_info("weights plan:\n");
+  for (c=0; c<lw_class_count; c++)
+  {
+    double sz_c = 0, sz_c_m, k_tok, k_ne;
+    int n_ovr = 0, wy, wx;
+    if ((c == lw_class_moe_gate) && !p->moe.num_experts)
+      continue;
+    get_lw_shape(c, &wy, &wx);
+    wd.wx = wx;
+    k_ne = ((c >= lw_class_w1) && (c <= lw_class_w3)) ? n_exp : 1;
+    k_tok = ((c >= lw_class_w1) && (c <= lw_class_w3)) ? n_exp_tok / n_exp : 1;
+
+    for (l=0; l<p->n_layers; l++)
+    {
+      wd.d_type = p->lw_cls_type[c];
+      if (p->ly_ovr && p->ly_ovr[l])
+      {
+        wd.d_type = p->ly_type;
+        n_ovr++;
+      }
+      sz_c += k_ne * wd_ne_sizeof(&wd, (size_t)wy * wx);
+    }
+    if ((c != lw_class_wk) && (c != lw_class_wv))         // wd.d_type of last layer
+      sz_exit += k_ne * wd_ne_sizeof(&wd, (size_t)wy * wx) * k_tok;
+    wd.d_type = p->torch_type;
+    sz_c_m = k_ne * p->n_layers * wd_ne_sizeof(&wd, (size_t)wy * wx);
+
+    if (n_ovr)
+      msg_info("  %-8s %-4s (%d layers %s) %7.3f Gb\n", lw_class_name[c], w_type_name[p->lw_cls_type[c]], 
+               n_ovr, w_type_name[p->ly_type], sz_c / (1024.0*1024.0*1024.0));
+    else
+      msg_info("  %-8s %-4s %7.3f Gb\n", lw_class_name[c], w_type_name[p->lw_cls_type[c]], sz_c / (1024.0*1024.0*1024.0));
+    sz_l += sz_c;
+    sz_tok += sz_c * k_tok;
+    sz_tok_m += sz_c_m * k_tok;
+  }
+
+  // prefill tokens, forward exit after last layer kv
+  p->sz_read_pf = sz_tok - sz_exit;
+
+  // classifier is read for each token, embeddings one raw only
+  wd.d_type = p->em_type;
+  wd.wx = p->dim;
+  sz_em = (double)wd_ne_sizeof(&wd, (size_t)p->vocab_size * p->dim);
+  if (model.config.wcls_shadow != w_type_COUNT)  // two stages classifier, read copy and rescored rows
+  {
+    sz_tok += sz_em * model.config.wcls_rescore / p->vocab_size;
+    wd.d_type = model.config.wcls_shadow;
+    sz_tok += (double)wd_ne_sizeof(&wd, (size_t)p->vocab_size * p->dim);
+  }
+  else
+    sz_tok += sz_em;
+  wd.d_type = p->torch_type;
+  sz_tok_m += (double)wd_ne_sizeof(&wd, (size_t)p->vocab_size * p->dim);
+
+  msg_info("  layers %.3f Gb, embeddings/classifier %s %.3f Gb, read per token %.3f Gb\n", sz_l / (1024.0*1024.0*1024.0),
+           w_type_name[p->em_type], sz_em / (1024.0*1024.0*1024.0), sz_tok / (1024.0*1024.0*1024.0));
+  msg_info("  expected speed x%.2f relative to model format %s\n", sz_tok_m / sz_tok, w_type_name[p->torch_type]);
+  p->sz_read_tok = sz_tok;
+}
+
+// init fused classifier statistics from sampler config
+static void init_cls_stats(void)
+{
+  struct transformer_config_t *p = &model.transformer.config;
+  const struct sampler_conf_t *cfg = &model.sampler.conf;
+  int n_ovr = 2;                       // eos/eot logits modified by eos_amp
+
+  if (model.config.test_nan_logits)    // debug, sampler check all logits
+    return;
+
+  p->cls_stats = true;
+  p->cls_k_temp = 1.0f;
+  if ((cfg->temperature <= 0.99f) || (cfg->temperature >= 1.01f))
+    p->cls_k_temp = 1.0f / cfg->temperature;
+
+  // top list must contain topk tokens after logits decreased by repeat penalty
+  if (cfg->repeat_penalty > 0.01f)
+    n_ovr += cfg->repeat_penalty_n;
+  p->cls_topk = CLS_TOPK;
+  if (cfg->topk && ((cfg->topk + n_ovr) < CLS_TOPK))
+    p->cls_topk = cfg->topk + n_ovr;
+  if (cfg->temperature <= 0.01f)
+    p->cls_topk = 0;                   // greedy
+
+  model.transformer.state.cls_stats = (struct cls_stats_t *)malloc_check(numa_map.n_threads * sizeof(struct cls_stats_t));
+}
+
+// init classifier options, after sampler init
+void build_classifier(const int *tk_select)
+{
+  // restricted tokens
+  if (tk_select)
+    compact_wcls(tk_select);
+
+  // optional classifier low precision copy
+  init_wcls_shadow();
+
+  // fused classifier statistics
+  init_cls_stats();
+}
+
+// ----------------------------------------------
+// random weights (bench mode, no model files)
+
+// fill d with ne random values of type typ (f32/f16/bf16), sign + 12 bits mantissa, abs range [1/32..1/2[
+static void rand_w_data(void *d, enum e_w_type typ, size_t ne)
+{
+  size_t i;
+  for (i=0; i<ne; i++)
+  {
+    int r = rand_n();                  // 15 bits: sign, 2 bits exponent, 12 bits mantissa
+    int s = r & 1;
+    int e = (r >> 1) & 3;
+    int m = r >> 3;
+    if (typ == w_type_f16)
+      ((f16_t *)d)[i] = (f16_t)((s << 15) | ((e + 10) << 10) | (m >> 2));
+    else
+    if (typ == w_type_bf16)
+      ((bf16_t *)d)[i] = (bf16_t)((s << 15) | ((e + 122) << 7) | (m >> 5));
+    else
+      ((float *)d)[i] = (s ? -1.0f : 1.0f) * (float)(1 << e) * (1.0f + m * (1.0f/4096)) * (1.0f/32);
+  }
+}
+
+// fill all z units of wd with a same random block converted from s_type to memory format
+static void rand_wd(struct w_dat_t *wd, enum e_w_type s_type)
+{
+  size_t ne = (size_t)wd->wy * wd->wx;
+  void *s, *d = NULL;
+  int z;
+
+  CHECK(!wd->z_wd);                    // w_policy layers list not used in bench mode
+  s = malloc_check(ne * w_type_sizeof[s_type]);
+  rand_w_data(s, s_type, ne);
+  if (wd->d_type != s_type)
+  {
+    d = malloc_check(wd->wy * wd_ne_sizeof(wd, wd->wx));
+    cvt_w_data(d, wd->d_type, s, s_type, ne, wd->wx);
+  }
+  for (z=0; z<wd->nz; z++)
+    numa_cpy_wd_z(wd, z, d ? d : s, NULL);
+  free_check(d);
+  free_check(s);
+}
+
+// fill all z units of f32 wd with value v
+static void set_wd_f32(struct w_dat_t *wd, float v)
+{
+  VAR_ALLOC(s, float, wd->wx);
+  int i;
+  for (i=0; i<wd->wx; i++)
+    s[i] = v;
+  for (i=0; i<wd->nz; i++)
+    numa_cpy_wd_z(wd, i, s, NULL);
+  free_check(s);
+}
+
+// init weights with random datas, replace load_checkpoint_weights
+static void rand_transformer_weights(void)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  struct transformer_weights_t *w = &model.transformer.weights;
+  enum e_w_type t = p->torch_type;
+
+  if (!p->rope_theta)
+    msg_error("bench mode require rope_theta defined in config.json");
+
+  if (p->moe.num_experts)
+    rand_wd(&w->moe_gate, t);
+  rand_wd(&w->token_emb, t);
+  rand_wd(&w->wq, t);
+  rand_wd(&w->wk, t);
+  rand_wd(&w->wv, t);
+  rand_wd(&w->wo, t);
+  rand_wd(&w->w1, t);
+  rand_wd(&w->w2, t);
+  rand_wd(&w->w3, t);
+  rand_wd(&w->wcls, t);
+
+  set_wd_f32(&w->rms_att, 1.0f);
+  set_wd_f32(&w->rms_ffn, 1.0f);
+  set_wd_f32(&w->rms_final, 1.0f);
+
+  // qkv bias used by qwen2 only, free reserved mem for other models (as done in check_load)
+  if (model.config.e_model_id == model_id_qwen2)
+  {
+    set_wd_f32(&w->bq, 0.0f);
+    set_wd_f32(&w->bk, 0.0f);
+    set_wd_f32(&w->bv, 0.0f);
+  }
+  else
+  {
+    free_wd(&w->bq);
+    free_wd(&w->bk);
+    free_wd(&w->bv);
+  }
+}
+
+// build transformer, weights loaded from model files or random if bench set
+static void build_transformer_ex(bool bench)
+{
+  struct transformer_config_t *p = &model.transformer.config;
+  int n_procs;
+
+  // load config (defined by caller in bench mode)
+  if (!bench)
+    load_checkpoint_config();
 
   // init math/convert functions depending of weights data types
   init_wd_types_procs();
 
-  // init numa config and omp 
-  numa_init_omp(model.config.num_procs, model.config.numa_nodes);
+  // init numa config and omp, matmul kernels and threads count can be defined by autotune profile
+  n_procs = mm_tune_init();
+  numa_init_omp(n_procs, model.config.numa_nodes);
+  n_procs = mm_tune_run();
+  if (n_procs)
+    numa_init_omp(n_procs, model.config.numa_nodes);
 
   // numa_disp_mem();                     // mem in nodes before allocs
 
+  // token embeddings read in model file
+  p->emb_disk = model.config.emb_disk && !bench;
+
+  // MoE expert paging, define resident experts count
+  p->moe.page_slots = moe_page_init();
+
+  // layer streaming, define resident layers count
+  p->stream_nbuf = layer_stream_init();
+
+  // display weights memory/speed plan
+  disp_w_plan();
+
   // alloc mem to load weights
   alloc_transformer();
 
   // load weight datas
-  load_checkpoint_weights();
+  if (bench)
+    rand_transformer_weights();
+  else
+    load_checkpoint_weights();
+
+  // optional load time weights fusion
+  p->w_fuse = w_fuse_weights();
 
   // alloc struct transformer_runstate_t buffers
   alloc_run_state();
@@ -695,9 +1454,22 @@ void build_transformer(void)
 
   // init RoPE freqs
   if (p->rope_theta)
+  {
     init_RoPE(model.transformer.state.rope_freq, p->rope_theta, p->head_size);
+    init_RoPE_tab(model.transformer.state.rope_tab, model.transformer.state.rope_freq, p->head_size, p->seq_len);
+  }
 
 #ifdef USE_SA_SIMD
   init_head_att_opt(matmul_procs.simd_set);    // sse/avx select code
 #endif
 }
+
+void build_transformer(void)
+{
+  build_transformer_ex(false);
+}
+
+void build_transformer_bench(void)
+{
+  build_transformer_ex(true);
+}
@@ -4,6 +4,23 @@
 // matmul function, used one depend of weights data type (f32/f16/bf16/f8)
 typedef void (*mm_proc_t)(float *res, const float *vec, const void *mat, int len_vec, int y_mat);
 
+// layer weights tensor classes, type can be defined for each class (w_policy)
+enum e_lw_class
+{
+  lw_class_wq = 0,
+  lw_class_wk,
+  lw_class_wv,
+  lw_class_wo,
+  lw_class_w1,
+  lw_class_w2,
+  lw_class_w3,
+  lw_class_moe_gate,
+  lw_class_count,
+};
+
+// names of classes (in transformer.c), used as w_policy keys
+extern const char *lw_class_name[lw_class_count];
+
 // transformer config from config.json
 struct transformer_config_t
 {
@@ -26,18 +43,45 @@ struct transformer_config_t
   int kv_mul;                      // n_heads / n_kv_heads
   float sqrt_head_size;            // sqrt(head_size)
 
-  // matmul and conversion functions depend of loaded/mem weights format (f32/f16/bf16/f8)
+  // conversion function depend of loaded/mem weights format (f32/f16/bf16/f8), matmul function defined in w_dat_t
   enum e_w_type em_type;           // embeddings data type
-  enum e_w_type lw_type;           // layer weights data type
+  enum e_w_type lw_type;           // layer weights data type (default for classes not defined in w_policy)
+  enum e_w_type lw_cls_type[lw_class_count]; // layer weights data type for each tensor class
+  enum e_w_type ly_type;           // data type of w_policy override layers
+  bool *ly_ovr;                    // [n_layers] true if layer use ly_type (NULL if no override)
   void (* def_embeddings)(float *f32, const void *emb, size_t ne);
-  mm_proc_t matmul_em;             // matmul function used for embeddings weights
-  mm_proc_t matmul_lw;             // matmul function used for layer weights
+
+  // restricted tokens (sampler ch_restrict)
+  int *cls_map;                    // token id of each wcls row if wcls contain only allowed tokens, else NULL
+
+  // two stages classifier
+  int cls_rescore;                 // count of candidates computed with wcls after wcls_sh selection (0 = disable)
+
+  // fused classifier statistics (defined from sampler config)
+  bool cls_stats;                  // true if classifier compute per thread statistics used by sampler
+  int cls_topk;                    // size of per thread top logits list (0 = argmax only, greedy)
+  float cls_k_temp;                // temperature factor applied to logits in sum_exp
+
+  // weights read per token (defined in disp_w_plan, used for bandwidth stats)
+  double sz_read_tok;              // bytes
+  double sz_read_pf;               // bytes for prefill tokens (no logits: classifier and last layer q/o/ffn skipped)
+
+  // token embeddings rows read in .safetensors file for each token (token_emb not allocated)
+  bool emb_disk;
+
+  // load time weights fusion
+  int w_fuse;                      // applied fusions (W_FUSE_xx flags in w_fuse.h, 0 = none)
+
+  // layer streaming
+  int stream_nbuf;                 // resident layers for wq/wk/wv/wo/w1/w2/w3 (0 = disable, all layers loaded)
 
   // MoE/mixtral specific
   struct
   {
     int num_experts;               // number of experts in the expert model
     int top_k;                     // expert num per token
+    float skip_th;                 // adaptive routing: skip secondary experts with normalized weight < skip_th (0 = disable)
+    int page_slots;                // expert paging: resident experts per layer (0 = disable, all experts loaded)
   } moe;
 };
 
@@ -58,10 +102,15 @@ struct w_dat_t
   int dy;                          // splitted wy size
   int nn;                          // num different nodes used to store weights
   size_t ne;                       // num element total nz*wy*wx, used to check load
+  mm_proc_t mm_proc;               // matmul function for d_type (NULL if matmul not used)
+  struct w_dat_t *z_wd;            // [nz] z units datas if z units types differ (w_policy layers), else NULL
   void *p_node[MAX_NUMA_NODES];    // allocated mem base in nodes
   struct w_part_t lp[MAX_NUMA_PROCS]; // layer 0 weight part list
 };
 
+// select z unit datas if z units have different types
+#define WD_SEL_Z(wd, z) if ((wd)->z_wd) { (wd) = &(wd)->z_wd[z]; (z) = 0; }
+
 // copy weight datas
 void copy_w_dat(struct w_dat_t *wd, void *d);
 
@@ -83,13 +132,14 @@ struct transformer_weights_t
   struct w_dat_t bv;               // (layer, n_kv_heads * head_size)
   // ffn weights
   struct w_dat_t rms_ffn;          // (layer, dim, 1)
-  struct w_dat_t w1;               // (layer, hidden_dim, dim)  (layer * n_experts if MoE)
-  struct w_dat_t w2;               // (layer, dim, hidden_dim)  (layer * n_experts if MoE)
-  struct w_dat_t w3;               // (layer, hidden_dim, dim)  (layer * n_experts if MoE)
+  struct w_dat_t w1;               // (layer, hidden_dim, dim)  (layer * n_experts if MoE, layer * page_slots if paging)
+  struct w_dat_t w2;               // (layer, dim, hidden_dim)  (layer * n_experts if MoE, layer * page_slots if paging)
+  struct w_dat_t w3;               // (layer, hidden_dim, dim)  (layer * n_experts if MoE, layer * page_slots if paging)
   // final rmsnorm
   struct w_dat_t rms_final;        // (dim, 1)
   // (optional) classifier weights for the logits, on the last layer
   struct w_dat_t wcls;
+  struct w_dat_t wcls_sh;          // (optional) low precision copy of wcls, used to select best logits candidates
   // MoE
   struct w_dat_t moe_gate;         // (layer, dim, num_experts)
 };
@@ -108,6 +158,19 @@ struct ctoken_t
   bool sampled;                    // 0 if injected (user defined), 1 if sampled (LLM defined)
 };
 
+// classifier per thread part statistics, allow sampling without full pass on logits
+#define CLS_TOPK 256               // max size of per thread top logits list
+
+struct cls_stats_t
+{
+  float max;                       // max logit of part
+  float sum_exp;                   // sum of exp((logit - max) * cls_k_temp) of part
+  int n;                           // top list size (0 if empty part)
+  bool complete;                   // true if top list contain all part logits
+  float top_l[CLS_TOPK];           // top logits (not sorted)
+  int top_tk[CLS_TOPK];            // top logits token id
+};
+
 struct transformer_runstate_t
 {
   // current wave of activations
@@ -121,10 +184,15 @@ struct transformer_runstate_t
   float *v_cache;                  // value cache (layer, seq_len, dim)
   float *att;                      // buffer for scores/attention values (n_heads, seq_len)
   float *logits;                   // output logits
+  int *cls_ids;                    // two stages classifier candidates list (cls_rescore,)
+  float *cls_logits;               // restricted tokens classifier output (wcls.wy,)
+  struct cls_stats_t *cls_stats;   // classifier statistics for each thread part (n_threads,)
+  int cls_n_stats;                 // count of defined cls_stats, 0 if logits must be used
 
   // RoPE
   float *rope_freq;                // inv freq (NULL if contained in .safetensors)
   float *rope_sin_cos;             // sin/cos values for positions
+  float *rope_tab;                 // sin/cos values for all positions (seq_len, head_size), NULL if rope_if used
 
   // tokens cache/history
   struct
@@ -141,7 +209,22 @@ struct transformer_runstate_t
   {
     float *exp_logits;             // num_experts
     struct exp_prob_t *exp_probs;  // num_experts
+    int *exp_ids;                  // num_experts, paging experts id list
+    int *exp_slots;                // num_experts, paging resident slots list
+
+    // adaptive routing stats (user info)
+    int64_t n_exp_eval;            // count of evaluated experts
+    int64_t n_exp_skip;            // count of skipped experts
+    double w_skip_sum;             // sum of skipped normalized weights
+    double w_skip_max;             // max skipped normalized weight sum for one token layer
   } moe;
+
+  // teacher forced evaluation stats (user info)
+  struct
+  {
+    int64_t n_nll;                 // count of evaluated tokens
+    double nll_sum;                // sum of evaluated tokens negative log likelihood
+  } eval;
 };
 
 struct transformer_t
@@ -154,6 +237,15 @@ struct transformer_t
 // init
 void build_transformer(void);
 
+// init with random weights from config already defined, no model files required (bench mode)
+void build_transformer_bench(void);
+
+// init classifier options, after sampler init (tk_select: allowed tokens binary array, NULL if all tokens allowed)
+void build_classifier(const int *tk_select);
+
+// get matmul function for weights data type
+mm_proc_t get_mm_proc(enum e_w_type d_type);
+
 // free mem
 void free_wd(struct w_dat_t *wd);
 void free_transformer(void);
@@ -161,6 +253,18 @@ void free_transformer(void);
 // forward, update cache and return logits if def_logits set as true
 void forward(int token, bool is_sampled, bool def_logits);
 
+// get classifier logit of token (after forward with cls_n_stats defined)
+float transformer_get_logit(int token);
+
+// define all tokens logits in state logits from classifier output (if cls_n_stats defined)
+void transformer_def_logits(void);
+
+// teacher forced evaluation, add negative log likelihood of token with last forward logits
+void transformer_eval_nll(int token);
+
+// display forward statistics (user info)
+void transformer_disp_stats(void);
+
 #ifdef PACK_KV_CACHE
 
 // private, for kv_cache.c
@@ -0,0 +1,209 @@
+// load time weights fusion
+// - rms_att/rms_ffn weights are multiplied in columns of following matmul weights, rms norm then only scale x.
+//   done for fp32 weights only, result is exact to fp32 rounding. fp16/bf16 would need a second rounding of
+//   all weights (and fp16 range check), other formats have limited range or use blocs scale.
+// - wk/wv/wq parts of each thread are copied in one bloc per layer, thread qkv matmuls read a single stream.
+// - w1/w3 parts of each thread are interleaved by blocs of W_FUSE_BY rows, gate/up matmuls of a bloc read
+//   contiguous memory and swiglu is applied to bloc results while in cache (opt_compute_w1_w3_swiglu).
+
+#include <string.h>
+#include "l_util.h"
+#include "mem_alloc.h"
+#include "model.h"
+#include "matmul.h"
+#include "omp_numa.h"
+#include "w_fuse.h"
+
+#define W_FUSE_NW 3                    // max fused tensors
+
+// get rows count of thread part (<= 0 if unused thread)
+static int part_dy(const struct w_dat_t *wd, int tid)
+{
+  int y = tid * wd->dy;
+  return WD_GET_DY(y, wd->dy, wd->wy);
+}
+
+// return true if wd format can be modified to fold norm weights
+static bool can_fold(const struct w_dat_t *wd)
+{
+  return !wd->z_wd && (wd->d_type == w_type_f32);
+}
+
+// multiply columns of wd rows by rms norm weights of layer
+static void fold_norm_wd(struct w_dat_t *wd, const struct w_dat_t *rms)
+{
+  int n_thrd = numa_map.n_threads;
+  int nz_l = wd->nz / rms->nz;         // z units per layer (experts count if MoE)
+  int i;
+
+  #pragma omp parallel for
+  for (i=0; i<n_thrd; i++)
+  {
+    int z, y, x, wx = wd->wx, dy = part_dy(wd, i);
+    for (z=0; (dy > 0) && (z<wd->nz); z++)
+    {
+      const float *g = (const float *)rms->lp[0].p + (size_t)(z / nz_l) * rms->wx;
+      float *r = (float *)((char *)wd->lp[i].p + (size_t)z * wd->lp[i].sz_l);
+      for (y=0; y<dy; y++, r+=wx)
+        for (x=0; x<wx; x++)
+          r[x] *= g[x];
+    }
+  }
+}
+
+// copy thread parts of n tensors in one alloc per node. for each thread and z unit, parts are stored
+// contiguous [wl[0] part][wl[1] part].. if by is 0, or interleaved by blocs of by rows (same dy required).
+// fused memory is owned by wl[0].
+static void fuse_wd(struct w_dat_t **wl, int n, int by)
+{
+  size_t sz_wx[W_FUSE_NW];
+  size_t sz_l[MAX_NUMA_NODES] = { 0 };   // node layer size
+  size_t ofs[MAX_NUMA_PROCS];            // thread bloc offset in node layer
+  char *p_node[MAX_NUMA_NODES] = { 0 };
+  int i, t, n_thrd = numa_map.n_threads, nz = wl[0]->nz;
+
+  for (t=0; t<n; t++)
+  {
+    sz_wx[t] = wd_ne_sizeof(wl[t], wl[t]->wx);
+    CHECK(!by || (wl[t]->wy == wl[0]->wy));    // interleave require same rows split
+  }
+
+  for (i=0; i<n_thrd; i++)
+  {
+    int nd = numa_map.tid_to_node_id[i];
+    ofs[i] = sz_l[nd];
+    for (t=0; t<n; t++)
+    {
+      int dy = part_dy(wl[t], i);
+      if (dy > 0)
+        sz_l[nd] += (size_t)dy * sz_wx[t];
+    }
+  }
+
+  for (i=0; i<numa.n_nodes; i++)
+    if (sz_l[i])
+      p_node[i] = numa_alloc((size_t)nz * sz_l[i], i);
+
+  // each thread copy own parts (tensors can have different rows count of thread if contiguous)
+  #pragma omp parallel for
+  for (i=0; i<n_thrd; i++)
+  {
+    int nd = numa_map.tid_to_node_id[i];
+    int z, y, k, nb, dy = part_dy(wl[0], i);
+    for (z=0; z<nz; z++)
+    {
+      char *d = p_node[nd] + (size_t)z * sz_l[nd] + ofs[i];
+      if (!by)
+      {
+        for (k=0; k<n; k++)
+        {
+          const char *s = (const char *)wl[k]->lp[i].p + (size_t)z * wl[k]->lp[i].sz_l;
+          nb = part_dy(wl[k], i);
+          if (nb > 0)
+          {
+            memcpy(d, s, (size_t)nb * sz_wx[k]);
+            d += (size_t)nb * sz_wx[k];
+          }
+        }
+        continue;
+      }
+      for (y=0; y<dy; y+=by)
+      {
+        nb = ((dy - y) < by) ? dy - y : by;
+        for (k=0; k<n; k++)
+        {
+          const char *s = (const char *)wl[k]->lp[i].p + (size_t)z * wl[k]->lp[i].sz_l + (size_t)y * sz_wx[k];
+          memcpy(d, s, (size_t)nb * sz_wx[k]);
+          d += (size_t)nb * sz_wx[k];
+        }
+      }
+    }
+  }
+
+  // free unfused datas and set parts pointers in fused datas
+  for (t=0; t<n; t++)
+  {
+    free_wd(wl[t]);
+    wl[t]->nn = 0;
+    memset(wl[t]->p_node, 0, sizeof(wl[t]->p_node));
+  }
+  for (i=0; i<numa.n_nodes; i++)
+    if (p_node[i])
+      wl[0]->p_node[wl[0]->nn++] = p_node[i];
+
+  for (i=0; i<n_thrd; i++)
+  {
+    int nd = numa_map.tid_to_node_id[i];
+    size_t o = ofs[i];
+    for (t=0; t<n; t++)
+    {
+      int dy = part_dy(wl[t], i);
+      if (dy > 0)
+      {
+        wl[t]->lp[i].p = p_node[nd] + o;
+        wl[t]->lp[i].sz_l = sz_l[nd];
+        o += (size_t)((by && (dy > by)) ? by : dy) * sz_wx[t];
+      }
+    }
+  }
+}
+
+int w_fuse_weights(void)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  struct transformer_weights_t *w = &model.transformer.weights;
+  struct w_dat_t *wl[W_FUSE_NW];
+  int fuse = 0;
+
+  if (!model.config.w_fuse)
+    return 0;
+  if (p->stream_nbuf || p->moe.page_slots || p->ly_ovr)
+  {
+    msg_info("w_fuse: not used with layer streaming, MoE paging or w_policy layers list.\n");
+    return 0;
+  }
+
+  // fold rms_att in wq/wk/wv
+  if (can_fold(&w->wq) && can_fold(&w->wk) && can_fold(&w->wv))
+  {
+    fold_norm_wd(&w->wq, &w->rms_att);
+    fold_norm_wd(&w->wk, &w->rms_att);
+    fold_norm_wd(&w->wv, &w->rms_att);
+    fuse |= W_FUSE_NORM_ATT;
+  }
+
+  // fold rms_ffn in w1/w3 (and MoE gate)
+  if (can_fold(&w->w1) && can_fold(&w->w3) && (!p->moe.num_experts || can_fold(&w->moe_gate)))
+  {
+    if (p->moe.num_experts)
+      fold_norm_wd(&w->moe_gate, &w->rms_ffn);
+    fold_norm_wd(&w->w1, &w->rms_ffn);
+    fold_norm_wd(&w->w3, &w->rms_ffn);
+    fuse |= W_FUSE_NORM_FFN;
+  }
+
+  // qkv contiguous, order of use in opt_compute_qkv
+  wl[0] = &w->wk;
+  wl[1] = &w->wv;
+  wl[2] = &w->wq;
+  fuse_wd(wl, 3, 0);
+  fuse |= W_FUSE_QKV;
+
+#ifdef USE_THRD_BATCH
+  // w1/w3 interleaved, read by opt_compute_w1_w3_swiglu only
+  if (w->w1.d_type == w->w3.d_type)
+  {
+    wl[0] = &w->w1;
+    wl[1] = &w->w3;
+    fuse_wd(wl, 2, W_FUSE_BY);
+    fuse |= W_FUSE_W13;
+  }
+#endif
+
+  msg_info("w_fuse: qkv %s, w1/w3 %s, rms_att %s, rms_ffn %s\n",
+    (fuse & W_FUSE_QKV) ? "fused" : "-",
+    (fuse & W_FUSE_W13) ? "interleaved" : "-",
+    (fuse & W_FUSE_NORM_ATT) ? "folded" : "-",
+    (fuse & W_FUSE_NORM_FFN) ? "folded" : "-");
+  return fuse;
+}
@@ -0,0 +1,12 @@
+// load time weights fusion (optional, w_fuse config), applied once after weights load.
+
+// applied fusions flags (transformer config w_fuse)
+#define W_FUSE_QKV      1              // wk/wv/wq parts of each thread contiguous in memory
+#define W_FUSE_W13      2              // w1/w3 parts of each thread interleaved by blocs of W_FUSE_BY rows
+#define W_FUSE_NORM_ATT 4              // rms_att weights folded in wq/wk/wv columns
+#define W_FUSE_NORM_FFN 8              // rms_ffn weights folded in w1/w3 (and moe_gate) columns
+
+#define W_FUSE_BY 32                   // w1/w3 interleaved rows bloc size
+
+// apply fusions if enabled in config, return W_FUSE_xx flags of applied fusions
+int w_fuse_weights(void);
@@ -0,0 +1,243 @@
+// weights read at run time from files (MoE expert paging, layer streaming, token embeddings)
+
+#include <stdio.h>
+#include <string.h>
+#include "l_util.h"
+#include "mem_alloc.h"
+#include "model.h"
+#include "matmul.h"
+#include "omp_numa.h"
+#include "w_src.h"
+
+// converted weights file header
+#define CVT_FILE_MAGIC "LST_WCV2"           // V2: q/k weights in .safetensors order (not permuted)
+#define CVT_FILE_HDR_SZ 4096           // data start offset in file (aligned)
+
+struct cvt_file_hdr_t
+{
+  char magic[8];
+  char cvt_id[16];                     // content identifier
+  int n_layers;
+  int dim;
+  int hidden_dim;
+  int n_heads;
+  int n_kv_heads;
+  int n_experts;
+  int d_type[lw_class_count];          // memory data type of layer weights classes
+  int64_t size;                        // data size
+};
+
+static struct
+{
+  int n_files;                         // .safetensors count defined
+  int cvt_file_id;                     // converted weights file id
+  char **file_names;
+  file_t *files;
+  struct cvt_file_hdr_t hdr;           // expected converted file header
+  bool cvt_valid;                      // converted weights file exist and is valid
+  bool cvt_write;                      // converted weights file created
+  int64_t cvt_end;                     // converted datas end offset
+} ws = { 0 };
+
+static void def_file_hdr(struct cvt_file_hdr_t *hdr, const char *cvt_id, int64_t size)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  int i;
+  memset(hdr, 0, sizeof(*hdr));
+  memcpy(hdr->magic, CVT_FILE_MAGIC, sizeof(hdr->magic));
+  strncpy(hdr->cvt_id, cvt_id, sizeof(hdr->cvt_id) - 1);
+  hdr->n_layers = p->n_layers;
+  hdr->dim = p->dim;
+  hdr->hidden_dim = p->hidden_dim;
+  hdr->n_heads = p->n_heads;
+  hdr->n_kv_heads = p->n_kv_heads;
+  hdr->n_experts = p->moe.num_experts;
+  for (i=0; i<lw_class_count; i++)
+    hdr->d_type[i] = p->lw_cls_type[i];
+  hdr->size = size;
+}
+
+// check if converted weights file exist with expected header and size
+static bool cvt_file_check(const char *name)
+{
+  struct cvt_file_hdr_t f_hdr;
+  file_t f = { 0 };
+  FILE *fp = fopen(name, "rb");
+  bool valid;
+  if (!fp)
+    return false;
+  fclose(fp);
+
+  f_open(&f, name, "rb");
+  valid = (f.size == (CVT_FILE_HDR_SZ + ws.hdr.size))
+       && f_read_at(&f, 0, &f_hdr, sizeof(f_hdr))
+       && !memcmp(&ws.hdr, &f_hdr, sizeof(f_hdr));
+  f_close(&f);
+  return valid;
+}
+
+bool w_src_init(const char *cvt_id, int64_t cvt_size)
+{
+  const struct transformer_config_t *p = &model.transformer.config;
+  int n_st = model.config.load.model_num_safetensors;
+
+  // files, last one is converted weights file
+  ws.n_files = 0;
+  ws.cvt_file_id = n_st;
+  ws.file_names = (char **)calloc_check((n_st + 1) * sizeof(char *));
+  ws.files = (file_t *)calloc_check((n_st + 1) * sizeof(file_t));
+
+  if (cvt_id)
+  {
+    char name[256];
+    const char *t_name = w_type_name[p->lw_type];
+    int i, l;
+    for (i=0; i<lw_class_count; i++)   // name "mix" if w_policy define different types
+      if (p->lw_cls_type[i] != p->lw_type)
+        t_name = "mix";
+    l = _snprintf(name, sizeof(name), "%s/%s_%s.bin", model.config.load.model_path, cvt_id, t_name);
+    if ((l < 0) || (l == sizeof(name)))
+      msg_error("converted weights file path too long");
+    ws.file_names[ws.cvt_file_id] = str_alloc(name, l);
+
+    def_file_hdr(&ws.hdr, cvt_id, cvt_size);
+    ws.cvt_valid = cvt_file_check(name);
+    if (ws.cvt_valid)
+      msg_info("use converted weights file %s\n", name);
+    else
+    {
+      // create file, header is written when all datas are converted
+      struct cvt_file_hdr_t hdr = { 0 };
+      msg_info("create converted weights file %s\n", name);
+      f_open(&ws.files[ws.cvt_file_id], ws.file_names[ws.cvt_file_id], "wb");
+      f_write(&hdr, sizeof(hdr), &ws.files[ws.cvt_file_id]);
+      ws.cvt_write = true;
+    }
+  }
+  return ws.cvt_valid;
+}
+
+void w_src_exit(void)
+{
+  int i;
+  if (!ws.file_names)
+    return;
+  for (i=0; i<=ws.cvt_file_id; i++)
+  {
+    if (ws.files[i].handle)
+      f_close(&ws.files[i]);
+    free_check(ws.file_names[i]);
+  }
+  free_check(ws.files);
+  free_check(ws.file_names);
+  memset(&ws, 0, sizeof(ws));
+}
+
+void w_src_set_file(const char *file_name)
+{
+  if (ws.n_files >= ws.cvt_file_id)
+    msg_error("w_src: too many .safetensors files");
+  ws.file_names[ws.n_files++] = str_alloc(file_name, (int)strlen(file_name));
+}
+
+void w_src_def(struct w_src_t *src, int64_t ofs)
+{
+  src->file_id = ws.n_files - 1;
+  src->ofs = ofs;
+}
+
+void w_src_def_cvt(struct w_src_t *src, int64_t cvt_ofs, const void *d, size_t sz)
+{
+  CHECK(ws.file_names[ws.cvt_file_id] && ((cvt_ofs + (int64_t)sz) <= ws.hdr.size));
+  src->file_id = ws.cvt_file_id;
+  src->ofs = CVT_FILE_HDR_SZ + cvt_ofs;
+  if (ws.cvt_write)
+  {
+    file_t *f = &ws.files[ws.cvt_file_id];
+    f_seek(f, src->ofs, f_SEEK_SET);
+    f_write((void *)d, sz, f);
+    if ((cvt_ofs + (int64_t)sz) > ws.cvt_end)
+      ws.cvt_end = cvt_ofs + sz;
+  }
+}
+
+bool w_src_cvt_valid(void)
+{
+  return ws.cvt_valid;
+}
+
+void w_src_start(void)
+{
+  int i;
+
+  // converted file complete, write header
+  if (ws.cvt_write)
+  {
+    file_t *f = &ws.files[ws.cvt_file_id];
+    uint8_t end = 0;
+    // write last byte if end of data space unused
+    if (ws.cvt_end < ws.hdr.size)
+    {
+      f_seek(f, CVT_FILE_HDR_SZ + ws.hdr.size - 1, f_SEEK_SET);
+      f_write(&end, 1, f);
+    }
+    f_seek(f, 0, f_SEEK_SET);
+    f_write(&ws.hdr, sizeof(ws.hdr), f);
+    f_close(f);
+    ws.cvt_write = false;
+    ws.cvt_valid = true;
+  }
+
+  // open files used for read (used only by io thread)
+  for (i=0; i<=ws.cvt_file_id; i++)
+    if (ws.file_names[i])
+      f_open(&ws.files[i], ws.file_names[i], "rb");
+}
+
+bool w_src_read(const struct w_src_t *src, struct w_dat_t *wd, int z_id)
+{
+  return numa_read_wd_z(wd, z_id, &ws.files[src->file_id], src->ofs);
+}
+
+// ------------------------------------
+// token embeddings rows read at run time
+
+static struct
+{
+  char *file_name;
+  file_t f;
+  int64_t ofs;                         // embeddings datas offset in file
+  enum e_w_type d_type;                // file data type
+  int wx;                              // row size
+  void *row;                           // read buffer if conversion required
+} es = { 0 };
+
+void w_src_emb_def(const char *file_name, int64_t ofs, enum e_w_type d_type, int wx)
+{
+  es.file_name = str_alloc(file_name, (int)strlen(file_name));
+  es.ofs = ofs;
+  es.d_type = d_type;
+  es.wx = wx;
+  if (d_type != w_type_f32)
+    es.row = malloc_check((size_t)wx * w_type_sizeof[d_type]);
+  f_open(&es.f, es.file_name, "rb");
+}
+
+void w_src_emb_read(float *x, int token)
+{
+  size_t sz = (size_t)es.wx * w_type_sizeof[es.d_type];
+  if (!f_read_at(&es.f, es.ofs + (int64_t)token * sz, es.row ? es.row : x, sz))
+    msg_error("embeddings read error in file %s", es.file_name);
+  if (es.row)
+    cvt_w_data(x, w_type_f32, es.row, es.d_type, es.wx, es.wx);
+}
+
+void w_src_emb_exit(void)
+{
+  if (!es.file_name)
+    return;
+  f_close(&es.f);
+  free_check(es.row);
+  free_check(es.file_name);
+  memset(&es, 0, sizeof(es));
+}
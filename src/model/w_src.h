@@ -0,0 +1,50 @@
+// weights read at run time from files (MoE expert paging, layer streaming).
+// datas are read in .safetensors files if memory format is same as file format, else in a
+// converted weights file in memory format, created at first load and reused at next loads.
+
+// weight tensor source in file
+struct w_src_t
+{
+  int file_id;                         // -1 if undefined
+  int64_t ofs;                         // data offset in file
+};
+
+// init files list. if cvt_id not NULL, use converted weights file model_path/<cvt_id>_<type>.bin
+// of cvt_size data bytes. return true if converted file exist and is valid (no conversion required).
+bool w_src_init(const char *cvt_id, int64_t cvt_size);
+
+// close files and free datas
+void w_src_exit(void);
+
+// define .safetensors file used for next w_src_def calls
+void w_src_set_file(const char *file_name);
+
+// define source at data offset in current .safetensors file
+void w_src_def(struct w_src_t *src, int64_t ofs);
+
+// define source in converted weights file, write datas if file not valid
+void w_src_def_cvt(struct w_src_t *src, int64_t cvt_ofs, const void *d, size_t sz);
+
+// converted weights file valid (datas not required for w_src_def_cvt)
+bool w_src_cvt_valid(void);
+
+// end of load, complete converted file and open files for read
+void w_src_start(void);
+
+// read source datas in wd z unit. no error trap (usable in io thread), return false if error
+bool w_src_read(const struct w_src_t *src, struct w_dat_t *wd, int z_id);
+
+// check source defined
+#define W_SRC_DEFINED(src) ((src)->file_id >= 0)
+
+// --------------------------
+// token embeddings rows read at run time (emb_disk), independent of other sources
+
+// define embeddings source at data offset in file, table of rows of wx values of type d_type
+void w_src_emb_def(const char *file_name, int64_t ofs, enum e_w_type d_type, int wx);
+
+// read embeddings row of token converted to float
+void w_src_emb_read(float *x, int token);
+
+// close embeddings file
+void w_src_emb_exit(void);
@@ -0,0 +1,16 @@
+// background io thread, execute jobs (file read) in post order while main thread compute.
+
+// job procedure, arg is user data
+typedef void (*io_job_proc_t)(void *arg);
+
+// start io thread
+void io_async_init(void);
+
+// stop io thread (wait pending jobs end)
+void io_async_exit(void);
+
+// post a job, *done is set to 0 at post and to 1 when job completed
+void io_async_post(io_job_proc_t proc, void *arg, volatile int *done);
+
+// wait job completed
+void io_async_wait(volatile int *done);
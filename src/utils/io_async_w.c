@@ -0,0 +1,115 @@
+// background io thread for windows
+
+#include <windows.h>
+#include "l_util.h"          // msg_error
+#include "io_async.h"
+
+#define IO_MAX_JOBS 256      // max pending jobs
+
+struct io_job_t
+{
+  io_job_proc_t proc;
+  void *arg;
+  volatile int *done;
+};
+
+static struct
+{
+  HANDLE h_thread;
+  HANDLE ev_post;            // job posted
+  HANDLE ev_done;            // job done
+  CRITICAL_SECTION cs;
+  struct io_job_t jobs[IO_MAX_JOBS];
+  volatile unsigned int rd;  // read index in jobs ring, incremented when job done
+  volatile unsigned int wr;  // write index in jobs ring
+  volatile bool exit;
+} io = { 0 };
+
+static DWORD WINAPI io_thread_proc(LPVOID param)
+{
+  while (1)
+  {
+    struct io_job_t job;
+    bool get;
+
+    EnterCriticalSection(&io.cs);
+    get = (io.rd != io.wr);
+    if (get)
+      job = io.jobs[io.rd % IO_MAX_JOBS];
+    LeaveCriticalSection(&io.cs);
+
+    if (!get)
+    {
+      if (io.exit)
+        break;
+      WaitForSingleObject(io.ev_post, INFINITE);
+      continue;
+    }
+
+    job.proc(job.arg);
+
+    // free ring entry after execution
+    EnterCriticalSection(&io.cs);
+    io.rd++;
+    *job.done = 1;
+    LeaveCriticalSection(&io.cs);
+    SetEvent(io.ev_done);
+  }
+  return 0;
+}
+
+void io_async_init(void)
+{
+  if (io.h_thread)
+    return;                  // already started
+  InitializeCriticalSection(&io.cs);
+  io.ev_post = CreateEvent(NULL, FALSE, FALSE, NULL);   // auto reset
+  io.ev_done = CreateEvent(NULL, FALSE, FALSE, NULL);
+  io.rd = 0;
+  io.wr = 0;
+  io.exit = false;
+  if (!io.ev_post || !io.ev_done)
+    msg_error("io thread event create failed");
+  io.h_thread = CreateThread(NULL, 0, io_thread_proc, NULL, 0, NULL);
+  if (!io.h_thread)
+    msg_error("io thread create failed");
+}
+
+void io_async_exit(void)
+{
+  if (!io.h_thread)
+    return;
+  io.exit = true;
+  SetEvent(io.ev_post);
+  WaitForSingleObject(io.h_thread, INFINITE);
+  CloseHandle(io.h_thread);
+  CloseHandle(io.ev_post);
+  CloseHandle(io.ev_done);
+  DeleteCriticalSection(&io.cs);
+  io.h_thread = NULL;
+}
+
+void io_async_post(io_job_proc_t proc, void *arg, volatile int *done)
+{
+  struct io_job_t *job;
+  *done = 0;
+
+  // wait free entry in ring
+  while ((io.wr - io.rd) >= IO_MAX_JOBS)
+    WaitForSingleObject(io.ev_done, INFINITE);
+
+  EnterCriticalSection(&io.cs);
+  job = &io.jobs[io.wr % IO_MAX_JOBS];
+  job->proc = proc;
+  job->arg = arg;
+  job->done = done;
+  io.wr++;
+  LeaveCriticalSection(&io.cs);
+  SetEvent(io.ev_post);
+}
+
+void io_async_wait(volatile int *done)
+{
+  while (!*done)
+    WaitForSingleObject(io.ev_done, INFINITE);
+}
@@ -227,6 +227,13 @@ void f_write(void *p, int64_t size, file_t *h)
     msg_error("write error in file '%s'", h->name);
 }
 
+bool f_read_at(file_t *h, int64_t ofs, void *p, int64_t size)
+{
+  if (!h->handle || _fseeki64((FILE *)h->handle, ofs, SEEK_SET))
+    return false;
+  return fread(p, size, 1, (FILE *)h->handle) == 1;
+}
+
 // --------------------------------------------------------
 // wait return pressed and exit (debug usage)
 
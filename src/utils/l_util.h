@@ -96,6 +96,9 @@ void f_close(file_t *h);
 void f_read(void *p, int64_t size, file_t *h);
 void f_write(void *p, int64_t size, file_t *h);
 
+// read at offset without error trap (usable from other thread), return false if error
+bool f_read_at(file_t *h, int64_t ofs, void *p, int64_t size);
+
 // ------------------------------------
 // wait return pressed and exit
 